@@ -18,149 +18,53 @@
 #include "s_user.h"
 #include "channel.h"
 #include "chmode.h"
+#include "logger.h"
 #include "hash.h"
 #include "match.h"
+#include "history.h"
 
 static const char chm_history_desc[] = "Adds channel mode +H, which stores and replays recent messages";
 
 static unsigned int mode_history;
-#define MAX_HISTORY_MESSAGES 100
+#define HISTORY_REPLAY_LINES 20
 #define DEFAULT_HISTORY_EXPIRE_TIME 3600  /* 1 hour default expiration */
 
 static time_t history_expire_time = DEFAULT_HISTORY_EXPIRE_TIME;
 static struct ev_entry *history_expire_ev;
 
-struct history_entry {
-	char *nick;
-	char *text;
-	time_t timestamp;
-	rb_dlink_node node;
-};
-
-struct channel_history {
-	struct Channel *chptr;
-	rb_dlink_list messages;
-	rb_dlink_node node;
-};
-
-static rb_dictionary *history_dict;
-
-/* Export history_dict for use by other modules */
-rb_dictionary *chm_history_dict_get(void)
-{
-	return history_dict;
-}
-
 static void hook_privmsg_channel(void *);
 static void hook_channel_join(void *);
 static void expire_history_messages(void *);
 
 mapi_hfn_list_av1 chm_history_hfnlist[] = {
-	{ "privmsg_channel", hook_privmsg_channel },
+	{ "privmsg_channel", hook_privmsg_channel, HOOK_MONITOR },
 	{ "channel_join", hook_channel_join },
 	{ NULL, NULL }
 };
 
-static struct channel_history *
-get_channel_history(struct Channel *chptr)
-{
-	struct channel_history *hist;
-
-	hist = rb_dictionary_retrieve(history_dict, chptr->chname);
-	if (hist == NULL) {
-		hist = rb_malloc(sizeof(struct channel_history));
-		hist->chptr = chptr;
-		rb_dictionary_add(history_dict, chptr->chname, hist);
-	}
-
-	return hist;
-}
-
-static void
-add_history_message(struct Channel *chptr, struct Client *source_p, const char *text)
-{
-	struct channel_history *hist;
-	struct history_entry *entry;
-
-	if (!(chptr->mode.mode & mode_history))
-		return;
-
-	hist = get_channel_history(chptr);
-
-	entry = rb_malloc(sizeof(struct history_entry));
-	entry->nick = rb_strdup(source_p->name);
-	entry->text = rb_strdup(text);
-	entry->timestamp = rb_current_time();
-
-	rb_dlinkAdd(entry, &entry->node, &hist->messages);
-
-	/* Limit history size */
-	while (rb_dlink_list_length(&hist->messages) > MAX_HISTORY_MESSAGES) {
-		rb_dlink_node *ptr = hist->messages.head;
-		struct history_entry *old = ptr->data;
-		rb_dlinkDelete(ptr, &hist->messages);
-		rb_free(old->nick);
-		rb_free(old->text);
-		rb_free(old);
-	}
-}
-
 static void
 expire_history_messages(void *unused)
 {
-	rb_dictionary_iter iter;
-	struct channel_history *hist;
-	time_t now = rb_current_time();
-	time_t expire_time = now - history_expire_time;
-
-	RB_DICTIONARY_FOREACH(hist, &iter, history_dict) {
-		rb_dlink_node *ptr, *next;
-		
-		RB_DLINK_FOREACH_SAFE(ptr, next, hist->messages.head) {
-			struct history_entry *entry = ptr->data;
-			
-			/* Remove expired messages */
-			if (entry->timestamp < expire_time) {
-				rb_dlinkDelete(ptr, &hist->messages);
-				rb_free(entry->nick);
-				rb_free(entry->text);
-				rb_free(entry);
-			}
-		}
-		
-		/* Clean up empty history entries */
-		if (rb_dlink_list_length(&hist->messages) == 0) {
-			rb_dictionary_delete(history_dict, hist->chptr->chname);
-			rb_free(hist);
-		}
-	}
+	history_expire((int64_t)(rb_current_time() - history_expire_time) * 1000);
 }
 
 static void
 replay_history(struct Client *client_p, struct Channel *chptr)
 {
-	struct channel_history *hist;
-	rb_dlink_node *ptr;
-	struct history_entry *entry;
-	int count = 0;
-	int max = 20;
+	struct history_buf *buf;
+	struct history_line line;
+	unsigned int count, i;
 
 	if (!(chptr->mode.mode & mode_history))
 		return;
 
-	hist = rb_dictionary_retrieve(history_dict, chptr->chname);
-	if (hist == NULL)
-		return;
+	buf = history_find(chptr->chname);
+	count = history_count(buf);
 
 	/* Send last N messages */
-	RB_DLINK_FOREACH_REVERSE(ptr, hist->messages.tail) {
-		if (count >= max)
-			break;
-		entry = ptr->data;
-		/* Send recent messages to joining user */
-		sendto_one(client_p, ":%s!%s@%s PRIVMSG %s :%s",
-			entry->nick, entry->nick, "history", chptr->chname, entry->text);
-		count++;
+	for (i = count > HISTORY_REPLAY_LINES ? count - HISTORY_REPLAY_LINES : 0; i < count; i++) {
+		history_get(buf, i, &line);
+		history_send(client_p, chptr->chname, &line, NULL);
 	}
 }
 
@@ -168,9 +72,20 @@ static void
 hook_privmsg_channel(void *data_)
 {
 	hook_data_privmsg_channel *data = data_;
+	char source[NICKLEN + USERLEN + HOSTLEN + 3];
+
+	if (data->approved || EmptyString(data->text))
+		return;
 
-	if (data->msgtype == MESSAGE_TYPE_PRIVMSG)
-		add_history_message(data->chptr, data->source_p, data->text);
+	if (data->msgtype != MESSAGE_TYPE_PRIVMSG && data->msgtype != MESSAGE_TYPE_NOTICE)
+		return;
+
+	if (!(data->chptr->mode.mode & mode_history) || !IsPerson(data->source_p))
+		return;
+
+	snprintf(source, sizeof(source), "%s!%s@%s", data->source_p->name,
+		data->source_p->username, data->source_p->host);
+	history_add(data->chptr->chname, data->msgtype, source, data->text);
 }
 
 static void
@@ -191,7 +106,6 @@ _modinit(void)
 		return -1;
 	}
 
-	history_dict = rb_dictionary_create("channel_history", rb_dictionary_str_casecmp);
 	history_expire_ev = rb_event_addish("history_expire", expire_history_messages, NULL, 300);
 	return 0;
 }
@@ -199,33 +113,15 @@ _modinit(void)
 static void
 _moddeinit(void)
 {
-	rb_dictionary_iter iter;
-	struct channel_history *hist;
-	rb_dlink_node *ptr, *next;
-
 	if (history_expire_ev != NULL) {
 		rb_event_delete(history_expire_ev);
 		history_expire_ev = NULL;
 	}
 
-	RB_DICTIONARY_FOREACH(hist, &iter, history_dict) {
-		RB_DLINK_FOREACH_SAFE(ptr, next, hist->messages.head) {
-			struct history_entry *entry = ptr->data;
-			rb_dlinkDelete(ptr, &hist->messages);
-			rb_free(entry->nick);
-			rb_free(entry->text);
-			rb_free(entry);
-		}
-		rb_free(hist);
-	}
-
-	if (history_dict != NULL) {
-		rb_dictionary_destroy(history_dict, NULL, NULL);
-		history_dict = NULL;
-	}
+	/* nothing records or expires history without us */
+	history_expire(INT64_MAX);
 
 	cflag_orphan('H');
 }
 
 DECLARE_MODULE_AV2(chm_history, _modinit, _moddeinit, NULL, NULL, chm_history_hfnlist, NULL, NULL, chm_history_desc);
-
@@ -18,9 +18,8 @@
 #include "modules.h"
 #include "hook.h"
 #include "match.h"
-#include "dns.h"
-#include "rb_commio.h"
 #include "logger.h"
+#include "httpqueue.h"
 
 static const char discord_relay_desc[] = "Relays IRC messages to Discord via webhooks";
 
@@ -29,37 +28,30 @@ static char *discord_webhook_url = NULL;
 static rb_dlink_list relay_channels;  /* List of channels to relay */
 static bool relay_all_channels = false;
 static bool relay_private_messages = false;
-static int max_message_length = 2000;  /* Discord's limit is 2000 chars */
+static int max_message_length = 1800;  /* a batch must fit Discord's 2000 chars */
+static struct http_queue *discord_queue = NULL;
+
+/* lines are batched into one message's content */
+static const struct http_batch_format discord_format = {
+	.content_type = "application/json",
+	.prefix = "{\"username\":\"IRC\",\"content\":\"",
+	.separator = "\\n",
+	.suffix = "\"}",
+	.dropped = "(%u messages dropped)",
+	.max_bytes = 1900,
+	.max_items = 20,
+	.window = 1,
+};
 
 struct channel_relay_config {
 	char *channel;
 	rb_dlink_node node;
 };
 
-struct discord_request {
-	struct Client *source_p;
-	struct Channel *chptr;
-	char *message;
-	char *username;
-	char *channel_name;
-	rb_fde_t *fd;
-	char response_buf[4096];
-	size_t response_len;
-	uint32_t dns_req;
-	uint32_t dns_req_v4;
-	bool tried_ipv6;
-};
-
 static void hook_privmsg_channel(void *);
 static void hook_privmsg_user(void *);
-static void discord_dns_callback(const char *res, int status, int aftype, void *data);
-static void discord_connect_callback(rb_fde_t *F, int status, void *data);
-static void discord_read_callback(rb_fde_t *F, void *data);
-static void discord_timeout_callback(rb_fde_t *F, void *data);
 static bool should_relay_channel(const char *channel);
 static void json_escape_string(const char *input, char *output, size_t output_size);
-static void parse_webhook_url(const char *url, char *host, size_t host_size, 
-			       char *path, size_t path_size, int *port, bool *is_https);
 
 mapi_hfn_list_av1 discord_relay_hfnlist[] = {
 	{ "privmsg_channel", hook_privmsg_channel },
@@ -106,62 +98,6 @@ add_relay_channel(const char *channel)
 	rb_dlinkAdd(config, &config->node, &relay_channels);
 }
 
-/* Parse Discord webhook URL */
-static void
-parse_webhook_url(const char *url, char *host, size_t host_size, 
-		  char *path, size_t path_size, int *port, bool *is_https)
-{
-	const char *p;
-
-	*is_https = false;
-	*port = 443;
-
-	/* Skip protocol */
-	if (strncmp(url, "https://", 8) == 0)
-	{
-		*is_https = true;
-		*port = 443;
-		p = url + 8;
-	}
-	else if (strncmp(url, "http://", 7) == 0)
-	{
-		*is_https = false;
-		*port = 80;
-		p = url + 7;
-	}
-	else
-	{
-		/* Assume https if no protocol */
-		*is_https = true;
-		*port = 443;
-		p = url;
-	}
-
-	/* Extract host and path */
-	const char *slash = strchr(p, '/');
-	if (slash != NULL)
-	{
-		size_t host_len = slash - p;
-		if (host_len >= host_size)
-			host_len = host_size - 1;
-		rb_strlcpy(host, p, host_len + 1);
-		rb_strlcpy(path, slash, path_size);
-	}
-	else
-	{
-		rb_strlcpy(host, p, host_size);
-		rb_strlcpy(path, "/", path_size);
-	}
-
-	/* Check for custom port in host */
-	char *colon = strchr(host, ':');
-	if (colon != NULL)
-	{
-		*colon = '\0';
-		*port = atoi(colon + 1);
-	}
-}
-
 /* JSON escape a string */
 static void
 json_escape_string(const char *input, char *output, size_t output_size)
@@ -220,271 +156,50 @@ json_escape_string(const char *input, char *output, size_t output_size)
 	output[j] = '\0';
 }
 
-/* DNS callback */
-static void
-discord_dns_callback(const char *res, int status, int aftype, void *data)
-{
-	struct discord_request *req = data;
-	struct sockaddr_storage addr;
-	struct sockaddr_in *sin;
-	struct sockaddr_in6 *sin6;
-	char host[256];
-	char path[512];
-	int port;
-	bool is_https;
-
-	if (aftype == AF_INET6)
-	{
-		req->dns_req = 0;
-		req->tried_ipv6 = true;
-	}
-	else
-	{
-		req->dns_req_v4 = 0;
-	}
-
-	if (status == 0 || res == NULL)
-	{
-		/* If IPv6 failed, try IPv4 as fallback */
-		if (aftype == AF_INET6)
-		{
-			parse_webhook_url(discord_webhook_url, host, sizeof(host), path, sizeof(path), &port, &is_https);
-			req->dns_req_v4 = lookup_hostname(host, AF_INET, discord_dns_callback, req);
-			if (req->dns_req_v4 != 0)
-				return;
-		}
-
-		/* Both failed */
-		ilog(L_MAIN, "Discord relay: Failed to resolve Discord webhook hostname");
-		rb_free(req->message);
-		rb_free(req->username);
-		if (req->channel_name)
-			rb_free(req->channel_name);
-		rb_free(req);
-		return;
-	}
-
-	memset(&addr, 0, sizeof(addr));
-	parse_webhook_url(discord_webhook_url, host, sizeof(host), path, sizeof(path), &port, &is_https);
-
-	if (aftype == AF_INET6)
-	{
-		sin6 = (struct sockaddr_in6 *)&addr;
-		sin6->sin6_family = AF_INET6;
-		sin6->sin6_port = htons(port);
-		if (rb_inet_pton(AF_INET6, res, &sin6->sin6_addr) <= 0)
-		{
-			ilog(L_MAIN, "Discord relay: Invalid IPv6 address");
-			rb_free(req->message);
-			rb_free(req->username);
-			if (req->channel_name)
-				rb_free(req->channel_name);
-			rb_free(req);
-			return;
-		}
-	}
-	else
-	{
-		sin = (struct sockaddr_in *)&addr;
-		sin->sin_family = AF_INET;
-		sin->sin_port = htons(port);
-		if (rb_inet_pton(AF_INET, res, &sin->sin_addr) <= 0)
-		{
-			ilog(L_MAIN, "Discord relay: Invalid IPv4 address");
-			rb_free(req->message);
-			rb_free(req->username);
-			if (req->channel_name)
-				rb_free(req->channel_name);
-			rb_free(req);
-			return;
-		}
-	}
-
-	req->fd = rb_socket(GET_SS_FAMILY(&addr), SOCK_STREAM, IPPROTO_TCP, "discord_webhook");
-	if (req->fd == NULL)
-	{
-		ilog(L_MAIN, "Discord relay: Failed to create socket");
-		rb_free(req->message);
-		rb_free(req->username);
-		if (req->channel_name)
-			rb_free(req->channel_name);
-		rb_free(req);
-		return;
-	}
-
-	rb_connect_tcp(req->fd, (struct sockaddr *)&addr, NULL, discord_connect_callback, req, 10);
-}
-
-/* Connection callback */
+/* Queue a line for the webhook */
 static void
-discord_connect_callback(rb_fde_t *F, int status, void *data)
+discord_send(const char *channel, const char *username, const char *message)
 {
-	struct discord_request *req = data;
-	char request[4096];
-	char json_body[2048];
+	char line[2048];
 	char escaped_username[256];
 	char escaped_message[2048];
 	char escaped_channel[256];
-	char host[256];
-	char path[512];
-	int port;
-	bool is_https;
-	size_t len;
-
-	if (status != RB_OK)
-	{
-		ilog(L_MAIN, "Discord relay: Failed to connect to Discord webhook");
-		rb_close(F);
-		rb_free(req->message);
-		rb_free(req->username);
-		if (req->channel_name)
-			rb_free(req->channel_name);
-		rb_free(req);
-		return;
-	}
-
-	if (discord_webhook_url == NULL)
-	{
-		rb_close(F);
-		rb_free(req->message);
-		rb_free(req->username);
-		if (req->channel_name)
-			rb_free(req->channel_name);
-		rb_free(req);
-		return;
-	}
-
-	parse_webhook_url(discord_webhook_url, host, sizeof(host), path, sizeof(path), &port, &is_https);
+	size_t len, end;
 
 	/* Escape strings for JSON */
-	json_escape_string(req->username, escaped_username, sizeof(escaped_username));
-	json_escape_string(req->message, escaped_message, sizeof(escaped_message));
-
-	/* Truncate message if too long */
-	if (strlen(escaped_message) > max_message_length - 50)
-	{
-		escaped_message[max_message_length - 50] = '\0';
+	json_escape_string(username, escaped_username, sizeof(escaped_username));
+	json_escape_string(message, escaped_message, sizeof(escaped_message));
+
+	/* Truncate message if too long, not inside an escape or a character */
+	len = strlen(escaped_message);
+	if (len > max_message_length - 50)
+	{
+		len = max_message_length - 50;
+		while (len > 0 && ((unsigned char)escaped_message[len] & 0xc0) == 0x80)
+			len--;
+		/* an odd run of backslashes ends in half an escape */
+		for (end = len; end > 0 && escaped_message[end - 1] == '\\'; end--)
+			;
+		if ((len - end) % 2 == 1)
+			len--;
+		escaped_message[len] = '\0';
 		rb_strlcat(escaped_message, "...", sizeof(escaped_message));
 	}
 
-	/* Build JSON payload */
-	if (req->channel_name != NULL)
+	if (channel != NULL)
 	{
-		json_escape_string(req->channel_name, escaped_channel, sizeof(escaped_channel));
-		snprintf(json_body, sizeof(json_body),
-			"{\"content\":\"[%s] <%s> %s\",\"username\":\"%s\"}",
-			escaped_channel, escaped_username, escaped_message, escaped_username);
+		json_escape_string(channel, escaped_channel, sizeof(escaped_channel));
+		snprintf(line, sizeof(line), "[%s] <%s> %s",
+			escaped_channel, escaped_username, escaped_message);
 	}
 	else
 	{
-		snprintf(json_body, sizeof(json_body),
-			"{\"content\":\"<%s> %s\",\"username\":\"%s\"}",
-			escaped_username, escaped_message, escaped_username);
-	}
-
-	/* Build HTTP request */
-	snprintf(request, sizeof(request),
-		"POST %s HTTP/1.1\r\n"
-		"Host: %s\r\n"
-		"Content-Type: application/json\r\n"
-		"Content-Length: %zu\r\n"
-		"Connection: close\r\n"
-		"\r\n"
-		"%s",
-		path, host, strlen(json_body), json_body);
-
-	len = strlen(request);
-	if (rb_write(F, request, len) != (ssize_t)len)
-	{
-		ilog(L_MAIN, "Discord relay: Failed to send webhook request");
-		rb_close(F);
-		rb_free(req->message);
-		rb_free(req->username);
-		if (req->channel_name)
-			rb_free(req->channel_name);
-		rb_free(req);
-		return;
-	}
-
-	req->response_len = 0;
-	req->fd = F;
-	rb_settimeout(F, 15, discord_timeout_callback, req);
-	rb_setselect(F, RB_SELECT_READ, discord_read_callback, req);
-}
-
-/* Read callback */
-static void
-discord_read_callback(rb_fde_t *F, void *data)
-{
-	struct discord_request *req = data;
-	ssize_t len;
-	char buf[512];
-
-	len = rb_read(F, buf, sizeof(buf) - 1);
-	if (len <= 0)
-	{
-		rb_settimeout(F, 0, NULL, NULL);
-		rb_close(F);
-		rb_free(req->message);
-		rb_free(req->username);
-		if (req->channel_name)
-			rb_free(req->channel_name);
-		rb_free(req);
-		return;
-	}
-
-	buf[len] = '\0';
-	if (req->response_len + len < sizeof(req->response_buf))
-	{
-		rb_strlcat(req->response_buf, buf, sizeof(req->response_buf));
-		req->response_len += len;
-	}
-
-	/* Check if we got a complete response (simple check) */
-	if (strstr(req->response_buf, "\r\n\r\n") != NULL)
-	{
-		/* Response received, clean up */
-		rb_settimeout(F, 0, NULL, NULL);
-		rb_close(F);
-		rb_free(req->message);
-		rb_free(req->username);
-		if (req->channel_name)
-			rb_free(req->channel_name);
-		rb_free(req);
+		snprintf(line, sizeof(line), "<%s> %s",
+			escaped_username, escaped_message);
 	}
-}
-
-/* Timeout callback */
-static void
-discord_timeout_callback(rb_fde_t *F, void *data)
-{
-	struct discord_request *req = data;
 
-	if (req->dns_req != 0)
-	{
-		cancel_lookup(req->dns_req);
-		req->dns_req = 0;
-	}
-
-	if (req->dns_req_v4 != 0)
-	{
-		cancel_lookup(req->dns_req_v4);
-		req->dns_req_v4 = 0;
-	}
-
-	if (req->fd != NULL)
-	{
-		rb_settimeout(req->fd, 0, NULL, NULL);
-		rb_close(req->fd);
-		req->fd = NULL;
-	}
-
-	ilog(L_MAIN, "Discord relay: Request timed out");
-	rb_free(req->message);
-	rb_free(req->username);
-	if (req->channel_name)
-		rb_free(req->channel_name);
-	rb_free(req);
+	/* a full queue drops it, and says so in the next batch */
+	http_queue_add(discord_queue, line);
 }
 
 /* Hook for channel messages */
@@ -492,16 +207,11 @@ static void
 hook_privmsg_channel(void *data_)
 {
 	hook_data_privmsg_channel *data = data_;
-	struct discord_request *req;
-	char host[256];
-	char path[512];
-	int port;
-	bool is_https;
 
 	if (data->msgtype != MESSAGE_TYPE_PRIVMSG)
 		return;
 
-	if (discord_webhook_url == NULL)
+	if (discord_queue == NULL)
 		return;
 
 	if (!should_relay_channel(data->chptr->chname))
@@ -511,38 +221,7 @@ hook_privmsg_channel(void *data_)
 	if (data->text[0] == '\001')
 		return;
 
-	parse_webhook_url(discord_webhook_url, host, sizeof(host), path, sizeof(path), &port, &is_https);
-
-	req = rb_malloc(sizeof(struct discord_request));
-	req->source_p = data->source_p;
-	req->chptr = data->chptr;
-	req->message = rb_strdup(data->text);
-	req->username = rb_strdup(data->source_p->name);
-	req->channel_name = rb_strdup(data->chptr->chname);
-	req->fd = NULL;
-	req->response_len = 0;
-	req->dns_req = 0;
-	req->dns_req_v4 = 0;
-	req->tried_ipv6 = false;
-
-	/* Start DNS lookup */
-	req->tried_ipv6 = false;
-	req->dns_req = lookup_hostname(host, AF_INET6, discord_dns_callback, req);
-	req->dns_req_v4 = 0;
-
-	if (req->dns_req == 0)
-	{
-		/* IPv6 lookup failed, try IPv4 immediately */
-		req->dns_req_v4 = lookup_hostname(host, AF_INET, discord_dns_callback, req);
-		if (req->dns_req_v4 == 0)
-		{
-			rb_free(req->message);
-			rb_free(req->username);
-			rb_free(req->channel_name);
-			rb_free(req);
-			return;
-		}
-	}
+	discord_send(data->chptr->chname, data->source_p->name, data->text);
 }
 
 /* Hook for private messages */
@@ -550,11 +229,6 @@ static void
 hook_privmsg_user(void *data_)
 {
 	hook_data_privmsg_user *data = data_;
-	struct discord_request *req;
-	char host[256];
-	char path[512];
-	int port;
-	bool is_https;
 
 	if (data->msgtype != MESSAGE_TYPE_PRIVMSG)
 		return;
@@ -562,43 +236,14 @@ hook_privmsg_user(void *data_)
 	if (!relay_private_messages)
 		return;
 
-	if (discord_webhook_url == NULL)
+	if (discord_queue == NULL)
 		return;
 
 	/* Skip CTCP and ACTION messages */
 	if (data->text[0] == '\001')
 		return;
 
-	parse_webhook_url(discord_webhook_url, host, sizeof(host), path, sizeof(path), &port, &is_https);
-
-	req = rb_malloc(sizeof(struct discord_request));
-	req->source_p = data->source_p;
-	req->chptr = NULL;
-	req->message = rb_strdup(data->text);
-	req->username = rb_strdup(data->source_p->name);
-	req->channel_name = NULL;
-	req->fd = NULL;
-	req->response_len = 0;
-	req->dns_req = 0;
-	req->dns_req_v4 = 0;
-	req->tried_ipv6 = false;
-
-	/* Start DNS lookup */
-	req->tried_ipv6 = false;
-	req->dns_req = lookup_hostname(host, AF_INET6, discord_dns_callback, req);
-	req->dns_req_v4 = 0;
-
-	if (req->dns_req == 0)
-	{
-		req->dns_req_v4 = lookup_hostname(host, AF_INET, discord_dns_callback, req);
-		if (req->dns_req_v4 == 0)
-		{
-			rb_free(req->message);
-			rb_free(req->username);
-			rb_free(req);
-			return;
-		}
-	}
+	discord_send(NULL, data->source_p->name, data->text);
 }
 
 static int
@@ -609,8 +254,22 @@ _modinit(void)
 	const char *env_url = getenv("DISCORD_WEBHOOK_URL");
 	if (env_url != NULL)
 	{
-		discord_webhook_url = rb_strdup(env_url);
-		ilog(L_MAIN, "Discord relay: Webhook URL configured from environment");
+		/* Assume https if no protocol */
+		if (strstr(env_url, "://") == NULL)
+		{
+			char url[BUFSIZE];
+
+			snprintf(url, sizeof(url), "https://%s", env_url);
+			discord_webhook_url = rb_strdup(url);
+		}
+		else
+			discord_webhook_url = rb_strdup(env_url);
+
+		discord_queue = http_queue_create("discord", discord_webhook_url, &discord_format);
+		if (discord_queue == NULL)
+			ilog(L_MAIN, "Discord relay: Ignoring invalid webhook URL");
+		else
+			ilog(L_MAIN, "Discord relay: Webhook URL configured from environment");
 	}
 	else
 	{
@@ -620,7 +279,7 @@ _modinit(void)
 	}
 
 	/* Default: relay all channels if webhook is configured */
-	if (discord_webhook_url != NULL)
+	if (discord_queue != NULL)
 	{
 		relay_all_channels = true;
 	}
@@ -633,6 +292,9 @@ _moddeinit(void)
 {
 	rb_dlink_node *ptr, *next;
 
+	http_queue_destroy(discord_queue);
+	discord_queue = NULL;
+
 	if (discord_webhook_url != NULL)
 	{
 		rb_free(discord_webhook_url);
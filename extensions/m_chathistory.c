@@ -22,77 +22,112 @@
 #include "parse.h"
 #include "numeric.h"
 #include "msgbuf.h"
+#include "history.h"
 
 static const char chathistory_desc[] = "Provides CHATHISTORY command for querying message history";
 
+#define CHATHISTORY_MAX_LIMIT 100
+
 static void m_chathistory(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
 
 struct Message chathistory_msgtab = {
 	"CHATHISTORY", 0, 0, 0, 0,
-	{mg_unreg, {m_chathistory, 2}, mg_ignore, mg_ignore, mg_ignore, {m_chathistory, 2}}
+	{mg_unreg, {m_chathistory, 4}, mg_ignore, mg_ignore, mg_ignore, {m_chathistory, 4}}
 };
 
 mapi_clist_av1 chathistory_clist[] = { &chathistory_msgtab, NULL };
 
 DECLARE_MODULE_AV2(m_chathistory, NULL, NULL, chathistory_clist, NULL, NULL, NULL, NULL, chathistory_desc);
 
-/* Note: This requires chm_history extension to be loaded */
-/* Access history through exported function */
-extern rb_dictionary *chm_history_dict_get(void);
-
 /* CHATHISTORY capability - defined in modules/cap_chathistory.c */
 extern unsigned int CLICAP_CHATHISTORY;
-/* Server-time capability - defined in modules/cap_server_time.c */
-extern unsigned int CLICAP_SERVER_TIME;
-
-struct history_entry {
-	char *nick;
-	char *text;
-	time_t timestamp;
-	rb_dlink_node node;
-};
+/* batch capability - defined in modules/cap_batch.c */
+extern unsigned int CLICAP_BATCH;
 
-struct channel_history {
-	struct Channel *chptr;
-	rb_dlink_list messages;
-	rb_dlink_node node;
+/*
+ * A reference names a point in the history: lo is the first line at or
+ * after it and hi the first line after it.  They differ only when a
+ * msgid or timestamp matches lines exactly.
+ */
+struct history_ref
+{
+	unsigned int lo;
+	unsigned int hi;
 };
 
-/* Helper function to send history message with optional server-time tag */
+/* parse "timestamp=YYYY-MM-DDThh:mm:ss.sssZ" or "msgid=..." */
+static bool
+parse_ref(struct history_buf *buf, const char *param, struct history_ref *ref)
+{
+	int64_t when;
+	uint64_t id;
+
+	if (!strncmp(param, "msgid=", 6))
+	{
+		if (!history_parse_msgid(param + 6, &id))
+			return false;
+
+		ref->lo = history_index_id(buf, id);
+		ref->hi = history_index_id(buf, id + 1);
+		return true;
+	}
+
+	if (strncmp(param, "timestamp=", 10))
+		return false;
+
+	if (!history_parse_time(param + 10, &when))
+		return false;
+
+	ref->lo = history_index_msec(buf, when);
+	ref->hi = history_index_msec(buf, when + 1);
+	return true;
+}
+
 static void
-send_history_message(struct Client *source_p, struct history_entry *entry, struct Channel *chptr)
+send_history(struct Client *source_p, const char *target, struct history_buf *buf,
+	unsigned int start, unsigned int end)
 {
-	if (CLICAP_SERVER_TIME != 0 && IsCapable(source_p, CLICAP_SERVER_TIME)) {
-		char time_str[64];
-		struct tm *tm_info = gmtime(&entry->timestamp);
-		strftime(time_str, sizeof(time_str), "%Y-%m-%dT%H:%M:%S.000Z", tm_info);
-		sendto_one(source_p, "@time=%s :%s!%s@%s PRIVMSG %s :%s",
-			time_str, entry->nick, entry->nick, "history", chptr->chname, entry->text);
-	} else {
-		sendto_one(source_p, ":%s!%s@%s PRIVMSG %s :%s",
-			entry->nick, entry->nick, "history", chptr->chname, entry->text);
+	static unsigned int batch_id;
+	struct history_line line;
+	char batch[16];
+	bool batched = CLICAP_BATCH != 0 && IsCapable(source_p, CLICAP_BATCH);
+
+	if (batched)
+	{
+		snprintf(batch, sizeof(batch), "chathist%u", ++batch_id);
+		sendto_one(source_p, ":%s BATCH +%s chathistory %s", me.name, batch, target);
 	}
+
+	for (; start < end; start++)
+	{
+		history_get(buf, start, &line);
+		history_send(source_p, target, &line, batched ? batch : NULL);
+	}
+
+	if (batched)
+		sendto_one(source_p, ":%s BATCH -%s", me.name, batch);
 }
 
+/*
+ * CHATHISTORY LATEST <target> <reference|*> <limit>
+ * CHATHISTORY BEFORE <target> <reference> <limit>
+ * CHATHISTORY AFTER <target> <reference> <limit>
+ * CHATHISTORY AROUND <target> <reference> <limit>
+ * CHATHISTORY BETWEEN <target> <reference> <reference> <limit>
+ *
+ * Lines are always sent oldest first; the references themselves are
+ * not included, except by AROUND.
+ */
 static void
 m_chathistory(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
 {
 	struct Channel *chptr;
-	const char *target;
-	const char *query_type;
-	const char *query_param;
-	struct channel_history *hist;
-	rb_dlink_node *ptr;
-	struct history_entry *entry;
-	int count = 0;
-	int limit = 50;
-	time_t target_time = 0;
-
-	if (parc < 3 || EmptyString(parv[1]) || EmptyString(parv[2]))
-	{
-		sendto_one_numeric(source_p, ERR_NEEDMOREPARAMS, form_str(ERR_NEEDMOREPARAMS), "CHATHISTORY");
-		return;
-	}
+	struct history_buf *buf;
+	struct history_ref ref, ref2;
+	const char *subcmd = parv[1];
+	const char *target = parv[2];
+	unsigned int count, start, end;
+	int limit;
 
 	/* Check for CHATHISTORY capability */
 	if (CLICAP_CHATHISTORY != 0 && !IsCapable(source_p, CLICAP_CHATHISTORY)) {
@@ -100,27 +135,26 @@ m_chathistory(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *s
 		return;
 	}
 
-	target = parv[1];
-	query_type = parv[2];
-	query_param = parc > 3 ? parv[3] : NULL;
-
-	if (parc > 4 && !EmptyString(parv[4]))
-		limit = atoi(parv[4]);
-	if (limit > 100)
-		limit = 100;
-	if (limit < 1)
-		limit = 50;
+	if (!irccmp(subcmd, "BETWEEN") && (parc < 6 || EmptyString(parv[5])))
+	{
+		sendto_one_numeric(source_p, ERR_NEEDMOREPARAMS, form_str(ERR_NEEDMOREPARAMS), "CHATHISTORY");
+		return;
+	}
 
-	if (!IsChanPrefix(target[0]))
+	if (parc < 5 || EmptyString(parv[4]))
 	{
-		sendto_one_numeric(source_p, ERR_NOSUCHCHANNEL, form_str(ERR_NOSUCHCHANNEL), target);
+		sendto_one_numeric(source_p, ERR_NEEDMOREPARAMS, form_str(ERR_NEEDMOREPARAMS), "CHATHISTORY");
 		return;
 	}
 
-	chptr = find_channel(target);
-	if (chptr == NULL)
+	limit = atoi(parv[irccmp(subcmd, "BETWEEN") ? 4 : 5]);
+	if (limit < 1 || limit > CHATHISTORY_MAX_LIMIT)
+		limit = CHATHISTORY_MAX_LIMIT;
+
+	if (!IsChanPrefix(target[0]) || (chptr = find_channel(target)) == NULL)
 	{
-		sendto_one_numeric(source_p, ERR_NOSUCHCHANNEL, form_str(ERR_NOSUCHCHANNEL), target);
+		sendto_one(source_p, ":%s FAIL CHATHISTORY INVALID_TARGET %s %s :Messages could not be retrieved",
+			me.name, subcmd, target);
 		return;
 	}
 
@@ -130,112 +164,63 @@ m_chathistory(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *s
 		return;
 	}
 
-	/* Get history from chm_history extension if available */
-	rb_dictionary *history_dict = chm_history_dict_get();
-	if (history_dict == NULL)
+	buf = history_find(chptr->chname);
+	count = history_count(buf);
+
+	if (!irccmp(subcmd, "LATEST") && !strcmp(parv[3], "*"))
 	{
-		sendto_one_notice(source_p, ":*** History not available (chm_history extension not loaded)");
-		return;
+		ref.lo = ref.hi = 0;
 	}
-
-	hist = rb_dictionary_retrieve(history_dict, chptr->chname);
-	if (hist == NULL)
+	else if (!parse_ref(buf, parv[3], &ref) ||
+		(!irccmp(subcmd, "BETWEEN") && !parse_ref(buf, parv[4], &ref2)))
 	{
-		sendto_one_notice(source_p, ":*** No history available for %s", chptr->chname);
+		sendto_one(source_p, ":%s FAIL CHATHISTORY INVALID_PARAMS %s :Invalid message reference",
+			me.name, subcmd);
 		return;
 	}
 
-	if (query_param != NULL)
-		target_time = atoi(query_param);
-
-	/* Query types: LATEST, AROUND, BEFORE, AFTER */
-	if (!strcmp(query_type, "LATEST"))
+	if (!irccmp(subcmd, "LATEST"))
 	{
-		/* Send latest N messages */
-		RB_DLINK_FOREACH_REVERSE(ptr, hist->messages.tail)
-		{
-			if (count >= limit)
-				break;
-			entry = ptr->data;
-			send_history_message(source_p, entry, chptr);
-			count++;
-		}
+		end = count;
+		start = count - ref.hi > (unsigned int)limit ? count - limit : ref.hi;
 	}
-	else if (!strcmp(query_type, "AROUND") && query_param != NULL)
+	else if (!irccmp(subcmd, "BEFORE"))
 	{
-		/* Send messages around a timestamp */
-		rb_dlink_node *start_ptr = NULL;
-		RB_DLINK_FOREACH(ptr, hist->messages.head)
-		{
-			entry = ptr->data;
-			if (entry->timestamp >= target_time)
-			{
-				start_ptr = ptr;
-				break;
-			}
-		}
-		if (start_ptr != NULL)
-		{
-			/* Send messages before and after */
-			rb_dlink_node *p;
-			int before = limit / 2;
-			int after = limit - before;
-			int sent = 0;
-
-			/* Go backwards first */
-			p = start_ptr;
-			for (int i = 0; i < before && p != NULL; i++)
-			{
-				if (p->prev == NULL)
-					break;
-				p = p->prev;
-			}
-
-			/* Send from here */
-			for (p = p ? p : hist->messages.head; p != NULL && sent < limit; p = p->next)
-			{
-				entry = p->data;
-				if (abs((long)(entry->timestamp - target_time)) > 3600) /* 1 hour window */
-					break;
-				send_history_message(source_p, entry, chptr);
-				sent++;
-			}
-		}
+		end = ref.lo;
+		start = ref.lo > (unsigned int)limit ? ref.lo - limit : 0;
 	}
-	else if (!strcmp(query_type, "BEFORE") && query_param != NULL)
+	else if (!irccmp(subcmd, "AFTER"))
 	{
-		/* Send messages before a timestamp */
-		RB_DLINK_FOREACH_REVERSE(ptr, hist->messages.tail)
-		{
-			if (count >= limit)
-				break;
-			entry = ptr->data;
-			if (entry->timestamp >= target_time)
-				continue;
-			send_history_message(source_p, entry, chptr);
-			count++;
-		}
+		start = ref.hi;
+		end = count - ref.hi > (unsigned int)limit ? ref.hi + limit : count;
+	}
+	else if (!irccmp(subcmd, "AROUND"))
+	{
+		start = ref.lo > (unsigned int)limit / 2 ? ref.lo - limit / 2 : 0;
+		end = count - start > (unsigned int)limit ? start + limit : count;
+		start = end > (unsigned int)limit ? end - limit : 0;
 	}
-	else if (!strcmp(query_type, "AFTER") && query_param != NULL)
+	else if (!irccmp(subcmd, "BETWEEN"))
 	{
-		/* Send messages after a timestamp */
-		RB_DLINK_FOREACH(ptr, hist->messages.head)
+		if (ref.lo <= ref2.lo)
 		{
-			if (count >= limit)
-				break;
-			entry = ptr->data;
-			if (entry->timestamp <= target_time)
-				continue;
-			send_history_message(source_p, entry, chptr);
-			count++;
+			/* forwards from the first reference */
+			start = ref.hi;
+			end = ref2.lo > start && ref2.lo - start > (unsigned int)limit ? start + limit : ref2.lo;
+		}
+		else
+		{
+			/* backwards from the first reference */
+			end = ref.lo;
+			start = end > ref2.hi && end - ref2.hi > (unsigned int)limit ? end - limit : ref2.hi;
 		}
 	}
 	else
 	{
-		sendto_one_notice(source_p, ":*** Invalid query type. Use: LATEST, AROUND, BEFORE, or AFTER");
+		sendto_one(source_p, ":%s FAIL CHATHISTORY INVALID_PARAMS %s :Unknown subcommand",
+			me.name, subcmd);
 		return;
 	}
 
-	sendto_one_notice(source_p, ":*** End of history for %s (%d messages)", chptr->chname, count);
+	send_history(source_p, chptr->chname, buf, start, MAX(start, end));
 }
-
@@ -73,6 +73,8 @@ m_clearchan(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *sou
 			cleared++;
 		}
 
+		chptr->bants++;
+
 		sendto_one_notice(source_p, ":*** Cleared %d bans on %s", cleared, chptr->chname);
 	}
 
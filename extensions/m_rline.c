@@ -132,6 +132,7 @@ m_unrline(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *sourc
 		if(!irccmp(aconf->host, mask))
 		{
 			rb_dlinkDelete(ptr, &xline_conf_list);
+			xline_list_changed();
 			bandb_del(BANDB_XLINE, aconf->host, NULL);
 			free_conf(aconf);
 			check_xlines();
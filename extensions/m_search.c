@@ -21,10 +21,17 @@
 #include "parse.h"
 #include "numeric.h"
 #include "match.h"
+#include "history.h"
+#include "textindex.h"
+#include "rb_radixtree.h"
 
 static const char search_desc[] = "Provides SEARCH command for searching channel messages";
 
+#define SEARCH_MAX_LIMIT	50
+
 static void m_search(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
+static void hook_privmsg_channel(void *);
+static void expire_search_indexes(void *);
 
 struct Message search_msgtab = {
 	"SEARCH", 0, 0, 0, 0,
@@ -33,24 +40,231 @@ struct Message search_msgtab = {
 
 mapi_clist_av1 search_clist[] = { &search_msgtab, NULL };
 
-DECLARE_MODULE_AV2(m_search, NULL, NULL, search_clist, NULL, NULL, NULL, NULL, search_desc);
+mapi_hfn_list_av1 search_hfnlist[] = {
+	{ "privmsg_channel", hook_privmsg_channel, HOOK_MONITOR },
+	{ NULL, NULL }
+};
 
-/* Access history from chm_history extension */
-extern rb_dictionary *chm_history_dict_get(void);
+/*
+ * A channel gets a word index over its history on its first SEARCH.
+ * Once the index has caught up with the history store, the
+ * privmsg_channel hook adds each new line to it.  Catching up, at first
+ * and when the index is rebuilt after most of what it covers has left
+ * the store, is left to an event that indexes a bounded number of lines
+ * per run, since a channel's history log may hold days of lines.  Until
+ * a rebuild has caught up, searches keep using the old index.
+ */
+#define SEARCH_HOOK_LINES	16
+#define SEARCH_FILL_LINES	2000
 
-struct history_entry {
-	char *nick;
-	char *text;
-	time_t timestamp;
-	rb_dlink_node node;
+struct search_chan
+{
+	char *name;
+	struct text_index *index;
+	struct text_index *fill;	/* being caught up, possibly index itself */
+	rb_dlink_node fill_node;
 };
 
-struct channel_history {
-	struct Channel *chptr;
-	rb_dlink_list messages;
-	rb_dlink_node node;
-};
+static rb_radixtree *search_tree;
+static rb_dlink_list search_fill_list;
+static struct ev_entry *search_expire_ev;
+static struct ev_entry *search_fill_ev;
+
+static void
+free_search_chan(struct search_chan *sc)
+{
+	rb_radixtree_delete(search_tree, sc->name);
+	if (sc->fill != NULL)
+		rb_dlinkDelete(&sc->fill_node, &search_fill_list);
+	if (sc->fill != NULL && sc->fill != sc->index)
+		text_index_destroy(sc->fill);
+	text_index_destroy(sc->index);
+	rb_free(sc->name);
+	rb_free(sc);
+}
+
+static void
+start_fill(struct search_chan *sc, struct text_index *idx)
+{
+	if (sc->fill != NULL)
+		return;
+
+	sc->fill = idx;
+	rb_dlinkAdd(sc, &sc->fill_node, &search_fill_list);
+}
+
+/* add up to max of the lines idx has not seen; returns true once none are left */
+static bool
+index_lines(struct history_buf *buf, struct text_index *idx, unsigned int max)
+{
+	struct history_line line;
+	unsigned int i, count = history_count(buf);
+
+	for (i = history_index_id(buf, text_index_last_id(idx) + 1); i < count && max > 0; i++, max--)
+	{
+		history_get(buf, i, &line);
+		text_index_add(idx, line.id, line.text);
+	}
+
+	return i >= count;
+}
+
+static void
+fill_search_indexes(void *unused)
+{
+	struct search_chan *sc;
+	struct history_buf *buf;
+	rb_dlink_node *ptr, *next_ptr;
+	unsigned int before, budget = SEARCH_FILL_LINES;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, search_fill_list.head)
+	{
+		sc = ptr->data;
+		buf = history_find(sc->name);
+
+		if (history_count(buf) == 0)
+		{
+			free_search_chan(sc);
+			continue;
+		}
+
+		before = text_index_lines(sc->fill);
+		if (index_lines(buf, sc->fill, budget))
+		{
+			rb_dlinkDelete(&sc->fill_node, &search_fill_list);
+			if (sc->fill != sc->index)
+			{
+				text_index_destroy(sc->index);
+				sc->index = sc->fill;
+			}
+			sc->fill = NULL;
+		}
+
+		budget -= text_index_lines(sc->fill != NULL ? sc->fill : sc->index) - before;
+		if (budget == 0)
+			break;
+	}
+}
+
+/* find a channel's index, starting one on its first search */
+static struct search_chan *
+find_search_chan(const char *chname)
+{
+	struct search_chan *sc = rb_radixtree_retrieve(search_tree, chname);
+
+	if (history_count(history_find(chname)) == 0)
+	{
+		if (sc != NULL)
+			free_search_chan(sc);
+		return NULL;
+	}
+
+	if (sc == NULL)
+	{
+		sc = rb_malloc(sizeof(struct search_chan));
+		sc->name = rb_strdup(chname);
+		sc->index = text_index_create();
+		rb_radixtree_add(search_tree, sc->name, sc);
+		start_fill(sc, sc->index);
+	}
+
+	return sc;
+}
 
+static void
+hook_privmsg_channel(void *data_)
+{
+	hook_data_privmsg_channel *data = data_;
+	struct search_chan *sc;
+	struct history_buf *buf;
+
+	/* the history extension may only see this line after us, in which
+	 * case it is picked up with the next one */
+	if (data->approved)
+		return;
+
+	sc = rb_radixtree_retrieve(search_tree, data->chptr->chname);
+	if (sc == NULL || sc->fill == sc->index)
+		return;
+
+	buf = history_find(sc->name);
+	if (!index_lines(buf, sc->index, SEARCH_HOOK_LINES))
+		start_fill(sc, sc->index);
+	else if (sc->fill == NULL && text_index_lines(sc->index) > 2 * history_count(buf) + 1024)
+		start_fill(sc, text_index_create());
+}
+
+static void
+expire_search_indexes(void *unused)
+{
+	struct search_chan *sc;
+	rb_radixtree_iteration_state iter;
+	rb_dlink_list gone = { NULL, NULL, 0 };
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_RADIXTREE_FOREACH(sc, &iter, search_tree)
+	{
+		if (history_count(history_find(sc->name)) == 0)
+			rb_dlinkAddAlloc(sc, &gone);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, gone.head)
+	{
+		free_search_chan(ptr->data);
+		rb_dlinkDestroy(ptr, &gone);
+	}
+}
+
+static int
+modinit(void)
+{
+	search_tree = rb_radixtree_create_casemap("search", irctoupper_tab);
+	search_expire_ev = rb_event_addish("expire_search_indexes", expire_search_indexes, NULL, 300);
+	search_fill_ev = rb_event_add("fill_search_indexes", fill_search_indexes, NULL, 1);
+	return 0;
+}
+
+static void
+moddeinit(void)
+{
+	struct search_chan *sc;
+	rb_radixtree_iteration_state iter;
+
+	rb_event_delete(search_fill_ev);
+	rb_event_delete(search_expire_ev);
+
+	RB_RADIXTREE_FOREACH(sc, &iter, search_tree)
+	{
+		free_search_chan(sc);
+	}
+
+	rb_radixtree_destroy(search_tree, NULL, NULL);
+	search_tree = NULL;
+}
+
+DECLARE_MODULE_AV2(m_search, modinit, moddeinit, search_clist, NULL, search_hfnlist, NULL, NULL, search_desc);
+
+/* unix seconds, or YYYY-MM-DDThh:mm:ss[.sssZ], in milliseconds */
+static bool
+parse_search_time(const char *s, int64_t *msec)
+{
+	char *end;
+
+	if (strchr(s, 'T') != NULL)
+		return history_parse_time(s, msec);
+
+	*msec = (int64_t)strtoll(s, &end, 10) * 1000;
+	return *s != '\0' && *end == '\0';
+}
+
+/*
+ * SEARCH <channel> <words> [limit]
+ *
+ * Finds the newest lines of the channel's history holding all of the
+ * words.  after=<time> and before=<time> among the words limit the
+ * search to a stretch of time.  Without history, the words are matched
+ * against the members' nicks instead.
+ */
 static void
 m_search(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
 {
@@ -59,6 +273,14 @@ m_search(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source
 	const char *query;
 	rb_dlink_node *ptr;
 	struct membership *msptr;
+	struct search_chan *sc;
+	struct history_buf *buf;
+	struct history_line line;
+	char words[BUFSIZE], copy[BUFSIZE];
+	char *word, *p;
+	uint64_t ids[SEARCH_MAX_LIMIT], min_id, max_id;
+	int64_t after = 0, before = INT64_MAX;
+	unsigned int i, idx, found;
 	int count = 0;
 	int limit = 20;
 
@@ -73,8 +295,8 @@ m_search(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source
 
 	if (parc > 3 && !EmptyString(parv[3]))
 		limit = atoi(parv[3]);
-	if (limit > 50)
-		limit = 50;
+	if (limit > SEARCH_MAX_LIMIT)
+		limit = SEARCH_MAX_LIMIT;
 	if (limit < 1)
 		limit = 20;
 
@@ -98,33 +320,72 @@ m_search(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source
 	}
 
 	/* Search message history if available */
-	rb_dictionary *history_dict = chm_history_dict_get();
-	struct channel_history *hist = NULL;
-	if (history_dict != NULL) {
-		hist = rb_dictionary_retrieve(history_dict, chptr->chname);
-	}
+	if ((sc = find_search_chan(chptr->chname)) != NULL) {
+		buf = history_find(chptr->chname);
 
-	if (hist != NULL && rb_dlink_list_length(&hist->messages) > 0) {
-		/* Search message history */
-		struct history_entry *entry;
-		sendto_one_notice(source_p, ":*** Searching message history in %s for: %s", chptr->chname, query);
+		/* pick up the line the hook ran ahead of */
+		if (sc->fill != sc->index && !index_lines(buf, sc->index, SEARCH_HOOK_LINES))
+			start_fill(sc, sc->index);
 
-		RB_DLINK_FOREACH_REVERSE(ptr, hist->messages.tail)
+		/* split the time limits off the words */
+		words[0] = '\0';
+		rb_strlcpy(copy, query, sizeof(copy));
+		for (word = rb_strtok_r(copy, " ", &p); word != NULL; word = rb_strtok_r(NULL, " ", &p))
 		{
-			if (count >= limit)
-				break;
+			if ((!strncmp(word, "after=", 6) && !parse_search_time(word + 6, &after)) ||
+				(!strncmp(word, "before=", 7) && !parse_search_time(word + 7, &before)))
+			{
+				sendto_one_notice(source_p, ":*** Invalid time: %s", word);
+				return;
+			}
 
-			entry = ptr->data;
-			/* Case-insensitive search in message text */
-			if (entry->text != NULL && strcasestr(entry->text, query) != NULL) {
-				count++;
-				char time_str[64];
-				struct tm *tm_info = localtime(&entry->timestamp);
-				strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
-				sendto_one_notice(source_p, ":*** [%s] <%s> %s", time_str, entry->nick, entry->text);
+			if (strncmp(word, "after=", 6) && strncmp(word, "before=", 7))
+			{
+				rb_strlcat(words, word, sizeof(words));
+				rb_strlcat(words, " ", sizeof(words));
 			}
 		}
 
+		/* the times, as the ids of the lines inside them */
+		i = history_index_msec(buf, after);
+		if (i < history_count(buf)) {
+			history_get(buf, i, &line);
+			min_id = line.id;
+		} else
+			min_id = UINT64_MAX;
+
+		i = history_index_msec(buf, before);
+		if (i > 0) {
+			history_get(buf, i - 1, &line);
+			max_id = line.id;
+		} else
+			max_id = 0;
+
+		sendto_one_notice(source_p, ":*** Searching message history in %s for: %s", chptr->chname, query);
+		if (sc->fill == sc->index)
+			sendto_one_notice(source_p, ":*** Message history in %s is still being indexed, results may be incomplete",
+				chptr->chname);
+
+		found = min_id <= max_id ? text_index_search(sc->index, words, min_id, max_id, ids, limit) : 0;
+		for (i = 0; i < found; i++)
+		{
+			char time_str[64];
+			time_t when;
+
+			/* the index may still hold lines the store has dropped */
+			idx = history_index_id(buf, ids[i]);
+			if (idx >= history_count(buf))
+				continue;
+			history_get(buf, idx, &line);
+			if (line.id != ids[i])
+				continue;
+
+			when = line.msec / 1000;
+			count++;
+			strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&when));
+			sendto_one_notice(source_p, ":*** [%s] <%s> %s", time_str, line.source, line.text);
+		}
+
 		sendto_one_notice(source_p, ":*** Search complete (%d message matches)", count);
 	} else {
 		/* Fallback: Search current channel members for matching nicks */
@@ -22,13 +22,15 @@
 #include "numeric.h"
 #include "s_serv.h"
 #include "logger.h"
+#include "match.h"
+#include "rb_hashmap.h"
 
 static const char seen_desc[] = "Provides SEEN command to track when users were last seen online";
 
 /* Structure to store last seen information */
 struct seen_entry {
 	char *nick;
-	char *nick_lower;  /* lowercase nickname for dictionary key */
+	char *nick_key;    /* nickname the entry is filed under */
 	char *username;
 	char *host;
 	char *action;  /* "message", "join", "part", "quit", etc. */
@@ -37,8 +39,8 @@ struct seen_entry {
 	rb_dlink_node node;
 };
 
-/* Dictionary to store seen entries keyed by nickname */
-static rb_dictionary *seen_dict;
+/* Hash map to store seen entries keyed by nickname */
+static rb_hashmap *seen_dict;
 
 /* Forward declarations */
 static void m_seen(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
@@ -48,7 +50,7 @@ static void hook_channel_join_seen(void *);
 static void hook_channel_part_seen(void *);
 static void hook_client_exit_seen(void *);
 static void update_seen(struct Client *, const char *, const char *);
-static void free_seen_entry(void *);
+static void free_seen_entry(const void *, void *, void *);
 
 struct Message seen_msgtab = {
 	"SEEN", 0, 0, 0, 0,
@@ -76,29 +78,24 @@ static void
 update_seen(struct Client *client_p, const char *action, const char *channel)
 {
 	struct seen_entry *entry;
-	char *nick_lower;
-	char nick_buf[NICKLEN + 1];
 
 	if (client_p == NULL || client_p->name == NULL)
 		return;
 
-	/* Convert nickname to lowercase for case-insensitive lookup */
-	rb_strlcpy(nick_buf, client_p->name, sizeof(nick_buf));
-	rb_strlwr(nick_buf);
-
-	entry = rb_dictionary_retrieve(seen_dict, nick_buf);
+	/* the map ignores case, so any spelling of the nick finds it */
+	entry = rb_hashmap_retrieve(seen_dict, client_p->name);
 	if (entry == NULL)
 	{
 		/* Create new entry */
 		entry = rb_malloc(sizeof(struct seen_entry));
 		entry->nick = rb_strdup(client_p->name);
-		entry->nick_lower = rb_strdup(nick_buf);
+		entry->nick_key = rb_strdup(client_p->name);
 		entry->username = client_p->username ? rb_strdup(client_p->username) : NULL;
 		entry->host = client_p->host ? rb_strdup(client_p->host) : NULL;
 		entry->action = rb_strdup(action);
 		entry->channel = channel ? rb_strdup(channel) : NULL;
 		entry->last_seen = rb_current_time();
-		rb_dictionary_add(seen_dict, entry->nick_lower, entry);
+		rb_hashmap_add(seen_dict, entry->nick_key, entry);
 	}
 	else
 	{
@@ -123,19 +120,17 @@ update_seen(struct Client *client_p, const char *action, const char *channel)
 
 /* Free a seen entry */
 static void
-free_seen_entry(rb_dictionary_element *delem, void *privdata)
+free_seen_entry(const void *key, void *data, void *privdata)
 {
-	struct seen_entry *entry;
+	struct seen_entry *entry = data;
 
-	if (delem == NULL || delem->data == NULL)
+	if (entry == NULL)
 		return;
 
-	entry = delem->data;
-
 	if (entry->nick)
 		rb_free(entry->nick);
-	if (entry->nick_lower)
-		rb_free(entry->nick_lower);
+	if (entry->nick_key)
+		rb_free(entry->nick_key);
 	if (entry->username)
 		rb_free(entry->username);
 	if (entry->host)
@@ -203,7 +198,6 @@ m_seen(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p
 {
 	struct seen_entry *entry;
 	struct Client *target_p;
-	char nick_buf[NICKLEN + 1];
 	char time_buf[128];
 	time_t now;
 	time_t diff;
@@ -224,10 +218,7 @@ m_seen(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p
 	}
 
 	/* Look up in seen database */
-	rb_strlcpy(nick_buf, parv[1], sizeof(nick_buf));
-	rb_strlwr(nick_buf);
-
-	entry = rb_dictionary_retrieve(seen_dict, nick_buf);
+	entry = rb_hashmap_retrieve(seen_dict, parv[1]);
 	if (entry == NULL)
 	{
 		sendto_one_notice(source_p, ":*** I have not seen %s", parv[1]);
@@ -278,7 +269,7 @@ m_seen(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p
 static int
 modinit(void)
 {
-	seen_dict = rb_dictionary_create("seen", rb_dictionary_str_casecmp);
+	seen_dict = rb_hashmap_create_casemap("seen", irctoupper_tab);
 	if (seen_dict == NULL)
 		return -1;
 	return 0;
@@ -289,7 +280,7 @@ moddeinit(void)
 {
 	if (seen_dict != NULL)
 	{
-		rb_dictionary_destroy(seen_dict, free_seen_entry);
+		rb_hashmap_destroy(seen_dict, free_seen_entry, NULL);
 		seen_dict = NULL;
 	}
 }
@@ -20,6 +20,8 @@
 #include "hash.h"
 #include "parse.h"
 #include "numeric.h"
+#include "match.h"
+#include "rb_hashmap.h"
 
 static const char topic_history_desc[] = "Provides TOPICHISTORY command for viewing topic change history";
 
@@ -37,7 +39,7 @@ struct channel_topic_history {
 	rb_dlink_node node;
 };
 
-static rb_dictionary *topic_history_dict;
+static rb_hashmap *topic_history_dict;
 
 struct Message topic_history_msgtab = {
 	"TOPICHISTORY", 0, 0, 0, 0,
@@ -95,7 +97,7 @@ m_topic_history(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client
 static int
 modinit(void)
 {
-	topic_history_dict = rb_dictionary_create("topic_history", rb_dictionary_str_casecmp);
+	topic_history_dict = rb_hashmap_create_casemap("topic_history", irctoupper_tab);
 	return 0;
 }
 
@@ -104,11 +106,11 @@ moddeinit(void)
 {
 	if (topic_history_dict != NULL)
 	{
-		rb_dictionary_iter iter;
+		rb_hashmap_iter iter;
 		struct channel_topic_history *hist;
 		rb_dlink_node *ptr, *next_ptr;
 
-		RB_DICTIONARY_FOREACH(hist, &iter, topic_history_dict)
+		RB_HASHMAP_FOREACH(hist, &iter, topic_history_dict)
 		{
 			RB_DLINK_FOREACH_SAFE(ptr, next_ptr, hist->history.head)
 			{
@@ -119,7 +121,7 @@ moddeinit(void)
 				rb_free(entry);
 			}
 		}
-		rb_dictionary_destroy(topic_history_dict, NULL, NULL);
+		rb_hashmap_destroy(topic_history_dict, NULL, NULL);
 		topic_history_dict = NULL;
 	}
 }
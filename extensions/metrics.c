@@ -20,30 +20,14 @@
 #include "s_serv.h"
 #include "s_stats.h"
 #include "hash.h"
+#include "match.h"
+#include "rb_hashmap.h"
+#include "metrics.h"
 
 static const char metrics_desc[] = "Provides metrics and observability for the IRC server";
 
-struct channel_metrics {
-	unsigned long messages;
-	unsigned long joins;
-	unsigned long parts;
-	unsigned long unique_users;
-	time_t created;
-	time_t last_activity;
-	rb_dlink_list active_users;
-	struct Channel *chptr;
-};
-
-struct server_metrics {
-	unsigned long connections;
-	unsigned long messages;
-	unsigned long channels;
-	unsigned long users;
-	time_t last_update;
-};
-
 struct server_metrics metrics;
-rb_dictionary *channel_metrics_dict;
+rb_hashmap *channel_metrics_dict;
 static struct ev_entry *metrics_update_ev;
 
 static void hook_new_local_user(void *);
@@ -137,7 +121,7 @@ get_channel_metrics(struct Channel *chptr)
 	if (chptr == NULL)
 		return NULL;
 
-	chm = rb_dictionary_retrieve(channel_metrics_dict, chptr->chname);
+	chm = rb_hashmap_retrieve(channel_metrics_dict, chptr->chname);
 	if (chm == NULL)
 	{
 	chm = rb_malloc(sizeof(struct channel_metrics));
@@ -145,7 +129,7 @@ get_channel_metrics(struct Channel *chptr)
 	chm->chptr = chptr;
 	chm->created = rb_current_time();
 	chm->last_activity = rb_current_time();
-	rb_dictionary_add(channel_metrics_dict, chptr->chname, chm);
+	rb_hashmap_add(channel_metrics_dict, chptr->chname, chm);
 	}
 
 	return chm;
@@ -163,7 +147,7 @@ static int
 modinit(void)
 {
 	memset(&metrics, 0, sizeof(metrics));
-	channel_metrics_dict = rb_dictionary_create("channel_metrics", rb_dictionary_str_casecmp);
+	channel_metrics_dict = rb_hashmap_create_casemap("channel_metrics", irctoupper_tab);
 	metrics_update_ev = rb_event_addish("metrics_update", metrics_update, NULL, 60);
 	return 0;
 }
@@ -175,7 +159,7 @@ moddeinit(void)
 		rb_event_delete(metrics_update_ev);
 	if (channel_metrics_dict != NULL)
 	{
-		rb_dictionary_destroy(channel_metrics_dict, NULL, NULL);
+		rb_hashmap_destroy(channel_metrics_dict, NULL, NULL);
 		channel_metrics_dict = NULL;
 	}
 }
@@ -20,8 +20,13 @@
 #include "s_serv.h"
 #include "s_stats.h"
 #include "hash.h"
+#include "logger.h"
+#include "msg.h"
+#include "parse.h"
 #include <rb_lib.h>
 #include <rb_commio.h>
+#include <rb_hashmap.h>
+#include "metrics.h"
 
 static const char metrics_http_desc[] = "HTTP endpoint for Prometheus metrics export";
 
@@ -37,6 +42,12 @@ struct http_connection {
 	size_t buffer_size;
 	size_t buffer_pos;
 	bool headers_sent;
+
+	/* the response, and how much of it is written */
+	char *out;
+	size_t out_len;
+	size_t out_cap;
+	size_t out_pos;
 };
 
 /* Forward declarations */
@@ -44,80 +55,211 @@ static void metrics_http_accept_callback(rb_fde_t *F, int status, struct sockadd
 static int metrics_http_accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t len, void *data);
 static void metrics_http_read_callback(rb_fde_t *F, void *data);
 static void metrics_http_timeout_callback(rb_fde_t *F, void *data);
+static void metrics_http_write_callback(rb_fde_t *F, void *data);
 
-/* External references to metrics from metrics.c */
-extern struct server_metrics metrics;
-extern rb_dictionary *channel_metrics_dict;
-
-/* Forward declaration */
-struct channel_metrics {
-	unsigned long messages;
-	unsigned long joins;
-	unsigned long parts;
-	unsigned long unique_users;
-	time_t created;
-	time_t last_activity;
-	rb_dlink_list active_users;
-	struct Channel *chptr;
-};
+static void
+metrics_http_close(struct http_connection *conn)
+{
+	rb_close(conn->fd);
+	rb_free(conn->buffer);
+	rb_free(conn->out);
+	rb_free(conn);
+}
+
+/* Append to the response */
+static void __attribute__((format(printf, 2, 3)))
+metrics_printf(struct http_connection *conn, const char *format, ...)
+{
+	va_list args;
+	int len;
+
+	for (;;) {
+		va_start(args, format);
+		len = vsnprintf(conn->out + conn->out_len, conn->out_cap - conn->out_len, format, args);
+		va_end(args);
+
+		if (len < 0)
+			return;
+		if ((size_t)len < conn->out_cap - conn->out_len)
+			break;
+
+		conn->out_cap = (conn->out_cap + len) * 2;
+		conn->out = rb_realloc(conn->out, conn->out_cap);
+	}
+
+	conn->out_len += len;
+}
+
+/* One histogram's series; labels is a list like a="x",b="y", or "".
+ * Times are exported in seconds, counts as they are. */
+static void
+metrics_histogram(struct http_connection *conn, const char *name, const char *labels,
+		const struct rb_histogram *hist, bool seconds)
+{
+	const char *sep = *labels != '\0' ? "," : "";
+	unsigned long long seen = 0;
+	int i;
+
+	for (i = 0; i < RB_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		if (seconds)
+			metrics_printf(conn, "%s_bucket{%s%sle=\"%g\"} %llu\n",
+				name, labels, sep, rb_histogram_bound(i) / 1e6, seen);
+		else
+			metrics_printf(conn, "%s_bucket{%s%sle=\"%llu\"} %llu\n",
+				name, labels, sep,
+				(unsigned long long)rb_histogram_bound(i) - 1, seen);
+	}
+
+	metrics_printf(conn, "%s_bucket{%s%sle=\"+Inf\"} %llu\n",
+		name, labels, sep, (unsigned long long)hist->count);
+	if (seconds)
+		metrics_printf(conn, "%s_sum{%s} %.6f\n", name, labels, hist->sum / 1e9);
+	else
+		metrics_printf(conn, "%s_sum{%s} %llu\n", name, labels,
+			(unsigned long long)hist->sum);
+	metrics_printf(conn, "%s_count{%s} %llu\n", name, labels,
+		(unsigned long long)hist->count);
+}
+
+/* Command handler latency histograms, see general::command_timing */
+static void
+generate_command_metrics(struct http_connection *conn)
+{
+	static const char *source_names[] = { "local", "remote", "server" };
+	rb_dictionary_iter iter;
+	struct Message *msg;
+	char labels[128];
+	int source;
+
+	metrics_printf(conn,
+		"# HELP ircd_commands_total Commands received\n"
+		"# TYPE ircd_commands_total counter\n");
+
+	RB_DICTIONARY_FOREACH(msg, &iter, cmd_dict) {
+		if (msg->count != 0)
+			metrics_printf(conn, "ircd_commands_total{command=\"%s\"} %u\n",
+				msg->cmd, msg->count);
+	}
+
+	metrics_printf(conn,
+		"\n"
+		"# HELP ircd_command_duration_seconds Time spent in command handlers\n"
+		"# TYPE ircd_command_duration_seconds histogram\n");
+
+	RB_DICTIONARY_FOREACH(msg, &iter, cmd_dict) {
+		for (source = 0; source < LAST_COMMAND_SOURCE; source++) {
+			if (msg->latency[source].count == 0)
+				continue;
+
+			snprintf(labels, sizeof(labels), "command=\"%s\",source=\"%s\"",
+				msg->cmd, source_names[source]);
+			metrics_histogram(conn, "ircd_command_duration_seconds", labels,
+				&msg->latency[source], true);
+		}
+	}
+
+	metrics_printf(conn, "\n");
+}
+
+static void
+event_metrics_cb(const char *name, const struct rb_histogram *hist, void *ptr)
+{
+	char labels[64];
+
+	snprintf(labels, sizeof(labels), "event=\"%s\"", name);
+	metrics_histogram(ptr, "ircd_event_duration_seconds", labels, hist, true);
+}
+
+/* Where the event loop's time goes: a loop that stays busy long after
+ * each wakeup is one whose clients are waiting on it */
+static void
+generate_loop_metrics(struct http_connection *conn)
+{
+	const struct rb_loop_stats *loop = rb_get_loop_stats();
+
+	metrics_printf(conn,
+		"# HELP ircd_loop_busy_seconds Time from each event loop wakeup to the next wait\n"
+		"# TYPE ircd_loop_busy_seconds histogram\n");
+	metrics_histogram(conn, "ircd_loop_busy_seconds", "", &loop->busy, true);
+
+	metrics_printf(conn,
+		"\n"
+		"# HELP ircd_loop_ready_fds Descriptors ready at each event loop wakeup\n"
+		"# TYPE ircd_loop_ready_fds histogram\n");
+	metrics_histogram(conn, "ircd_loop_ready_fds", "", &loop->ready, false);
+
+	metrics_printf(conn,
+		"\n"
+		"# HELP ircd_loop_handler_seconds Time spent in descriptor handlers and timed events\n"
+		"# TYPE ircd_loop_handler_seconds histogram\n");
+	metrics_histogram(conn, "ircd_loop_handler_seconds", "type=\"read\"", &loop->read, true);
+	metrics_histogram(conn, "ircd_loop_handler_seconds", "type=\"write\"", &loop->write, true);
+	metrics_histogram(conn, "ircd_loop_handler_seconds", "type=\"event\"", &loop->events, true);
+
+	metrics_printf(conn,
+		"\n"
+		"# HELP ircd_event_duration_seconds Time spent in each timed event\n"
+		"# TYPE ircd_event_duration_seconds histogram\n");
+	rb_dump_event_times(event_metrics_cb, conn);
+
+	metrics_printf(conn, "\n");
+}
 
 /* Generate Prometheus metrics output */
 static void
 generate_prometheus_metrics(struct http_connection *conn)
 {
-	char response[8192];
-	size_t pos = 0;
-
 	/* HTTP headers */
-	pos += snprintf(response + pos, sizeof(response) - pos,
+	metrics_printf(conn,
 		"HTTP/1.1 200 OK\r\n"
 		"Content-Type: text/plain; version=0.0.4\r\n"
 		"Connection: close\r\n"
 		"\r\n");
 
 	/* Server metrics */
-	pos += snprintf(response + pos, sizeof(response) - pos,
+	metrics_printf(conn,
 		"# HELP ircd_users_total Total number of users\n"
 		"# TYPE ircd_users_total gauge\n"
 		"ircd_users_total %lu\n"
 		"\n",
 		ServerStats.is_cl);
 
-	pos += snprintf(response + pos, sizeof(response) - pos,
+	metrics_printf(conn,
 		"# HELP ircd_channels_total Total number of channels\n"
 		"# TYPE ircd_channels_total gauge\n"
 		"ircd_channels_total %lu\n"
 		"\n",
 		rb_dlink_list_length(&global_channel_list));
 
-	pos += snprintf(response + pos, sizeof(response) - pos,
+	metrics_printf(conn,
 		"# HELP ircd_connections_total Total number of connections\n"
 		"# TYPE ircd_connections_total counter\n"
 		"ircd_connections_total %lu\n"
 		"\n",
 		metrics.connections);
 
-	pos += snprintf(response + pos, sizeof(response) - pos,
+	metrics_printf(conn,
 		"# HELP ircd_messages_total Total number of messages\n"
 		"# TYPE ircd_messages_total counter\n"
 		"ircd_messages_total %lu\n"
 		"\n",
 		metrics.messages);
 
-	pos += snprintf(response + pos, sizeof(response) - pos,
+	metrics_printf(conn,
 		"# HELP ircd_uptime_seconds Server uptime in seconds\n"
 		"# TYPE ircd_uptime_seconds gauge\n"
 		"ircd_uptime_seconds %.0f\n"
 		"\n",
-		(double)(rb_current_time() - me.serv->boot_time));
+		(double)(rb_current_time() - startup_time));
 
 	/* Channel metrics */
 	if (channel_metrics_dict != NULL) {
-		rb_dictionary_iter iter;
+		rb_hashmap_iter iter;
 		struct channel_metrics *chm;
-		RB_DICTIONARY_FOREACH(chm, &iter, channel_metrics_dict) {
+		RB_HASHMAP_FOREACH(chm, &iter, channel_metrics_dict) {
 			if (chm->chptr != NULL) {
-				pos += snprintf(response + pos, sizeof(response) - pos,
+				metrics_printf(conn,
 					"# HELP ircd_channel_messages_total Total messages in channel\n"
 					"# TYPE ircd_channel_messages_total counter\n"
 					"ircd_channel_messages_total{channel=\"%s\"} %lu\n"
@@ -127,11 +269,33 @@ generate_prometheus_metrics(struct http_connection *conn)
 		}
 	}
 
-	/* Send response */
-	rb_write(conn->fd, response, pos);
-	rb_close(conn->fd);
-	rb_free(conn->buffer);
-	rb_free(conn);
+	generate_command_metrics(conn);
+	generate_loop_metrics(conn);
+
+	/* Send response; the request has been read */
+	rb_setselect(conn->fd, RB_SELECT_READ, NULL, NULL);
+	metrics_http_write_callback(conn->fd, conn);
+}
+
+static void
+metrics_http_write_callback(rb_fde_t *F, void *data)
+{
+	struct http_connection *conn = data;
+	ssize_t n;
+
+	while (conn->out_pos < conn->out_len) {
+		n = rb_write(F, conn->out + conn->out_pos, conn->out_len - conn->out_pos);
+		if (n <= 0) {
+			if (n < 0 && rb_ignore_errno(errno)) {
+				rb_setselect(F, RB_SELECT_WRITE, metrics_http_write_callback, conn);
+				return;
+			}
+			break;
+		}
+		conn->out_pos += n;
+	}
+
+	metrics_http_close(conn);
 }
 
 static void
@@ -141,17 +305,13 @@ metrics_http_read_callback(rb_fde_t *F, void *data)
 	ssize_t n;
 
 	if (conn->buffer_pos >= conn->buffer_size - 1) {
-		rb_close(F);
-		rb_free(conn->buffer);
-		rb_free(conn);
+		metrics_http_close(conn);
 		return;
 	}
 
 	n = rb_read(F, conn->buffer + conn->buffer_pos, conn->buffer_size - conn->buffer_pos - 1);
 	if (n <= 0) {
-		rb_close(F);
-		rb_free(conn->buffer);
-		rb_free(conn);
+		metrics_http_close(conn);
 		return;
 	}
 
@@ -172,9 +332,7 @@ metrics_http_read_callback(rb_fde_t *F, void *data)
 					       "\r\n"
 					       "404 Not Found\r\n";
 			rb_write(F, response, strlen(response));
-			rb_close(F);
-			rb_free(conn->buffer);
-			rb_free(conn);
+			metrics_http_close(conn);
 		}
 	}
 }
@@ -183,9 +341,7 @@ static void
 metrics_http_timeout_callback(rb_fde_t *F, void *data)
 {
 	struct http_connection *conn = data;
-	rb_close(F);
-	rb_free(conn->buffer);
-	rb_free(conn);
+	metrics_http_close(conn);
 }
 
 static int
@@ -19,8 +19,9 @@
 #include "modules.h"
 #include "numeric.h"
 #include "hook.h"
-#include "event.h"
-#include "rb_lib.h"
+#include "hash.h"
+#include "match.h"
+#include "httpclient.h"
 
 static const char rss_feed_desc[] = "Provides RSS feed fetching and display";
 
@@ -29,6 +30,7 @@ static void m_rssadd(struct MsgBuf *, struct Client *, struct Client *, int, con
 static void m_rssdel(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
 static void m_rsslist(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
 static void rss_update(void *);
+static void rss_done(const struct http_response *, void *);
 
 struct rss_feed {
 	char *url;
@@ -41,7 +43,7 @@ struct rss_feed {
 };
 
 static rb_dlink_list rss_feeds;
-static rb_event *rss_update_event;
+static struct ev_entry *rss_update_event;
 
 struct Message rss_msgtab = {
 	"RSS", 0, 0, 0, 0,
@@ -65,6 +67,164 @@ struct Message rsslist_msgtab = {
 
 mapi_clist_av1 rss_feed_clist[] = { &rss_msgtab, &rssadd_msgtab, &rssdel_msgtab, &rsslist_msgtab, NULL };
 
+/* A fetch on its way, for a feed or for whoever asked */
+struct rss_fetch {
+	char *url;
+	char channel[CHANNELLEN + 1];
+	char source[IDLEN];
+	bool feed;
+	rb_dlink_node node;
+};
+
+static rb_dlink_list rss_fetches;
+
+static void
+rss_fetch(const char *url, const char *channel, struct Client *source_p, bool feed)
+{
+	struct rss_fetch *fetch;
+
+	fetch = rb_malloc(sizeof(struct rss_fetch));
+	fetch->url = rb_strdup(url);
+	fetch->feed = feed;
+	if (channel != NULL)
+		rb_strlcpy(fetch->channel, channel, sizeof(fetch->channel));
+	if (source_p != NULL)
+		rb_strlcpy(fetch->source, source_p->id, sizeof(fetch->source));
+
+	/* listed first, as rss_done may run before http_request returns */
+	rb_dlinkAdd(fetch, &fetch->node, &rss_fetches);
+	if (!http_request("GET", url, NULL, NULL, 0, NULL, rss_done, fetch)) {
+		rb_dlinkDelete(&fetch->node, &rss_fetches);
+		rb_free(fetch->url);
+		rb_free(fetch);
+
+		if (source_p != NULL)
+			sendto_one_notice(source_p, ":*** Cannot fetch RSS feed %s", url);
+	}
+}
+
+/* the text of the first <tag> in xml, without CDATA markers or spaces around it */
+static bool
+rss_extract(const char *xml, const char *tag, char *buf, size_t len)
+{
+	char open[32], close[32];
+	const char *start, *end;
+
+	snprintf(open, sizeof(open), "<%s", tag);
+	snprintf(close, sizeof(close), "</%s>", tag);
+
+	for (start = xml; (start = strstr(start, open)) != NULL; start++) {
+		if (start[strlen(open)] == '>' || start[strlen(open)] == ' ')
+			break;
+	}
+	if (start == NULL || (start = strchr(start, '>')) == NULL)
+		return false;
+	start++;
+
+	if ((end = strstr(start, close)) == NULL)
+		return false;
+
+	if (!strncmp(start, "<![CDATA[", 9)) {
+		start += 9;
+		if (end - start >= 3 && !strncmp(end - 3, "]]>", 3))
+			end -= 3;
+	}
+
+	while (start < end && IsSpace(*start))
+		start++;
+	while (end > start && IsSpace(end[-1]))
+		end--;
+
+	if ((size_t)(end - start) >= len)
+		end = start + len - 1;
+	memcpy(buf, start, end - start);
+	buf[end - start] = '\0';
+	return buf[0] != '\0';
+}
+
+/* the newest item of an RSS or Atom feed */
+static bool
+rss_latest(const char *xml, char *title, size_t titlelen, char *link, size_t linklen)
+{
+	const char *item, *href, *end;
+
+	if ((item = strstr(xml, "<item")) == NULL && (item = strstr(xml, "<entry")) == NULL)
+		return false;
+
+	if (!rss_extract(item, "title", title, titlelen))
+		return false;
+
+	link[0] = '\0';
+	if (!rss_extract(item, "link", link, linklen)) {
+		/* Atom has <link href="..."/> */
+		if ((href = strstr(item, "<link")) != NULL && (href = strstr(href, "href=\"")) != NULL &&
+				(end = strchr(href + 6, '"')) != NULL) {
+			href += 6;
+			rb_strlcpy(link, href, MIN((size_t)(end - href) + 1, linklen));
+		}
+	}
+
+	return true;
+}
+
+static void
+rss_done(const struct http_response *resp, void *data)
+{
+	struct rss_fetch *fetch = data;
+	struct Client *source_p = fetch->source[0] != '\0' ? find_id(fetch->source) : NULL;
+	struct Channel *chptr = fetch->channel[0] != '\0' ? find_channel(fetch->channel) : NULL;
+	struct rss_feed *feed = NULL;
+	rb_dlink_node *ptr;
+	char title[256], link[256];
+
+	rb_dlinkDelete(&fetch->node, &rss_fetches);
+
+	if (resp->status < 200 || resp->status >= 300 || resp->body == NULL ||
+			!rss_latest(resp->body, title, sizeof(title), link, sizeof(link))) {
+		if (source_p != NULL)
+			sendto_one_notice(source_p, ":*** Cannot fetch RSS feed %s: %s", fetch->url,
+				resp->status == 0 ? resp->error : "no items found");
+		goto out;
+	}
+
+	if (!fetch->feed) {
+		if (chptr != NULL)
+			sendto_channel_local(&me, ALL_MEMBERS, chptr, ":%s NOTICE %s :[RSS] %s %s",
+				me.name, chptr->chname, title, link);
+		else if (source_p != NULL)
+			sendto_one_notice(source_p, ":*** RSS Feed %s: %s %s", fetch->url, title, link);
+		goto out;
+	}
+
+	/* the feed may have been deleted meanwhile */
+	RB_DLINK_FOREACH(ptr, rss_feeds.head) {
+		struct rss_feed *f = ptr->data;
+
+		if (!strcmp(f->url, fetch->url) && !strcmp(f->channel, fetch->channel)) {
+			feed = f;
+			break;
+		}
+	}
+
+	if (feed == NULL || (feed->last_title != NULL && !strcmp(feed->last_title, title)))
+		goto out;
+
+	/* the first fetch only notes where the feed is */
+	if (feed->last_title != NULL && chptr != NULL)
+		sendto_channel_local(&me, ALL_MEMBERS, chptr, ":%s NOTICE %s :[RSS] %s %s",
+			me.name, chptr->chname, title, link);
+
+	rb_free(feed->last_title);
+	rb_free(feed->last_link);
+	feed->last_title = rb_strdup(title);
+	feed->last_link = rb_strdup(link);
+	feed->last_update = rb_current_time();
+
+out:
+	rb_free(fetch->url);
+	rb_free(fetch);
+}
+
 static void
 rss_update(void *unused)
 {
@@ -76,17 +236,9 @@ rss_update(void *unused)
 	RB_DLINK_FOREACH(ptr, rss_feeds.head) {
 		feed = ptr->data;
 		
-		if (now - feed->last_check > 300) { /* 5 minutes */
+		if (now - feed->last_check >= 300) { /* 5 minutes */
 			feed->last_check = now;
-			
-			/* TODO: Actually fetch RSS feed using HTTP */
-			/* For now, just update the timestamp */
-			/* In a real implementation, you would:
-			 * 1. Use rb_commio or similar to fetch the RSS feed
-			 * 2. Parse the XML
-			 * 3. Check for new items
-			 * 4. Send notices to the channel if new items found
-			 */
+			rss_fetch(feed->url, feed->channel, NULL, true);
 		}
 	}
 }
@@ -112,14 +264,8 @@ m_rss(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 		}
 	}
 
-	/* TODO: Fetch and parse RSS feed */
-	/* For now, just show a placeholder */
-	sendto_one_notice(source_p, ":*** RSS Feed: %s", url);
-	if (chptr) {
-		sendto_channel_local(ALL_MEMBERS, chptr, ":*** RSS Feed update: %s", url);
-	} else {
-		sendto_one_notice(source_p, ":*** RSS feed functionality requires HTTP fetching (not yet implemented)");
-	}
+	sendto_one_notice(source_p, ":*** Fetching RSS Feed: %s", url);
+	rss_fetch(url, chptr != NULL ? chptr->chname : NULL, source_p, false);
 }
 
 static void
@@ -162,6 +308,7 @@ m_rssadd(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source
 	feed->last_link = NULL;
 
 	rb_dlinkAddAlloc(feed, &rss_feeds);
+	rss_fetch(feed->url, feed->channel, NULL, true);
 
 	sendto_one_notice(source_p, ":*** RSS feed added: %s -> %s", url, channel);
 	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE, "%s added RSS feed: %s -> %s",
@@ -247,6 +394,14 @@ moddeinit(void)
 	if (rss_update_event)
 		rb_event_delete(rss_update_event);
 
+	http_cancel_callback(rss_done);
+	RB_DLINK_FOREACH_SAFE(ptr, next, rss_fetches.head) {
+		struct rss_fetch *fetch = ptr->data;
+		rb_dlinkDelete(ptr, &rss_fetches);
+		rb_free(fetch->url);
+		rb_free(fetch);
+	}
+
 	RB_DLINK_FOREACH_SAFE(ptr, next, rss_feeds.head) {
 		feed = ptr->data;
 		rb_dlinkDelete(ptr, &rss_feeds);
@@ -18,8 +18,8 @@
 #include "modules.h"
 #include "hook.h"
 #include "match.h"
-#include "dns.h"
-#include "rb_commio.h"
+#include "hash.h"
+#include "httpclient.h"
 
 static const char url_title_desc[] = "Fetches and displays URL titles from messages";
 
@@ -27,19 +27,21 @@ static const char url_title_desc[] = "Fetches and displays URL titles from messa
 #define URL_TITLE_RATE_WINDOW 60
 
 struct url_rate_limit {
-	struct Client *client;
+	char id[IDLEN];		/* not the client, which may be gone by now */
 	time_t window_start;
 	int count;
 	rb_dlink_node node;
 };
 
 static rb_dlink_list url_rate_limits;
+static rb_dlink_list url_requests;
 static struct ev_entry *url_rate_cleanup_ev;
 
 static void hook_privmsg_channel(void *);
 static void hook_privmsg_user(void *);
 static void url_rate_cleanup(void *);
 static bool check_url_rate_limit(struct Client *client_p);
+static void url_done(const struct http_response *resp, void *arg);
 
 static int
 _modinit(void)
@@ -62,6 +64,12 @@ _moddeinit(void)
 		rb_dlinkDelete(ptr, &url_rate_limits);
 		rb_free(ptr->data);
 	}
+
+	http_cancel_callback(url_done);
+	RB_DLINK_FOREACH_SAFE(ptr, next, url_requests.head) {
+		rb_dlinkDelete(ptr, &url_requests);
+		rb_free(ptr->data);
+	}
 }
 
 mapi_hfn_list_av1 url_title_hfnlist[] = {
@@ -75,154 +83,17 @@ mapi_hfn_list_av1 url_title_hfnlist[] = {
 #define MAX_RESPONSE_LEN 8192
 
 struct url_request {
-	struct Client *source_p;
-	struct Channel *chptr;
-	char url[MAX_URL_LEN];
-	char host[256];
-	char path[512];
-	int port;
-	rb_fde_t *fd;
+	char source[IDLEN];
+	char channel[CHANNELLEN + 1];
 	char response_buf[MAX_RESPONSE_LEN];
 	size_t response_len;
-	uint32_t dns_req;
-	uint32_t dns_req_v4;
-	bool is_https;
-	bool tried_ipv6;
+	rb_dlink_node node;
 };
 
-static void url_dns_callback(const char *res, int status, int aftype, void *data);
-static void url_connect_callback(rb_fde_t *F, int status, void *data);
-static void url_read_callback(rb_fde_t *F, void *data);
-static void url_timeout_callback(rb_fde_t *F, void *data);
+static bool url_data(const char *data, size_t len, void *arg);
 static bool extract_url(const char *text, char *url, size_t url_len);
-static void parse_url(const char *url, char *host, size_t host_len, char *path, size_t path_len, int *port, bool *is_https);
 static char *extract_title_from_html(const char *html, size_t html_len);
 
-static void
-url_timeout_callback(rb_fde_t *F, void *data)
-{
-	struct url_request *req = data;
-	
-	if (req->dns_req != 0) {
-		cancel_lookup(req->dns_req);
-		req->dns_req = 0;
-	}
-	
-	if (req->dns_req_v4 != 0) {
-		cancel_lookup(req->dns_req_v4);
-		req->dns_req_v4 = 0;
-	}
-	
-	if (req->fd != NULL) {
-		rb_settimeout(req->fd, 0, NULL, NULL);
-		rb_close(req->fd);
-		req->fd = NULL;
-	}
-	
-	rb_free(req);
-}
-
-static void
-url_dns_callback(const char *res, int status, int aftype, void *data)
-{
-	struct url_request *req = data;
-	struct sockaddr_storage addr;
-	struct sockaddr_in *sin;
-	struct sockaddr_in6 *sin6;
-	
-	if (aftype == AF_INET6) {
-		req->dns_req = 0;
-		req->tried_ipv6 = true;
-	} else {
-		req->dns_req_v4 = 0;
-	}
-	
-	if (status == 0 || res == NULL) {
-		/* If IPv6 failed, try IPv4 as fallback */
-		if (aftype == AF_INET6) {
-			req->dns_req_v4 = lookup_hostname(req->host, AF_INET, url_dns_callback, req);
-			if (req->dns_req_v4 != 0)
-				return;
-		}
-		
-		/* Both failed or IPv4 failed */
-		rb_free(req);
-		return;
-	}
-	
-	memset(&addr, 0, sizeof(addr));
-	
-	if (aftype == AF_INET6) {
-		sin6 = (struct sockaddr_in6 *)&addr;
-		sin6->sin6_family = AF_INET6;
-		sin6->sin6_port = htons(req->port);
-		if (rb_inet_pton(AF_INET6, res, &sin6->sin6_addr) <= 0) {
-			rb_free(req);
-			return;
-		}
-	} else {
-		sin = (struct sockaddr_in *)&addr;
-		sin->sin_family = AF_INET;
-		sin->sin_port = htons(req->port);
-		if (rb_inet_pton(AF_INET, res, &sin->sin_addr) <= 0) {
-			rb_free(req);
-			return;
-		}
-	}
-	
-	req->fd = rb_socket(GET_SS_FAMILY(&addr), SOCK_STREAM, IPPROTO_TCP, "url_title");
-	if (req->fd == NULL) {
-		rb_free(req);
-		return;
-	}
-	
-	if (req->is_https) {
-		/* Use SSL connection for HTTPS */
-		if (rb_supports_ssl()) {
-			rb_connect_tcp_ssl(req->fd, (struct sockaddr *)&addr, NULL, url_connect_callback, req, 10);
-		} else {
-			/* SSL not available, skip HTTPS URLs */
-			rb_close(req->fd);
-			rb_free(req);
-			return;
-		}
-	} else {
-		rb_connect_tcp(req->fd, (struct sockaddr *)&addr, NULL, url_connect_callback, req, 10);
-	}
-}
-
-static void
-url_connect_callback(rb_fde_t *F, int status, void *data)
-{
-	struct url_request *req = data;
-	char request[1024];
-	
-	if (status != RB_OK) {
-		rb_close(F);
-		rb_free(req);
-		return;
-	}
-	
-	snprintf(request, sizeof(request),
-		"GET %s HTTP/1.1\r\n"
-		"Host: %s\r\n"
-		"User-Agent: FoxComet-IRCD/1.0\r\n"
-		"Connection: close\r\n"
-		"\r\n",
-		req->path, req->host);
-	
-	if (rb_write(F, request, strlen(request)) != (ssize_t)strlen(request)) {
-		rb_close(F);
-		rb_free(req);
-		return;
-	}
-	
-	req->response_len = 0;
-	req->fd = F;
-	rb_settimeout(F, 15, url_timeout_callback, req);
-	rb_setselect(F, RB_SELECT_READ, url_read_callback, req);
-}
-
 static char *
 extract_title_from_html(const char *html, size_t html_len)
 {
@@ -232,13 +103,13 @@ extract_title_from_html(const char *html, size_t html_len)
 	
 	/* Look for <title> tag (case-insensitive) */
 	title_start = html;
-	while ((title_start = strcasestr(title_start, "<title")) != NULL) {
+	while ((title_start = rb_strcasestr(title_start, "<title")) != NULL) {
 		title_start = strchr(title_start, '>');
 		if (title_start == NULL)
 			break;
 		title_start++; /* Skip '>' */
 		
-		title_end = strcasestr(title_start, "</title>");
+		title_end = rb_strcasestr(title_start, "</title>");
 		if (title_end == NULL)
 			break;
 		
@@ -263,107 +134,69 @@ extract_title_from_html(const char *html, size_t html_len)
 	return NULL;
 }
 
+/* keep the start of the page, until the title has been seen */
+static bool
+url_data(const char *data, size_t len, void *arg)
+{
+	struct url_request *req = arg;
+
+	if (len > sizeof(req->response_buf) - req->response_len - 1)
+		len = sizeof(req->response_buf) - req->response_len - 1;
+
+	memcpy(req->response_buf + req->response_len, data, len);
+	req->response_len += len;
+	req->response_buf[req->response_len] = '\0';
+
+	return req->response_len < sizeof(req->response_buf) - 1 &&
+		rb_strcasestr(req->response_buf, "</title>") == NULL;
+}
+
 static void
-url_read_callback(rb_fde_t *F, void *data)
+url_done(const struct http_response *resp, void *arg)
 {
-	struct url_request *req = data;
-	ssize_t n;
+	struct url_request *req = arg;
+	struct Client *source_p;
+	struct Channel *chptr;
 	char *title;
-	char *body_start;
-	
-	n = rb_read(F, req->response_buf + req->response_len, sizeof(req->response_buf) - req->response_len - 1);
-	if (n <= 0) {
-		rb_settimeout(F, 0, NULL, NULL);
-		rb_close(F);
-		req->fd = NULL;
-		
-		req->response_buf[req->response_len] = '\0';
-		
-		/* Find HTTP body (after \r\n\r\n) */
-		body_start = strstr(req->response_buf, "\r\n\r\n");
-		if (body_start == NULL)
-			body_start = strstr(req->response_buf, "\n\n");
-		
-		if (body_start != NULL) {
-			body_start += (strstr(req->response_buf, "\r\n\r\n") != NULL) ? 4 : 2;
-			title = extract_title_from_html(body_start, req->response_len - (body_start - req->response_buf));
-			
-			if (title != NULL) {
-				char msg[512];
-				snprintf(msg, sizeof(msg), ":*** URL Title: %s", title);
-				
-				if (req->chptr != NULL) {
-					sendto_channel_local(ALL_MEMBERS, req->chptr,
-						":%s NOTICE %s %s", me.name, req->chptr->chname, msg);
-				} else {
-					sendto_one_notice(req->source_p, "%s", msg);
-				}
-				
-				rb_free(title);
-			}
+
+	rb_dlinkDelete(&req->node, &url_requests);
+
+	if (resp->status >= 200 && resp->status < 300 &&
+			(title = extract_title_from_html(req->response_buf, req->response_len)) != NULL) {
+		char msg[512];
+		snprintf(msg, sizeof(msg), ":*** URL Title: %s", title);
+
+		if (req->channel[0] != '\0') {
+			if ((chptr = find_channel(req->channel)) != NULL)
+				sendto_channel_local(&me, ALL_MEMBERS, chptr,
+					":%s NOTICE %s %s", me.name, chptr->chname, msg);
+		} else if ((source_p = find_id(req->source)) != NULL) {
+			sendto_one_notice(source_p, "%s", msg);
 		}
-		
-		rb_free(req);
-		return;
-	}
-	
-	req->response_len += n;
-	if (req->response_len >= sizeof(req->response_buf) - 1) {
-		rb_settimeout(F, 0, NULL, NULL);
-		rb_close(F);
-		req->fd = NULL;
-		rb_free(req);
+
+		rb_free(title);
 	}
+
+	rb_free(req);
 }
 
+/* fetch url, and tell the channel, or the user, its title */
 static void
-parse_url(const char *url, char *host, size_t host_len, char *path, size_t path_len, int *port, bool *is_https)
+fetch_url_title(const char *url, struct Client *source_p, struct Channel *chptr)
 {
-	const char *p, *host_start, *host_end, *path_start;
-	
-	*is_https = false;
-	*port = 80;
-	
-	if (strncasecmp(url, "https://", 8) == 0) {
-		*is_https = true;
-		*port = 443;
-		host_start = url + 8;
-	} else if (strncasecmp(url, "http://", 7) == 0) {
-		host_start = url + 7;
-	} else {
-		return;
-	}
-	
-	/* Find end of hostname (:/ or / or end) */
-	host_end = host_start;
-	while (*host_end && *host_end != '/' && *host_end != ':')
-		host_end++;
-	
-	/* Check for port */
-	if (*host_end == ':') {
-		*port = atoi(host_end + 1);
-		path_start = strchr(host_end + 1, '/');
-	} else {
-		path_start = host_end;
-	}
-	
-	if (path_start == NULL || *path_start == '\0') {
-		strncpy(path, "/", path_len);
-		path[path_len - 1] = '\0';
-	} else {
-		size_t path_len_calc = strlen(path_start);
-		if (path_len_calc >= path_len)
-			path_len_calc = path_len - 1;
-		memcpy(path, path_start, path_len_calc);
-		path[path_len_calc] = '\0';
+	struct url_request *req;
+
+	req = rb_malloc(sizeof(struct url_request));
+	rb_strlcpy(req->source, source_p->id, sizeof(req->source));
+	if (chptr != NULL)
+		rb_strlcpy(req->channel, chptr->chname, sizeof(req->channel));
+
+	/* listed first, as url_done may run before http_request returns */
+	rb_dlinkAdd(req, &req->node, &url_requests);
+	if (!http_request("GET", url, NULL, NULL, 0, url_data, url_done, req)) {
+		rb_dlinkDelete(&req->node, &url_requests);
+		rb_free(req);
 	}
-	
-	/* Copy hostname */
-	size_t host_len_calc = host_end - host_start;
-	if (host_len_calc >= host_len)
-		host_len_calc = host_len - 1;
-	memcpy(host, host_start, host_len_calc);
-	host[host_len_calc] = '\0';
 }
 
 static bool
@@ -411,7 +244,7 @@ check_url_rate_limit(struct Client *client_p)
 	/* Find or create rate limit entry */
 	RB_DLINK_FOREACH(ptr, url_rate_limits.head) {
 		limit = ptr->data;
-		if (limit->client == client_p) {
+		if (!strcmp(limit->id, client_p->id)) {
 			/* Reset window if expired */
 			if (now - limit->window_start > URL_TITLE_RATE_WINDOW) {
 				limit->window_start = now;
@@ -429,7 +262,7 @@ check_url_rate_limit(struct Client *client_p)
 	
 	/* Create new entry */
 	limit = rb_malloc(sizeof(struct url_rate_limit));
-	limit->client = client_p;
+	rb_strlcpy(limit->id, client_p->id, sizeof(limit->id));
 	limit->window_start = now;
 	limit->count = 1;
 	rb_dlinkAdd(limit, &limit->node, &url_rate_limits);
@@ -456,7 +289,6 @@ hook_privmsg_channel(void *data_)
 {
 	hook_data_privmsg_channel *data = data_;
 	char url[MAX_URL_LEN];
-	struct url_request *req;
 	
 	if (data->msgtype != MESSAGE_TYPE_PRIVMSG)
 		return;
@@ -469,40 +301,7 @@ hook_privmsg_channel(void *data_)
 	if (!extract_url(data->text, url, sizeof(url)))
 		return;
 	
-	/* HTTPS is now supported if SSL is available */
-	
-	req = rb_malloc(sizeof(struct url_request));
-	req->source_p = data->source_p;
-	req->chptr = data->chptr;
-	rb_strlcpy(req->url, url, sizeof(req->url));
-	req->fd = NULL;
-	req->response_len = 0;
-	req->dns_req = 0;
-	req->dns_req_v4 = 0;
-	req->tried_ipv6 = false;
-	
-	parse_url(url, req->host, sizeof(req->host), req->path, sizeof(req->path), &req->port, &req->is_https);
-	
-	if (req->host[0] == '\0') {
-		rb_free(req);
-		return;
-	}
-	
-	/* Start DNS lookup - prefer IPv6, fallback to IPv4 */
-	req->tried_ipv6 = false;
-	req->dns_req = lookup_hostname(req->host, AF_INET6, url_dns_callback, req);
-	req->dns_req_v4 = 0;
-	
-	if (req->dns_req == 0) {
-		/* IPv6 lookup failed, try IPv4 immediately */
-		req->dns_req_v4 = lookup_hostname(req->host, AF_INET, url_dns_callback, req);
-		if (req->dns_req_v4 == 0) {
-			rb_free(req);
-			return;
-		}
-	}
-	
-	/* Timeout will be handled by DNS and connection callbacks */
+	fetch_url_title(url, data->source_p, data->chptr);
 }
 
 static void
@@ -510,7 +309,6 @@ hook_privmsg_user(void *data_)
 {
 	hook_data_privmsg_user *data = data_;
 	char url[MAX_URL_LEN];
-	struct url_request *req;
 	
 	if (data->msgtype != MESSAGE_TYPE_PRIVMSG)
 		return;
@@ -522,38 +320,7 @@ hook_privmsg_user(void *data_)
 	if (!extract_url(data->text, url, sizeof(url)))
 		return;
 	
-	/* HTTPS is now supported if SSL is available */
-	
-	req = rb_malloc(sizeof(struct url_request));
-	req->source_p = data->source_p;
-	req->chptr = NULL;
-	rb_strlcpy(req->url, url, sizeof(req->url));
-	req->fd = NULL;
-	req->response_len = 0;
-	req->dns_req = 0;
-	
-	parse_url(url, req->host, sizeof(req->host), req->path, sizeof(req->path), &req->port, &req->is_https);
-	
-	if (req->host[0] == '\0') {
-		rb_free(req);
-		return;
-	}
-	
-	/* Start DNS lookup - prefer IPv6, fallback to IPv4 */
-	req->tried_ipv6 = false;
-	req->dns_req = lookup_hostname(req->host, AF_INET6, url_dns_callback, req);
-	req->dns_req_v4 = 0;
-	
-	if (req->dns_req == 0) {
-		/* IPv6 lookup failed, try IPv4 immediately */
-		req->dns_req_v4 = lookup_hostname(req->host, AF_INET, url_dns_callback, req);
-		if (req->dns_req_v4 == 0) {
-			rb_free(req);
-			return;
-		}
-	}
-	
-	/* Timeout will be handled by DNS and connection callbacks */
+	fetch_url_title(url, data->source_p, NULL);
 }
 
 DECLARE_MODULE_AV2(url_title, _modinit, _moddeinit, NULL, NULL, url_title_hfnlist, NULL, NULL, url_title_desc);
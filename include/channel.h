@@ -47,6 +47,8 @@ struct Mode
 	char forward[LOC_CHANNELLEN + 1];
 };
 
+struct ban_set;
+
 /* channel structure */
 struct Channel
 {
@@ -78,10 +80,14 @@ struct Channel
 	time_t channelts;
 	char *chname;
 
-	struct Client *last_checked_client;
-	time_t last_checked_ts;
-	unsigned int last_checked_type;
-	int last_checked_result;
+	struct ban_set *banset;		/* compiled lists, see find_ban() */
+	struct ban_set *quietset;
+	struct ban_set *exceptset;
+	struct ban_set *invexset;
+
+	/* members by client, once there are enough, see find_channel_membership() */
+	struct membership **member_index;
+	unsigned int member_index_mask;
 };
 
 struct membership
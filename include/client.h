@@ -94,25 +94,33 @@ struct Server
 
 struct Client
 {
+	/*
+	 * Sending to a channel visits every member, and mostly only to
+	 * check these: keep them together at the front, in the first
+	 * cache line (client_heap is cache line aligned), and everything
+	 * looked at only when the client is dealt with by itself below.
+	 */
+	struct Client *from;	/* == self, if Local Client, *NEVER* NULL! */
+	uint64_t flags;		/* client flags */
+	unsigned int umodes;	/* opers, normal users subset */
+	unsigned short status;	/* Client type */
+	unsigned char handler;	/* Handler index */
+	unsigned long serial;	/* used to enforce 1 send per nick */
+	struct LocalUser *localClient;
+	struct User *user;	/* ...defined, if this is a User */
+	struct Client *servptr;	/* Points to server this Client is on */
+
 	rb_dlink_node node;
 	rb_dlink_node lnode;
-	struct User *user;	/* ...defined, if this is a User */
 	struct Server *serv;	/* ...defined, if this is a server */
-	struct Client *servptr;	/* Points to server this Client is on */
-	struct Client *from;	/* == self, if Local Client, *NEVER* NULL! */
 
 	rb_dlink_list whowas_clist;
 
 	time_t tsinfo;		/* TS on the nick, SVINFO on server */
-	unsigned int umodes;	/* opers, normal users subset */
-	uint64_t flags;		/* client flags */
 
 	unsigned int snomask;	/* server notice mask */
 
 	int hopcount;		/* number of servers to this 0 = local */
-	unsigned short status;	/* Client type */
-	unsigned char handler;	/* Handler index */
-	unsigned long serial;	/* used to enforce 1 send per nick */
 
 	/* client->name is the unique name for a client nick or host */
 	char name[NAMELEN + 1];
@@ -146,7 +154,6 @@ struct Client
 	int received_number_of_privmsgs;
 	int flood_noticed;
 
-	struct LocalUser *localClient;
 	struct PreClient *preClient;
 
 	time_t large_ctcp_sent; /* ctcp to large group sent, relax flood checks */
@@ -176,6 +183,16 @@ struct LocalUser
 	time_t lasttime;	/* last time we parsed something */
 	time_t firsttime;	/* time client was created */
 
+	rb_dlink_node ping_node;	/* node on the ping wheel */
+	time_t ping_deadline;	/* next time check_pings looks at us, 0 if none */
+
+	/* nodes on the local user ban check index, see add_to_lclient_index() */
+	rb_dlink_node ip_node;		/* by address */
+	rb_dlink_node ip4_node;		/* by IPv4 address inside an IPv6 one */
+	rb_dlink_node host_node[2];	/* by orighost and sockhost */
+
+	rb_dlink_node flush_node;	/* on the deferred flush list, see send.c */
+
 	/* Send and receive linebuf queues .. */
 	buf_head_t buf_sendq;
 	buf_head_t buf_recvq;
@@ -198,6 +215,7 @@ struct LocalUser
 	uint32_t receiveK;	/* Statistics: total k-bytes received */
 	uint16_t sendB;		/* counters to count upto 1-k lots of bytes */
 	uint16_t receiveB;	/* sent and received. */
+	int caps;		/* capabilities bit-field */
 	struct Listener *listener;	/* listener accepted from */
 	struct ConfItem *att_conf;	/* attached conf */
 	struct server_conf *att_sconf;
@@ -218,7 +236,6 @@ struct LocalUser
 	char *fullcaps;
 	char *cipher_string;
 
-	int caps;		/* capabilities bit-field */
 	rb_fde_t *F;		/* >= 0, for local clients */
 
 	/* time challenge response is valid for */
@@ -428,6 +445,7 @@ struct ListClient
 #define LFLAGS_SECURE		0x00000010	/* for marking SSL clients as secure before registration */
 /* LFLAGS_FAKE: client may not have the usually expected machinery plugged in; don't assert on it. For tests only. */
 #define LFLAGS_FAKE		0x00000020
+#define LFLAGS_FLUSH_DEFERRED	0x00000040	/* on the list flushed as the loop iteration ends */
 
 /* umodes, settable flags */
 /* lots of this moved to snomask -- jilles */
@@ -499,6 +517,10 @@ struct ListClient
 #define SetFlush(x)		((x)->localClient->localflags |= LFLAGS_FLUSH)
 #define ClearFlush(x)		((x)->localClient->localflags &= ~LFLAGS_FLUSH)
 
+#define IsFlushDeferred(x)	((x)->localClient->localflags & LFLAGS_FLUSH_DEFERRED)
+#define SetFlushDeferred(x)	((x)->localClient->localflags |= LFLAGS_FLUSH_DEFERRED)
+#define ClearFlushDeferred(x)	((x)->localClient->localflags &= ~LFLAGS_FLUSH_DEFERRED)
+
 #define IsSCTP(x)		((x)->localClient->localflags & LFLAGS_SCTP)
 #define SetSCTP(x)		((x)->localClient->localflags |= LFLAGS_SCTP)
 #define ClearSCTP(x)		((x)->localClient->localflags &= ~LFLAGS_SCTP)
@@ -574,6 +596,7 @@ enum
 extern void check_banned_lines(void);
 extern void check_klines(void);
 extern void check_one_kline(struct ConfItem *kline);
+extern void check_new_klines(rb_dlink_list *klines);
 extern void check_dlines(void);
 extern void check_xlines(void);
 extern void resv_nick_fnc(const char *mask, const char *reason, int temp_time);
@@ -585,6 +608,10 @@ extern void init_client(void);
 extern struct Client *make_client(struct Client *from);
 extern void free_pre_client(struct Client *client);
 
+extern void add_to_lclient_index(struct Client *);
+extern void del_from_lclient_index(struct Client *);
+extern void schedule_ping(struct Client *, time_t);
+extern void unschedule_ping(struct Client *);
 extern void notify_banned_client(struct Client *, struct ConfItem *, int ban);
 extern int exit_client(struct Client *, struct Client *, struct Client *, const char *);
 
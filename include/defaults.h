@@ -48,6 +48,7 @@ typedef enum {
 	IRCD_PATH_IRCD_PID,
 	IRCD_PATH_IRCD_OMOTD,
 	IRCD_PATH_BANDB,
+	IRCD_PATH_HISTORY,
 	IRCD_PATH_BIN,
 	IRCD_PATH_LIBEXEC,
 	IRCD_PATH_COUNT
@@ -116,6 +117,7 @@ extern const char *ircd_paths[IRCD_PATH_COUNT];
 #define PPATH		PKGRUNDIR "/ircd.pid"				/* pid file */
 #define OPATH		ETCPATH "/opers.motd"				/* oper MOTD file */
 #define DBPATH		PKGLOCALSTATEDIR "/ban.db"			/* bandb file */
+#define HISTORYPATH	PKGLOCALSTATEDIR "/history"			/* history log directory */
 
 /* Below are somewhat configurable settings (though it's probably a bad idea
  * to blindly mess with them). If in any doubt, leave them alone.
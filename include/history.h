@@ -0,0 +1,75 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  history.h: Message history store shared by the history extensions.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#ifndef INCLUDED_history_h
+#define INCLUDED_history_h
+
+#include "hook.h"
+
+#define HISTORY_MSGID_LEN	32
+
+struct Client;
+
+/*
+ * Each target keeps its lines in a ring, oldest first, with the text in
+ * one arena per target.  Lines are numbered 0 (oldest) to
+ * history_count() - 1; ids and times never go backwards along the ring,
+ * so both can be binary searched.
+ *
+ * With channel::history_log, a target's lines are kept in a log on disk
+ * instead, and survive restarts; see history.c.
+ *
+ * The strings in a history_line point into the store and are only good
+ * until the next call into it, so use them before getting the next line.
+ */
+struct history_buf;
+
+struct history_line
+{
+	uint64_t id;
+	int64_t msec;			/* milliseconds since the epoch */
+	enum message_type type;
+	const char *source;		/* nick!user@host */
+	const char *text;
+};
+
+extern void init_history(void);
+extern void init_history_log(void);
+
+extern struct history_buf *history_find(const char *target);
+extern uint64_t history_add(const char *target, enum message_type type,
+		const char *source, const char *text);
+extern void history_drop(const char *target);
+extern void history_expire(int64_t before);
+
+extern unsigned int history_count(struct history_buf *buf);
+extern void history_get(struct history_buf *buf, unsigned int idx,
+		struct history_line *line);
+extern unsigned int history_index_msec(struct history_buf *buf, int64_t msec);
+extern unsigned int history_index_id(struct history_buf *buf, uint64_t id);
+
+extern void history_format_msgid(uint64_t id, char *buf, size_t len);
+extern bool history_parse_msgid(const char *msgid, uint64_t *id);
+extern bool history_parse_time(const char *s, int64_t *msec);
+
+extern void history_send(struct Client *client_p, const char *target,
+		const struct history_line *line, const char *batch);
+
+#endif /* INCLUDED_history_h */
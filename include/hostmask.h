@@ -52,6 +52,7 @@ void add_conf_by_address(const char *, int, const char *, const char *, struct C
 void delete_one_address_conf(const char *, struct ConfItem *);
 void clear_out_address_conf(enum aconf_category);
 void init_host_hash(void);
+const char *get_mask_suffix(const char *);
 struct ConfItem *find_address_conf(const char *host, const char *sockhost,
 				const char *, const char *, struct sockaddr *,
 				int, char *);
@@ -108,6 +109,9 @@ struct AddressRec
 
 	/* The next record in this hash bucket. */
 	struct AddressRec *next;
+
+	/* The next record on the same lookup index node. */
+	struct AddressRec *inext;
 };
 
 
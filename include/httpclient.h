@@ -0,0 +1,73 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  httpclient.h: Asynchronous HTTP/1.1 client shared by the extensions.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#ifndef INCLUDED_httpclient_h
+#define INCLUDED_httpclient_h
+
+#include "ircd_defs.h"
+
+/* the most of a response body kept for the callback */
+#define HTTP_MAX_BODY		(64 * 1024)
+
+struct http_url
+{
+	bool https;
+	int port;
+	char host[IRCD_RES_HOSTLEN + 1];
+	char path[BUFSIZE];
+};
+
+struct http_response
+{
+	int status;		/* the HTTP status, or 0 if there was no response */
+	const char *error;	/* why there was none */
+	const char *body;	/* the body, unless it was streamed */
+	size_t len;
+};
+
+/* called with the body as it arrives; return false to stop reading it */
+typedef bool HTTPDATACB(const char *data, size_t len, void *arg);
+
+/* called once, when the request is over */
+typedef void HTTPCB(const struct http_response *resp, void *arg);
+
+extern void init_http(void);
+
+extern bool http_parse_url(const char *url, struct http_url *parsed);
+
+/* http_request()
+ *
+ * input	- method, URL, the body's type, the body and its length
+ *                (or NULL), an optional callback for the response body,
+ *                a callback for the response (or NULL) and its argument
+ * output	- false if the URL is bad or too many requests are waiting;
+ *                otherwise the callback will be called exactly once,
+ *                perhaps before this returns
+ * side effects - the request is queued on a pooled connection to the
+ *                URL's origin
+ */
+extern bool http_request(const char *method, const char *url,
+		const char *content_type, const char *body, size_t len,
+		HTTPDATACB *datacb, HTTPCB *callback, void *arg);
+
+/* forget every request made with callback, before a module goes away */
+extern void http_cancel_callback(HTTPCB *callback);
+
+#endif /* INCLUDED_httpclient_h */
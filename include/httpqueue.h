@@ -0,0 +1,79 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  httpqueue.h: Batched, bounded queues of events posted over HTTP.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#ifndef INCLUDED_httpqueue_h
+#define INCLUDED_httpqueue_h
+
+/* the most items, and bytes of them, waiting on one queue */
+#define HTTP_QUEUE_MAX_ITEMS	1000
+#define HTTP_QUEUE_MAX_BYTES	(256 * 1024)
+
+/* how a batch of items is made into one request body */
+struct http_batch_format
+{
+	const char *content_type;
+	const char *prefix;		/* before the first item */
+	const char *separator;		/* between items */
+	const char *suffix;		/* after the last */
+	const char *dropped;		/* an item counting (%u) those dropped, or NULL */
+	size_t max_bytes;		/* the longest body, unless one item is longer */
+	unsigned int max_items;		/* the most items in a body */
+	unsigned int window;		/* seconds an item may wait for others */
+};
+
+struct http_queue;
+
+/* report_http_queue()
+ *
+ * input	- queue name, where it posts to (without the path),
+ *                items waiting, items in the request being sent,
+ *                items sent, dropped while waiting, and given up on
+ */
+typedef void HTTPQUEUECB(const char *name, const char *origin,
+		unsigned int queued, unsigned int inflight,
+		unsigned long sent, unsigned long dropped, unsigned long failed,
+		void *arg);
+
+extern void init_http_queues(void);
+
+/* http_queue_create()
+ *
+ * input	- a name for STATS, the URL to POST to, and the format,
+ *                which must outlive the queue
+ * output	- the queue, or NULL if the URL is bad
+ */
+extern struct http_queue *http_queue_create(const char *name, const char *url,
+		const struct http_batch_format *format);
+
+/* drops whatever is waiting; a request being sent is left to finish */
+extern void http_queue_destroy(struct http_queue *queue);
+
+/* http_queue_add()
+ *
+ * input	- queue and an item, already formatted for the body
+ * output	- false if the queue was full and the item was dropped
+ * side effects - the item is sent with others once a batch fills up
+ *                or the format's window has passed
+ */
+extern bool http_queue_add(struct http_queue *queue, const char *item);
+
+extern void http_queue_stats(HTTPQUEUECB *callback, void *arg);
+
+#endif /* INCLUDED_httpqueue_h */
@@ -0,0 +1,46 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  masktrie.h: Candidate lookup for lists of wildcard masks.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#ifndef INCLUDED_masktrie_h
+#define INCLUDED_masktrie_h
+
+/*
+ * A mask trie files the masks of a list under the literal (case
+ * folded) part at one end of each mask, by their position in the list.
+ * A lookup walks the trie along a name and only offers the masks whose
+ * literal part the name starts with (or ends with, for a reversed
+ * trie) to the caller's test, which does the real match.
+ */
+struct mask_trie;
+
+typedef bool mask_trie_test(unsigned int id, void *data);
+
+extern struct mask_trie *mask_trie_create(bool reverse);
+extern void mask_trie_destroy(struct mask_trie *trie);
+
+/* ids must be added in increasing order */
+extern void mask_trie_add(struct mask_trie *trie, const char *key, size_t len,
+		unsigned int id);
+
+/* returns the lowest id below best that passes test, else best */
+extern unsigned int mask_trie_find(struct mask_trie *trie, const char *name,
+		unsigned int best, mask_trie_test *test, void *data);
+
+#endif /* INCLUDED_masktrie_h */
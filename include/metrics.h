@@ -0,0 +1,53 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  metrics.h: Counters kept by the metrics extension.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#ifndef INCLUDED_metrics_h
+#define INCLUDED_metrics_h
+
+#include "rb_lib.h"
+#include "rb_hashmap.h"
+
+struct Channel;
+
+/* kept for each channel in channel_metrics_dict, keyed by name */
+struct channel_metrics {
+	unsigned long messages;
+	unsigned long joins;
+	unsigned long parts;
+	unsigned long unique_users;
+	time_t created;
+	time_t last_activity;
+	rb_dlink_list active_users;
+	struct Channel *chptr;
+};
+
+struct server_metrics {
+	unsigned long connections;
+	unsigned long messages;
+	unsigned long channels;
+	unsigned long users;
+	time_t last_update;
+};
+
+/* defined by the metrics extension, and read by metrics_http */
+extern struct server_metrics metrics;
+extern rb_hashmap *channel_metrics_dict;
+
+#endif /* INCLUDED_metrics_h */
@@ -43,6 +43,16 @@ typedef enum HandlerType
 }
 HandlerType;
 
+/* who a command came from, for its latency histograms */
+typedef enum CommandSource
+{
+	COMMAND_LOCAL,
+	COMMAND_REMOTE,
+	COMMAND_SERVER,
+	LAST_COMMAND_SOURCE
+}
+CommandSource;
+
 /* struct MsgBuf* msgbuf_p   - message buffer (including tags)
  * struct Client* client_p   - connection message originated from
  * struct Client* source_p   - source of message, may be different from client_p
@@ -70,6 +80,9 @@ struct Message
 	 * UNREGISTERED, CLIENT, RCLIENT, SERVER, ENCAP, OPER
 	 */
 	struct MessageEntry handlers[LAST_HANDLER_TYPE];
+
+	/* time spent in the handlers, if general::command_timing is on */
+	struct rb_histogram latency[LAST_COMMAND_SOURCE];
 };
 
 /* generic handlers */
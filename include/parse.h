@@ -37,6 +37,7 @@ extern void handle_encap(struct MsgBuf *, struct Client *, struct Client *,
 extern void clear_hash_parse(void);
 extern void mod_add_cmd(struct Message *msg);
 extern void mod_del_cmd(struct Message *msg);
+extern struct Message *find_command(const char *name);
 extern char *reconstruct_parv(int parc, const char *parv[]);
 
 extern rb_dictionary *alias_dict;
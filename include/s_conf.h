@@ -258,6 +258,9 @@ struct config_file_entry
 	int hide_opers_in_whois;
 	int hide_opers;
 
+	int command_timing;
+	int deferred_flush;
+
 	char *drain_reason;
 	char *sasl_only_client_message;
 	char *identd_only_client_message;
@@ -299,6 +302,10 @@ struct config_channel_entry
 	int cycle_host_change;
 	int ip_bans_through_vhost;
 	int invite_notify_notice;
+	int history_lines;
+	int history_size;
+	int history_log;
+	int history_log_time;
 };
 
 struct config_server_hide
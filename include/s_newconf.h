@@ -239,6 +239,8 @@ extern struct ConfItem *find_xline(const char *, int);
 extern struct ConfItem *find_xline_mask(const char *);
 extern struct ConfItem *find_nick_resv(const char *name);
 extern struct ConfItem *find_nick_resv_mask(const char *name);
+extern void xline_list_changed(void);
+extern void resv_list_changed(void);
 
 extern int valid_wild_card_simple(const char *);
 extern int clean_resv_nick(const char *);
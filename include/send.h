@@ -31,6 +31,7 @@
 struct Client;
 struct Channel;
 struct monitor;
+struct MsgBuf;
 
 /* The nasty global also used in s_serv.c for server bursts */
 extern unsigned long current_serial;
@@ -40,9 +41,15 @@ extern struct Client *remote_rehash_oper_p;
 extern void send_pop_queue(struct Client *);
 
 extern void send_queued(struct Client *to);
+extern void send_burst_start(struct Client *to);
+extern size_t send_burst_finish(unsigned long *lines);
+extern void send_flush_cancel(struct Client *to);
+extern void send_flush_all(void);
 
 extern void sendto_one(struct Client *target_p, const char *, ...) AFP(2, 3);
 extern void sendto_one_notice(struct Client *target_p,const char *, ...) AFP(2, 3);
+extern void sendto_one_tags(struct Client *target_p, const struct MsgBuf *msgbuf,
+		const char *, ...) AFP(3, 4);
 extern void sendto_one_prefix(struct Client *target_p, struct Client *source_p,
 			      const char *command, const char *, ...) AFP(4, 5);
 extern void sendto_one_numeric(struct Client *target_p,
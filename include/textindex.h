@@ -0,0 +1,51 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  textindex.h: Inverted word index over numbered lines of text.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#ifndef INCLUDED_textindex_h
+#define INCLUDED_textindex_h
+
+/*
+ * A text index maps each word (a run of letters, digits and non-ASCII
+ * bytes, case folded with the IRC casemapping) to the ids of the lines
+ * it appears in.  Lines must be added in increasing id order; the ids
+ * are kept as delta coded varints.
+ */
+struct text_index;
+
+extern struct text_index *text_index_create(void);
+extern void text_index_destroy(struct text_index *idx);
+
+extern void text_index_add(struct text_index *idx, uint64_t id, const char *text);
+
+/* the number of lines added, and the id of the last */
+extern unsigned int text_index_lines(struct text_index *idx);
+extern uint64_t text_index_last_id(struct text_index *idx);
+
+/* text_index_search()
+ *
+ * input	- index, the words wanted, the range of ids to look in,
+ *                room for the ids found and how much
+ * output	- the number of ids found: those of the newest lines
+ *                holding every word, newest first
+ */
+extern unsigned int text_index_search(struct text_index *idx, const char *query,
+		uint64_t min_id, uint64_t max_id, uint64_t *ids, unsigned int max);
+
+#endif /* INCLUDED_textindex_h */
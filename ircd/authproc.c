@@ -24,6 +24,7 @@
 
 #include "stdinc.h"
 #include "rb_lib.h"
+#include "rb_hashmap.h"
 #include "client.h"
 #include "ircd_defs.h"
 #include "parse.h"
@@ -64,7 +65,7 @@ rb_helper *authd_helper;
 static char *authd_path;
 
 uint32_t cid;
-static rb_dictionary *cid_clients;
+static rb_hashmap *cid_clients;
 static struct ev_entry *timeout_ev;
 
 rb_dictionary *dnsbl_stats = NULL;
@@ -112,7 +113,7 @@ start_authd(void)
 	}
 
 	if(cid_clients == NULL)
-		cid_clients = rb_dictionary_create("authd cid to uid mapping", rb_uint32cmp);
+		cid_clients = rb_hashmap_create("authd cid to uid mapping", RB_HASHMAP_INTEGER);
 
 	if(timeout_ev == NULL)
 		timeout_ev = rb_event_addish("timeout_dead_authd_clients", timeout_dead_authd_clients, NULL, 1);
@@ -153,9 +154,9 @@ cid_to_client(uint32_t ncid, bool del)
 	struct Client *client_p;
 
 	if(del)
-		client_p = rb_dictionary_delete(cid_clients, RB_UINT_TO_POINTER(ncid));
+		client_p = rb_hashmap_delete(cid_clients, RB_UINT_TO_POINTER(ncid));
 	else
-		client_p = rb_dictionary_retrieve(cid_clients, RB_UINT_TO_POINTER(ncid));
+		client_p = rb_hashmap_retrieve(cid_clients, RB_UINT_TO_POINTER(ncid));
 
 	/* If the client's not found, that's okay, it may have already gone away.
 	 * --Elizafox */
@@ -379,16 +380,16 @@ authd_free_client(struct Client *client_p)
 }
 
 static void
-authd_free_client_cb(rb_dictionary_element *delem, void *unused)
+authd_free_client_cb(const void *key, void *data, void *unused)
 {
-	struct Client *client_p = delem->data;
+	struct Client *client_p = data;
 	authd_free_client(client_p);
 }
 
 void
 authd_abort_client(struct Client *client_p)
 {
-	rb_dictionary_delete(cid_clients, RB_UINT_TO_POINTER(client_p->preClient->auth.cid));
+	rb_hashmap_delete(cid_clients, RB_UINT_TO_POINTER(client_p->preClient->auth.cid));
 	authd_free_client(client_p);
 }
 
@@ -404,7 +405,7 @@ restart_authd_cb(rb_helper * helper)
 		authd_helper = NULL;
 	}
 
-	rb_dictionary_destroy(cid_clients, authd_free_client_cb, NULL);
+	rb_hashmap_destroy(cid_clients, authd_free_client_cb, NULL);
 	cid_clients = NULL;
 
 	start_authd();
@@ -468,7 +469,7 @@ authd_initiate_client(struct Client *client_p, bool defer)
 	authd_cid = client_p->preClient->auth.cid = generate_cid();
 
 	/* Collisions are extremely unlikely, so disregard the possibility */
-	rb_dictionary_add(cid_clients, RB_UINT_TO_POINTER(authd_cid), client_p);
+	rb_hashmap_add(cid_clients, RB_UINT_TO_POINTER(authd_cid), client_p);
 
 	/* Retrieve listener and client IP's */
 	rb_inet_ntop_sock((struct sockaddr *)&client_p->preClient->lip, listen_ipaddr, sizeof(listen_ipaddr));
@@ -531,7 +532,7 @@ authd_decide_client(struct Client *client_p, const char *ident, const char *host
 	if(*host != '*')
 		rb_strlcpy(client_p->host, host, sizeof(client_p->host));
 
-	rb_dictionary_delete(cid_clients, RB_UINT_TO_POINTER(client_p->preClient->auth.cid));
+	rb_hashmap_delete(cid_clients, RB_UINT_TO_POINTER(client_p->preClient->auth.cid));
 
 	client_p->preClient->auth.accepted = accept;
 	client_p->preClient->auth.cause = cause;
@@ -569,25 +570,14 @@ authd_reject_client(struct Client *client_p, const char *ident, const char *host
 static void
 timeout_dead_authd_clients(void *notused __unused)
 {
-	rb_dictionary_iter iter;
+	rb_hashmap_iter iter;
 	struct Client *client_p;
-	rb_dlink_list freelist = { NULL, NULL, 0 };
-	rb_dlink_node *ptr, *nptr;
 
-	RB_DICTIONARY_FOREACH(client_p, &iter, cid_clients)
+	/* aborting a client only deletes it, which RB_HASHMAP_FOREACH allows */
+	RB_HASHMAP_FOREACH(client_p, &iter, cid_clients)
 	{
 		if(client_p->preClient->auth.timeout < rb_current_time())
-		{
-			rb_dlinkAddAlloc(client_p, &freelist);
-		}
-	}
-
-	/* RB_DICTIONARY_FOREACH is not safe for deletion, so we do this crap */
-	RB_DLINK_FOREACH_SAFE(ptr, nptr, freelist.head)
-	{
-		client_p = ptr->data;
-		authd_abort_client(client_p);
-		rb_dlinkDestroy(ptr, &freelist);
+			authd_abort_client(client_p);
 	}
 }
 
@@ -322,6 +322,7 @@ bandb_handle_finish(void)
 {
 	struct ConfItem *aconf;
 	rb_dlink_node *ptr, *next_ptr;
+	rb_dlink_list klines = { NULL, NULL, 0 };
 
 	clear_out_address_conf(AC_BANDB);
 	clear_s_newconf_bans();
@@ -336,7 +337,10 @@ bandb_handle_finish(void)
 		{
 		case CONF_KILL:
 			if(bandb_check_kline(aconf))
+			{
 				add_conf_by_address(aconf->host, CONF_KILL, aconf->user, NULL, aconf);
+				rb_dlinkAddAlloc(aconf, &klines);
+			}
 			else
 				free_conf(aconf);
 
@@ -352,7 +356,10 @@ bandb_handle_finish(void)
 
 		case CONF_XLINE:
 			if(bandb_check_xline(aconf))
+			{
 				rb_dlinkAddAlloc(aconf, &xline_conf_list);
+				xline_list_changed();
+			}
 			else
 				free_conf(aconf);
 
@@ -368,7 +375,10 @@ bandb_handle_finish(void)
 
 		case CONF_RESV_NICK:
 			if(bandb_check_resv_nick(aconf))
+			{
 				rb_dlinkAddAlloc(aconf, &resv_conf_list);
+				resv_list_changed();
+			}
 			else
 				free_conf(aconf);
 
@@ -376,7 +386,9 @@ bandb_handle_finish(void)
 		}
 	}
 
-	check_banned_lines();
+	check_dlines();
+	check_new_klines(&klines);
+	check_xlines();
 }
 
 static void
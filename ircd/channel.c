@@ -29,6 +29,7 @@
 #include "hash.h"
 #include "hook.h"
 #include "match.h"
+#include "masktrie.h"
 #include "ircd.h"
 #include "numeric.h"
 #include "s_serv.h"		/* captab */
@@ -51,6 +52,7 @@ static rb_bh *member_heap;
 unsigned int chm_anonymous_mode_flag = 0;
 
 static void free_topic(struct Channel *chptr);
+static void free_ban_set(struct ban_set *set);
 
 static int h_can_join;
 static int h_can_send;
@@ -90,6 +92,7 @@ allocate_channel(const char *chname)
 void
 free_channel(struct Channel *chptr)
 {
+	rb_free(chptr->member_index);
 	rb_free(chptr->chname);
 	rb_free(chptr->mode_lock);
 	rb_bh_free(channel_heap, chptr);
@@ -144,6 +147,118 @@ send_channel_join(struct Channel *chptr, struct Client *client_p)
 							    client_p->host, client_p->user->away);
 }
 
+/*
+ * Channels with more than a few members keep an open addressing table
+ * of their memberships, keyed by client, so find_channel_membership()
+ * need not walk a list.  It is kept between two and eight times the
+ * number of members, and dropped again when the channel gets small.
+ */
+#define MEMBER_INDEX_BUILD	16	/* members before there is a table */
+#define MEMBER_INDEX_DROP	8	/* members below which it goes */
+#define MEMBER_INDEX_MIN	64	/* smallest table */
+
+static inline unsigned int
+member_index_hash(struct Channel *chptr, struct Client *client_p)
+{
+	return (((uint64_t)(uintptr_t)client_p * 0x9E3779B97F4A7C15ULL) >> 32) & chptr->member_index_mask;
+}
+
+static void
+member_index_insert(struct Channel *chptr, struct membership *msptr)
+{
+	unsigned int i = member_index_hash(chptr, msptr->client_p);
+
+	while(chptr->member_index[i] != NULL)
+		i = (i + 1) & chptr->member_index_mask;
+	chptr->member_index[i] = msptr;
+}
+
+/* builds a table of size slots from the member list, or drops it if 0 */
+static void
+member_index_resize(struct Channel *chptr, unsigned int size)
+{
+	rb_dlink_node *ptr;
+
+	rb_free(chptr->member_index);
+	chptr->member_index = NULL;
+	chptr->member_index_mask = 0;
+
+	if(size == 0)
+		return;
+
+	chptr->member_index = rb_malloc(size * sizeof(struct membership *));
+	chptr->member_index_mask = size - 1;
+
+	RB_DLINK_FOREACH(ptr, chptr->members.head)
+		member_index_insert(chptr, ptr->data);
+}
+
+static unsigned int
+member_index_size(unsigned int count)
+{
+	unsigned int size = MEMBER_INDEX_MIN;
+
+	while(size < count * 4)
+		size <<= 1;
+	return size;
+}
+
+/* call after msptr is on chptr->members */
+static void
+member_index_add(struct Channel *chptr, struct membership *msptr)
+{
+	unsigned int count = rb_dlink_list_length(&chptr->members);
+
+	if(chptr->member_index == NULL)
+	{
+		if(count >= MEMBER_INDEX_BUILD)
+			member_index_resize(chptr, member_index_size(count));
+	}
+	else if(count * 2 > chptr->member_index_mask + 1)
+		member_index_resize(chptr, member_index_size(count));
+	else
+		member_index_insert(chptr, msptr);
+}
+
+/* call after msptr is off chptr->members */
+static void
+member_index_del(struct Channel *chptr, struct membership *msptr)
+{
+	unsigned int count = rb_dlink_list_length(&chptr->members);
+	unsigned int mask = chptr->member_index_mask;
+	unsigned int i, j, home;
+
+	if(chptr->member_index == NULL)
+		return;
+
+	if(count < MEMBER_INDEX_DROP)
+	{
+		member_index_resize(chptr, 0);
+		return;
+	}
+
+	if(count * 8 < mask + 1 && mask + 1 > MEMBER_INDEX_MIN)
+	{
+		member_index_resize(chptr, member_index_size(count));
+		return;
+	}
+
+	for(i = member_index_hash(chptr, msptr->client_p); chptr->member_index[i] != msptr; i = (i + 1) & mask)
+		s_assert(chptr->member_index[i] != NULL);
+
+	/* move back any entry after the gap that would not be found past it */
+	for(j = (i + 1) & mask; chptr->member_index[j] != NULL; j = (j + 1) & mask)
+	{
+		home = member_index_hash(chptr, chptr->member_index[j]->client_p);
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			chptr->member_index[i] = chptr->member_index[j];
+			i = j;
+		}
+	}
+	chptr->member_index[i] = NULL;
+}
+
 /* find_channel_membership()
  *
  * input	- channel to find them in, client to find
@@ -155,10 +270,22 @@ find_channel_membership(struct Channel *chptr, struct Client *client_p)
 {
 	struct membership *msptr;
 	rb_dlink_node *ptr;
+	unsigned int i;
 
 	if(!IsClient(client_p))
 		return NULL;
 
+	if(chptr->member_index != NULL)
+	{
+		for(i = member_index_hash(chptr, client_p); (msptr = chptr->member_index[i]) != NULL;
+				i = (i + 1) & chptr->member_index_mask)
+		{
+			if(msptr->client_p == client_p)
+				return msptr;
+		}
+		return NULL;
+	}
+
 	/* Pick the most efficient list to use to be nice to things like
 	 * CHANSERV which could be in a large number of channels
 	 */
@@ -289,6 +416,7 @@ add_user_to_channel(struct Channel *chptr, struct Client *client_p, int flags)
 		rb_dlinkAddBefore(p, msptr, &msptr->usernode, &client_p->user->channel);
 
 	rb_dlinkAdd(msptr, &msptr->channode, &chptr->members);
+	member_index_add(chptr, msptr);
 
 	if(MyClient(client_p))
 		rb_dlinkAdd(msptr, &msptr->locchannode, &chptr->locmembers);
@@ -314,6 +442,7 @@ remove_user_from_channel(struct membership *msptr)
 
 	rb_dlinkDelete(&msptr->usernode, &client_p->user->channel);
 	rb_dlinkDelete(&msptr->channode, &chptr->members);
+	member_index_del(chptr, msptr);
 
 	if(client_p->servptr == &me)
 		rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
@@ -349,6 +478,7 @@ remove_user_from_channels(struct Client *client_p)
 		chptr = msptr->chptr;
 
 		rb_dlinkDelete(&msptr->channode, &chptr->members);
+		member_index_del(chptr, msptr);
 
 		if(client_p->servptr == &me)
 			rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
@@ -454,6 +584,11 @@ destroy_channel(struct Channel *chptr)
 	free_channel_list(&chptr->invexlist);
 	free_channel_list(&chptr->quietlist);
 
+	free_ban_set(chptr->banset);
+	free_ban_set(chptr->quietset);
+	free_ban_set(chptr->exceptset);
+	free_ban_set(chptr->invexset);
+
 	/* Free the topic */
 	free_topic(chptr);
 
@@ -589,6 +724,304 @@ del_invite(struct Channel *chptr, struct Client *who)
 	rb_dlinkFindDestroy(chptr, &who->user->invited);
 }
 
+/*
+ * Ban lists longer than BAN_SET_MIN are compiled into a ban set the
+ * first time a local client is checked against them, and recompiled
+ * once chptr->bants has moved.  Each mask is filed where only clients
+ * that could match it will look:
+ *
+ *  - extbans are kept apart and tried in list order.
+ *  - *!*@address/len masks sit on a patricia tree per family.  Every
+ *    prefix covering an address is an ancestor of its best match.
+ *  - everything else goes on a mask trie under its literal prefix or
+ *    its literal suffix, whichever is longer, so exact masks and the
+ *    usual *!*@host and nick!*@* forms narrow to a few candidates.
+ *  - other masks match_cidr() could match are tried in list order.
+ *
+ * Candidates are confirmed with matches_mask() and the lowest list
+ * position wins, so the result is the same as walking the list.
+ */
+#define BAN_SET_MIN 8
+
+struct ban_set
+{
+	time_t bants;
+	unsigned long length;
+	struct Ban **bans;
+	struct mask_trie *prefix_trie;
+	struct mask_trie *suffix_trie;
+	rb_patricia_tree_t *ipv4_tree;
+	rb_patricia_tree_t *ipv6_tree;
+	unsigned int *extbans;
+	unsigned int nextbans;
+	unsigned int *cidrs;
+	unsigned int ncidrs;
+};
+
+struct ban_match_data
+{
+	struct ban_set *set;
+	const struct matchset *ms;
+};
+
+static void
+free_ban_set(struct ban_set *set)
+{
+	if(set == NULL)
+		return;
+
+	mask_trie_destroy(set->prefix_trie);
+	mask_trie_destroy(set->suffix_trie);
+	rb_destroy_patricia(set->ipv4_tree, NULL);
+	rb_destroy_patricia(set->ipv6_tree, NULL);
+	rb_free(set->bans);
+	rb_free(set->extbans);
+	rb_free(set->cidrs);
+	rb_free(set);
+}
+
+/* parse_ban_cidr()
+ *
+ * input	- ban mask, address to fill in, flag to fill in
+ * output	- CIDR length if match_cidr() can ever match the mask, else 0
+ * side effects - *anyuser is set if the mask is *!*@address/len
+ */
+static int
+parse_ban_cidr(const char *banstr, struct rb_sockaddr_storage *addr, bool *anyuser)
+{
+	char mask[BUFSIZE];
+	char *ipmask, *len;
+	int cidrlen;
+
+	rb_strlcpy(mask, banstr, sizeof(mask));
+
+	if((ipmask = strrchr(mask, '@')) == NULL)
+		return 0;
+	*ipmask++ = '\0';
+
+	if((len = strrchr(ipmask, '/')) == NULL)
+		return 0;
+	*len++ = '\0';
+
+	cidrlen = atoi(len);
+	if(cidrlen <= 0 || cidrlen > (strchr(ipmask, ':') ? 128 : 32))
+		return 0;
+
+	if(!rb_inet_pton_sock(ipmask, (struct sockaddr_storage *)addr))
+		return 0;
+
+	*anyuser = !strcmp(mask, "*!*");
+	return cidrlen;
+}
+
+static struct ban_set *
+build_ban_set(struct Channel *chptr, rb_dlink_list *list)
+{
+	struct ban_set *set = rb_malloc(sizeof(struct ban_set));
+	struct rb_sockaddr_storage addr;
+	rb_dlink_node *ptr;
+	unsigned int id = 0;
+
+	set->bants = chptr->bants;
+	set->length = rb_dlink_list_length(list);
+	set->bans = rb_malloc(sizeof(struct Ban *) * set->length);
+	set->prefix_trie = mask_trie_create(false);
+	set->suffix_trie = mask_trie_create(true);
+	set->ipv4_tree = rb_new_patricia(32);
+	set->ipv6_tree = rb_new_patricia(128);
+	set->extbans = rb_malloc(sizeof(unsigned int) * set->length);
+	set->cidrs = rb_malloc(sizeof(unsigned int) * set->length);
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		struct Ban *banptr = ptr->data;
+		const char *mask = banptr->banstr;
+		size_t len = strlen(mask);
+		size_t prefix, suffix;
+		bool anyuser;
+		int cidrlen;
+
+		set->bans[id] = banptr;
+
+		if(*mask == '$')
+		{
+			set->extbans[set->nextbans++] = id++;
+			continue;
+		}
+
+		prefix = strcspn(mask, "*?");
+		for(suffix = 0; suffix < len; suffix++)
+			if(mask[len - suffix - 1] == '*' || mask[len - suffix - 1] == '?')
+				break;
+
+		if(suffix > prefix)
+			mask_trie_add(set->suffix_trie, mask + len - suffix, suffix, id);
+		else
+			mask_trie_add(set->prefix_trie, mask, prefix, id);
+
+		if((cidrlen = parse_ban_cidr(mask, &addr, &anyuser)) > 0)
+		{
+			rb_patricia_node_t *pnode = NULL;
+
+			if(anyuser)
+				pnode = make_and_lookup_ip(GET_SS_FAMILY(&addr) == AF_INET6 ?
+						set->ipv6_tree : set->ipv4_tree,
+						(struct sockaddr *)&addr, cidrlen);
+
+			/* the first id filed on a node is its lowest */
+			if(pnode != NULL)
+			{
+				if(pnode->data == NULL)
+					pnode->data = (void *)(uintptr_t)(id + 1);
+			}
+			else
+				set->cidrs[set->ncidrs++] = id;
+		}
+
+		id++;
+	}
+
+	return set;
+}
+
+static bool
+ban_matches(unsigned int id, void *data)
+{
+	struct ban_match_data *md = data;
+
+	return matches_mask(md->ms, md->set->bans[id]->banstr);
+}
+
+static unsigned int
+find_ban_cidr(struct ban_set *set, const char *ip, unsigned int best)
+{
+	struct rb_sockaddr_storage addr;
+	rb_patricia_tree_t *tree;
+	rb_patricia_node_t *pnode;
+	void *ipptr;
+
+	if((ip = strrchr(ip, '@')) == NULL)
+		return best;
+
+	if(!rb_inet_pton_sock(ip + 1, (struct sockaddr_storage *)&addr))
+		return best;
+
+	if(GET_SS_FAMILY(&addr) == AF_INET6)
+	{
+		tree = set->ipv6_tree;
+		ipptr = &((struct sockaddr_in6 *)&addr)->sin6_addr;
+	}
+	else
+	{
+		tree = set->ipv4_tree;
+		ipptr = &((struct sockaddr_in *)&addr)->sin_addr;
+	}
+
+	for(pnode = rb_match_ip(tree, (struct sockaddr *)&addr); pnode != NULL; pnode = pnode->parent)
+	{
+		unsigned int id;
+
+		if(pnode->prefix == NULL || pnode->data == NULL)
+			continue;
+
+		id = (uintptr_t)pnode->data - 1;
+		if(id < best && comp_with_mask(ipptr, rb_prefix_touchar(pnode->prefix),
+					pnode->prefix->bitlen))
+			best = id;
+	}
+
+	return best;
+}
+
+static struct ban_set **
+get_ban_set_slot(struct Channel *chptr, rb_dlink_list *list)
+{
+	if(list == &chptr->banlist)
+		return &chptr->banset;
+	if(list == &chptr->quietlist)
+		return &chptr->quietset;
+	if(list == &chptr->exceptlist)
+		return &chptr->exceptset;
+	return &chptr->invexset;
+}
+
+/* find_ban()
+ *
+ * input	- channel, ban list, local user to check, prebuilt buffers,
+ *                type for extbans
+ * output	- the first ban in the list matching the user, or NULL
+ * side effects - the list's ban set may be (re)compiled
+ */
+static struct Ban *
+find_ban(struct Channel *chptr, rb_dlink_list *list, struct Client *who,
+	 const struct matchset *ms, long mode_type)
+{
+	struct ban_match_data md;
+	struct ban_set **slot, *set;
+	rb_dlink_node *ptr;
+	unsigned int best = UINT_MAX;
+	unsigned int i;
+
+	if(rb_dlink_list_length(list) < BAN_SET_MIN)
+	{
+		RB_DLINK_FOREACH(ptr, list->head)
+		{
+			struct Ban *banptr = ptr->data;
+
+			if(matches_mask(ms, banptr->banstr) ||
+					match_extban(banptr->banstr, who, chptr, mode_type))
+				return banptr;
+		}
+
+		return NULL;
+	}
+
+	slot = get_ban_set_slot(chptr, list);
+	if(*slot == NULL || (*slot)->bants != chptr->bants ||
+			(*slot)->length != rb_dlink_list_length(list))
+	{
+		free_ban_set(*slot);
+		*slot = build_ban_set(chptr, list);
+	}
+
+	set = *slot;
+	md.set = set;
+	md.ms = ms;
+
+	for(i = 0; i < ARRAY_SIZE(ms->host) && ms->host[i][0] != '\0'; i++)
+	{
+		best = mask_trie_find(set->prefix_trie, ms->host[i], best, ban_matches, &md);
+		best = mask_trie_find(set->suffix_trie, ms->host[i], best, ban_matches, &md);
+	}
+
+	for(i = 0; i < ARRAY_SIZE(ms->ip) && ms->ip[i][0] != '\0'; i++)
+	{
+		best = mask_trie_find(set->prefix_trie, ms->ip[i], best, ban_matches, &md);
+		best = mask_trie_find(set->suffix_trie, ms->ip[i], best, ban_matches, &md);
+		best = find_ban_cidr(set, ms->ip[i], best);
+	}
+
+	for(i = 0; i < set->ncidrs && set->cidrs[i] < best; i++)
+	{
+		if(matches_mask(ms, set->bans[set->cidrs[i]]->banstr))
+		{
+			best = set->cidrs[i];
+			break;
+		}
+	}
+
+	for(i = 0; i < set->nextbans && set->extbans[i] < best; i++)
+	{
+		if(match_extban(set->bans[set->extbans[i]]->banstr, who, chptr, mode_type))
+		{
+			best = set->extbans[i];
+			break;
+		}
+	}
+
+	return best == UINT_MAX ? NULL : set->bans[best];
+}
+
 /* is_banned_list()
  *
  * input	- channel to check bans for, ban list (banlist or quietlist),
@@ -603,9 +1036,7 @@ is_banned_list(struct Channel *chptr, rb_dlink_list *list,
 	       const struct matchset *ms, const char **forward)
 {
 	struct matchset ms_;
-	rb_dlink_node *ptr;
-	struct Ban *actualBan = NULL;
-	struct Ban *actualExcept = NULL;
+	struct Ban *actualBan;
 
 	if (!MyClient(who))
 		return 0;
@@ -616,36 +1047,20 @@ is_banned_list(struct Channel *chptr, rb_dlink_list *list,
 		ms = &ms_;
 	}
 
-	RB_DLINK_FOREACH(ptr, list->head)
-	{
-		actualBan = ptr->data;
-		if (matches_mask(ms, actualBan->banstr))
-			break;
-		if (match_extban(actualBan->banstr, who, chptr, CHFL_BAN))
-			break;
-		actualBan = NULL;
-	}
+	actualBan = find_ban(chptr, list, who, ms, CHFL_BAN);
 
-	if ((actualBan != NULL) && ConfigChannel.use_except)
+	/* theyre exempted.. */
+	if ((actualBan != NULL) && ConfigChannel.use_except &&
+			find_ban(chptr, &chptr->exceptlist, who, ms, CHFL_EXCEPTION) != NULL)
 	{
-		RB_DLINK_FOREACH(ptr, chptr->exceptlist.head)
+		/* cache the fact theyre not banned */
+		if(msptr != NULL)
 		{
-			actualExcept = ptr->data;
-
-			/* theyre exempted.. */
-			if (matches_mask(ms, actualExcept->banstr) ||
-					match_extban(actualExcept->banstr, who, chptr, CHFL_EXCEPTION))
-			{
-				/* cache the fact theyre not banned */
-				if(msptr != NULL)
-				{
-					msptr->bants = chptr->bants;
-					msptr->flags &= ~CHFL_BANNED;
-				}
-
-				return CHFL_EXCEPTION;
-			}
+			msptr->bants = chptr->bants;
+			msptr->flags &= ~CHFL_BANNED;
 		}
+
+		return CHFL_EXCEPTION;
 	}
 
 	/* cache the banned/not banned status */
@@ -682,22 +1097,7 @@ int
 is_banned(struct Channel *chptr, struct Client *who, struct membership *msptr,
 	  const struct matchset *ms, const char **forward)
 {
-#if 0
-	if (chptr->last_checked_client != NULL &&
-		who == chptr->last_checked_client &&
-		chptr->last_checked_type == CHFL_BAN &&
-		chptr->last_checked_ts > chptr->bants)
-		return chptr->last_checked_result;
-
-	chptr->last_checked_client = who;
-	chptr->last_checked_type = CHFL_BAN;
-	chptr->last_checked_result = is_banned_list(chptr, &chptr->banlist, who, msptr, s, s2, forward);
-	chptr->last_checked_ts = rb_current_time();
-
-	return chptr->last_checked_result;
-#else
 	return is_banned_list(chptr, &chptr->banlist, who, msptr, ms, forward);
-#endif
 }
 
 /* is_quieted()
@@ -711,22 +1111,7 @@ int
 is_quieted(struct Channel *chptr, struct Client *who, struct membership *msptr,
 	   const struct matchset *ms)
 {
-#if 0
-	if (chptr->last_checked_client != NULL &&
-		who == chptr->last_checked_client &&
-		chptr->last_checked_type == CHFL_QUIET &&
-		chptr->last_checked_ts > chptr->bants)
-		return chptr->last_checked_result;
-
-	chptr->last_checked_client = who;
-	chptr->last_checked_type = CHFL_QUIET;
-	chptr->last_checked_result = is_banned_list(chptr, &chptr->quietlist, who, msptr, s, s2, NULL);
-	chptr->last_checked_ts = rb_current_time();
-
-	return chptr->last_checked_result;
-#else
 	return is_banned_list(chptr, &chptr->quietlist, who, msptr, ms, NULL);
-#endif
 }
 
 /* can_join()
@@ -740,8 +1125,6 @@ int
 can_join(struct Client *source_p, struct Channel *chptr, const char *key, const char **forward)
 {
 	rb_dlink_node *invite = NULL;
-	rb_dlink_node *ptr;
-	struct Ban *invex = NULL;
 	struct matchset ms;
 	int i = 0;
 	hook_data_channel moduledata;
@@ -781,14 +1164,7 @@ can_join(struct Client *source_p, struct Channel *chptr, const char *key, const
 		{
 			if(!ConfigChannel.use_invex)
 				moduledata.approved = ERR_INVITEONLYCHAN;
-			RB_DLINK_FOREACH(ptr, chptr->invexlist.head)
-			{
-				invex = ptr->data;
-				if (matches_mask(&ms, invex->banstr) ||
-						match_extban(invex->banstr, source_p, chptr, CHFL_INVEX))
-					break;
-			}
-			if(ptr == NULL)
+			if(find_ban(chptr, &chptr->invexlist, source_p, &ms, CHFL_INVEX) == NULL)
 				moduledata.approved = ERR_INVITEONLYCHAN;
 		}
 	}
@@ -292,8 +292,9 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid, const
 
 	rb_dlinkAdd(actualBan, &actualBan->node, list);
 
-	/* invalidate the can_send() cache */
-	if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET || mode_type == CHFL_EXCEPTION)
+	/* invalidate the can_send() cache and the compiled ban sets */
+	if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET ||
+			mode_type == CHFL_EXCEPTION || mode_type == CHFL_INVEX)
 		chptr->bants++;
 
 	return actualBan;
@@ -322,8 +323,9 @@ del_id(struct Channel *chptr, const char *banid, rb_dlink_list * list, long mode
 		{
 			rb_dlinkDelete(&banptr->node, list);
 
-			/* invalidate the can_send() cache */
-			if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET || mode_type == CHFL_EXCEPTION)
+			/* invalidate the can_send() cache and the compiled ban sets */
+			if(mode_type == CHFL_BAN || mode_type == CHFL_QUIET ||
+					mode_type == CHFL_EXCEPTION || mode_type == CHFL_INVEX)
 				chptr->bants++;
 
 			return banptr;
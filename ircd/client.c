@@ -55,8 +55,8 @@
 
 #define DEBUG_EXITED_CLIENTS
 
-static void check_pings_list(rb_dlink_list * list);
-static void check_unknowns_list(rb_dlink_list * list);
+static time_t check_ping_client(struct Client *client_p);
+static time_t check_unknown_client(struct Client *client_p);
 static void free_exited_clients(void *unused);
 static void exit_aborted_clients(void *unused);
 
@@ -93,6 +93,21 @@ struct abort_client
 
 static rb_dlink_list abort_list;
 
+/*
+ * Every local connection sits in one slot of the ping wheel, indexed by
+ * the second at which check_pings() should next look at it.  Deadlines
+ * are only hints: activity moves lasttime forward without touching the
+ * wheel, and the client is simply rescheduled when its slot comes round.
+ */
+#define PING_WHEEL_SIZE 512
+
+static rb_dlink_list ping_wheel[PING_WHEEL_SIZE];
+static time_t ping_wheel_time;
+
+static rb_patricia_tree_t *lclient_ipv4_tree;
+static rb_patricia_tree_t *lclient_ipv6_tree;
+static rb_radixtree *lclient_host_tree;
+
 
 /*
  * init_client
@@ -108,18 +123,23 @@ init_client(void)
 	 * start off the check ping event ..  -- adrian
 	 * Every 30 seconds is plenty -- db
 	 */
-	client_heap = rb_bh_create(sizeof(struct Client), CLIENT_HEAP_SIZE, "client_heap");
+	client_heap = rb_bh_create_aligned(sizeof(struct Client), RB_CACHE_LINE_SIZE, CLIENT_HEAP_SIZE, "client_heap");
 	lclient_heap = rb_bh_create(sizeof(struct LocalUser), LCLIENT_HEAP_SIZE, "lclient_heap");
 	pclient_heap = rb_bh_create(sizeof(struct PreClient), PCLIENT_HEAP_SIZE, "pclient_heap");
 	user_heap = rb_bh_create(sizeof(struct User), USER_HEAP_SIZE, "user_heap");
 	away_heap = rb_bh_create(AWAYLEN, AWAY_HEAP_SIZE, "away_heap");
 
-	rb_event_addish("check_pings", check_pings, NULL, 30);
+	ping_wheel_time = rb_current_time();
+	rb_event_add("check_pings", check_pings, NULL, 1);
 	rb_event_addish("free_exited_clients", &free_exited_clients, NULL, 4);
 	rb_event_addish("exit_aborted_clients", exit_aborted_clients, NULL, 1);
 	rb_event_add("flood_recalc", flood_recalc, NULL, 1);
 
 	nd_dict = rb_dictionary_create("nickdelay", irccmp);
+
+	lclient_ipv4_tree = rb_new_patricia(32);
+	lclient_ipv6_tree = rb_new_patricia(128);
+	lclient_host_tree = rb_radixtree_create_casemap("local user host", irctoupper_tab);
 }
 
 /*
@@ -231,6 +251,9 @@ make_client(struct Client *from)
 
 		/* as good a place as any... */
 		rb_dlinkAdd(client_p, &client_p->localClient->tnode, &unknown_list);
+		/* the unknown timeout is rechecked properly once this fires */
+		schedule_ping(client_p, client_p->localClient->firsttime + 1 +
+				(ConfigFileEntry.connect_timeout < 30 ? ConfigFileEntry.connect_timeout : 30));
 	}
 	else
 	{			/* from is not NULL */
@@ -271,6 +294,9 @@ free_local_client(struct Client *client_p)
 	if(client_p->localClient == NULL)
 		return;
 
+	unschedule_ping(client_p);
+	send_flush_cancel(client_p);
+
 	/*
 	 * clean up extra sockets from P-lines which have been discarded.
 	 */
@@ -322,11 +348,52 @@ free_client(struct Client *client_p)
 }
 
 /*
- * check_pings - go through the local client list and check activity
- * kill off stuff that should die
+ * schedule_ping
+ *
+ * inputs	- local client, time check_pings() should look at it next
+ * output	- NONE
+ * side effects	- client is (re)placed on the ping wheel
+ */
+void
+schedule_ping(struct Client *client_p, time_t when)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+
+	unschedule_ping(client_p);
+
+	if(when <= ping_wheel_time)
+		when = ping_wheel_time + 1;
+
+	lclient_p->ping_deadline = when;
+	rb_dlinkAdd(client_p, &lclient_p->ping_node, &ping_wheel[when % PING_WHEEL_SIZE]);
+}
+
+/*
+ * unschedule_ping
+ *
+ * inputs	- local client
+ * output	- NONE
+ * side effects	- client is taken off the ping wheel
+ */
+void
+unschedule_ping(struct Client *client_p)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+
+	if(lclient_p->ping_deadline == 0)
+		return;
+
+	rb_dlinkDelete(&lclient_p->ping_node,
+			&ping_wheel[lclient_p->ping_deadline % PING_WHEEL_SIZE]);
+	lclient_p->ping_deadline = 0;
+}
+
+/*
+ * check_pings - check activity on local connections whose deadline
+ * has come up, and kill off stuff that should die
  *
  * inputs       - NOT USED (from event)
- * output       - next time_t when check_pings() should be called again
+ * output       - NONE
  * side effects -
  *
  *
@@ -336,158 +403,192 @@ free_client(struct Client *client_p)
  */
 
 /*
- * Addon from adrian. We used to call this after nextping seconds,
- * however I've changed it to run once a second. This is only for
- * PING timeouts, not K/etc-line checks (thanks dianora!). Having it
- * run once a second makes life a lot easier - when a new client connects
- * and they need a ping in 4 seconds, if nextping was set to 20 seconds
- * we end up waiting 20 seconds. This is stupid. :-)
- * I will optimise (hah!) check_pings() once I've finished working on
- * tidying up other network IO evilnesses.
- *     -- adrian
+ * This used to walk every local client every 30 seconds, which with a
+ * lot of clients is a noticeable stall.  It now runs once a second and
+ * only visits the ping wheel slots that have come due since the last
+ * run; each client checked there is put back on the wheel at the next
+ * time it could need attention.
  */
-
 static void
 check_pings(void *notused)
 {
-	check_pings_list(&lclient_list);
-	check_pings_list(&serv_list);
-	check_unknowns_list(&unknown_list);
+	struct Client *client_p;
+	rb_dlink_node *ptr, *next_ptr;
+	time_t now = rb_current_time();
+	time_t last = ping_wheel_time;
+	time_t t, next;
+
+	if(now <= last)
+		return;
+
+	if(now - last > PING_WHEEL_SIZE)
+		last = now - PING_WHEEL_SIZE;
+
+	/* anything rescheduled below lands in the future */
+	ping_wheel_time = now;
+
+	for(t = last + 1; t <= now; t++)
+	{
+		/*
+		 * exit_client() never frees local clients directly, they go
+		 * via the dead list, so the walk is safe against exits.
+		 */
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, ping_wheel[t % PING_WHEEL_SIZE].head)
+		{
+			client_p = ptr->data;
+
+			/* a later lap of the wheel */
+			if(client_p->localClient->ping_deadline > now)
+				continue;
+
+			unschedule_ping(client_p);
+
+			if(IsDead(client_p) || IsClosing(client_p))
+				continue;
+
+			if(IsRegistered(client_p))
+				next = check_ping_client(client_p);
+			else
+				next = check_unknown_client(client_p);
+
+			if(next != 0)
+				schedule_ping(client_p, next);
+		}
+	}
 }
 
 /*
- * Check_pings_list()
+ * check_ping_client()
  *
- * inputs	- pointer to list to check
- * output	- NONE
- * side effects	-
+ * inputs	- pointer to registered local client or server
+ * output	- next time the client needs checking, 0 if it was exited
+ * side effects	- client may be pinged, warned about or exited
  */
-static void
-check_pings_list(rb_dlink_list * list)
+static time_t
+check_ping_client(struct Client *client_p)
 {
 	char scratch[32];	/* way too generous but... */
-	struct Client *client_p;	/* current local client_p being examined */
 	int ping = 0;		/* ping time value from client */
-	rb_dlink_node *ptr, *next_ptr;
+	time_t next;
+	bool warn;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
-	{
-		client_p = ptr->data;
-
-		if(!MyConnect(client_p) || IsDead(client_p))
-			continue;
+	ping = get_client_ping(client_p);
+	warn = ConfigFileEntry.ping_warn_time > 0 && (IsServer(client_p) || IsHandshake(client_p));
 
-		ping = get_client_ping(client_p);
+	if(ping >= (rb_current_time() - client_p->localClient->lasttime))
+		return client_p->localClient->lasttime + ping + 1;
 
-		if(ping < (rb_current_time() - client_p->localClient->lasttime))
+	/*
+	 * If the client/server hasnt talked to us in 2*ping seconds
+	 * and it has a ping time, then close its connection.
+	 */
+	if(((rb_current_time() - client_p->localClient->lasttime) >= (2 * ping)
+	    && (client_p->flags & FLAGS_PINGSENT)))
+	{
+		if(IsServer(client_p))
 		{
-			/*
-			 * If the client/server hasnt talked to us in 2*ping seconds
-			 * and it has a ping time, then close its connection.
-			 */
-			if(((rb_current_time() - client_p->localClient->lasttime) >= (2 * ping)
-			    && (client_p->flags & FLAGS_PINGSENT)))
-			{
-				if(IsServer(client_p))
-				{
-					sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-							     "No response from %s, closing link",
-							     client_p->name);
-					ilog(L_SERVER,
+			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
 					     "No response from %s, closing link",
-					     log_client_name(client_p, HIDE_IP));
-				}
-				(void) snprintf(scratch, sizeof(scratch),
-						  "Ping timeout: %d seconds",
-						  (int) (rb_current_time() - client_p->localClient->lasttime));
-
-				exit_client(client_p, client_p, &me, scratch);
-				continue;
-			}
-			else if((client_p->flags & FLAGS_PINGSENT) == 0)
-			{
-				/*
-				 * if we havent PINGed the connection and we havent
-				 * heard from it in a while, PING it to make sure
-				 * it is still alive.
-				 */
-				client_p->flags |= FLAGS_PINGSENT;
-				/* not nice but does the job */
-				client_p->localClient->lasttime = rb_current_time() - ping;
-				sendto_one(client_p, "PING :%s", me.name);
-			}
-			else if (ConfigFileEntry.ping_warn_time > 0 && (IsServer(client_p) || IsHandshake(client_p)) &&
-					(rb_current_time() - client_p->localClient->lasttime) >= (ping + ConfigFileEntry.ping_warn_time))
-			{
-				/*
-				 * if we haven't heard from a server in a while,
-				 * warn opers that something could be wrong...
-				 *
-				 * we'll do this about every 30 seconds until
-				 * the server either becomes responsive or
-				 * pings out. whichever comes first.
-				 */
-				client_p->flags |= FLAGS_PINGWARN;
-				sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					     "Warning: No response from %s for %ld seconds",
-					     client_p->name,
-					     (rb_current_time() - client_p->localClient->lasttime - ping));
-				ilog(L_SERVER,
-					     "Warning: No response from %s for %ld seconds",
-					     log_client_name(client_p, HIDE_IP),
-					     (rb_current_time() - client_p->localClient->lasttime - ping));
-			}
+					     client_p->name);
+			ilog(L_SERVER,
+			     "No response from %s, closing link",
+			     log_client_name(client_p, HIDE_IP));
 		}
-		/* ping_timeout: */
+		(void) snprintf(scratch, sizeof(scratch),
+				  "Ping timeout: %d seconds",
+				  (int) (rb_current_time() - client_p->localClient->lasttime));
+
+		exit_client(client_p, client_p, &me, scratch);
+		return 0;
+	}
+	else if((client_p->flags & FLAGS_PINGSENT) == 0)
+	{
+		/*
+		 * if we havent PINGed the connection and we havent
+		 * heard from it in a while, PING it to make sure
+		 * it is still alive.
+		 */
+		client_p->flags |= FLAGS_PINGSENT;
+		/* not nice but does the job */
+		client_p->localClient->lasttime = rb_current_time() - ping;
+		sendto_one(client_p, "PING :%s", me.name);
+	}
+	else if (warn && (rb_current_time() - client_p->localClient->lasttime) >= (ping + ConfigFileEntry.ping_warn_time))
+	{
+		/*
+		 * if we haven't heard from a server in a while,
+		 * warn opers that something could be wrong...
+		 *
+		 * we'll do this about every 30 seconds until
+		 * the server either becomes responsive or
+		 * pings out. whichever comes first.
+		 */
+		client_p->flags |= FLAGS_PINGWARN;
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+			     "Warning: No response from %s for %ld seconds",
+			     client_p->name,
+			     (rb_current_time() - client_p->localClient->lasttime - ping));
+		ilog(L_SERVER,
+			     "Warning: No response from %s for %ld seconds",
+			     log_client_name(client_p, HIDE_IP),
+			     (rb_current_time() - client_p->localClient->lasttime - ping));
+
+		next = rb_current_time() + 30;
+		if(next > client_p->localClient->lasttime + 2 * ping)
+			next = client_p->localClient->lasttime + 2 * ping;
+		return next;
+	}
 
+	/* ping_timeout: */
+	next = client_p->localClient->lasttime + 2 * ping;
+	if(warn && ConfigFileEntry.ping_warn_time < ping)
+	{
+		time_t warn_at = client_p->localClient->lasttime + ping + ConfigFileEntry.ping_warn_time;
+
+		if(warn_at > rb_current_time() && warn_at < next)
+			next = warn_at;
 	}
+	return next;
 }
 
 /*
- * check_unknowns_list
+ * check_unknown_client
  *
- * inputs	- pointer to list of unknown clients
- * output	- NONE
+ * inputs	- pointer to unknown client
+ * output	- next time the client needs checking, 0 if it was exited
  * side effects	- unknown clients get marked for termination after n seconds
  */
-static void
-check_unknowns_list(rb_dlink_list * list)
+static time_t
+check_unknown_client(struct Client *client_p)
 {
-	rb_dlink_node *ptr, *next_ptr;
-	struct Client *client_p;
 	int timeout;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
-	{
-		client_p = ptr->data;
-
-		if(IsDead(client_p) || IsClosing(client_p))
-			continue;
-
-		/* Still querying with authd */
-		if(client_p->preClient != NULL && client_p->preClient->auth.cid != 0)
-			continue;
+	/* Still querying with authd */
+	if(client_p->preClient != NULL && client_p->preClient->auth.cid != 0)
+		return rb_current_time() + 1;
 
-		/*
-		 * Check UNKNOWN connections - if they have been in this state
-		 * for > 30s, close them.
-		 */
+	/*
+	 * Check UNKNOWN connections - if they have been in this state
+	 * for > 30s, close them.
+	 */
 
-		timeout = IsAnyServer(client_p) ? ConfigFileEntry.connect_timeout : 30;
-		if((rb_current_time() - client_p->localClient->firsttime) > timeout)
+	timeout = IsAnyServer(client_p) ? ConfigFileEntry.connect_timeout : 30;
+	if((rb_current_time() - client_p->localClient->firsttime) > timeout)
+	{
+		if(IsAnyServer(client_p))
 		{
-			if(IsAnyServer(client_p))
-			{
-				sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-						     "No response from %s, closing link",
-						     client_p->name);
-				ilog(L_SERVER,
-				     "No response from %s, closing link",
-				     log_client_name(client_p, HIDE_IP));
-			}
-			exit_client(client_p, client_p, &me, "Connection timed out");
+			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+					     "No response from %s, closing link",
+					     client_p->name);
+			ilog(L_SERVER,
+			     "No response from %s, closing link",
+			     log_client_name(client_p, HIDE_IP));
 		}
+		exit_client(client_p, client_p, &me, "Connection timed out");
+		return 0;
 	}
+
+	return client_p->localClient->firsttime + timeout + 1;
 }
 
 void
@@ -578,6 +679,274 @@ check_klines(void)
 }
 
 
+/*
+ * Local users are indexed by address and by the last two labels of
+ * their orighost and sockhost, so that a new K-line only has to look at
+ * the users it could possibly match rather than all of lclient_list.
+ * Both indexes map to an rb_dlink_list of clients.
+ */
+
+/* const char *host_index_key(const char *)
+ * Input: A hostname, or the literal suffix of a host mask.
+ * Output: Its last two labels, or NULL if it has fewer than that.
+ * Side effects: None
+ */
+static const char *
+host_index_key(const char *host)
+{
+	const char *p = host + strlen(host);
+	int dots = 0;
+
+	while(p > host)
+	{
+		if(p[-1] == '.' && ++dots == 2)
+			return p;
+		p--;
+	}
+
+	return dots == 1 ? host : NULL;
+}
+
+static void
+add_to_ip_index(struct sockaddr *ip, struct Client *client_p, rb_dlink_node *node)
+{
+	rb_patricia_tree_t *tree = ip->sa_family == AF_INET6 ? lclient_ipv6_tree : lclient_ipv4_tree;
+	rb_patricia_node_t *pnode;
+
+	pnode = make_and_lookup_ip(tree, ip, ip->sa_family == AF_INET6 ? 128 : 32);
+	if(pnode == NULL)
+		return;
+
+	if(pnode->data == NULL)
+		pnode->data = rb_malloc(sizeof(rb_dlink_list));
+
+	rb_dlinkAdd(client_p, node, pnode->data);
+}
+
+static void
+del_from_ip_index(struct sockaddr *ip, rb_dlink_node *node)
+{
+	rb_patricia_tree_t *tree = ip->sa_family == AF_INET6 ? lclient_ipv6_tree : lclient_ipv4_tree;
+	rb_patricia_node_t *pnode;
+	rb_dlink_list *list;
+
+	if(node->data == NULL)
+		return;
+
+	pnode = rb_match_ip_exact(tree, ip, ip->sa_family == AF_INET6 ? 128 : 32);
+	if(pnode == NULL)
+		return;
+
+	list = pnode->data;
+	rb_dlinkDelete(node, list);
+	node->data = NULL;
+
+	if(rb_dlink_list_length(list) == 0)
+	{
+		rb_free(list);
+		rb_patricia_remove(tree, pnode);
+	}
+}
+
+static void
+add_to_host_index(const char *host, struct Client *client_p, rb_dlink_node *node)
+{
+	const char *key = host_index_key(host);
+	rb_dlink_list *list;
+
+	if(key == NULL)
+		return;
+
+	if((list = rb_radixtree_retrieve(lclient_host_tree, key)) == NULL)
+	{
+		list = rb_malloc(sizeof(rb_dlink_list));
+		rb_radixtree_add(lclient_host_tree, key, list);
+	}
+
+	rb_dlinkAdd(client_p, node, list);
+}
+
+static void
+del_from_host_index(const char *host, rb_dlink_node *node)
+{
+	const char *key = host_index_key(host);
+	rb_dlink_list *list;
+
+	if(key == NULL || node->data == NULL)
+		return;
+
+	if((list = rb_radixtree_retrieve(lclient_host_tree, key)) == NULL)
+		return;
+
+	rb_dlinkDelete(node, list);
+	node->data = NULL;
+
+	if(rb_dlink_list_length(list) == 0)
+	{
+		rb_radixtree_delete(lclient_host_tree, key);
+		rb_free(list);
+	}
+}
+
+/*
+ * add_to_lclient_index
+ *
+ * inputs	- local client that just registered
+ * output	- NONE
+ * side effects	- client is added to the ban check indexes
+ */
+void
+add_to_lclient_index(struct Client *client_p)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+	struct sockaddr_in ip4;
+
+	add_to_ip_index((struct sockaddr *)&lclient_p->ip, client_p, &lclient_p->ip_node);
+
+	if(GET_SS_FAMILY(&lclient_p->ip) == AF_INET6 &&
+			rb_ipv4_from_ipv6((struct sockaddr_in6 *)&lclient_p->ip, &ip4))
+		add_to_ip_index((struct sockaddr *)&ip4, client_p, &lclient_p->ip4_node);
+
+	add_to_host_index(client_p->orighost, client_p, &lclient_p->host_node[0]);
+
+	if(irccmp(client_p->orighost, client_p->sockhost))
+		add_to_host_index(client_p->sockhost, client_p, &lclient_p->host_node[1]);
+}
+
+/*
+ * del_from_lclient_index
+ *
+ * inputs	- local client that is exiting
+ * output	- NONE
+ * side effects	- client is taken off the ban check indexes
+ */
+void
+del_from_lclient_index(struct Client *client_p)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+	struct sockaddr_in ip4;
+
+	del_from_ip_index((struct sockaddr *)&lclient_p->ip, &lclient_p->ip_node);
+
+	if(GET_SS_FAMILY(&lclient_p->ip) == AF_INET6 &&
+			rb_ipv4_from_ipv6((struct sockaddr_in6 *)&lclient_p->ip, &ip4))
+		del_from_ip_index((struct sockaddr *)&ip4, &lclient_p->ip4_node);
+
+	del_from_host_index(client_p->orighost, &lclient_p->host_node[0]);
+	del_from_host_index(client_p->sockhost, &lclient_p->host_node[1]);
+}
+
+/*
+ * kline_candidates
+ *
+ * inputs	- K-line, its parsed mask, list to fill in
+ * output	- true if the list holds every local user the K-line could
+ *		  match, false if the index cannot narrow it down
+ * side effects	- NONE
+ */
+static bool
+kline_candidates(struct ConfItem *kline, int masktype, struct rb_sockaddr_storage *addr,
+		int bits, rb_dlink_list *list)
+{
+	rb_patricia_node_t *pnode;
+	rb_dlink_list *clients;
+	rb_dlink_node *ptr;
+	const char *key;
+
+	switch (masktype) {
+	case HM_IPV4:
+	case HM_IPV6:
+		pnode = rb_match_ip_subtree(masktype == HM_IPV6 ? lclient_ipv6_tree : lclient_ipv4_tree,
+				(struct sockaddr *)addr, bits);
+		if(pnode == NULL)
+			return true;
+
+		RB_PATRICIA_WALK(pnode, pnode)
+		{
+			clients = pnode->data;
+			RB_DLINK_FOREACH(ptr, clients->head)
+				rb_dlinkAddAlloc(ptr->data, list);
+		}
+		RB_PATRICIA_WALK_END;
+		return true;
+	case HM_HOST:
+		if((key = host_index_key(get_mask_suffix(kline->host))) == NULL)
+			return false;
+
+		if((clients = rb_radixtree_retrieve(lclient_host_tree, key)) != NULL)
+			RB_DLINK_FOREACH(ptr, clients->head)
+				rb_dlinkAddAlloc(ptr->data, list);
+		return true;
+	}
+
+	return false;
+}
+
+/* check_one_kline_client()
+ *
+ * inputs       - K-line, its parsed mask, local user to check
+ * outputs      -
+ * side effects - client is exited if the K-line matches
+ */
+static void
+check_one_kline_client(struct ConfItem *kline, int masktype, struct rb_sockaddr_storage *sockaddr,
+		int bits, struct Client *client_p)
+{
+	struct sockaddr_in ip4;
+	int matched = 0;
+
+	if(IsMe(client_p) || !IsPerson(client_p) || IsAnyDead(client_p))
+		return;
+
+	if(!match(kline->user, client_p->username))
+		return;
+
+	/* match one kline */
+	switch (masktype) {
+	case HM_IPV4:
+	case HM_IPV6:
+		if (IsConfDoSpoofIp(client_p->localClient->att_conf) &&
+				IsConfKlineSpoof(client_p->localClient->att_conf))
+			break;
+		if (client_p->localClient->ip.ss_family == AF_INET6 && sockaddr->ss_family == AF_INET &&
+				rb_ipv4_from_ipv6((struct sockaddr_in6 *)&client_p->localClient->ip, &ip4)
+					&& comp_with_mask_sock((struct sockaddr *)&ip4, (struct sockaddr *)sockaddr, bits))
+			matched = 1;
+		else if (client_p->localClient->ip.ss_family == sockaddr->ss_family &&
+				comp_with_mask_sock((struct sockaddr *)&client_p->localClient->ip,
+					(struct sockaddr *)sockaddr, bits))
+			matched = 1;
+		break;
+	case HM_HOST:
+		if (match(kline->host, client_p->orighost))
+			matched = 1;
+		if (IsConfDoSpoofIp(client_p->localClient->att_conf) &&
+				IsConfKlineSpoof(client_p->localClient->att_conf))
+			break;
+		if (match(kline->host, client_p->sockhost))
+			matched = 1;
+		break;
+	}
+
+	if (!matched)
+		return;
+
+	if(IsExemptKline(client_p))
+	{
+		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+					 "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
+					 get_client_name(client_p, HIDE_IP),
+					 kline->user, kline->host);
+		return;
+	}
+
+	sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
+				 "Disconnecting K-Lined user %s (%s@%s)",
+				 get_client_name(client_p, HIDE_IP), kline->user, kline->host);
+
+	notify_banned_client(client_p, kline, K_LINED);
+}
+
 /* check_one_kline()
  *
  * This process needs to be kept in sync with find_kline() aka find_conf_by_address().
@@ -589,73 +958,67 @@ check_klines(void)
 void
 check_one_kline(struct ConfItem *kline)
 {
-	struct Client *client_p;
+	rb_dlink_list candidates = { NULL, NULL, 0 };
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 	int masktype;
 	int bits;
 	struct rb_sockaddr_storage sockaddr;
-	struct sockaddr_in ip4;
 
 	masktype = parse_netmask(kline->host, (struct sockaddr_storage *)&sockaddr, &bits);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
+	if(!kline_candidates(kline, masktype, &sockaddr, bits, &candidates))
 	{
-		int matched = 0;
-
-		client_p = ptr->data;
-
-		if(IsMe(client_p) || !IsPerson(client_p))
-			continue;
-
-		if(!match(kline->user, client_p->username))
-			continue;
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
+			check_one_kline_client(kline, masktype, &sockaddr, bits, ptr->data);
+		return;
+	}
 
-		/* match one kline */
-		switch (masktype) {
-		case HM_IPV4:
-		case HM_IPV6:
-			if (IsConfDoSpoofIp(client_p->localClient->att_conf) &&
-					IsConfKlineSpoof(client_p->localClient->att_conf))
-				break;
-			if (client_p->localClient->ip.ss_family == AF_INET6 && sockaddr.ss_family == AF_INET &&
-					rb_ipv4_from_ipv6((struct sockaddr_in6 *)&client_p->localClient->ip, &ip4)
-						&& comp_with_mask_sock((struct sockaddr *)&ip4, (struct sockaddr *)&sockaddr, bits))
-				matched = 1;
-			else if (client_p->localClient->ip.ss_family == sockaddr.ss_family &&
-					comp_with_mask_sock((struct sockaddr *)&client_p->localClient->ip,
-						(struct sockaddr *)&sockaddr, bits))
-				matched = 1;
-			break;
-		case HM_HOST:
-			if (match(kline->host, client_p->orighost))
-				matched = 1;
-			if (IsConfDoSpoofIp(client_p->localClient->att_conf) &&
-					IsConfKlineSpoof(client_p->localClient->att_conf))
-				break;
-			if (match(kline->host, client_p->sockhost))
-				matched = 1;
-			break;
-		}
+	/* collected up front, exiting clients takes them off the index */
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, candidates.head)
+	{
+		check_one_kline_client(kline, masktype, &sockaddr, bits, ptr->data);
+		rb_dlinkDestroy(ptr, &candidates);
+	}
+}
 
-		if (!matched)
-			continue;
+/* check_new_klines()
+ *
+ * inputs       - list of K-lines that were just added, emptied on return
+ * outputs      -
+ * side effects - all clients will be checked against the new klines
+ *
+ * A few K-lines are applied one by one through the local user index;
+ * once that would cost more than looking every user up once, fall back
+ * to check_klines().
+ */
+void
+check_new_klines(rb_dlink_list *klines)
+{
+	struct ConfItem *kline;
+	rb_dlink_node *ptr;
+	rb_dlink_node *next_ptr;
+	bool walk = rb_dlink_list_length(klines) >= rb_dlink_list_length(&lclient_list);
 
-		if(IsExemptKline(client_p))
-		{
-			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-						 "KLINE over-ruled for %s, client is kline_exempt [%s@%s]",
-						 get_client_name(client_p, HIDE_IP),
-						 kline->user, kline->host);
-			continue;
-		}
+	for(ptr = klines->head; ptr != NULL && !walk; ptr = ptr->next)
+	{
+		kline = ptr->data;
 
-		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					 "Disconnecting K-Lined user %s (%s@%s)",
-					 get_client_name(client_p, HIDE_IP), kline->user, kline->host);
+		/* needs a full walk of its own */
+		if(parse_netmask(kline->host, NULL, NULL) == HM_HOST &&
+				host_index_key(get_mask_suffix(kline->host)) == NULL)
+			walk = true;
+	}
 
-		notify_banned_client(client_p, kline, K_LINED);
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, klines->head)
+	{
+		if(!walk)
+			check_one_kline(ptr->data);
+		rb_dlinkDestroy(ptr, klines);
 	}
+
+	if(walk)
+		check_klines();
 }
 
 
@@ -1625,6 +1988,7 @@ exit_local_client(struct Client *client_p, struct Client *source_p, struct Clien
 
 	s_assert(IsPerson(source_p));
 	rb_dlinkDelete(&source_p->localClient->tnode, &lclient_list);
+	del_from_lclient_index(source_p);
 	rb_dlinkDelete(&source_p->lnode, &me.serv->users);
 
 	if(IsOper(source_p))
@@ -2111,6 +2475,8 @@ close_connection(struct Client *client_p)
 
 	client_release_connids(client_p);
 
+	send_flush_cancel(client_p);
+
 	if(client_p->localClient->F != NULL)
 	{
 		/* attempt to flush any pending dbufs. Evil, but .. -- adrian */
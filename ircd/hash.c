@@ -37,9 +37,10 @@
 #include "s_newconf.h"
 #include "s_assert.h"
 #include "rb_dictionary.h"
+#include "rb_hashmap.h"
 #include "rb_radixtree.h"
 
-rb_dictionary *client_connid_tree = NULL;
+rb_hashmap *client_connid_tree = NULL;
 rb_radixtree *client_id_tree = NULL;
 rb_radixtree *client_name_tree = NULL;
 
@@ -58,14 +59,14 @@ rb_radixtree *hostname_tree = NULL;
 void
 init_hash(void)
 {
-	client_connid_tree = rb_dictionary_create("client connid", rb_uint32cmp);
+	client_connid_tree = rb_hashmap_create("client connid", RB_HASHMAP_INTEGER);
 	client_id_tree = rb_radixtree_create("client id", NULL);
-	client_name_tree = rb_radixtree_create("client name", irccasecanon);
+	client_name_tree = rb_radixtree_create_casemap("client name", irctoupper_tab);
 
-	channel_tree = rb_radixtree_create("channel", irccasecanon);
-	resv_tree = rb_radixtree_create("resv", irccasecanon);
+	channel_tree = rb_radixtree_create_casemap("channel", irctoupper_tab);
+	resv_tree = rb_radixtree_create_casemap("resv", irctoupper_tab);
 
-	hostname_tree = rb_radixtree_create("hostname", irccasecanon);
+	hostname_tree = rb_radixtree_create_casemap("hostname", irctoupper_tab);
 }
 
 uint32_t
@@ -493,17 +494,17 @@ clear_resv_hash(void)
 void
 add_to_cli_connid_hash(struct Client *client_p, uint32_t id)
 {
-	rb_dictionary_add(client_connid_tree, RB_UINT_TO_POINTER(id), client_p);
+	rb_hashmap_add(client_connid_tree, RB_UINT_TO_POINTER(id), client_p);
 }
 
 void
 del_from_cli_connid_hash(uint32_t id)
 {
-	rb_dictionary_delete(client_connid_tree, RB_UINT_TO_POINTER(id));
+	rb_hashmap_delete(client_connid_tree, RB_UINT_TO_POINTER(id));
 }
 
 struct Client *
 find_cli_connid_hash(uint32_t connid)
 {
-	return rb_dictionary_retrieve(client_connid_tree, RB_UINT_TO_POINTER(connid));
+	return rb_hashmap_retrieve(client_connid_tree, RB_UINT_TO_POINTER(connid));
 }
@@ -0,0 +1,1333 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  history.c: Message history store shared by the history extensions.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#include "stdinc.h"
+#include "client.h"
+#include "ircd.h"
+#include "match.h"
+#include "logger.h"
+#include "s_conf.h"
+#include "s_serv.h"
+#include "send.h"
+#include "msgbuf.h"
+#include "capability.h"
+#include "history.h"
+#include "rb_radixtree.h"
+
+/*
+ * A target's lines live in a ring of fixed size records, and their
+ * source and text in a byte ring (the arena) next to it.  Both rings
+ * start small and double, up to channel::history_lines and
+ * channel::history_size, before the oldest lines start being dropped;
+ * growing copies the live part to the front of the new ring.
+ *
+ * The arena only ever wraps at a line boundary: a line that does not
+ * fit before the end goes to offset 0, and the space left behind is
+ * reclaimed when the line before it is dropped.
+ */
+#define HISTORY_MIN_LINES	16
+#define HISTORY_MIN_ARENA	4096
+
+/*
+ * With channel::history_log, lines go to an append-only log on disk
+ * instead: one directory per target, named by the hex of the case
+ * folded target, holding segments named by the hex id of their first
+ * line.  A segment is written until it reaches HISTORY_SEG_SIZE bytes
+ * or HISTORY_SEG_TIME milliseconds of age, and is then sealed by
+ * writing out its index.  Whole segments are deleted once their last
+ * line is older than channel::history_log_time.
+ *
+ * Segments are read through mmap.  Every HISTORY_SEG_MARK'th line of a
+ * segment is kept in its index, so finding a line by position, id or
+ * time is a binary search and at most that many steps along the log.
+ * Only the segments being written, and the HISTORY_SEG_MAPPED sealed
+ * segments used most recently, are mapped at any time.
+ *
+ * A segment being written holds a descriptor and a mapping of its whole
+ * size, so at most HISTORY_SEG_WRITING are open at once, the one written
+ * least recently being sealed to make room, and one left unwritten for
+ * HISTORY_SEG_IDLE milliseconds is sealed by the expiry event.
+ */
+#define HISTORY_SEG_SIZE	(1024 * 1024)
+#define HISTORY_SEG_TIME	(6 * 3600 * 1000)
+#define HISTORY_SEG_MARK	16
+#define HISTORY_SEG_MAPPED	256
+#define HISTORY_SEG_WRITING	64
+#define HISTORY_SEG_IDLE	(10 * 60 * 1000)
+#define HISTORY_IDX_MAGIC	0x58444948	/* "HIDX" */
+
+struct history_rec
+{
+	uint64_t id;
+	int64_t msec;
+	uint32_t off;
+	uint16_t source_len;
+	uint16_t text_len;
+	unsigned char type;
+};
+
+/* a line in a log segment, followed by its source and text, each NUL
+ * terminated, and padded to 8 bytes.  Segments are in host byte order. */
+struct history_disk_rec
+{
+	uint32_t len;
+	uint16_t source_len;
+	uint16_t text_len;
+	uint64_t id;
+	int64_t msec;
+	uint8_t type;
+	uint8_t pad[7];
+};
+
+struct history_mark
+{
+	uint64_t id;
+	int64_t msec;
+	uint64_t off;
+};
+
+/* a segment's .idx file: this, then its marks */
+struct history_idx_head
+{
+	uint32_t magic;
+	uint32_t count;
+	uint64_t len;
+	uint64_t first_id;
+	uint64_t last_id;
+	int64_t first_msec;
+	int64_t last_msec;
+	uint32_t nmarks;
+	uint32_t pad;
+};
+
+struct history_seg
+{
+	rb_dlink_node node;		/* on seg_writing while being written, else
+					 * on seg_mapped if mapped */
+	char *path;			/* without the .log or .idx */
+	int fd;				/* only while being written */
+	char *map;
+	size_t map_size;
+	size_t len;
+
+	uint64_t first_id;
+	uint64_t last_id;
+	int64_t first_msec;
+	int64_t last_msec;
+	unsigned int base;		/* position of its first line in the log */
+	unsigned int count;
+
+	struct history_mark *marks;
+	unsigned int nmarks;
+	unsigned int maxmarks;
+};
+
+struct history_buf
+{
+	char *target;
+	unsigned int count;
+
+	struct history_rec *recs;
+	unsigned int cap;
+	unsigned int first;
+
+	char *arena;
+	size_t size;
+	size_t tail;
+	size_t used;
+
+	bool logged;
+	struct history_seg **segs;
+	unsigned int nsegs;
+	unsigned int maxsegs;
+};
+
+static rb_radixtree *history_tree;
+static uint64_t history_last_id;
+static int64_t history_last_msec;
+
+static bool history_logging;
+static rb_dlink_list seg_mapped;
+static rb_dlink_list seg_writing;
+static struct ev_entry *history_log_ev;
+
+static void free_seg(struct history_seg *seg, bool remove);
+
+void
+init_history(void)
+{
+	history_tree = rb_radixtree_create_casemap("history", irctoupper_tab);
+}
+
+static inline struct history_rec *
+get_rec(struct history_buf *buf, unsigned int idx)
+{
+	return &buf->recs[(buf->first + idx) % buf->cap];
+}
+
+static inline size_t
+rec_len(const struct history_rec *rec)
+{
+	return rec->source_len + rec->text_len + 2;
+}
+
+static void
+get_log_dir(const char *target, char *path, size_t len)
+{
+	size_t off = snprintf(path, len, "%s/", ircd_paths[IRCD_PATH_HISTORY]);
+
+	for(; *target != '\0' && off + 3 <= len; target++)
+		off += snprintf(path + off, len - off, "%02x", (unsigned char)irctolower(*target));
+}
+
+static void
+free_history_buf(struct history_buf *buf, bool remove)
+{
+	char path[PATH_MAX];
+	unsigned int i;
+
+	for(i = 0; i < buf->nsegs; i++)
+		free_seg(buf->segs[i], remove);
+
+	if(remove && buf->logged)
+	{
+		get_log_dir(buf->target, path, sizeof path);
+		rmdir(path);
+	}
+
+	rb_free(buf->segs);
+	rb_free(buf->target);
+	rb_free(buf->recs);
+	rb_free(buf->arena);
+	rb_free(buf);
+}
+
+static void
+drop_oldest(struct history_buf *buf)
+{
+	struct history_rec *rec = get_rec(buf, 0);
+
+	buf->used -= rec_len(rec);
+	buf->first = (buf->first + 1) % buf->cap;
+
+	if(--buf->count == 0)
+	{
+		buf->first = 0;
+		buf->tail = 0;
+	}
+}
+
+static void
+grow_recs(struct history_buf *buf, unsigned int cap)
+{
+	struct history_rec *recs = rb_malloc(sizeof(struct history_rec) * cap);
+	unsigned int i;
+
+	for(i = 0; i < buf->count; i++)
+		recs[i] = *get_rec(buf, i);
+
+	rb_free(buf->recs);
+	buf->recs = recs;
+	buf->cap = cap;
+	buf->first = 0;
+}
+
+static void
+grow_arena(struct history_buf *buf, size_t size)
+{
+	char *arena = rb_malloc(size);
+	size_t off = 0;
+	unsigned int i;
+
+	for(i = 0; i < buf->count; i++)
+	{
+		struct history_rec *rec = get_rec(buf, i);
+
+		memcpy(arena + off, buf->arena + rec->off, rec_len(rec));
+		rec->off = off;
+		off += rec_len(rec);
+	}
+
+	rb_free(buf->arena);
+	buf->arena = arena;
+	buf->size = size;
+	buf->tail = off;
+}
+
+/* where a line of len bytes can go, or -1 if the arena has no room */
+static ssize_t
+arena_place(struct history_buf *buf, size_t len)
+{
+	size_t head;
+
+	if(buf->count == 0)
+		return len <= buf->size ? 0 : -1;
+
+	head = get_rec(buf, 0)->off;
+
+	if(buf->tail > head)
+	{
+		if(len <= buf->size - buf->tail)
+			return buf->tail;
+		if(len <= head)
+			return 0;
+		return -1;
+	}
+
+	if(len <= head - buf->tail)
+		return buf->tail;
+
+	return -1;
+}
+
+static void
+ring_add(struct history_buf *buf, uint64_t id, int64_t msec, enum message_type type,
+		const char *source, size_t source_len, const char *text, size_t text_len)
+{
+	struct history_rec *rec;
+	size_t len = source_len + text_len + 2;
+	size_t max_size;
+	unsigned int max_lines;
+	ssize_t off;
+
+	max_lines = ConfigChannel.history_lines > 0 ? ConfigChannel.history_lines : 1;
+	max_size = ConfigChannel.history_size > HISTORY_MIN_ARENA ?
+			(size_t)ConfigChannel.history_size : HISTORY_MIN_ARENA;
+
+	/* grow before dropping anything, then trim to the limits, which a
+	 * rehash may have lowered */
+	if(buf->count == buf->cap && buf->cap < max_lines)
+		grow_recs(buf, buf->cap ? MIN(buf->cap * 2, max_lines) : MIN(HISTORY_MIN_LINES, max_lines));
+
+	if(buf->used + len > buf->size && buf->size < max_size)
+		grow_arena(buf, MIN(MAX(buf->size * 2, MAX(buf->used + len, HISTORY_MIN_ARENA)), max_size));
+
+	while(buf->count > 0 && (buf->count >= MIN(max_lines, buf->cap) || buf->used + len > max_size))
+		drop_oldest(buf);
+
+	while((off = arena_place(buf, len)) < 0)
+		drop_oldest(buf);
+
+	rec = &buf->recs[(buf->first + buf->count) % buf->cap];
+	rec->id = id;
+	rec->msec = msec;
+	rec->off = off;
+	rec->source_len = source_len;
+	rec->text_len = text_len;
+	rec->type = type;
+
+	memcpy(buf->arena + off, source, source_len);
+	buf->arena[off + source_len] = '\0';
+	memcpy(buf->arena + off + source_len + 1, text, text_len);
+	buf->arena[off + len - 1] = '\0';
+
+	buf->tail = off + len;
+	buf->used += len;
+	buf->count++;
+}
+
+static void
+unmap_seg(struct history_seg *seg)
+{
+	if(seg->map == NULL)
+		return;
+
+	munmap(seg->map, seg->map_size);
+	seg->map = NULL;
+
+	if(seg->fd < 0)
+		rb_dlinkDelete(&seg->node, &seg_mapped);
+}
+
+static bool
+map_seg(struct history_seg *seg)
+{
+	char path[PATH_MAX];
+	void *map;
+	int fd;
+
+	if(seg->map != NULL)
+	{
+		/* keep the most recently used sealed segments mapped */
+		if(seg->fd < 0)
+		{
+			rb_dlinkDelete(&seg->node, &seg_mapped);
+			rb_dlinkAddTail(seg, &seg->node, &seg_mapped);
+		}
+		return true;
+	}
+
+	if(seg->len == 0)
+		return false;
+
+	snprintf(path, sizeof path, "%s.log", seg->path);
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		ilog(L_MAIN, "history: cannot open %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	map = mmap(NULL, seg->len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED)
+	{
+		ilog(L_MAIN, "history: cannot map %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	if(rb_dlink_list_length(&seg_mapped) >= HISTORY_SEG_MAPPED)
+		unmap_seg(seg_mapped.head->data);
+
+	seg->map = map;
+	seg->map_size = seg->len;
+	rb_dlinkAddTail(seg, &seg->node, &seg_mapped);
+	return true;
+}
+
+static inline const struct history_disk_rec *
+seg_rec(struct history_seg *seg, size_t off)
+{
+	return (const struct history_disk_rec *)(seg->map + off);
+}
+
+/* account for the line at off, already in the segment */
+static void
+seg_append(struct history_seg *seg, const struct history_disk_rec *rec, size_t off)
+{
+	if(seg->count % HISTORY_SEG_MARK == 0)
+	{
+		if(seg->nmarks == seg->maxmarks)
+		{
+			seg->maxmarks = seg->maxmarks ? seg->maxmarks * 2 : 16;
+			seg->marks = rb_realloc(seg->marks, seg->maxmarks * sizeof(struct history_mark));
+		}
+
+		seg->marks[seg->nmarks].id = rec->id;
+		seg->marks[seg->nmarks].msec = rec->msec;
+		seg->marks[seg->nmarks].off = off;
+		seg->nmarks++;
+	}
+
+	if(seg->count == 0)
+	{
+		seg->first_id = rec->id;
+		seg->first_msec = rec->msec;
+	}
+
+	seg->last_id = rec->id;
+	seg->last_msec = rec->msec;
+	seg->len = off + rec->len;
+	seg->count++;
+}
+
+/* rebuild the index of a segment that was never sealed, up to its last
+ * whole line */
+static void
+scan_seg(struct history_seg *seg, size_t size)
+{
+	const struct history_disk_rec *rec;
+	size_t off = 0;
+
+	seg->len = size;
+	if(!map_seg(seg))
+	{
+		seg->len = 0;
+		return;
+	}
+
+	seg->len = 0;
+
+	while(off + sizeof(struct history_disk_rec) <= size)
+	{
+		rec = seg_rec(seg, off);
+
+		if(rec->len < sizeof(struct history_disk_rec) || rec->len % 8 != 0 ||
+				rec->len > size - off ||
+				sizeof(struct history_disk_rec) + rec->source_len + rec->text_len + 2 > rec->len ||
+				(seg->count > 0 && rec->id <= seg->last_id))
+			break;
+
+		seg_append(seg, rec, off);
+		off += rec->len;
+	}
+
+	unmap_seg(seg);
+}
+
+static bool
+read_seg_index(struct history_seg *seg, size_t size)
+{
+	char path[PATH_MAX];
+	struct history_idx_head head;
+	size_t marks_len;
+	int fd;
+	bool ok = false;
+
+	snprintf(path, sizeof path, "%s.idx", seg->path);
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+
+	if(read(fd, &head, sizeof head) == sizeof head && head.magic == HISTORY_IDX_MAGIC &&
+			head.len == size && head.count > 0 &&
+			head.nmarks == (head.count + HISTORY_SEG_MARK - 1) / HISTORY_SEG_MARK)
+	{
+		marks_len = head.nmarks * sizeof(struct history_mark);
+		seg->marks = rb_malloc(marks_len);
+		seg->maxmarks = head.nmarks;
+
+		if(read(fd, seg->marks, marks_len) == (ssize_t)marks_len)
+		{
+			seg->nmarks = head.nmarks;
+			seg->count = head.count;
+			seg->len = head.len;
+			seg->first_id = head.first_id;
+			seg->last_id = head.last_id;
+			seg->first_msec = head.first_msec;
+			seg->last_msec = head.last_msec;
+			ok = true;
+		}
+	}
+
+	close(fd);
+	return ok;
+}
+
+static void
+write_seg_index(struct history_seg *seg)
+{
+	char path[PATH_MAX];
+	struct history_idx_head head;
+	size_t marks_len = seg->nmarks * sizeof(struct history_mark);
+	int fd;
+
+	memset(&head, 0, sizeof head);
+	head.magic = HISTORY_IDX_MAGIC;
+	head.count = seg->count;
+	head.len = seg->len;
+	head.first_id = seg->first_id;
+	head.last_id = seg->last_id;
+	head.first_msec = seg->first_msec;
+	head.last_msec = seg->last_msec;
+	head.nmarks = seg->nmarks;
+
+	snprintf(path, sizeof path, "%s.idx", seg->path);
+	if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+	{
+		ilog(L_MAIN, "history: cannot create %s: %s", path, strerror(errno));
+		return;
+	}
+
+	/* a short index is noticed, and rebuilt, when it is next loaded */
+	if(write(fd, &head, sizeof head) != sizeof head ||
+			write(fd, seg->marks, marks_len) != (ssize_t)marks_len)
+		ilog(L_MAIN, "history: cannot write %s: %s", path, strerror(errno));
+
+	close(fd);
+}
+
+/* stop writing a segment: write out its index, and map it again later
+ * with only the length used */
+static void
+seal_seg(struct history_seg *seg)
+{
+	if(seg->fd < 0)
+		return;
+
+	if(seg->count > 0)
+		write_seg_index(seg);
+
+	munmap(seg->map, seg->map_size);
+	seg->map = NULL;
+	close(seg->fd);
+	seg->fd = -1;
+	rb_dlinkDelete(&seg->node, &seg_writing);
+}
+
+static void
+free_seg(struct history_seg *seg, bool remove)
+{
+	char path[PATH_MAX];
+
+	if(remove)
+	{
+		snprintf(path, sizeof path, "%s.log", seg->path);
+		unlink(path);
+		snprintf(path, sizeof path, "%s.idx", seg->path);
+		unlink(path);
+
+		if(seg->fd >= 0)
+		{
+			munmap(seg->map, seg->map_size);
+			seg->map = NULL;
+			close(seg->fd);
+			seg->fd = -1;
+			rb_dlinkDelete(&seg->node, &seg_writing);
+		}
+	}
+
+	seal_seg(seg);
+	unmap_seg(seg);
+
+	rb_free(seg->marks);
+	rb_free(seg->path);
+	rb_free(seg);
+}
+
+static void
+add_seg(struct history_buf *buf, struct history_seg *seg)
+{
+	if(buf->nsegs == buf->maxsegs)
+	{
+		buf->maxsegs = buf->maxsegs ? buf->maxsegs * 2 : 4;
+		buf->segs = rb_realloc(buf->segs, buf->maxsegs * sizeof(struct history_seg *));
+	}
+
+	seg->base = buf->count;
+	buf->segs[buf->nsegs++] = seg;
+	buf->count += seg->count;
+
+	if(seg->last_id > history_last_id)
+		history_last_id = seg->last_id;
+	if(seg->last_msec > history_last_msec)
+		history_last_msec = seg->last_msec;
+}
+
+static struct history_seg *
+create_seg(struct history_buf *buf, uint64_t id)
+{
+	struct history_seg *seg;
+	char path[PATH_MAX];
+	void *map;
+	int fd;
+
+	get_log_dir(buf->target, path, sizeof path);
+	if(mkdir(path, 0700) < 0 && errno != EEXIST)
+	{
+		ilog(L_MAIN, "history: cannot create %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if(rb_dlink_list_length(&seg_writing) >= HISTORY_SEG_WRITING)
+		seal_seg(seg_writing.head->data);
+
+	rb_snprintf_append(path, sizeof path, "/%016" PRIx64 ".log", id);
+	if((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+	{
+		ilog(L_MAIN, "history: cannot create %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	/* map the whole size up front; only what has been written is read */
+	map = mmap(NULL, HISTORY_SEG_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		ilog(L_MAIN, "history: cannot map %s: %s", path, strerror(errno));
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+
+	seg = rb_malloc(sizeof(struct history_seg));
+	path[strlen(path) - 4] = '\0';
+	seg->path = rb_strdup(path);
+	seg->fd = fd;
+	seg->map = map;
+	seg->map_size = HISTORY_SEG_SIZE;
+	rb_dlinkAddTail(seg, &seg->node, &seg_writing);
+
+	add_seg(buf, seg);
+	return seg;
+}
+
+static void
+log_add(struct history_buf *buf, uint64_t id, int64_t msec, enum message_type type,
+		const char *source, size_t source_len, const char *text, size_t text_len)
+{
+	static char data[sizeof(struct history_disk_rec) + 2 * (UINT16_MAX + 1)];
+	struct history_disk_rec *rec = (struct history_disk_rec *)data;
+	struct history_seg *seg = buf->nsegs > 0 ? buf->segs[buf->nsegs - 1] : NULL;
+	size_t len = sizeof(struct history_disk_rec) + source_len + text_len + 2;
+
+	len = (len + 7) & ~(size_t)7;
+
+	if(seg != NULL && seg->fd >= 0 && seg->count > 0 &&
+			(seg->len + len > HISTORY_SEG_SIZE || msec - seg->first_msec >= HISTORY_SEG_TIME))
+		seal_seg(seg);
+
+	if(seg == NULL || seg->fd < 0)
+	{
+		if((seg = create_seg(buf, id)) == NULL)
+			return;
+	}
+
+	memset(data, 0, len);
+	rec->len = len;
+	rec->source_len = source_len;
+	rec->text_len = text_len;
+	rec->id = id;
+	rec->msec = msec;
+	rec->type = type;
+	memcpy(data + sizeof(struct history_disk_rec), source, source_len);
+	memcpy(data + sizeof(struct history_disk_rec) + source_len + 1, text, text_len);
+
+	if(pwrite(seg->fd, data, len, seg->len) != (ssize_t)len)
+	{
+		ilog(L_MAIN, "history: cannot write %s.log: %s", seg->path, strerror(errno));
+		return;
+	}
+
+	seg_append(seg, rec, seg->len);
+	buf->count++;
+
+	/* keep seg_writing in the order last written */
+	rb_dlinkDelete(&seg->node, &seg_writing);
+	rb_dlinkAddTail(seg, &seg->node, &seg_writing);
+}
+
+uint64_t
+history_add(const char *target, enum message_type type, const char *source, const char *text)
+{
+	struct history_buf *buf;
+	size_t source_len = strlen(source);
+	size_t text_len = strlen(text);
+	uint64_t id;
+	const struct timeval *tv = rb_current_time_tv();
+	int64_t msec = (int64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+
+	if(source_len > UINT16_MAX)
+		source_len = UINT16_MAX;
+	if(text_len > UINT16_MAX)
+		text_len = UINT16_MAX;
+
+	if(!history_logging &&
+			source_len + text_len + 2 > (size_t)MAX(ConfigChannel.history_size, HISTORY_MIN_ARENA))
+		return 0;
+
+	if((buf = rb_radixtree_retrieve(history_tree, target)) == NULL)
+	{
+		buf = rb_malloc(sizeof(struct history_buf));
+		buf->target = rb_strdup(target);
+		buf->logged = history_logging;
+		rb_radixtree_add(history_tree, buf->target, buf);
+	}
+
+	/* ids and times must not go backwards, whatever the clock does */
+	if(msec < history_last_msec)
+		msec = history_last_msec;
+	history_last_msec = msec;
+	id = ++history_last_id;
+
+	if(buf->logged)
+		log_add(buf, id, msec, type, source, source_len, text, text_len);
+	else
+		ring_add(buf, id, msec, type, source, source_len, text, text_len);
+
+	return id;
+}
+
+struct history_buf *
+history_find(const char *target)
+{
+	return rb_radixtree_retrieve(history_tree, target);
+}
+
+void
+history_drop(const char *target)
+{
+	struct history_buf *buf = rb_radixtree_retrieve(history_tree, target);
+
+	if(buf == NULL)
+		return;
+
+	rb_radixtree_delete(history_tree, target);
+	free_history_buf(buf, true);
+}
+
+/* history_expire()
+ *
+ * input	- time in milliseconds
+ * output	-
+ * side effects - lines older than the time are dropped, and targets
+ *                left with none are freed.  The history log is expired
+ *                on its own, by channel::history_log_time.
+ */
+void
+history_expire(int64_t before)
+{
+	struct history_buf *buf;
+	rb_radixtree_iteration_state iter;
+	rb_dlink_list empty = { NULL, NULL, 0 };
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_RADIXTREE_FOREACH(buf, &iter, history_tree)
+	{
+		if(buf->logged)
+			continue;
+
+		while(buf->count > 0 && get_rec(buf, 0)->msec < before)
+			drop_oldest(buf);
+
+		/* the tree cannot be changed while we walk it */
+		if(buf->count == 0)
+			rb_dlinkAddAlloc(buf, &empty);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, empty.head)
+	{
+		buf = ptr->data;
+		rb_radixtree_delete(history_tree, buf->target);
+		free_history_buf(buf, false);
+		rb_dlinkDestroy(ptr, &empty);
+	}
+}
+
+/* seal the log segments left unwritten for HISTORY_SEG_IDLE, and delete
+ * those whose last line is older than channel::history_log_time */
+static void
+expire_history_log(void *unused)
+{
+	struct history_buf *buf;
+	struct history_seg *seg;
+	rb_radixtree_iteration_state iter;
+	rb_dlink_list empty = { NULL, NULL, 0 };
+	rb_dlink_node *ptr, *next_ptr;
+	int64_t now = (int64_t)rb_current_time() * 1000;
+	int64_t before = now - (int64_t)ConfigChannel.history_log_time * 1000;
+	unsigned int i, n;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, seg_writing.head)
+	{
+		seg = ptr->data;
+		if(seg->last_msec >= now - HISTORY_SEG_IDLE)
+			break;
+		seal_seg(seg);
+	}
+
+	RB_RADIXTREE_FOREACH(buf, &iter, history_tree)
+	{
+		if(!buf->logged)
+			continue;
+
+		for(n = 0; n < buf->nsegs && buf->segs[n]->last_msec < before; n++)
+			;
+
+		if(n == buf->nsegs)
+		{
+			rb_dlinkAddAlloc(buf, &empty);
+			continue;
+		}
+
+		if(n == 0)
+			continue;
+
+		for(i = 0; i < n; i++)
+			free_seg(buf->segs[i], true);
+
+		buf->nsegs -= n;
+		memmove(buf->segs, buf->segs + n, buf->nsegs * sizeof(struct history_seg *));
+
+		for(buf->count = 0, i = 0; i < buf->nsegs; i++)
+		{
+			buf->segs[i]->base = buf->count;
+			buf->count += buf->segs[i]->count;
+		}
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, empty.head)
+	{
+		buf = ptr->data;
+		rb_radixtree_delete(history_tree, buf->target);
+		free_history_buf(buf, true);
+		rb_dlinkDestroy(ptr, &empty);
+	}
+}
+
+static int
+seg_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+load_log_dir(const char *name)
+{
+	struct history_buf *buf;
+	struct history_seg *seg;
+	struct stat st;
+	char path[PATH_MAX], target[CHANNELLEN + 1];
+	char **files = NULL;
+	size_t nfiles = 0, maxfiles = 0, len, i;
+	unsigned int c;
+	DIR *dir;
+	struct dirent *ent;
+
+	len = strlen(name);
+	if(len == 0 || len % 2 != 0 || len / 2 > CHANNELLEN)
+		return;
+
+	for(i = 0; i < len / 2; i++)
+	{
+		if(sscanf(name + i * 2, "%2x", &c) != 1 || c == 0)
+			return;
+		target[i] = c;
+	}
+	target[len / 2] = '\0';
+
+	snprintf(path, sizeof path, "%s/%s", ircd_paths[IRCD_PATH_HISTORY], name);
+	if((dir = opendir(path)) == NULL)
+		return;
+
+	while((ent = readdir(dir)) != NULL)
+	{
+		if(strlen(ent->d_name) != 20 || strcmp(ent->d_name + 16, ".log") != 0)
+			continue;
+
+		if(nfiles == maxfiles)
+		{
+			maxfiles = maxfiles ? maxfiles * 2 : 16;
+			files = rb_realloc(files, maxfiles * sizeof(char *));
+		}
+		files[nfiles++] = rb_strndup(ent->d_name, 17);
+	}
+	closedir(dir);
+
+	/* the names are the fixed width hex of the first id in each */
+	if(nfiles > 0)
+		qsort(files, nfiles, sizeof(char *), seg_name_cmp);
+
+	buf = rb_malloc(sizeof(struct history_buf));
+	buf->target = rb_strdup(target);
+	buf->logged = true;
+
+	for(i = 0; i < nfiles; i++)
+	{
+		snprintf(path, sizeof path, "%s/%s/%s.log", ircd_paths[IRCD_PATH_HISTORY], name, files[i]);
+		rb_free(files[i]);
+
+		if(stat(path, &st) < 0)
+			continue;
+
+		seg = rb_malloc(sizeof(struct history_seg));
+		path[strlen(path) - 4] = '\0';
+		seg->path = rb_strdup(path);
+		seg->fd = -1;
+
+		if(!read_seg_index(seg, st.st_size))
+		{
+			rb_free(seg->marks);
+			seg->marks = NULL;
+			seg->maxmarks = 0;
+
+			scan_seg(seg, st.st_size);
+
+			/* cut off a line that was being written when we stopped */
+			if(seg->count > 0)
+			{
+				if(seg->len < (size_t)st.st_size)
+				{
+					rb_snprintf_append(path, sizeof path, ".log");
+					if(truncate(path, seg->len) < 0)
+						ilog(L_MAIN, "history: cannot truncate %s: %s", path, strerror(errno));
+				}
+				write_seg_index(seg);
+			}
+		}
+
+		if(seg->count == 0 || (buf->nsegs > 0 && seg->first_id <= buf->segs[buf->nsegs - 1]->last_id))
+		{
+			free_seg(seg, true);
+			continue;
+		}
+
+		add_seg(buf, seg);
+	}
+	rb_free(files);
+
+	if(buf->nsegs == 0 || rb_radixtree_retrieve(history_tree, buf->target) != NULL)
+	{
+		free_history_buf(buf, false);
+		return;
+	}
+
+	rb_radixtree_add(history_tree, buf->target, buf);
+}
+
+static void
+clear_history(void)
+{
+	struct history_buf *buf;
+	rb_radixtree_iteration_state iter;
+	rb_dlink_list all = { NULL, NULL, 0 };
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_RADIXTREE_FOREACH(buf, &iter, history_tree)
+	{
+		rb_dlinkAddAlloc(buf, &all);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, all.head)
+	{
+		buf = ptr->data;
+		rb_radixtree_delete(history_tree, buf->target);
+		free_history_buf(buf, false);
+		rb_dlinkDestroy(ptr, &all);
+	}
+}
+
+/* init_history_log()
+ *
+ * input	-
+ * output	-
+ * side effects - the history log is loaded, or closed, following
+ *                channel::history_log.  Either way, the history held
+ *                until then is forgotten.
+ */
+void
+init_history_log(void)
+{
+	DIR *dir;
+	struct dirent *ent;
+
+	if(history_logging == (ConfigChannel.history_log != 0))
+		return;
+
+	clear_history();
+	history_logging = ConfigChannel.history_log != 0;
+
+	if(!history_logging)
+	{
+		rb_event_delete(history_log_ev);
+		history_log_ev = NULL;
+		return;
+	}
+
+	if(mkdir(ircd_paths[IRCD_PATH_HISTORY], 0700) < 0 && errno != EEXIST)
+		ilog(L_MAIN, "history: cannot create %s: %s",
+				ircd_paths[IRCD_PATH_HISTORY], strerror(errno));
+
+	if((dir = opendir(ircd_paths[IRCD_PATH_HISTORY])) != NULL)
+	{
+		while((ent = readdir(dir)) != NULL)
+		{
+			if(ent->d_name[0] != '.')
+				load_log_dir(ent->d_name);
+		}
+		closedir(dir);
+	}
+
+	expire_history_log(NULL);
+	history_log_ev = rb_event_addish("expire_history_log", expire_history_log, NULL, 300);
+}
+
+unsigned int
+history_count(struct history_buf *buf)
+{
+	return buf != NULL ? buf->count : 0;
+}
+
+/* the segment holding line idx of a logged target */
+static struct history_seg *
+find_seg(struct history_buf *buf, unsigned int idx)
+{
+	unsigned int lo = 0, hi = buf->nsegs;
+
+	while(hi - lo > 1)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if(buf->segs[mid]->base <= idx)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return buf->segs[lo];
+}
+
+static void
+log_get(struct history_buf *buf, unsigned int idx, struct history_line *line)
+{
+	struct history_seg *seg = find_seg(buf, idx);
+	const struct history_disk_rec *rec;
+	unsigned int n = idx - seg->base;
+	size_t off;
+
+	if(!map_seg(seg))
+	{
+		memset(line, 0, sizeof *line);
+		line->source = line->text = "";
+		return;
+	}
+
+	off = seg->marks[n / HISTORY_SEG_MARK].off;
+	for(n %= HISTORY_SEG_MARK; n > 0; n--)
+		off += seg_rec(seg, off)->len;
+
+	rec = seg_rec(seg, off);
+	line->id = rec->id;
+	line->msec = rec->msec;
+	line->type = rec->type;
+	line->source = (const char *)(rec + 1);
+	line->text = line->source + rec->source_len + 1;
+}
+
+void
+history_get(struct history_buf *buf, unsigned int idx, struct history_line *line)
+{
+	struct history_rec *rec;
+
+	if(buf->logged)
+	{
+		log_get(buf, idx, line);
+		return;
+	}
+
+	rec = get_rec(buf, idx);
+	line->id = rec->id;
+	line->msec = rec->msec;
+	line->type = rec->type;
+	line->source = buf->arena + rec->off;
+	line->text = buf->arena + rec->off + rec->source_len + 1;
+}
+
+/* the first line of a logged target at or after an id (or a time), by
+ * whole segments, then marks, then lines */
+static unsigned int
+log_index(struct history_buf *buf, bool by_id, uint64_t id, int64_t msec)
+{
+	struct history_seg *seg;
+	const struct history_disk_rec *rec;
+	unsigned int lo = 0, hi = buf->nsegs, n;
+	size_t off;
+
+#define BEFORE(i, m)	(by_id ? (i) < id : (m) < msec)
+
+	while(lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if(BEFORE(buf->segs[mid]->last_id, buf->segs[mid]->last_msec))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if(lo == buf->nsegs)
+		return buf->count;
+
+	seg = buf->segs[lo];
+	lo = 0;
+	hi = seg->nmarks;
+
+	while(lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if(BEFORE(seg->marks[mid].id, seg->marks[mid].msec))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* the line is between the mark before lo and lo itself */
+	if(lo == 0)
+		return seg->base;
+
+	if(!map_seg(seg))
+		return seg->base + lo * HISTORY_SEG_MARK;
+
+	n = (lo - 1) * HISTORY_SEG_MARK;
+	off = seg->marks[lo - 1].off;
+
+	for(rec = seg_rec(seg, off); BEFORE(rec->id, rec->msec); rec = seg_rec(seg, off))
+	{
+		off += rec->len;
+		n++;
+	}
+
+#undef BEFORE
+
+	return seg->base + n;
+}
+
+/* history_index_msec()
+ *
+ * input	- history buffer, time in milliseconds
+ * output	- index of the first line at or after the time, or
+ *                history_count() if there is none
+ */
+unsigned int
+history_index_msec(struct history_buf *buf, int64_t msec)
+{
+	unsigned int lo = 0, hi = history_count(buf);
+
+	if(hi > 0 && buf->logged)
+		return log_index(buf, false, 0, msec);
+
+	while(lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if(get_rec(buf, mid)->msec < msec)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* history_index_id()
+ *
+ * input	- history buffer, message id
+ * output	- index of the first line with an id at or after the given
+ *                one, or history_count() if there is none
+ */
+unsigned int
+history_index_id(struct history_buf *buf, uint64_t id)
+{
+	unsigned int lo = 0, hi = history_count(buf);
+
+	if(hi > 0 && buf->logged)
+		return log_index(buf, true, id, 0);
+
+	while(lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if(get_rec(buf, mid)->id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+void
+history_format_msgid(uint64_t id, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s%016" PRIx64, me.id, id);
+}
+
+bool
+history_parse_msgid(const char *msgid, uint64_t *id)
+{
+	size_t idlen = strlen(me.id);
+	char *end;
+
+	if(strncmp(msgid, me.id, idlen) != 0 || strlen(msgid + idlen) != 16)
+		return false;
+
+	*id = strtoull(msgid + idlen, &end, 16);
+	return *end == '\0';
+}
+
+/* history_parse_time()
+ *
+ * input	- YYYY-MM-DDThh:mm:ss[.sss][Z], in UTC
+ * output	- true and the time in milliseconds, or false if it is not
+ *                such a time or a field is out of range
+ */
+bool
+history_parse_time(const char *s, int64_t *msec)
+{
+	struct tm tm;
+	int year, mon, mday, hour, min, sec, len = 0;
+	int ms = 0, scale = 100;
+	time_t when;
+
+	if(sscanf(s, "%4d-%2d-%2dT%2d:%2d:%2d%n", &year, &mon, &mday,
+			&hour, &min, &sec, &len) != 6 || len == 0)
+		return false;
+	s += len;
+
+	if(*s == '.')
+	{
+		if(!IsDigit(s[1]))
+			return false;
+		for(s++; IsDigit(*s); s++, scale /= 10)
+			ms += (*s - '0') * scale;
+	}
+	if(*s == 'Z')
+		s++;
+	if(*s != '\0')
+		return false;
+
+	if(year < 1970 || mon < 1 || mon > 12 || mday < 1 || mday > 31 ||
+			hour > 23 || min > 59 || sec > 59 || hour < 0 || min < 0 || sec < 0)
+		return false;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = year - 1900;
+	tm.tm_mon = mon - 1;
+	tm.tm_mday = mday;
+	tm.tm_hour = hour;
+	tm.tm_min = min;
+	tm.tm_sec = sec;
+	when = timegm(&tm);
+
+	/* timegm() rolls the 31st of a shorter month over into the next */
+	if(tm.tm_mday != mday)
+		return false;
+
+	*msec = (int64_t)when * 1000 + ms;
+	return true;
+}
+
+/* history_send()
+ *
+ * input	- client, target the line was sent to, the line, batch
+ *                reference or NULL
+ * output	-
+ * side effects - the line is sent to the client as it was first sent,
+ *                with its time and msgid as tags for clients asking for
+ *                them
+ */
+void
+history_send(struct Client *client_p, const char *target,
+		const struct history_line *line, const char *batch)
+{
+	struct MsgBuf msgbuf;
+	char timebuf[32], msgid[HISTORY_MSGID_LEN];
+	time_t sec = line->msec / 1000;
+	size_t len;
+
+	len = strftime(timebuf, sizeof timebuf, "%Y-%m-%dT%H:%M:%S.", gmtime(&sec));
+	snprintf(timebuf + len, sizeof timebuf - len, "%03dZ", (int)(line->msec % 1000));
+	history_format_msgid(line->id, msgid, sizeof msgid);
+
+	msgbuf_init(&msgbuf);
+	msgbuf_append_tag(&msgbuf, "time", timebuf,
+			capability_get(cli_capindex, "server-time", NULL));
+	msgbuf_append_tag(&msgbuf, "msgid", msgid,
+			capability_get(cli_capindex, "draft/chathistory", NULL));
+	if(batch != NULL)
+		msgbuf_append_tag(&msgbuf, "batch", batch,
+				capability_get(cli_capindex, "batch", NULL));
+
+	sendto_one_tags(client_p, &msgbuf, ":%s %s %s :%s", line->source,
+			line->type == MESSAGE_TYPE_NOTICE ? "NOTICE" : "PRIVMSG",
+			target, line->text);
+}
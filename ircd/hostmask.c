@@ -31,6 +31,7 @@
 #include "numeric.h"
 #include "send.h"
 #include "match.h"
+#include "rb_radixtree.h"
 
 static unsigned long hash_ipv6(struct sockaddr *, int);
 static unsigned long hash_ipv4(struct sockaddr *, int);
@@ -129,10 +130,210 @@ int parse_netmask_strict(const char *mask, struct rb_sockaddr_storage *addr, int
 /* Hashtable stuff...now external as its used in m_stats.c */
 struct AddressRec *atable[ATABLE_SIZE];
 
+/*
+ * atable holds every address record and is what the reporting code
+ * walks.  Lookups go through separate indexes instead, so that one
+ * connection does not have to wade through every bucket collision:
+ *
+ *  - IPv4 and IPv6 masks sit on a patricia tree per family, one node
+ *    per prefix.  Every prefix covering an address is an ancestor of
+ *    the best match, so walking up from there finds all candidates.
+ *  - host masks are keyed on the literal part right of their last
+ *    wildcard (see get_mask_hash()) with the labels reversed, so a
+ *    hostname only has to look up each of its label suffixes.
+ *  - host masks with a wildcard in the final label go on wild_hosts
+ *    and are checked for every lookup, like atable[0] used to be.
+ *
+ * Records sharing an index node are chained through inext.
+ */
+static rb_patricia_tree_t *ipv4_tree;
+static rb_patricia_tree_t *ipv6_tree;
+static rb_radixtree *host_tree;
+static struct AddressRec *wild_hosts;
+
 void
 init_host_hash(void)
 {
 	memset(&atable, 0, sizeof(atable));
+	ipv4_tree = rb_new_patricia(32);
+	ipv6_tree = rb_new_patricia(128);
+	host_tree = rb_radixtree_create_casemap("hostmask", irctoupper_tab);
+}
+
+/* static bool reverse_labels(const char *, char *, size_t)
+ * Input: A hostname or host suffix, an output buffer and its size.
+ * Output: true if the name fitted, with its labels written in reverse
+ *         order ("a.example.com" -> "com.example.a"), false otherwise.
+ * Side effects: None
+ */
+static bool
+reverse_labels(const char *name, char *buf, size_t len)
+{
+	const char *p = name + strlen(name);
+	const char *label;
+	char *out = buf;
+
+	if((size_t)(p - name) >= len)
+		return false;
+
+	for(;;)
+	{
+		for(label = p; label > name && label[-1] != '.'; label--)
+			;
+
+		memcpy(out, label, p - label);
+		out += p - label;
+
+		if(label == name)
+			break;
+
+		*out++ = '.';
+		p = label - 1;
+	}
+
+	*out = '\0';
+	return true;
+}
+
+/* const char *get_mask_suffix(const char *)
+ * Input: A host mask.
+ * Output: The literal suffix of the mask right of the first '.' past the
+ *         last wildcard, "" if the last label holds a wildcard.  This is
+ *         the part get_mask_hash() hashes.
+ * Side effects: None
+ */
+const char *
+get_mask_suffix(const char *text)
+{
+	const char *hp = "", *p;
+
+	for (p = text + strlen(text) - 1; p >= text; p--)
+		if(*p == '*' || *p == '?')
+			return hp;
+		else if(*p == '.')
+			hp = p + 1;
+	return text;
+}
+
+static rb_patricia_tree_t *
+get_ip_tree(int masktype)
+{
+	return masktype == HM_IPV6 ? ipv6_tree : ipv4_tree;
+}
+
+/* static void index_address_rec(struct AddressRec *)
+ * Input: A fully set up address record.
+ * Output: None
+ * Side effects: The record is added to the lookup indexes.
+ */
+static void
+index_address_rec(struct AddressRec *arec)
+{
+	char key[BUFSIZE];
+	const char *suffix;
+
+	if(arec->masktype == HM_IPV4 || arec->masktype == HM_IPV6)
+	{
+		rb_patricia_node_t *pnode;
+
+		pnode = make_and_lookup_ip(get_ip_tree(arec->masktype),
+				(struct sockaddr *)&arec->Mask.ipa.addr, arec->Mask.ipa.bits);
+		if(pnode != NULL)
+		{
+			arec->inext = pnode->data;
+			pnode->data = arec;
+			return;
+		}
+	}
+	else
+	{
+		suffix = get_mask_suffix(arec->Mask.hostname);
+		if(*suffix != '\0' && reverse_labels(suffix, key, sizeof key))
+		{
+			rb_radixtree_leaf *leaf = rb_radixtree_elem_find(host_tree, key, 0);
+
+			if(leaf != NULL)
+			{
+				arec->inext = rb_radixtree_elem_get_data(leaf);
+				rb_radixtree_elem_set_data(leaf, arec);
+			}
+			else
+			{
+				arec->inext = NULL;
+				rb_radixtree_add(host_tree, key, arec);
+			}
+			return;
+		}
+	}
+
+	/* no usable key, so check it on every lookup */
+	arec->inext = wild_hosts;
+	wild_hosts = arec;
+}
+
+static struct AddressRec *
+unlink_address_rec(struct AddressRec *head, struct AddressRec *arec)
+{
+	struct AddressRec **prev;
+
+	for(prev = &head; *prev != NULL; prev = &(*prev)->inext)
+	{
+		if(*prev == arec)
+		{
+			*prev = arec->inext;
+			break;
+		}
+	}
+	return head;
+}
+
+/* static void unindex_address_rec(struct AddressRec *)
+ * Input: An address record previously passed to index_address_rec().
+ * Output: None
+ * Side effects: The record is removed from the lookup indexes.
+ */
+static void
+unindex_address_rec(struct AddressRec *arec)
+{
+	char key[BUFSIZE];
+	const char *suffix;
+	struct AddressRec *head;
+
+	if(arec->masktype == HM_IPV4 || arec->masktype == HM_IPV6)
+	{
+		rb_patricia_tree_t *tree = get_ip_tree(arec->masktype);
+		rb_patricia_node_t *pnode;
+
+		pnode = rb_match_ip_exact(tree, (struct sockaddr *)&arec->Mask.ipa.addr,
+				arec->Mask.ipa.bits);
+		if(pnode != NULL)
+		{
+			pnode->data = unlink_address_rec(pnode->data, arec);
+			if(pnode->data == NULL)
+				rb_patricia_remove(tree, pnode);
+			return;
+		}
+	}
+	else
+	{
+		suffix = get_mask_suffix(arec->Mask.hostname);
+		if(*suffix != '\0' && reverse_labels(suffix, key, sizeof key))
+		{
+			rb_radixtree_leaf *leaf = rb_radixtree_elem_find(host_tree, key, 0);
+
+			if(leaf != NULL)
+			{
+				head = unlink_address_rec(rb_radixtree_elem_get_data(leaf), arec);
+				if(head != NULL)
+					rb_radixtree_elem_set_data(leaf, head);
+				else
+					rb_radixtree_elem_delete(host_tree, leaf);
+				return;
+			}
+		}
+	}
+
+	wild_hosts = unlink_address_rec(wild_hosts, arec);
 }
 
 /* unsigned long hash_ipv4(struct rb_sockaddr_storage*)
@@ -210,14 +411,109 @@ hash_text(const char *start)
 static unsigned long
 get_mask_hash(const char *text)
 {
-	const char *hp = "", *p;
+	return hash_text(get_mask_suffix(text));
+}
 
-	for (p = text + strlen(text) - 1; p >= text; p--)
-		if(*p == '*' || *p == '?')
-			return hash_text(hp);
-		else if(*p == '.')
-			hp = p + 1;
-	return hash_text(text);
+/* static bool arec_matches_user(struct AddressRec *, int, const char *, const char *)
+ * Input: An address record, the type of mask to find, the username, the
+ *        authenticated user.
+ * Output: Whether the record applies to this type and user.
+ * Side effects: None
+ */
+static inline bool
+arec_matches_user(struct AddressRec *arec, int type, const char *username, const char *auth_user)
+{
+	return arec->type == (type & ~0x1) &&
+		(type & 0x1 || match(arec->username, username)) &&
+		(type != CONF_CLIENT || !arec->auth_user ||
+		(auth_user && match(arec->auth_user, auth_user)));
+}
+
+/* static void find_ip_conf(rb_patricia_tree_t *, struct sockaddr *, ...)
+ * Input: The tree for the address family, the address, the type of mask
+ *        to find, the username, the authenticated user, the best record
+ *        found so far.
+ * Output: None
+ * Side effects: *hprec and *hprecv are updated if a better record is found.
+ */
+static void
+find_ip_conf(rb_patricia_tree_t *tree, struct sockaddr *addr, int type,
+		const char *username, const char *auth_user,
+		unsigned long *hprecv, struct ConfItem **hprec)
+{
+	rb_patricia_node_t *pnode;
+	struct AddressRec *arec;
+
+	for(pnode = rb_match_ip(tree, addr); pnode != NULL; pnode = pnode->parent)
+	{
+		if(pnode->prefix == NULL)
+			continue;
+
+		for(arec = pnode->data; arec; arec = arec->inext)
+			if(arec->precedence > *hprecv &&
+			   comp_with_mask_sock(addr, (struct sockaddr *)&arec->Mask.ipa.addr,
+					       arec->Mask.ipa.bits) &&
+			   arec_matches_user(arec, type, username, auth_user))
+			{
+				*hprecv = arec->precedence;
+				*hprec = arec->aconf;
+			}
+	}
+}
+
+/* static void find_host_conf(const char *, const char *, ...)
+ * Input: The hostname, the socket host, the type of mask to find, the
+ *        username, the authenticated user, the best record found so far.
+ * Output: None
+ * Side effects: *hprec and *hprecv are updated if a better record is found.
+ */
+static void
+find_host_conf(const char *name, const char *sockhost, int type,
+		const char *username, const char *auth_user,
+		unsigned long *hprecv, struct ConfItem **hprec)
+{
+	char key[BUFSIZE];
+	struct AddressRec *arec;
+	char *p, c;
+
+	/* look up each label suffix of the name */
+	if(reverse_labels(name, key, sizeof key))
+	{
+		for(p = key;; p++)
+		{
+			if(*p != '.' && *p != '\0')
+				continue;
+
+			c = *p;
+			*p = '\0';
+
+			for(arec = rb_radixtree_retrieve(host_tree, key); arec; arec = arec->inext)
+				if(arec->precedence > *hprecv &&
+				   match(arec->Mask.hostname, name) &&
+				   arec_matches_user(arec, type, username, auth_user))
+				{
+					*hprecv = arec->precedence;
+					*hprec = arec->aconf;
+				}
+
+			*p = c;
+			if(c == '\0')
+				break;
+		}
+	}
+
+	for(arec = wild_hosts; arec; arec = arec->inext)
+	{
+		if(arec->masktype == HM_HOST &&
+		   arec->precedence > *hprecv &&
+		   (match(arec->Mask.hostname, name) ||
+		    (sockhost && match(arec->Mask.hostname, sockhost))) &&
+		   arec_matches_user(arec, type, username, auth_user))
+		{
+			*hprecv = arec->precedence;
+			*hprec = arec->aconf;
+		}
+	}
 }
 
 /* struct ConfItem* find_conf_by_address(const char*, struct rb_sockaddr_storage*,
@@ -239,10 +535,8 @@ find_conf_by_address(const char *name, const char *sockhost,
 {
 	unsigned long hprecv = 0;
 	struct ConfItem *hprec = NULL;
-	struct AddressRec *arec;
 	struct sockaddr_in ip4;
 	struct sockaddr *pip4 = NULL;
-	int b;
 
 	if(username == NULL)
 		username = "";
@@ -257,128 +551,19 @@ find_conf_by_address(const char *name, const char *sockhost,
 			if (type == CONF_KILL && rb_ipv4_from_ipv6((struct sockaddr_in6 *)addr, &ip4))
 				pip4 = (struct sockaddr *)&ip4;
 
-			for (b = 128; b >= 0; b -= 16)
-			{
-				for (arec = atable[hash_ipv6(addr, b)]; arec; arec = arec->next)
-					if(arec->type == (type & ~0x1) &&
-					   arec->masktype == HM_IPV6 &&
-					   comp_with_mask_sock(addr, (struct sockaddr *)&arec->Mask.ipa.addr,
-						arec->Mask.ipa.bits) &&
-						(type & 0x1 || match(arec-> username, username)) &&
-						(type != CONF_CLIENT || !arec->auth_user ||
-						(auth_user && match(arec->auth_user, auth_user))) &&
-						arec->precedence > hprecv)
-					{
-						hprecv = arec->precedence;
-						hprec = arec->aconf;
-					}
-			}
+			find_ip_conf(ipv6_tree, addr, type, username, auth_user, &hprecv, &hprec);
 		}
 
 		if (pip4 != NULL)
-		{
-			for (b = 32; b >= 0; b -= 8)
-			{
-				for (arec = atable[hash_ipv4(pip4, b)]; arec; arec = arec->next)
-					if(arec->type == (type & ~0x1) &&
-					   arec->masktype == HM_IPV4 &&
-					   comp_with_mask_sock(pip4, (struct sockaddr *)&arec->Mask.ipa.addr,
-							       arec->Mask.ipa.bits) &&
-						(type & 0x1 || match(arec->username, username)) &&
-						(type != CONF_CLIENT || !arec->auth_user ||
-						(auth_user && match(arec->auth_user, auth_user))) &&
-						arec->precedence > hprecv)
-					{
-						hprecv = arec->precedence;
-						hprec = arec->aconf;
-					}
-			}
-		}
+			find_ip_conf(ipv4_tree, pip4, type, username, auth_user, &hprecv, &hprec);
 	}
 
 	if(orighost != NULL)
-	{
-		const char *p;
-
-		for (p = orighost; p != NULL;)
-		{
-			for (arec = atable[hash_text(p)]; arec; arec = arec->next)
-
-				if((arec->type == (type & ~0x1)) &&
-				   (arec->masktype == HM_HOST) &&
-				   arec->precedence > hprecv &&
-				   match(arec->Mask.hostname, orighost) &&
-				   (type != CONF_CLIENT || !arec->auth_user ||
-				   (auth_user && match(arec->auth_user, auth_user))) &&
-				   (type & 0x1 || match(arec->username, username)))
-				{
-					hprecv = arec->precedence;
-					hprec = arec->aconf;
-				}
-			p = strchr(p, '.');
-			if(p != NULL)
-				p++;
-			else
-				break;
-		}
-		for (arec = atable[0]; arec; arec = arec->next)
-		{
-			if(arec->type == (type & ~0x1) &&
-			   arec->masktype == HM_HOST &&
-			   arec->precedence > hprecv &&
-			   (match(arec->Mask.hostname, orighost) ||
-			    (sockhost && match(arec->Mask.hostname, sockhost))) &&
-			    (type != CONF_CLIENT || !arec->auth_user ||
-			    (auth_user && match(arec->auth_user, auth_user))) &&
-			   (type & 0x1 || match(arec->username, username)))
-			{
-				hprecv = arec->precedence;
-				hprec = arec->aconf;
-			}
-		}
-	}
+		find_host_conf(orighost, sockhost, type, username, auth_user, &hprecv, &hprec);
 
 	if(name != NULL)
-	{
-		const char *p;
-		/* And yes - we have to check p after strchr and p after increment for
-		 * NULL -kre */
-		for (p = name; p != NULL;)
-		{
-			for (arec = atable[hash_text(p)]; arec; arec = arec->next)
-				if((arec->type == (type & ~0x1)) &&
-				   (arec->masktype == HM_HOST) &&
-				   arec->precedence > hprecv &&
-				   match(arec->Mask.hostname, name) &&
-				   (type != CONF_CLIENT || !arec->auth_user ||
-				   (auth_user && match(arec->auth_user, auth_user))) &&
-				   (type & 0x1 || match(arec->username, username)))
-				{
-					hprecv = arec->precedence;
-					hprec = arec->aconf;
-				}
-			p = strchr(p, '.');
-			if(p != NULL)
-				p++;
-			else
-				break;
-		}
-		for (arec = atable[0]; arec; arec = arec->next)
-		{
-			if(arec->type == (type & ~0x1) &&
-			   arec->masktype == HM_HOST &&
-			   arec->precedence > hprecv &&
-			   (match(arec->Mask.hostname, name) ||
-			    (sockhost && match(arec->Mask.hostname, sockhost))) &&
-			    (type != CONF_CLIENT || !arec->auth_user ||
-			    (auth_user && match(arec->auth_user, auth_user))) &&
-			   (type & 0x1 || match(arec->username, username)))
-			{
-				hprecv = arec->precedence;
-				hprec = arec->aconf;
-			}
-		}
-	}
+		find_host_conf(name, sockhost, type, username, auth_user, &hprecv, &hprec);
+
 	return hprec;
 }
 
@@ -584,6 +769,8 @@ add_conf_by_address(const char *address, int type, const char *username, const c
 	arec->aconf = aconf;
 	arec->precedence = prec_value--;
 	arec->type = type;
+
+	index_address_rec(arec);
 }
 
 /* void delete_one_address(const char*, struct ConfItem*)
@@ -622,6 +809,7 @@ delete_one_address_conf(const char *address, struct ConfItem *aconf)
 				arecl->next = arec->next;
 			else
 				atable[hv] = arec->next;
+			unindex_address_rec(arec);
 			aconf->status |= CONF_ILLEGAL;
 			if(!aconf->clients)
 				free_conf(aconf);
@@ -668,6 +856,7 @@ clear_out_address_conf(enum aconf_category clear_type)
 			}
 			else
 			{
+				unindex_address_rec(arec);
 				arec->aconf->status |= CONF_ILLEGAL;
 				if(!arec->aconf->clients)
 					free_conf(arec->aconf);
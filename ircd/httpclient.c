@@ -0,0 +1,1033 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  httpclient.c: Asynchronous HTTP/1.1 client shared by the extensions.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "ircd.h"
+#include "match.h"
+#include "dns.h"
+#include "httpclient.h"
+#include "rb_radixtree.h"
+
+/*
+ * Requests are queued per origin (scheme, host and port) and sent over a
+ * small pool of connections to it, which are kept open between requests
+ * for HTTP_IDLE_TIME.  Once a connection has shown it stays open after a
+ * response, up to HTTP_MAX_PIPELINE requests are written to it without
+ * waiting for the answers; new connections are only opened for what
+ * that leaves waiting, and no more than HTTP_MAX_CONNS at all.
+ *
+ * Host names are looked up once per HTTP_DNS_TIME, and failures
+ * remembered for HTTP_DNS_FAIL_TIME.  Requests the server never started
+ * answering before a kept-alive connection closed are sent again on
+ * another.
+ */
+#define HTTP_MAX_CONNS		64
+#define HTTP_MAX_ORIGIN_CONNS	4
+#define HTTP_MAX_PIPELINE	4
+#define HTTP_MAX_REQUESTS	1024
+#define HTTP_MAX_TRIES		2
+#define HTTP_MAX_HEADER		8192
+#define HTTP_TIMEOUT		15
+#define HTTP_CONNECT_TIMEOUT	10
+#define HTTP_IDLE_TIME		30
+#define HTTP_DNS_TIME		300
+#define HTTP_DNS_FAIL_TIME	30
+#define HTTP_READBUF		16384
+
+struct http_dns
+{
+	char *host;
+	struct sockaddr_storage addr;
+	bool ok;
+	time_t expires;
+	uint32_t xid;			/* the lookup running, if any */
+	rb_dlink_list waiting;		/* origins waiting for it */
+};
+
+struct http_origin
+{
+	char *key;			/* scheme://host:port */
+	char host[IRCD_RES_HOSTLEN + 1];
+	int port;
+	bool https;
+	bool resolving;
+	rb_dlink_list queue;		/* requests not sent yet */
+	rb_dlink_list conns;
+	rb_dlink_node dns_node;
+};
+
+enum http_phase
+{
+	HTTP_HEAD,
+	HTTP_BODY,
+	HTTP_TO_CLOSE,
+	HTTP_CHUNK_SIZE,
+	HTTP_CHUNK_DATA,
+	HTTP_CHUNK_END,
+	HTTP_TRAILER
+};
+
+struct http_conn
+{
+	struct http_origin *origin;
+	rb_fde_t *F;
+	rawbuf_head_t *out;
+	char *in;			/* read and not parsed yet, nul terminated */
+	size_t inlen;
+	size_t incap;
+	rb_dlink_list sent;		/* requests waiting for answers, oldest first */
+	time_t idle_since;
+	bool connecting;
+	bool reading;
+	bool reused;			/* has stayed open after a response */
+	bool close;			/* closes after this response */
+
+	/* the response being read */
+	enum http_phase phase;
+	int status;
+	uint64_t left;			/* body, or chunk, bytes to come */
+
+	rb_dlink_node node;
+	rb_dlink_node all_node;
+};
+
+struct http_request
+{
+	struct http_origin *origin;
+	struct http_conn *conn;		/* sent on, if it has been */
+	char *data;			/* the request, ready to write */
+	size_t len;
+	bool head;
+	unsigned int tries;
+	time_t deadline;
+
+	HTTPDATACB *datacb;
+	HTTPCB *callback;
+	void *arg;
+
+	char *body;
+	size_t body_len;
+	size_t body_cap;
+
+	rb_dlink_node node;		/* in the origin's queue, or conn's sent list */
+	rb_dlink_node all_node;
+};
+
+static rb_radixtree *http_origins;
+static rb_radixtree *http_dns_cache;
+static rb_dlink_list http_requests;	/* oldest, so first to time out, first */
+static rb_dlink_list http_conns;
+
+static void http_run(struct http_origin *origin);
+static void http_conn_close(struct http_conn *conn, const char *error);
+static void http_read(rb_fde_t *F, void *data);
+
+bool
+http_parse_url(const char *url, struct http_url *parsed)
+{
+	const char *p, *end, *host, *host_end, *s;
+	char *port_end;
+	long port;
+	size_t off;
+
+	memset(parsed, 0, sizeof(*parsed));
+
+	if(!strncasecmp(url, "https://", 8))
+	{
+		parsed->https = true;
+		parsed->port = 443;
+		p = url + 8;
+	}
+	else if(!strncasecmp(url, "http://", 7))
+	{
+		parsed->port = 80;
+		p = url + 7;
+	}
+	else
+		return false;
+
+	end = p + strcspn(p, "/?#");
+	host = p;
+
+	if(*p == '[')
+	{
+		/* [IPv6 address] */
+		host = p + 1;
+		if((host_end = memchr(host, ']', end - host)) == NULL)
+			return false;
+		p = host_end + 1;
+	}
+	else
+	{
+		if((host_end = memchr(host, ':', end - host)) == NULL)
+			host_end = end;
+		p = host_end;
+	}
+
+	if(host_end == host || host_end - host > IRCD_RES_HOSTLEN)
+		return false;
+	for(s = host; s < host_end; s++)
+		if(*s == '@' || (unsigned char)*s <= ' ')
+			return false;
+
+	memcpy(parsed->host, host, host_end - host);
+	parsed->host[host_end - host] = '\0';
+
+	if(*p == ':')
+	{
+		port = strtol(p + 1, &port_end, 10);
+		if(port_end != end || port < 1 || port > 65535)
+			return false;
+		parsed->port = port;
+	}
+	else if(p != end)
+		return false;
+
+	/* the path and query, without any fragment */
+	for(s = end; *s != '\0' && *s != '#'; s++)
+		if((unsigned char)*s <= ' ')
+			return false;
+
+	off = *end == '/' ? 0 : 1;
+	if((size_t)(s - end) + off >= sizeof(parsed->path))
+		return false;
+
+	parsed->path[0] = '/';
+	memcpy(parsed->path + off, end, s - end);
+	parsed->path[s - end + off] = '\0';
+	return true;
+}
+
+static void
+http_free(struct http_request *req)
+{
+	rb_dlinkDelete(&req->all_node, &http_requests);
+	rb_free(req->body);
+	rb_free(req->data);
+	rb_free(req);
+}
+
+/* end a request taken off its list, telling whoever made it */
+static void
+http_finish(struct http_request *req, int status, const char *error)
+{
+	struct http_response resp;
+
+	if(req->callback != NULL)
+	{
+		resp.status = status;
+		resp.error = error;
+		resp.body = status != 0 ? req->body : NULL;
+		resp.len = status != 0 ? req->body_len : 0;
+		req->callback(&resp, req->arg);
+	}
+
+	http_free(req);
+}
+
+static void
+http_fail_queue(struct http_origin *origin, const char *error)
+{
+	struct http_request *req;
+	rb_dlink_node *ptr;
+
+	while((ptr = origin->queue.head) != NULL)
+	{
+		req = ptr->data;
+		rb_dlinkDelete(ptr, &origin->queue);
+		http_finish(req, 0, error);
+	}
+}
+
+static void
+http_dns_done(const char *res, int status, int aftype, void *data)
+{
+	struct http_dns *dns = data;
+	struct http_origin *origin;
+	rb_dlink_node *ptr;
+
+	dns->xid = 0;
+
+	if(status == 0 || res == NULL || !rb_inet_pton_sock(res, &dns->addr))
+	{
+		/* no IPv6 address, so try for an IPv4 one */
+		if(aftype == AF_INET6 &&
+				(dns->xid = lookup_hostname(dns->host, AF_INET, http_dns_done, dns)) != 0)
+			return;
+
+		dns->ok = false;
+		dns->expires = rb_current_time() + HTTP_DNS_FAIL_TIME;
+	}
+	else
+	{
+		dns->ok = true;
+		dns->expires = rb_current_time() + HTTP_DNS_TIME;
+	}
+
+	while((ptr = dns->waiting.head) != NULL)
+	{
+		origin = ptr->data;
+		rb_dlinkDelete(ptr, &dns->waiting);
+		origin->resolving = false;
+		http_run(origin);
+	}
+}
+
+/* the origin's address, if it is known; if not, it is looked up */
+static bool
+http_resolve(struct http_origin *origin, struct sockaddr_storage *addr)
+{
+	struct http_dns *dns;
+
+	if(rb_inet_pton_sock(origin->host, addr))
+		return true;
+
+	if((dns = rb_radixtree_retrieve(http_dns_cache, origin->host)) == NULL)
+	{
+		dns = rb_malloc(sizeof(struct http_dns));
+		dns->host = rb_strdup(origin->host);
+		rb_radixtree_add(http_dns_cache, dns->host, dns);
+	}
+
+	if(dns->xid == 0 && dns->expires > rb_current_time())
+	{
+		if(dns->ok)
+		{
+			memcpy(addr, &dns->addr, sizeof(*addr));
+			return true;
+		}
+
+		http_fail_queue(origin, "could not resolve host");
+		return false;
+	}
+
+	if(dns->xid == 0)
+	{
+		dns->xid = lookup_hostname(dns->host, AF_INET6, http_dns_done, dns);
+		if(dns->xid == 0)
+			dns->xid = lookup_hostname(dns->host, AF_INET, http_dns_done, dns);
+		if(dns->xid == 0)
+		{
+			http_fail_queue(origin, "could not resolve host");
+			return false;
+		}
+	}
+
+	if(!origin->resolving)
+	{
+		origin->resolving = true;
+		rb_dlinkAdd(origin, &origin->dns_node, &dns->waiting);
+	}
+
+	return false;
+}
+
+static void
+http_connected(rb_fde_t *F, int status, void *data)
+{
+	struct http_conn *conn = data;
+	struct http_origin *origin = conn->origin;
+	struct http_dns *dns;
+
+	if(status != RB_OK)
+	{
+		/* look the host up again next time, in case it has moved */
+		if((dns = rb_radixtree_retrieve(http_dns_cache, origin->host)) != NULL)
+			dns->expires = 0;
+
+		http_conn_close(conn, rb_errstr(status));
+		http_fail_queue(origin, rb_errstr(status));
+		return;
+	}
+
+	conn->connecting = false;
+	conn->idle_since = rb_current_time();
+	rb_setselect(F, RB_SELECT_READ, http_read, conn);
+	http_run(origin);
+}
+
+static void
+http_open(struct http_origin *origin, struct sockaddr_storage *addr)
+{
+	struct http_conn *conn;
+	rb_fde_t *F;
+
+	SET_SS_PORT(addr, htons(origin->port));
+
+	if((F = rb_socket(GET_SS_FAMILY(addr), SOCK_STREAM, IPPROTO_TCP, "HTTP client")) == NULL)
+	{
+		http_fail_queue(origin, "could not create socket");
+		return;
+	}
+
+	conn = rb_malloc(sizeof(struct http_conn));
+	conn->origin = origin;
+	conn->F = F;
+	conn->out = rb_new_rawbuffer();
+	conn->connecting = true;
+	conn->phase = HTTP_HEAD;
+	rb_dlinkAdd(conn, &conn->node, &origin->conns);
+	rb_dlinkAdd(conn, &conn->all_node, &http_conns);
+
+	if(origin->https)
+		rb_connect_tcp_ssl(F, (struct sockaddr *)addr, NULL, http_connected, conn, HTTP_CONNECT_TIMEOUT);
+	else
+		rb_connect_tcp(F, (struct sockaddr *)addr, NULL, http_connected, conn, HTTP_CONNECT_TIMEOUT);
+}
+
+static void
+http_conn_close(struct http_conn *conn, const char *error)
+{
+	struct http_origin *origin = conn->origin;
+	struct http_request *req;
+	rb_dlink_node *ptr;
+	bool started = conn->phase != HTTP_HEAD || conn->inlen > 0;
+	bool first, requeued = false;
+
+	rb_dlinkDelete(&conn->node, &origin->conns);
+	rb_dlinkDelete(&conn->all_node, &http_conns);
+	rb_close(conn->F);
+	rb_free_rawbuffer(conn->out);
+	rb_free(conn->in);
+
+	/* put back what was never answered, from the newest, so the queue
+	 * keeps its order */
+	while((ptr = conn->sent.tail) != NULL)
+	{
+		req = ptr->data;
+		first = ptr == conn->sent.head;
+		rb_dlinkDelete(ptr, &conn->sent);
+		req->conn = NULL;
+
+		if((first && started) || req->tries >= HTTP_MAX_TRIES)
+			http_finish(req, 0, error);
+		else
+		{
+			rb_dlinkAdd(req, &req->node, &origin->queue);
+			requeued = true;
+		}
+	}
+
+	rb_free(conn);
+
+	if(requeued)
+		http_run(origin);
+}
+
+/* make room under HTTP_MAX_CONNS by closing the connection idle longest */
+static bool
+http_close_idle(void)
+{
+	struct http_conn *conn, *oldest = NULL;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, http_conns.head)
+	{
+		conn = ptr->data;
+		if(conn->connecting || conn->reading || conn->sent.head != NULL)
+			continue;
+		if(oldest == NULL || conn->idle_since < oldest->idle_since)
+			oldest = conn;
+	}
+
+	if(oldest == NULL)
+		return false;
+
+	http_conn_close(oldest, NULL);
+	return true;
+}
+
+static void
+http_write(rb_fde_t *F, void *data)
+{
+	struct http_conn *conn = data;
+	int ret;
+
+	while(rb_rawbuf_length(conn->out) > 0)
+	{
+		ret = rb_rawbuf_flush(conn->out, F);
+		if(ret > 0)
+			continue;
+
+		if(ret < 0 && rb_ignore_errno(errno))
+			rb_setselect(F, RB_SELECT_WRITE, http_write, conn);
+		else
+			http_conn_close(conn, "write error");
+		return;
+	}
+}
+
+static void
+http_send(struct http_conn *conn, struct http_request *req)
+{
+	rb_dlinkDelete(&req->node, &conn->origin->queue);
+	rb_dlinkAddTail(req, &req->node, &conn->sent);
+	req->conn = conn;
+	req->tries++;
+
+	/* written from the event loop, so requests sent together go out together */
+	rb_rawbuf_append(conn->out, req->data, req->len);
+	rb_setselect(conn->F, RB_SELECT_WRITE, http_write, conn);
+}
+
+static void
+http_fill(struct http_origin *origin, bool pipeline)
+{
+	struct http_conn *conn;
+	rb_dlink_node *ptr;
+	unsigned int room;
+
+	RB_DLINK_FOREACH(ptr, origin->conns.head)
+	{
+		conn = ptr->data;
+		if(conn->connecting || conn->close)
+			continue;
+
+		room = pipeline && conn->reused ? HTTP_MAX_PIPELINE : 1;
+		while(origin->queue.head != NULL && rb_dlink_list_length(&conn->sent) < room)
+			http_send(conn, origin->queue.head->data);
+	}
+}
+
+/* send what an origin has waiting, opening connections as needed */
+static void
+http_run(struct http_origin *origin)
+{
+	struct sockaddr_storage addr;
+	rb_dlink_node *ptr;
+	unsigned int connecting = 0;
+
+	/* idle connections first, then ones known to keep alive */
+	http_fill(origin, false);
+	http_fill(origin, true);
+
+	RB_DLINK_FOREACH(ptr, origin->conns.head)
+	{
+		struct http_conn *conn = ptr->data;
+
+		if(conn->connecting)
+			connecting++;
+	}
+
+	while(rb_dlink_list_length(&origin->queue) > connecting &&
+			rb_dlink_list_length(&origin->conns) < HTTP_MAX_ORIGIN_CONNS)
+	{
+		if(rb_dlink_list_length(&http_conns) >= HTTP_MAX_CONNS && !http_close_idle())
+			return;
+
+		if(!http_resolve(origin, &addr))
+			return;
+
+		http_open(origin, &addr);
+		connecting++;
+	}
+}
+
+static void
+http_consume(struct http_conn *conn, size_t len)
+{
+	conn->inlen -= len;
+	memmove(conn->in, conn->in + len, conn->inlen + 1);
+}
+
+/* the response to the oldest request is over; false if conn went with it */
+static bool
+http_done(struct http_conn *conn, struct http_request *req, int status, const char *error)
+{
+	bool close = conn->close || error != NULL;
+
+	rb_dlinkDelete(&req->node, &conn->sent);
+	req->conn = NULL;
+	conn->phase = HTTP_HEAD;
+
+	if(!close)
+	{
+		conn->reused = true;
+		if(conn->sent.head == NULL)
+			conn->idle_since = rb_current_time();
+	}
+
+	http_finish(req, status, error);
+
+	if(close)
+	{
+		http_conn_close(conn, "connection closed");
+		return false;
+	}
+
+	http_run(conn->origin);
+	return true;
+}
+
+/* hand on the first len bytes read as body */
+static bool
+http_deliver(struct http_conn *conn, struct http_request *req, size_t len)
+{
+	if(req->datacb != NULL)
+	{
+		if(!req->datacb(conn->in, len, req->arg))
+		{
+			/* the rest is unwanted, and so is this connection */
+			conn->close = true;
+			return http_done(conn, req, conn->status, NULL);
+		}
+	}
+	else if(req->callback != NULL)
+	{
+		if(req->body_len + len > HTTP_MAX_BODY)
+			return http_done(conn, req, 0, "response too large");
+
+		if(req->body_len + len + 1 > req->body_cap)
+		{
+			req->body_cap = MAX(req->body_cap * 2, req->body_len + len + 1);
+			req->body = rb_realloc(req->body, req->body_cap);
+		}
+
+		memcpy(req->body + req->body_len, conn->in, len);
+		req->body_len += len;
+		req->body[req->body_len] = '\0';
+	}
+
+	http_consume(conn, len);
+	return true;
+}
+
+static bool
+http_parse_head(struct http_conn *conn, struct http_request *req, char *head)
+{
+	char *line, *next, *value, *end;
+	uint64_t len = 0;
+	bool chunked = false, have_len = false;
+	int minor;
+
+	if(sscanf(head, "HTTP/1.%d %3d", &minor, &conn->status) != 2 ||
+			conn->status < 100 || conn->status > 999)
+		return false;
+
+	/* HTTP/1.0 servers close unless they say otherwise */
+	conn->close = minor == 0;
+
+	for(line = strstr(head, "\r\n"); line != NULL; line = next)
+	{
+		line += 2;
+		if((next = strstr(line, "\r\n")) != NULL)
+			*next = '\0';
+
+		if((value = strchr(line, ':')) == NULL)
+			continue;
+		*value++ = '\0';
+		value += strspn(value, " \t");
+
+		if(!strcasecmp(line, "Content-Length"))
+		{
+			len = strtoull(value, &end, 10);
+			if(end == value)
+				return false;
+			have_len = true;
+		}
+		else if(!strcasecmp(line, "Transfer-Encoding"))
+			chunked = rb_strcasestr(value, "chunked") != NULL;
+		else if(!strcasecmp(line, "Connection"))
+		{
+			if(rb_strcasestr(value, "close") != NULL)
+				conn->close = true;
+			else if(rb_strcasestr(value, "keep-alive") != NULL)
+				conn->close = false;
+		}
+	}
+
+	/* an interim response: the real one follows */
+	if(conn->status < 200)
+		return true;
+
+	if(req->head || conn->status == 204 || conn->status == 304)
+	{
+		conn->phase = HTTP_BODY;
+		conn->left = 0;
+	}
+	else if(chunked)
+		conn->phase = HTTP_CHUNK_SIZE;
+	else if(have_len)
+	{
+		conn->phase = HTTP_BODY;
+		conn->left = len;
+	}
+	else
+	{
+		conn->phase = HTTP_TO_CLOSE;
+		conn->close = true;
+	}
+
+	return true;
+}
+
+/* work through what has been read; false if conn has been closed */
+static bool
+http_parse(struct http_conn *conn)
+{
+	struct http_request *req;
+	char *end;
+	size_t len;
+	bool last;
+
+	for(;;)
+	{
+		if(conn->sent.head == NULL)
+		{
+			if(conn->inlen == 0)
+				return true;
+
+			http_conn_close(conn, "unexpected data");
+			return false;
+		}
+
+		req = conn->sent.head->data;
+
+		switch(conn->phase)
+		{
+		case HTTP_HEAD:
+			if((end = strstr(conn->in, "\r\n\r\n")) == NULL)
+			{
+				if(conn->inlen <= HTTP_MAX_HEADER)
+					return true;
+				http_conn_close(conn, "response header too long");
+				return false;
+			}
+
+			*end = '\0';
+			if(!http_parse_head(conn, req, conn->in))
+			{
+				http_conn_close(conn, "bad response");
+				return false;
+			}
+			http_consume(conn, end + 4 - conn->in);
+			break;
+
+		case HTTP_BODY:
+			len = MIN(conn->left, conn->inlen);
+			if(len > 0 && !http_deliver(conn, req, len))
+				return false;
+			conn->left -= len;
+
+			if(conn->left > 0)
+				return true;
+			if(!http_done(conn, req, conn->status, NULL))
+				return false;
+			break;
+
+		case HTTP_TO_CLOSE:
+			if(conn->inlen > 0 && !http_deliver(conn, req, conn->inlen))
+				return false;
+			return true;
+
+		case HTTP_CHUNK_SIZE:
+			if((end = strstr(conn->in, "\r\n")) == NULL)
+			{
+				if(conn->inlen <= HTTP_MAX_HEADER)
+					return true;
+				http_conn_close(conn, "bad chunk");
+				return false;
+			}
+
+			conn->left = strtoull(conn->in, &end, 16);
+			if(end == conn->in)
+			{
+				http_conn_close(conn, "bad chunk");
+				return false;
+			}
+
+			http_consume(conn, strstr(conn->in, "\r\n") + 2 - conn->in);
+			conn->phase = conn->left > 0 ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+			break;
+
+		case HTTP_CHUNK_DATA:
+			len = MIN(conn->left, conn->inlen);
+			if(len > 0 && !http_deliver(conn, req, len))
+				return false;
+			conn->left -= len;
+
+			if(conn->left > 0)
+				return true;
+			conn->phase = HTTP_CHUNK_END;
+			break;
+
+		case HTTP_CHUNK_END:
+			if(conn->inlen < 2)
+				return true;
+			if(conn->in[0] != '\r' || conn->in[1] != '\n')
+			{
+				http_conn_close(conn, "bad chunk");
+				return false;
+			}
+
+			http_consume(conn, 2);
+			conn->phase = HTTP_CHUNK_SIZE;
+			break;
+
+		case HTTP_TRAILER:
+			if((end = strstr(conn->in, "\r\n")) == NULL)
+			{
+				if(conn->inlen <= HTTP_MAX_HEADER)
+					return true;
+				http_conn_close(conn, "bad chunk");
+				return false;
+			}
+
+			last = end == conn->in;
+			http_consume(conn, end + 2 - conn->in);
+			if(last && !http_done(conn, req, conn->status, NULL))
+				return false;
+			break;
+		}
+	}
+}
+
+static void
+http_eof(struct http_conn *conn)
+{
+	struct http_request *req;
+
+	/* a body without a length ends with the connection */
+	if(conn->phase == HTTP_TO_CLOSE && conn->sent.head != NULL)
+	{
+		req = conn->sent.head->data;
+		http_done(conn, req, conn->status, NULL);
+		return;
+	}
+
+	http_conn_close(conn, "connection closed");
+}
+
+static void
+http_read(rb_fde_t *F, void *data)
+{
+	struct http_conn *conn = data;
+	char buf[HTTP_READBUF];
+	ssize_t len;
+
+	/* keeps http_close_idle() away while callbacks run */
+	conn->reading = true;
+
+	for(;;)
+	{
+		len = rb_read(F, buf, sizeof(buf));
+
+		if(len < 0 && rb_ignore_errno(errno))
+		{
+			conn->reading = false;
+			rb_setselect(F, RB_SELECT_READ, http_read, conn);
+			return;
+		}
+
+		if(len <= 0)
+		{
+			http_eof(conn);
+			return;
+		}
+
+		if(conn->inlen + len + 1 > conn->incap)
+		{
+			conn->incap = MAX(conn->incap * 2, conn->inlen + len + 1);
+			conn->in = rb_realloc(conn->in, conn->incap);
+		}
+
+		memcpy(conn->in + conn->inlen, buf, len);
+		conn->inlen += len;
+		conn->in[conn->inlen] = '\0';
+
+		if(!http_parse(conn))
+			return;
+	}
+}
+
+static void
+http_expire(void *unused)
+{
+	struct http_request *req;
+	struct http_conn *conn;
+	struct http_origin *origin;
+	struct http_dns *dns;
+	rb_radixtree_iteration_state iter;
+	rb_dlink_list idle = { NULL, NULL, 0 };
+	rb_dlink_node *ptr, *next_ptr;
+	time_t now = rb_current_time();
+
+	/* all requests get the same time, so the oldest are first */
+	while((ptr = http_requests.head) != NULL &&
+			(req = ptr->data)->deadline <= now)
+	{
+		if((conn = req->conn) != NULL)
+		{
+			/* nothing after it on the connection can be read now */
+			rb_dlinkDelete(&req->node, &conn->sent);
+			req->conn = NULL;
+			conn->phase = HTTP_HEAD;
+			conn->inlen = 0;
+			http_conn_close(conn, "timed out");
+		}
+		else
+			rb_dlinkDelete(&req->node, &req->origin->queue);
+
+		http_finish(req, 0, "timed out");
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, http_conns.head)
+	{
+		conn = ptr->data;
+		if(!conn->connecting && conn->sent.head == NULL &&
+				conn->idle_since + HTTP_IDLE_TIME <= now)
+			http_conn_close(conn, NULL);
+	}
+
+	/* forget idle origins, and retry those held up by HTTP_MAX_CONNS */
+	RB_RADIXTREE_FOREACH(origin, &iter, http_origins)
+	{
+		if(origin->resolving)
+			continue;
+		if(origin->queue.head != NULL || origin->conns.head == NULL)
+			rb_dlinkAddAlloc(origin, &idle);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, idle.head)
+	{
+		origin = ptr->data;
+		rb_dlinkDestroy(ptr, &idle);
+
+		if(origin->queue.head != NULL)
+			http_run(origin);
+		else if(origin->conns.head == NULL && !origin->resolving)
+		{
+			rb_radixtree_delete(http_origins, origin->key);
+			rb_free(origin->key);
+			rb_free(origin);
+		}
+	}
+
+	RB_RADIXTREE_FOREACH(dns, &iter, http_dns_cache)
+	{
+		if(dns->xid == 0 && dns->expires <= now)
+			rb_dlinkAddAlloc(dns, &idle);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, idle.head)
+	{
+		dns = ptr->data;
+		rb_dlinkDestroy(ptr, &idle);
+		rb_radixtree_delete(http_dns_cache, dns->host);
+		rb_free(dns->host);
+		rb_free(dns);
+	}
+}
+
+bool
+http_request(const char *method, const char *url,
+		const char *content_type, const char *body, size_t len,
+		HTTPDATACB *datacb, HTTPCB *callback, void *arg)
+{
+	struct http_url parsed;
+	struct http_origin *origin;
+	struct http_request *req;
+	char key[IRCD_RES_HOSTLEN + 32];
+	char host[IRCD_RES_HOSTLEN + 16];
+	char head[BUFSIZE * 3];
+
+	if(!http_parse_url(url, &parsed) || (parsed.https && !rb_supports_ssl()))
+		return false;
+
+	if(rb_dlink_list_length(&http_requests) >= HTTP_MAX_REQUESTS)
+		return false;
+
+	snprintf(key, sizeof(key), "%s://%s:%d", parsed.https ? "https" : "http",
+			parsed.host, parsed.port);
+	if((origin = rb_radixtree_retrieve(http_origins, key)) == NULL)
+	{
+		origin = rb_malloc(sizeof(struct http_origin));
+		origin->key = rb_strdup(key);
+		rb_strlcpy(origin->host, parsed.host, sizeof(origin->host));
+		origin->port = parsed.port;
+		origin->https = parsed.https;
+		rb_radixtree_add(http_origins, origin->key, origin);
+	}
+
+	/* IPv6 addresses are bracketed, and only unusual ports given */
+	snprintf(host, sizeof(host), strchr(parsed.host, ':') != NULL ? "[%s]" : "%s", parsed.host);
+	if(parsed.port != (parsed.https ? 443 : 80))
+		rb_snprintf_append(host, sizeof(host), ":%d", parsed.port);
+
+	snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: %s\r\n",
+			method, parsed.path, host, ircd_version);
+	if(body != NULL)
+		rb_snprintf_append(head, sizeof(head), "Content-Type: %s\r\nContent-Length: %zu\r\n",
+				content_type != NULL ? content_type : "application/octet-stream", len);
+	rb_strlcat(head, "\r\n", sizeof(head));
+
+	req = rb_malloc(sizeof(struct http_request));
+	req->origin = origin;
+	req->len = strlen(head) + (body != NULL ? len : 0);
+	req->data = rb_malloc(req->len);
+	memcpy(req->data, head, strlen(head));
+	if(body != NULL)
+		memcpy(req->data + strlen(head), body, len);
+	req->head = !strcmp(method, "HEAD");
+	req->deadline = rb_current_time() + HTTP_TIMEOUT;
+	req->datacb = datacb;
+	req->callback = callback;
+	req->arg = arg;
+
+	rb_dlinkAddTail(req, &req->all_node, &http_requests);
+	rb_dlinkAddTail(req, &req->node, &origin->queue);
+	http_run(origin);
+	return true;
+}
+
+void
+http_cancel_callback(HTTPCB *callback)
+{
+	struct http_request *req;
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, http_requests.head)
+	{
+		req = ptr->data;
+		if(req->callback != callback)
+			continue;
+
+		if(req->conn == NULL)
+		{
+			rb_dlinkDelete(&req->node, &req->origin->queue);
+			http_free(req);
+		}
+		else
+		{
+			/* its answer is on the way, and has to be read past */
+			req->datacb = NULL;
+			req->callback = NULL;
+		}
+	}
+}
+
+void
+init_http(void)
+{
+	rb_init_rawbuffers(64);
+	http_origins = rb_radixtree_create_casemap("http origins", irctoupper_tab);
+	http_dns_cache = rb_radixtree_create_casemap("http dns cache", irctoupper_tab);
+	rb_event_add("http_expire", http_expire, NULL, 1);
+}
@@ -0,0 +1,362 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  httpqueue.c: Batched, bounded queues of events posted over HTTP.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "ircd.h"
+#include "logger.h"
+#include "httpclient.h"
+#include "httpqueue.h"
+
+/*
+ * Each queue has at most one request out at a time, so however busy
+ * the network gets an endpoint costs one connection.  Items wait until
+ * a batch is full or the oldest has waited the format's window, and are
+ * then joined into one body.  When the queue is full new items are
+ * dropped, and the next batch starts with an item saying how many.
+ *
+ * A batch that gets no answer, a 429 or a 5xx is sent again after
+ * HTTP_QUEUE_BACKOFF seconds, doubling each time up to
+ * HTTP_QUEUE_MAX_BACKOFF, and given up on after HTTP_QUEUE_TRIES.
+ */
+#define HTTP_QUEUE_TRIES	5
+#define HTTP_QUEUE_BACKOFF	1
+#define HTTP_QUEUE_MAX_BACKOFF	60
+
+struct http_queue_item
+{
+	char *data;
+	size_t len;
+	time_t added;
+	rb_dlink_node node;
+};
+
+struct http_queue
+{
+	char *name;
+	char *url;
+	char origin[IRCD_RES_HOSTLEN + 16];
+	const struct http_batch_format *format;
+
+	rb_dlink_list items;
+	size_t bytes;
+	unsigned int pending_drops;	/* not reported yet */
+
+	/* the batch being sent, or waiting to be sent again */
+	char *body;
+	size_t body_len;
+	unsigned int body_items;
+	bool sending;
+	unsigned int tries;
+	time_t retry_at;
+	bool dead;
+
+	unsigned long sent;
+	unsigned long dropped;
+	unsigned long failed;
+
+	rb_dlink_node node;
+};
+
+static rb_dlink_list http_queues;
+
+static void http_queue_run(struct http_queue *queue);
+
+static void
+free_queue(struct http_queue *queue)
+{
+	rb_free(queue->body);
+	rb_free(queue->name);
+	rb_free(queue->url);
+	rb_free(queue);
+}
+
+static void
+free_batch(struct http_queue *queue)
+{
+	rb_free(queue->body);
+	queue->body = NULL;
+	queue->body_len = 0;
+	queue->body_items = 0;
+	queue->tries = 0;
+}
+
+static void
+http_queue_done(const struct http_response *resp, void *arg)
+{
+	struct http_queue *queue = arg;
+	time_t backoff;
+
+	queue->sending = false;
+
+	if(queue->dead)
+	{
+		free_queue(queue);
+		return;
+	}
+
+	if(resp->status >= 200 && resp->status < 300)
+	{
+		queue->sent += queue->body_items;
+		free_batch(queue);
+		http_queue_run(queue);
+		return;
+	}
+
+	if((resp->status == 0 || resp->status == 429 || resp->status >= 500) &&
+			++queue->tries < HTTP_QUEUE_TRIES)
+	{
+		backoff = HTTP_QUEUE_BACKOFF << (queue->tries - 1);
+		if(backoff > HTTP_QUEUE_MAX_BACKOFF)
+			backoff = HTTP_QUEUE_MAX_BACKOFF;
+		queue->retry_at = rb_current_time() + backoff;
+		return;
+	}
+
+	if(resp->status == 0)
+		ilog(L_MAIN, "%s: giving up on %u events for %s: %s",
+			queue->name, queue->body_items, queue->origin, resp->error);
+	else
+		ilog(L_MAIN, "%s: giving up on %u events for %s: HTTP status %d",
+			queue->name, queue->body_items, queue->origin, resp->status);
+
+	queue->failed += queue->body_items;
+	free_batch(queue);
+}
+
+static void
+http_queue_send(struct http_queue *queue)
+{
+	static const struct http_response full = { 0, "too many requests waiting", NULL, 0 };
+
+	queue->sending = true;
+	if(!http_request("POST", queue->url, queue->format->content_type,
+			queue->body, queue->body_len, NULL, http_queue_done, queue))
+		http_queue_done(&full, queue);
+}
+
+static bool
+batch_ready(struct http_queue *queue)
+{
+	const struct http_batch_format *format = queue->format;
+	struct http_queue_item *item;
+
+	if(rb_dlink_list_length(&queue->items) >= format->max_items ||
+			queue->bytes >= format->max_bytes)
+		return true;
+
+	item = queue->items.head->data;
+	return rb_current_time() - item->added >= format->window;
+}
+
+/* join the first items that fit into the next body */
+static void
+make_batch(struct http_queue *queue)
+{
+	const struct http_batch_format *format = queue->format;
+	size_t prefix_len = strlen(format->prefix);
+	size_t sep_len = strlen(format->separator);
+	size_t suffix_len = strlen(format->suffix);
+	char note[128];
+	size_t note_len = 0, len;
+	unsigned int count = 0, n;
+	rb_dlink_node *ptr, *next;
+	char *p;
+
+	if(queue->pending_drops > 0 && format->dropped != NULL)
+	{
+		note_len = snprintf(note, sizeof(note), format->dropped, queue->pending_drops);
+		if(note_len >= sizeof(note))
+			note_len = sizeof(note) - 1;
+		count++;
+	}
+	queue->pending_drops = 0;
+
+	len = prefix_len + note_len + suffix_len;
+	RB_DLINK_FOREACH(ptr, queue->items.head)
+	{
+		struct http_queue_item *item = ptr->data;
+		size_t need = item->len + (count > 0 ? sep_len : 0);
+
+		if(count >= format->max_items ||
+				(count > 0 && len + need > format->max_bytes))
+			break;
+
+		len += need;
+		count++;
+	}
+
+	queue->body = p = rb_malloc(len + 1);
+	queue->body_len = len;
+	queue->body_items = 0;
+
+	memcpy(p, format->prefix, prefix_len);
+	p += prefix_len;
+	memcpy(p, note, note_len);
+	p += note_len;
+	n = note_len > 0 ? 1 : 0;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, queue->items.head)
+	{
+		struct http_queue_item *item = ptr->data;
+
+		if(n >= count)
+			break;
+
+		if(n++ > 0)
+		{
+			memcpy(p, format->separator, sep_len);
+			p += sep_len;
+		}
+		memcpy(p, item->data, item->len);
+		p += item->len;
+
+		queue->bytes -= item->len;
+		queue->body_items++;
+		rb_dlinkDelete(ptr, &queue->items);
+		rb_free(item->data);
+		rb_free(item);
+	}
+
+	memcpy(p, format->suffix, suffix_len);
+	p[suffix_len] = '\0';
+}
+
+static void
+http_queue_run(struct http_queue *queue)
+{
+	if(queue->sending)
+		return;
+
+	if(queue->body != NULL)
+	{
+		if(rb_current_time() >= queue->retry_at)
+			http_queue_send(queue);
+		return;
+	}
+
+	if(rb_dlink_list_length(&queue->items) == 0 || !batch_ready(queue))
+		return;
+
+	make_batch(queue);
+	http_queue_send(queue);
+}
+
+static void
+http_queue_expire(void *unused)
+{
+	rb_dlink_node *ptr, *next;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, http_queues.head)
+		http_queue_run(ptr->data);
+}
+
+struct http_queue *
+http_queue_create(const char *name, const char *url, const struct http_batch_format *format)
+{
+	struct http_queue *queue;
+	struct http_url parsed;
+
+	if(!http_parse_url(url, &parsed))
+		return NULL;
+
+	queue = rb_malloc(sizeof(struct http_queue));
+	queue->name = rb_strdup(name);
+	queue->url = rb_strdup(url);
+	queue->format = format;
+	snprintf(queue->origin, sizeof(queue->origin), "%s://%s:%d",
+		parsed.https ? "https" : "http", parsed.host, parsed.port);
+
+	rb_dlinkAddTail(queue, &queue->node, &http_queues);
+	return queue;
+}
+
+void
+http_queue_destroy(struct http_queue *queue)
+{
+	rb_dlink_node *ptr, *next;
+
+	if(queue == NULL)
+		return;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, queue->items.head)
+	{
+		struct http_queue_item *item = ptr->data;
+
+		rb_free(item->data);
+		rb_free(item);
+	}
+
+	rb_dlinkDelete(&queue->node, &http_queues);
+
+	/* the request still points at it, so its callback frees it */
+	if(queue->sending)
+	{
+		queue->dead = true;
+		return;
+	}
+
+	free_queue(queue);
+}
+
+bool
+http_queue_add(struct http_queue *queue, const char *data)
+{
+	struct http_queue_item *item;
+	size_t len = strlen(data);
+
+	if(rb_dlink_list_length(&queue->items) >= HTTP_QUEUE_MAX_ITEMS ||
+			queue->bytes + len > HTTP_QUEUE_MAX_BYTES)
+	{
+		queue->dropped++;
+		queue->pending_drops++;
+		return false;
+	}
+
+	item = rb_malloc(sizeof(struct http_queue_item));
+	item->data = rb_strdup(data);
+	item->len = len;
+	item->added = rb_current_time();
+	rb_dlinkAddTail(item, &item->node, &queue->items);
+	queue->bytes += len;
+
+	http_queue_run(queue);
+	return true;
+}
+
+void
+http_queue_stats(HTTPQUEUECB *callback, void *arg)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, http_queues.head)
+	{
+		struct http_queue *queue = ptr->data;
+
+		callback(queue->name, queue->origin,
+			rb_dlink_list_length(&queue->items), queue->body_items,
+			queue->sent, queue->dropped, queue->failed, arg);
+	}
+}
+
+void
+init_http_queues(void)
+{
+	rb_event_add("http_queue_expire", http_queue_expire, NULL, 1);
+}
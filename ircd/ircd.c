@@ -64,6 +64,9 @@
 #include "bandbi.h"
 #include "authproc.h"
 #include "operhash.h"
+#include "history.h"
+#include "httpclient.h"
+#include "httpqueue.h"
 
 static void
 ircd_die_cb(const char *str) __attribute__((noreturn));
@@ -131,6 +134,7 @@ const char *ircd_paths[IRCD_PATH_COUNT] = {
 	[IRCD_PATH_IRCD_PID] = PPATH,
 	[IRCD_PATH_IRCD_OMOTD] = OPATH,
 	[IRCD_PATH_BANDB] = DBPATH,
+	[IRCD_PATH_HISTORY] = HISTORYPATH,
 	[IRCD_PATH_BIN] = BINPATH,
 	[IRCD_PATH_LIBEXEC] = PKGLIBEXECDIR,
 };
@@ -150,6 +154,7 @@ const char *ircd_pathnames[IRCD_PATH_COUNT] = {
 	[IRCD_PATH_IRCD_PID] = "ircd.pid",
 	[IRCD_PATH_IRCD_OMOTD] = "oper motd",
 	[IRCD_PATH_BANDB] = "bandb",
+	[IRCD_PATH_HISTORY] = "history log",
 	[IRCD_PATH_BIN] = "binary dir",
 	[IRCD_PATH_LIBEXEC] = "libexec dir",
 };
@@ -179,6 +184,9 @@ ircd_shutdown(const char *reason)
 			me.name, reason);
 	}
 
+	/* the loop won't run again to write these out */
+	send_flush_all();
+
 	ilog(L_MAIN, "Server Terminating. %s", reason);
 	close_logfiles();
 
@@ -642,6 +650,7 @@ comet_main(int argc, char * const argv[])
 	init_client();
 	init_hook();
 	init_channels();
+	init_history();
 	initclass();
 	whowas_init();
 	init_reject();
@@ -652,6 +661,8 @@ comet_main(int argc, char * const argv[])
 
 	init_authd();		/* Start up authd. */
 	init_dns();		/* Start up DNS query system */
+	init_http();		/* Start up the HTTP client */
+	init_http_queues();	/* and the queues posted through it */
 	init_modules();		/* Start up modules system */
 
 	privilegeset_set_new("default", "", 0);
@@ -733,6 +744,7 @@ comet_main(int argc, char * const argv[])
 	open_logfiles();
 
 	configure_authd();
+	init_history_log();
 
 	ilog(L_MAIN, "Server Ready");
 
@@ -0,0 +1,148 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  masktrie.c: Candidate lookup for lists of wildcard masks.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "match.h"
+#include "masktrie.h"
+
+struct mask_node
+{
+	struct mask_node *child;
+	struct mask_node *next;
+	unsigned int *ids;
+	unsigned int nids;
+	unsigned int maxids;
+	unsigned char c;
+};
+
+struct mask_trie
+{
+	struct mask_node root;
+	bool reverse;
+};
+
+struct mask_trie *
+mask_trie_create(bool reverse)
+{
+	struct mask_trie *trie = rb_malloc(sizeof(struct mask_trie));
+
+	trie->reverse = reverse;
+	return trie;
+}
+
+static void
+free_mask_nodes(struct mask_node *node)
+{
+	struct mask_node *next;
+
+	for(; node != NULL; node = next)
+	{
+		next = node->next;
+		free_mask_nodes(node->child);
+		rb_free(node->ids);
+		rb_free(node);
+	}
+}
+
+void
+mask_trie_destroy(struct mask_trie *trie)
+{
+	if(trie == NULL)
+		return;
+
+	free_mask_nodes(trie->root.child);
+	rb_free(trie->root.ids);
+	rb_free(trie);
+}
+
+void
+mask_trie_add(struct mask_trie *trie, const char *key, size_t len, unsigned int id)
+{
+	struct mask_node *node = &trie->root;
+	struct mask_node *child;
+	size_t i;
+
+	for(i = 0; i < len; i++)
+	{
+		unsigned char c = irctolower(key[trie->reverse ? len - i - 1 : i]);
+
+		for(child = node->child; child != NULL; child = child->next)
+			if(child->c == c)
+				break;
+
+		if(child == NULL)
+		{
+			child = rb_malloc(sizeof(struct mask_node));
+			child->c = c;
+			child->next = node->child;
+			node->child = child;
+		}
+
+		node = child;
+	}
+
+	if(node->nids == node->maxids)
+	{
+		node->maxids = node->maxids ? node->maxids * 2 : 4;
+		node->ids = rb_realloc(node->ids, node->maxids * sizeof(unsigned int));
+	}
+
+	node->ids[node->nids++] = id;
+}
+
+static inline unsigned int
+try_mask_ids(struct mask_node *node, unsigned int best, mask_trie_test *test, void *data)
+{
+	unsigned int i;
+
+	/* ids are added in increasing order, so nothing past best can win */
+	for(i = 0; i < node->nids && node->ids[i] < best; i++)
+		if(test(node->ids[i], data))
+			return node->ids[i];
+
+	return best;
+}
+
+unsigned int
+mask_trie_find(struct mask_trie *trie, const char *name, unsigned int best,
+		mask_trie_test *test, void *data)
+{
+	struct mask_node *node = &trie->root;
+	size_t len = strlen(name);
+	size_t i;
+
+	best = try_mask_ids(node, best, test, data);
+
+	for(i = 0; i < len; i++)
+	{
+		unsigned char c = irctolower(name[trie->reverse ? len - i - 1 : i]);
+
+		for(node = node->child; node != NULL; node = node->next)
+			if(node->c == c)
+				break;
+
+		if(node == NULL)
+			break;
+
+		best = try_mask_ids(node, best, test, data);
+	}
+
+	return best;
+}
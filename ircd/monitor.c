@@ -42,7 +42,7 @@ static rb_radixtree *monitor_tree;
 void
 init_monitor(void)
 {
-	monitor_tree = rb_radixtree_create("monitor lists", irccasecanon);
+	monitor_tree = rb_radixtree_create_casemap("monitor lists", irctoupper_tab);
 }
 
 struct monitor *
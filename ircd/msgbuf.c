@@ -47,36 +47,75 @@ static const char tag_unescape_table[256] = {
 	/* 7x */   0,   0,'\r', ' ',   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
 };
 
+/*
+ * unescape a value in place, from its first '\\' to end, its '\0'
+ */
 static void
-msgbuf_unescape_value(char *value)
+msgbuf_unescape_value(char *esc, char *end)
 {
-	char *in = value;
-	char *out = value;
+	char *in = esc;
+	char *out = esc;
+	size_t run;
 
-	if (value == NULL)
-		return;
+	while (*in == '\\') {
+		const char unescape = tag_unescape_table[(unsigned char)*++in];
 
-	while (*in != '\0') {
-		if (*in == '\\') {
-			const char unescape = tag_unescape_table[(unsigned char)*++in];
+		/* "\\\0" is unescaped to the character itself, "\0" */
+		if (*in == '\0')
+			break;
 
-			/* "\\\0" is unescaped to the character itself, "\0" */
-			if (*in == '\0')
-				break;
+		*out++ = unescape ? unescape : *in;
+		in++;
 
-			if (unescape) {
-				*out++ = unescape;
-				in++;
-			} else {
-				*out++ = *in++;
-			}
-		} else {
-			*out++ = *in++;
-		}
+		/* the plain run up to the next escape or the end */
+		run = rb_scan_any(in, end - in, "\\\\\\\\");
+		memmove(out, in, run);
+		in += run;
+		out += run;
 	}
 
 	/* copy final '\0' */
-	*out = *in;
+	*out = '\0';
+}
+
+/*
+ * split the tags in t, up to end (which is '\0'), into the MsgBuf.
+ *
+ * Clients put several tags on most lines, so each key and value is
+ * found with rb_scan_any() rather than a byte at a time, and only a
+ * value with a '\\' in it is unescaped.
+ */
+static void
+msgbuf_parse_tags(struct MsgBuf *msgbuf, char *t, char *end)
+{
+	while (t < end) {
+		char *key = t;
+		char *value = NULL;
+		char *esc = NULL;
+		char *value_end;
+
+		t += rb_scan_any(t, end - t, ";=;=");
+		if (*t == '=') {
+			*t++ = '\0';
+			value = t;
+
+			t += rb_scan_any(t, end - t, ";\\;\\");
+			if (*t == '\\') {
+				esc = t;
+				t += rb_scan_any(t, end - t, ";;;;");
+			}
+		}
+
+		value_end = t;
+		if (t < end)
+			*t++ = '\0';
+
+		if (*key != '\0') {
+			if (esc != NULL)
+				msgbuf_unescape_value(esc, value_end);
+			msgbuf_append_tag(msgbuf, key, value, 0);
+		}
+	}
 }
 
 /*
@@ -87,74 +126,51 @@ int
 msgbuf_parse(struct MsgBuf *msgbuf, char *line)
 {
 	char *ch = line;
+	size_t len = strlen(line);
 
 	msgbuf_init(msgbuf);
 
 	if (*ch == '@') {
-		char *t = ch + 1;
-
-		ch = strchr(ch, ' ');
-
-		/* truncate tags if they're too long */
-		if ((ch != NULL && (ch - line) + 1 > TAGSLEN) || (ch == NULL && strlen(line) >= TAGSLEN)) {
-			ch = &line[TAGSLEN - 1];
+		size_t lim = len < TAGSLEN ? len : TAGSLEN;
+		size_t sp = rb_scan_any(line, lim, "    ");
+
+		if (sp == lim) {
+			/* truncate tags if they're too long */
+			if (len < TAGSLEN)
+				return 1;
+			sp = TAGSLEN - 1;
 		}
 
-		if (ch != NULL) {
-			/* NULL terminate the tags string */
-			*ch++ = '\0';
-
-			while (1) {
-				char *next = strchr(t, ';');
-				char *eq = strchr(t, '=');
-
-				if (next != NULL) {
-					*next = '\0';
-
-					if (eq > next)
-						eq = NULL;
-				}
+		/* NULL terminate the tags string */
+		line[sp] = '\0';
+		msgbuf_parse_tags(msgbuf, line + 1, line + sp);
 
-				if (eq != NULL)
-					*eq++ = '\0';
-
-				if (*t != '\0') {
-					msgbuf_unescape_value(eq);
-					msgbuf_append_tag(msgbuf, t, eq, 0);
-				}
-
-				if (next != NULL) {
-					t = next + 1;
-				} else {
-					break;
-				}
-			}
-		} else {
-			return 1;
-		}
+		ch = line + sp + 1;
+		len -= sp + 1;
 	}
 
 	/* truncate message if it's too long */
-	if (strlen(ch) > DATALEN) {
+	if (len > DATALEN) {
 		ch[DATALEN] = '\0';
+		len = DATALEN;
 	}
 
 	if (*ch == ':') {
-		ch++;
-		msgbuf->origin = ch;
+		size_t end = rb_scan_any(ch, len, "    ");
 
-		char *end = strchr(ch, ' ');
-		if (end == NULL)
+		msgbuf->origin = ch + 1;
+		if (end == len)
 			return 4;
 
-		*end = '\0';
-		ch = end + 1;
+		ch[end] = '\0';
+		ch += end + 1;
+		len -= end + 1;
 	}
 
 	if (*ch == '\0')
 		return 2;
 
-	msgbuf->endp = &ch[strlen(ch)];
+	msgbuf->endp = &ch[len];
 	msgbuf->n_para = rb_string_to_array(ch, (char **)msgbuf->para, MAXPARA);
 	if (msgbuf->n_para == 0)
 		return 3;
@@ -234,7 +250,7 @@ msgbuf_unparse_tags(char *buf, size_t buflen, const struct MsgBuf *msgbuf, unsig
 
 		if (output + len > end)
 			break;
-		strcat(output, msgbuf->tags[i].key);
+		memcpy(output, msgbuf->tags[i].key, len);
 		output += len;
 
 		if (msgbuf->tags[i].value != NULL) {
@@ -2769,6 +2769,8 @@ static struct ConfEntry conf_general_table[] =
 	{ "away_interval",		CF_INT,   NULL, 0, &ConfigFileEntry.away_interval		},
 	{ "hide_opers_in_whois",	CF_YESNO, NULL, 0, &ConfigFileEntry.hide_opers_in_whois		},
 	{ "hide_opers",		CF_YESNO, NULL, 0, &ConfigFileEntry.hide_opers		},
+	{ "command_timing",	CF_YESNO, NULL, 0, &ConfigFileEntry.command_timing	},
+	{ "deferred_flush",	CF_YESNO, NULL, 0, &ConfigFileEntry.deferred_flush	},
 	{ "certfp_method",	CF_STRING, conf_set_general_certfp_method, 0, NULL },
 	{ "drain_reason",	CF_QSTRING, NULL, BUFSIZE, &ConfigFileEntry.drain_reason	},
 	{ "sasl_only_client_message",	CF_QSTRING, NULL, BUFSIZE, &ConfigFileEntry.sasl_only_client_message	},
@@ -2789,6 +2791,10 @@ static struct ConfEntry conf_channel_table[] =
 {
 	{ "default_split_user_count",	CF_INT,  NULL, 0, &ConfigChannel.default_split_user_count	 },
 	{ "default_split_server_count",	CF_INT,	 NULL, 0, &ConfigChannel.default_split_server_count },
+	{ "history_lines",	CF_INT,   NULL, 0, &ConfigChannel.history_lines		},
+	{ "history_size",	CF_INT,   NULL, 0, &ConfigChannel.history_size		},
+	{ "history_log",	CF_YESNO, NULL, 0, &ConfigChannel.history_log		},
+	{ "history_log_time",	CF_TIME,  NULL, 0, &ConfigChannel.history_log_time	},
 	{ "burst_topicwho",	CF_YESNO, NULL, 0, &ConfigChannel.burst_topicwho	},
 	{ "kick_on_split_riding", CF_YESNO, NULL, 0, &ConfigChannel.kick_on_split_riding },
 	{ "knock_delay",	CF_TIME,  NULL, 0, &ConfigChannel.knock_delay		},
@@ -44,12 +44,33 @@
 rb_dictionary *cmd_dict = NULL;
 rb_dictionary *alias_dict = NULL;
 
+/*
+ * cmd_dict keeps the commands in order, for STATS and the modules.
+ * Looking one up for each line parsed goes through cmd_hash instead: an
+ * open-addressed table of the uppercased names, at most a quarter full,
+ * and built again whenever a command is added or removed.  The names are
+ * kept in the slots so a lookup touches no other memory until it hits.
+ */
+#define CMD_HASH_MIN		64
+#define CMD_HASH_NAMELEN	32
+
+struct cmd_slot
+{
+	uint32_t hash;
+	char name[CMD_HASH_NAMELEN];
+	struct Message *msg;
+};
+
+static struct cmd_slot *cmd_hash;
+static uint32_t cmd_hash_mask;
+
 static void cancel_clients(struct Client *, struct Client *);
 static void remove_unknown(struct Client *, const char *, char *);
 
 static void do_numeric(int, struct Client *, struct Client *, int, const char **);
 
 static int handle_command(struct Message *, struct MsgBuf *, struct Client *, struct Client *);
+static void rebuild_cmd_hash(void);
 
 static char buffer[1024];
 
@@ -127,12 +148,16 @@ parse(struct Client *client_p, char *pbuffer, char *bufend)
 	if(IsDigit(*msgbuf.cmd) && IsDigit(*(msgbuf.cmd + 1)) && IsDigit(*(msgbuf.cmd + 2)))
 	{
 		mptr = NULL;
-		numeric = atoi(msgbuf.cmd);
+		if(msgbuf.cmd[3] == '\0')
+			numeric = (msgbuf.cmd[0] - '0') * 100 + (msgbuf.cmd[1] - '0') * 10 +
+				(msgbuf.cmd[2] - '0');
+		else
+			numeric = atoi(msgbuf.cmd);
 		ServerStats.is_num++;
 	}
 	else
 	{
-		mptr = rb_dictionary_retrieve(cmd_dict, msgbuf.cmd);
+		mptr = find_command(msgbuf.cmd);
 
 		/* no command or its encap only, error */
 		if(!mptr || !mptr->cmd)
@@ -195,6 +220,8 @@ handle_command(struct Message *mptr, struct MsgBuf *msgbuf_p, struct Client *cli
 	struct MessageEntry ehandler;
 	MessageHandler handler = 0;
 	char squitreason[80];
+	CommandSource source;
+	uint64_t start;
 
 	if(IsAnyDead(client_p))
 		return -1;
@@ -237,7 +264,23 @@ handle_command(struct Message *mptr, struct MsgBuf *msgbuf_p, struct Client *cli
 		return (-1);
 	}
 
+	if(!ConfigFileEntry.command_timing)
+	{
+		(*handler) (msgbuf_p, client_p, from, msgbuf_p->n_para, msgbuf_p->para);
+		return (1);
+	}
+
+	/* from may be gone once the handler returns */
+	if(IsServer(from))
+		source = COMMAND_SERVER;
+	else if(IsServer(client_p))
+		source = COMMAND_REMOTE;
+	else
+		source = COMMAND_LOCAL;
+
+	start = rb_monotonic_ns();
 	(*handler) (msgbuf_p, client_p, from, msgbuf_p->n_para, msgbuf_p->para);
+	rb_histogram_add(&mptr->latency[source], rb_monotonic_ns() - start);
 	return (1);
 }
 
@@ -249,7 +292,7 @@ handle_encap(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *so
 	struct MessageEntry ehandler;
 	MessageHandler handler = 0;
 
-	mptr = rb_dictionary_retrieve(cmd_dict, command);
+	mptr = find_command(command);
 
 	if(mptr == NULL || mptr->cmd == NULL)
 		return;
@@ -276,6 +319,90 @@ void
 clear_hash_parse()
 {
 	cmd_dict = rb_dictionary_create("command", rb_strcasecmp);
+	rebuild_cmd_hash();
+}
+
+/* cmd_hash_key()
+ *
+ * inputs	- command name, where to put it uppercased and its hash
+ * output	- false if it is too long to go in the table
+ * side effects -
+ */
+static bool
+cmd_hash_key(const char *name, char *key, uint32_t *hash)
+{
+	uint32_t h = FNV1_32_INIT;
+	size_t i;
+
+	for(i = 0; name[i] != '\0'; i++)
+	{
+		if(i == CMD_HASH_NAMELEN - 1)
+			return false;
+
+		key[i] = name[i] >= 'a' && name[i] <= 'z' ? name[i] - ('a' - 'A') : name[i];
+		h = (h ^ (unsigned char)key[i]) * 16777619U;
+	}
+	key[i] = '\0';
+	*hash = h;
+	return true;
+}
+
+/* rebuild_cmd_hash()
+ *
+ * inputs	-
+ * output	- NONE
+ * side effects - cmd_hash is made again from cmd_dict
+ */
+static void
+rebuild_cmd_hash(void)
+{
+	rb_dictionary_iter iter;
+	struct Message *msg;
+	char key[CMD_HASH_NAMELEN];
+	uint32_t size = CMD_HASH_MIN, hash, i;
+
+	while(size < rb_dictionary_size(cmd_dict) * 4)
+		size *= 2;
+
+	rb_free(cmd_hash);
+	cmd_hash = rb_malloc(sizeof(struct cmd_slot) * size);
+	cmd_hash_mask = size - 1;
+
+	RB_DICTIONARY_FOREACH(msg, &iter, cmd_dict)
+	{
+		/* those too long to fit are found in cmd_dict */
+		if(!cmd_hash_key(msg->cmd, key, &hash))
+			continue;
+
+		for(i = hash & cmd_hash_mask; cmd_hash[i].msg != NULL; i = (i + 1) & cmd_hash_mask)
+			;
+		cmd_hash[i].hash = hash;
+		strcpy(cmd_hash[i].name, key);
+		cmd_hash[i].msg = msg;
+	}
+}
+
+/* find_command()
+ *
+ * inputs	- command name, in any case
+ * output	- its struct Message, or NULL
+ * side effects -
+ */
+struct Message *
+find_command(const char *name)
+{
+	char key[CMD_HASH_NAMELEN];
+	uint32_t hash, i;
+
+	if(!cmd_hash_key(name, key, &hash))
+		return rb_dictionary_retrieve(cmd_dict, name);
+
+	for(i = hash & cmd_hash_mask; cmd_hash[i].msg != NULL; i = (i + 1) & cmd_hash_mask)
+	{
+		if(cmd_hash[i].hash == hash && !strcmp(cmd_hash[i].name, key))
+			return cmd_hash[i].msg;
+	}
+	return NULL;
 }
 
 /* mod_add_cmd
@@ -305,6 +432,7 @@ mod_add_cmd(struct Message *msg)
 	msg->bytes = 0;
 
 	rb_dictionary_add(cmd_dict, msg->cmd, msg);
+	rebuild_cmd_hash();
 }
 
 /* mod_del_cmd
@@ -323,7 +451,10 @@ mod_del_cmd(struct Message *msg)
 	if (rb_dictionary_delete(cmd_dict, msg->cmd) == NULL) {
 		ilog(L_MAIN, "Delete command: %s not found", msg->cmd);
 		s_assert(0);
+		return;
 	}
+
+	rebuild_cmd_hash();
 }
 
 /* cancel_clients()
@@ -67,7 +67,10 @@ server_reboot(void)
 	 *
 	 * bah, for now, the program ain't coming back to here, so forcibly
 	 * close everything the "wrong" way for now, and just LEAVE...
+	 * but write out what deferred_flush is still holding first.
 	 */
+	send_flush_all();
+
 	for (i = 0; i < maxconnections; ++i)
 		close(i);
 
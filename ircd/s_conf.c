@@ -53,6 +53,7 @@
 #include "s_assert.h"
 #include "authproc.h"
 #include "supported.h"
+#include "history.h"
 
 struct config_server_hide ConfigServerHide;
 
@@ -652,6 +653,7 @@ service_rehash(void *data_)
 		rb_strlcpy(me.info, "unknown", sizeof(me.info));
 
 	open_logfiles();
+	init_history_log();
 
 	RB_DLINK_FOREACH(n, local_oper_list.head)
 	{
@@ -793,6 +795,10 @@ set_default_conf(void)
 	ConfigChannel.max_chans_per_user_large = 60;
 	ConfigChannel.max_bans = 25;
 	ConfigChannel.max_bans_large = 500;
+	ConfigChannel.history_lines = 1000;
+	ConfigChannel.history_size = 256 * 1024;
+	ConfigChannel.history_log = 0;
+	ConfigChannel.history_log_time = 7 * 86400;
 	ConfigChannel.only_ascii_channels = false;
 	ConfigChannel.burst_topicwho = false;
 	ConfigChannel.kick_on_split_riding = false;
@@ -841,6 +847,8 @@ set_default_conf(void)
 	ConfigFileEntry.certfp_method = RB_SSL_CERTFP_METH_CERT_SHA1;
 	ConfigFileEntry.hide_opers_in_whois = 0;
 	ConfigFileEntry.hide_opers = 0;
+	ConfigFileEntry.command_timing = 1;
+	ConfigFileEntry.deferred_flush = 1;
 
 	if (!alias_dict)
 		alias_dict = rb_dictionary_create("alias", rb_strcasecmp);
@@ -1143,9 +1151,11 @@ deactivate_conf(struct ConfItem *aconf, time_t now)
 			break;
 		case CONF_XLINE:
 			rb_dlinkFindDestroy(aconf, &xline_conf_list);
+			xline_list_changed();
 			break;
 		case CONF_RESV_NICK:
 			rb_dlinkFindDestroy(aconf, &resv_conf_list);
+			resv_list_changed();
 			break;
 		case CONF_RESV_CHANNEL:
 			del_from_resv_hash(aconf->host, aconf);
@@ -48,6 +48,7 @@
 #include "hash.h"
 #include "rb_dictionary.h"
 #include "rb_radixtree.h"
+#include "masktrie.h"
 #include "s_assert.h"
 #include "logger.h"
 #include "dns.h"
@@ -129,6 +130,8 @@ clear_s_newconf_bans(void)
 		rb_dlinkDestroy(ptr, &xline_conf_list);
 	}
 
+	xline_list_changed();
+
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resv_conf_list.head)
 	{
 		aconf = ptr->data;
@@ -141,6 +144,8 @@ clear_s_newconf_bans(void)
 		rb_dlinkDestroy(ptr, &resv_conf_list);
 	}
 
+	resv_list_changed();
+
 	clear_resv_hash();
 }
 
@@ -541,25 +546,132 @@ disable_server_conf_autoconn(const char *name)
 	}
 }
 
-struct ConfItem *
-find_xline(const char *gecos, int counter)
+/*
+ * The xline and nick resv lists are matched against every registering
+ * or nick changing client, so instead of calling match_esc() on each
+ * entry they are filed on a mask trie under the literal prefix of each
+ * mask, up to its first wildcard.  Only the masks whose prefix the name
+ * starts with are tried, and the lowest list position that matches
+ * wins, so results are identical to walking the list.
+ *
+ * The matchers are rebuilt lazily on the next lookup after
+ * xline_list_changed()/resv_list_changed(), or if the list length has
+ * moved underneath us.
+ */
+struct conf_matcher
 {
-	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
+	rb_dlink_list *list;
+	struct mask_trie *trie;
+	struct ConfItem **confs;
+	unsigned long length;
+	bool dirty;
+};
 
-	RB_DLINK_FOREACH(ptr, xline_conf_list.head)
-	{
-		aconf = ptr->data;
+struct conf_match_data
+{
+	struct conf_matcher *matcher;
+	const char *name;
+};
+
+static struct conf_matcher xline_matcher = { &xline_conf_list, NULL, NULL, 0, true };
+static struct conf_matcher resv_matcher = { &resv_conf_list, NULL, NULL, 0, true };
 
-		if(match_esc(aconf->host, gecos))
+/* copy the literal prefix of a match_esc() mask, with escapes undone */
+static size_t
+esc_mask_prefix(const char *mask, char *buf, size_t buflen)
+{
+	const char *p;
+	size_t len = 0;
+
+	for(p = mask; *p != '\0' && len < buflen; p++)
+	{
+		if(*p == '\\')
 		{
-			if(counter)
-				aconf->port++;
-			return aconf;
+			if(*++p == '\0')
+				break;
+			buf[len++] = (*p == 's') ? ' ' : *p;
 		}
+		else if(*p == '*' || *p == '?' || *p == '@' || *p == '#')
+			break;
+		else
+			buf[len++] = *p;
 	}
 
-	return NULL;
+	return len;
+}
+
+static void
+build_conf_matcher(struct conf_matcher *matcher)
+{
+	rb_dlink_node *ptr;
+	unsigned int id = 0;
+	char prefix[BUFSIZE];
+
+	mask_trie_destroy(matcher->trie);
+	rb_free(matcher->confs);
+
+	matcher->length = rb_dlink_list_length(matcher->list);
+	matcher->trie = mask_trie_create(false);
+	matcher->confs = rb_malloc(sizeof(struct ConfItem *) * (matcher->length + 1));
+
+	RB_DLINK_FOREACH(ptr, matcher->list->head)
+	{
+		struct ConfItem *aconf = ptr->data;
+
+		matcher->confs[id] = aconf;
+		mask_trie_add(matcher->trie, prefix,
+				esc_mask_prefix(aconf->host, prefix, sizeof prefix), id);
+		id++;
+	}
+
+	matcher->dirty = false;
+}
+
+static bool
+conf_matches(unsigned int id, void *data)
+{
+	struct conf_match_data *md = data;
+
+	return match_esc(md->matcher->confs[id]->host, md->name);
+}
+
+static struct ConfItem *
+find_conf_match(struct conf_matcher *matcher, const char *name)
+{
+	struct conf_match_data md = { matcher, name };
+	unsigned int id;
+
+	if(matcher->dirty || matcher->length != rb_dlink_list_length(matcher->list))
+		build_conf_matcher(matcher);
+
+	id = mask_trie_find(matcher->trie, name, UINT_MAX, conf_matches, &md);
+
+	return id == UINT_MAX ? NULL : matcher->confs[id];
+}
+
+void
+xline_list_changed(void)
+{
+	xline_matcher.dirty = true;
+}
+
+void
+resv_list_changed(void)
+{
+	resv_matcher.dirty = true;
+}
+
+struct ConfItem *
+find_xline(const char *gecos, int counter)
+{
+	struct ConfItem *aconf;
+
+	aconf = find_conf_match(&xline_matcher, gecos);
+
+	if(aconf != NULL && counter)
+		aconf->port++;
+
+	return aconf;
 }
 
 struct ConfItem *
@@ -583,20 +695,13 @@ struct ConfItem *
 find_nick_resv(const char *name)
 {
 	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
 
-	RB_DLINK_FOREACH(ptr, resv_conf_list.head)
-	{
-		aconf = ptr->data;
+	aconf = find_conf_match(&resv_matcher, name);
 
-		if(match_esc(aconf->host, name))
-		{
-			aconf->port++;
-			return aconf;
-		}
-	}
+	if(aconf != NULL)
+		aconf->port++;
 
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -787,6 +892,7 @@ expire_temp_rxlines(void *unused)
 						aconf->host);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &resv_conf_list);
+			resv_list_changed();
 		}
 	}
 
@@ -804,6 +910,7 @@ expire_temp_rxlines(void *unused)
 						aconf->host);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &xline_conf_list);
+			xline_list_changed();
 		}
 	}
 }
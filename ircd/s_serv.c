@@ -770,6 +770,10 @@ server_estab(struct Client *client_p)
 	char *host;
 	rb_dlink_node *ptr;
 	char note[HOSTLEN + 15];
+	uint64_t burst_start;
+	size_t burst_bytes;
+	unsigned long burst_lines;
+	double burst_ms;
 
 	s_assert(NULL != client_p);
 	if(client_p == NULL)
@@ -925,6 +929,9 @@ server_estab(struct Client *client_p)
 	 **    see previous *WARNING*!!! (Also, original inpath
 	 **    is destroyed...)
 	 */
+	burst_start = rb_monotonic_ns();
+	send_burst_start(client_p);
+
 	RB_DLINK_FOREACH(ptr, global_serv_list.head)
 	{
 		target_p = ptr->data;
@@ -963,6 +970,16 @@ server_estab(struct Client *client_p)
 	/* Always send a PING after connect burst is done */
 	sendto_one(client_p, "PING :%s", get_id(&me, client_p));
 
+	burst_bytes = send_burst_finish(&burst_lines);
+	burst_ms = (rb_monotonic_ns() - burst_start) / 1000000.0;
+
+	sendto_realops_snomask(SNO_GENERAL, L_ALL,
+			"Burst to %s: %zu bytes, %lu lines in %.1f ms",
+			client_p->name, burst_bytes, burst_lines, burst_ms);
+
+	ilog(L_SERVER, "Burst to %s: %zu bytes, %lu lines in %.1f ms",
+	     log_client_name(client_p, SHOW_IP), burst_bytes, burst_lines, burst_ms);
+
 	free_pre_client(client_p);
 
 	send_pop_queue(client_p);
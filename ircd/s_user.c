@@ -687,6 +687,7 @@ register_local_user(struct Client *client_p, struct Client *source_p)
 
 	s_assert(!IsClient(source_p));
 	rb_dlinkMoveNode(&source_p->localClient->tnode, &unknown_list, &lclient_list);
+	add_to_lclient_index(source_p);
 	SetClient(source_p);
 
 	source_p->servptr = &me;
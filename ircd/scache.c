@@ -66,7 +66,7 @@ static rb_radixtree *scache_tree = NULL;
 void
 clear_scache_hash_table(void)
 {
-	scache_tree = rb_radixtree_create("server names cache", irccasecanon);
+	scache_tree = rb_radixtree_create_casemap("server names cache", irctoupper_tab);
 }
 
 static struct scache_entry *
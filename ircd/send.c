@@ -45,11 +45,43 @@
 #define CLIENT_CAPS_ONLY(x)	((IsClient((x)) && (x)->localClient) ? (x)->localClient->caps : 0)
 
 static void send_queued_write(rb_fde_t *F, void *data);
+static void send_defer(struct Client *to);
 
 unsigned long current_serial = 0L;
 
 struct Client *remote_rehash_oper_p;
 
+/*
+ * With general::deferred_flush, a message only puts its client on
+ * flush_list, and the list is flushed as the loop iteration ends, so
+ * a client sent thirty lines while we were busy gets one writev rather
+ * than thirty.  A sendq of SEND_FLUSH_EARLY bytes is sent at once.
+ */
+#define SEND_FLUSH_EARLY	(16 * 1024)
+
+static rb_dlink_list flush_list;
+
+/*
+ * While a server is being burst, what sendto_one() sends it is written
+ * straight into one large buffer instead of a linebuf per line, and the
+ * buffer goes onto the sendq as a few big chunks each time it fills.
+ * Anything else sent to that server first flushes the buffer, so the
+ * order of the lines is kept.  Only one burst is built at a time.
+ */
+#define BURST_BUFSIZE	(256 * 1024)
+
+static struct
+{
+	struct Client *to;
+	size_t len;			/* bytes waiting in data */
+	unsigned long lines;		/* lines waiting in data */
+	size_t sent_bytes;		/* put on the sendq so far */
+	unsigned long sent_lines;
+	char data[BURST_BUFSIZE];
+} burst;
+
+static void send_burst_flush(void);
+
 /* send_linebuf()
  *
  * inputs	- client to send to, linebuf to attach
@@ -68,6 +100,9 @@ _send_linebuf(struct Client *to, buf_head_t *linebuf)
 	if(!MyConnect(to) || IsIOError(to))
 		return 0;
 
+	if(to == burst.to && burst.len > 0)
+		send_burst_flush();
+
 	if(rb_linebuf_len(&to->localClient->buf_sendq) > get_sendq(to))
 	{
 		dead_link(to, 1);
@@ -103,8 +138,11 @@ _send_linebuf(struct Client *to, buf_head_t *linebuf)
 	 */
 	to->localClient->sendM += 1;
 	me.localClient->sendM += 1;
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
+	if(rb_linebuf_len(&to->localClient->buf_sendq) >= SEND_FLUSH_EARLY ||
+			!ConfigFileEntry.deferred_flush)
 		send_queued(to);
+	else if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
+		send_defer(to);
 	return 0;
 }
 
@@ -186,6 +224,63 @@ send_queued(struct Client *to)
 		ClearFlush(to);
 }
 
+static void
+send_flush_deferred(void *unused)
+{
+	send_flush_all();
+}
+
+/* send_flush_all()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - every client on the deferred flush list is written to
+ *                now, for when we're exiting before the loop gets to it
+ */
+void
+send_flush_all(void)
+{
+	struct Client *to;
+
+	while(flush_list.head != NULL)
+	{
+		to = flush_list.head->data;
+		rb_dlinkDelete(&to->localClient->flush_node, &flush_list);
+		ClearFlushDeferred(to);
+		send_queued(to);
+	}
+}
+
+static void
+send_defer(struct Client *to)
+{
+	/* already listed, or waiting until the socket is writable */
+	if(IsFlushDeferred(to) || IsFlush(to))
+		return;
+
+	if(flush_list.head == NULL)
+		rb_defer(send_flush_deferred, NULL);
+
+	SetFlushDeferred(to);
+	rb_dlinkAddTail(to, &to->localClient->flush_node, &flush_list);
+}
+
+/* send_flush_cancel()
+ *
+ * inputs	- local client
+ * outputs	-
+ * side effects - client is taken off the deferred flush list
+ */
+void
+send_flush_cancel(struct Client *to)
+{
+	if(!IsFlushDeferred(to))
+		return;
+
+	rb_dlinkDelete(&to->localClient->flush_node, &flush_list);
+	ClearFlushDeferred(to);
+}
+
 void
 send_pop_queue(struct Client *to)
 {
@@ -277,6 +372,128 @@ build_msgbuf_tags(struct MsgBuf *msgbuf, struct Client *from)
 	call_hook(h_outbound_msgbuf, &hdata);
 }
 
+/* send_burst_flush()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - what is in the burst buffer is put on the sendq
+ */
+static void
+send_burst_flush(void)
+{
+	struct Client *to = burst.to;
+	buf_head_t linebuf;
+	unsigned long lines = burst.lines;
+	size_t len = burst.len;
+
+	if(len == 0)
+		return;
+
+	burst.len = 0;
+	burst.lines = 0;
+
+	if(!MyConnect(to) || IsIOError(to))
+		return;
+
+	rb_linebuf_newbuf(&linebuf);
+	rb_linebuf_put_block(&linebuf, burst.data, len);
+
+	/* no longer the burst target for a moment, or this would recurse */
+	burst.to = NULL;
+	if(_send_linebuf(to, &linebuf) == 0)
+	{
+		/* _send_linebuf counted one message */
+		to->localClient->sendM += lines - 1;
+		me.localClient->sendM += lines - 1;
+		burst.sent_bytes += len;
+		burst.sent_lines += lines;
+	}
+	burst.to = to;
+
+	rb_linebuf_donebuf(&linebuf);
+}
+
+/* send_burst_append()
+ *
+ * inputs	- format and arguments of one line
+ * outputs	-
+ * side effects - the line is added to the burst buffer, truncated
+ *                just as rb_linebuf_put() would
+ */
+static void
+send_burst_append(const char *pattern, va_list args)
+{
+	int len;
+
+	if(BURST_BUFSIZE - burst.len < DATALEN + CRLF_LEN + 1)
+		send_burst_flush();
+
+	len = vsnprintf(burst.data + burst.len, DATALEN + 1, pattern, args);
+	if(len < 0)
+		len = 0;
+	else if(len > DATALEN)
+		len = DATALEN;
+
+	burst.data[burst.len + len++] = '\r';
+	burst.data[burst.len + len++] = '\n';
+
+	burst.len += len;
+	burst.lines++;
+}
+
+/* send_burst_start()
+ *
+ * inputs	- server about to be sent a burst
+ * outputs	-
+ * side effects - lines sent to the server are gathered up until
+ *                send_burst_finish(), and its socket is corked
+ */
+void
+send_burst_start(struct Client *to)
+{
+	s_assert(burst.to == NULL);
+	s_assert(MyConnect(to));
+
+	burst.to = to;
+	burst.len = 0;
+	burst.lines = 0;
+	burst.sent_bytes = 0;
+	burst.sent_lines = 0;
+
+	if(to->localClient->F != NULL)
+		rb_set_cork(to->localClient->F, 1);
+}
+
+/* send_burst_finish()
+ *
+ * inputs	- where to put how many lines the burst was, or NULL
+ * outputs	- how many bytes the burst was
+ * side effects - the rest of the burst is put on the sendq and written,
+ *                and the socket is uncorked
+ */
+size_t
+send_burst_finish(unsigned long *lines)
+{
+	struct Client *to = burst.to;
+
+	s_assert(to != NULL);
+	if(to == NULL)
+		return 0;
+
+	send_burst_flush();
+	burst.to = NULL;
+
+	if(!IsIOError(to) && to->localClient->F != NULL)
+	{
+		send_queued(to);
+		rb_set_cork(to->localClient->F, 0);
+	}
+
+	if(lines != NULL)
+		*lines = burst.sent_lines;
+	return burst.sent_bytes;
+}
+
 /* sendto_one()
  *
  * inputs	- client to send to, va_args
@@ -298,6 +515,15 @@ sendto_one(struct Client *target_p, const char *pattern, ...)
 	if(IsIOError(target_p))
 		return;
 
+	/* servers get no tags, so the line can go straight into the burst */
+	if(target_p == burst.to)
+	{
+		va_start(args, pattern);
+		send_burst_append(pattern, args);
+		va_end(args);
+		return;
+	}
+
 	rb_linebuf_newbuf(&linebuf);
 
 	build_msgbuf_tags(&msgbuf, &me);
@@ -310,6 +536,37 @@ sendto_one(struct Client *target_p, const char *pattern, ...)
 	rb_linebuf_donebuf(&linebuf);
 }
 
+/* sendto_one_tags()
+ *
+ * inputs	- client to send to, tags to send, va_args
+ * outputs	- client has message put into its queue
+ * side effects - the given tags are sent instead of the usual outbound
+ *                ones, e.g. to replay a message with its original time
+ */
+void
+sendto_one_tags(struct Client *target_p, const struct MsgBuf *msgbuf, const char *pattern, ...)
+{
+	va_list args;
+	buf_head_t linebuf;
+	rb_strf_t strings = { .format = pattern, .format_args = &args, .next = NULL };
+
+	if(target_p->from != NULL)
+		target_p = target_p->from;
+
+	if(IsIOError(target_p))
+		return;
+
+	rb_linebuf_newbuf(&linebuf);
+
+	va_start(args, pattern);
+	linebuf_put_tags(&linebuf, msgbuf, target_p, &strings);
+	va_end(args);
+
+	_send_linebuf(target_p, &linebuf);
+
+	rb_linebuf_donebuf(&linebuf);
+}
+
 /* sendto_one_prefix()
  *
  * inputs	- client to send to, va_args
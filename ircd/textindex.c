@@ -0,0 +1,395 @@
+/*
+ *  FoxComet: a modern, highly scalable IRCv3 server
+ *  textindex.c: Inverted word index over numbered lines of text.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "match.h"
+#include "hash.h"
+#include "textindex.h"
+
+/*
+ * Each word's posting list is the ids of its lines, each stored as the
+ * difference from the one before in a little endian base 128 varint,
+ * so a busy channel's lines cost a byte or two per word.  Every
+ * TEXT_SKIP'th posting is also noted in a skip list, so a search can
+ * jump ahead to an id without decoding everything before it.
+ *
+ * A search walks the words' lists together, rarest first, each jumping
+ * to the id the others are at, until they agree.
+ */
+#define TEXT_WORD_MAX		32
+#define TEXT_QUERY_MAX		16
+#define TEXT_SKIP		64
+#define TEXT_MIN_BITS		6
+
+struct text_skip
+{
+	uint64_t prev_id;	/* the id before the posting */
+	uint32_t off;		/* where the posting starts */
+};
+
+struct text_term
+{
+	struct text_term *next;
+	unsigned char *data;
+	uint32_t len;
+	uint32_t cap;
+	uint32_t count;
+	uint64_t last_id;
+
+	struct text_skip *skips;
+	uint32_t nskips;
+	uint32_t maxskips;
+
+	char word[TEXT_WORD_MAX + 1];
+};
+
+struct text_index
+{
+	struct text_term **table;
+	int bits;
+	unsigned int nterms;
+	unsigned int lines;
+	uint64_t last_id;
+};
+
+struct text_cursor
+{
+	struct text_term *term;
+	uint32_t off;
+	uint32_t n;		/* postings read */
+	uint64_t id;		/* the last one read */
+};
+
+struct text_index *
+text_index_create(void)
+{
+	struct text_index *idx = rb_malloc(sizeof(struct text_index));
+
+	idx->bits = TEXT_MIN_BITS;
+	idx->table = rb_malloc(sizeof(struct text_term *) << idx->bits);
+	return idx;
+}
+
+void
+text_index_destroy(struct text_index *idx)
+{
+	struct text_term *term, *next;
+	unsigned int i;
+
+	if(idx == NULL)
+		return;
+
+	for(i = 0; i < 1U << idx->bits; i++)
+	{
+		for(term = idx->table[i]; term != NULL; term = next)
+		{
+			next = term->next;
+			rb_free(term->data);
+			rb_free(term->skips);
+			rb_free(term);
+		}
+	}
+
+	rb_free(idx->table);
+	rb_free(idx);
+}
+
+/* the next word of s, case folded into word, or NULL if there is none */
+static const char *
+next_word(const char *s, char *word)
+{
+	size_t len = 0;
+
+#define IsWordChar(c)	((unsigned char)(c) >= 0x80 || isalnum((unsigned char)(c)))
+
+	while(*s != '\0' && !IsWordChar(*s))
+		s++;
+
+	if(*s == '\0')
+		return NULL;
+
+	for(; IsWordChar(*s); s++)
+	{
+		if(len < TEXT_WORD_MAX)
+			word[len++] = irctolower(*s);
+	}
+
+#undef IsWordChar
+
+	word[len] = '\0';
+	return s;
+}
+
+static void
+grow_table(struct text_index *idx)
+{
+	struct text_term **table, *term, *next;
+	unsigned int i, h;
+	int bits = idx->bits + 1;
+
+	table = rb_malloc(sizeof(struct text_term *) << bits);
+
+	for(i = 0; i < 1U << idx->bits; i++)
+	{
+		for(term = idx->table[i]; term != NULL; term = next)
+		{
+			next = term->next;
+			h = fnv_hash((const unsigned char *)term->word, bits);
+			term->next = table[h];
+			table[h] = term;
+		}
+	}
+
+	rb_free(idx->table);
+	idx->table = table;
+	idx->bits = bits;
+}
+
+static struct text_term *
+find_term(struct text_index *idx, const char *word, bool create)
+{
+	struct text_term *term;
+	unsigned int h = fnv_hash((const unsigned char *)word, idx->bits);
+
+	for(term = idx->table[h]; term != NULL; term = term->next)
+		if(strcmp(term->word, word) == 0)
+			return term;
+
+	if(!create)
+		return NULL;
+
+	if(idx->nterms >= 1U << idx->bits)
+	{
+		grow_table(idx);
+		h = fnv_hash((const unsigned char *)word, idx->bits);
+	}
+
+	term = rb_malloc(sizeof(struct text_term));
+	rb_strlcpy(term->word, word, sizeof term->word);
+	term->next = idx->table[h];
+	idx->table[h] = term;
+	idx->nterms++;
+	return term;
+}
+
+static void
+add_posting(struct text_term *term, uint64_t id)
+{
+	uint64_t delta;
+
+	/* a word said twice in a line */
+	if(term->count > 0 && term->last_id == id)
+		return;
+
+	if(term->count % TEXT_SKIP == 0)
+	{
+		if(term->nskips == term->maxskips)
+		{
+			term->maxskips = term->maxskips ? term->maxskips * 2 : 4;
+			term->skips = rb_realloc(term->skips, term->maxskips * sizeof(struct text_skip));
+		}
+
+		term->skips[term->nskips].prev_id = term->last_id;
+		term->skips[term->nskips].off = term->len;
+		term->nskips++;
+	}
+
+	/* a 64 bit varint takes at most 10 bytes */
+	if(term->len + 10 > term->cap)
+	{
+		term->cap = term->cap ? term->cap * 2 : 16;
+		term->data = rb_realloc(term->data, term->cap);
+	}
+
+	for(delta = id - term->last_id; delta >= 0x80; delta >>= 7)
+		term->data[term->len++] = (delta & 0x7f) | 0x80;
+	term->data[term->len++] = delta;
+
+	term->last_id = id;
+	term->count++;
+}
+
+void
+text_index_add(struct text_index *idx, uint64_t id, const char *text)
+{
+	char word[TEXT_WORD_MAX + 1];
+
+	if(id <= idx->last_id)
+		return;
+
+	while((text = next_word(text, word)) != NULL)
+		add_posting(find_term(idx, word, true), id);
+
+	idx->last_id = id;
+	idx->lines++;
+}
+
+unsigned int
+text_index_lines(struct text_index *idx)
+{
+	return idx->lines;
+}
+
+uint64_t
+text_index_last_id(struct text_index *idx)
+{
+	return idx->last_id;
+}
+
+static bool
+cursor_next(struct text_cursor *cur)
+{
+	const unsigned char *data = cur->term->data;
+	uint64_t delta = 0;
+	int shift = 0;
+
+	if(cur->n >= cur->term->count)
+		return false;
+
+	do
+	{
+		delta |= (uint64_t)(data[cur->off] & 0x7f) << shift;
+		shift += 7;
+	}
+	while(data[cur->off++] & 0x80);
+
+	cur->id += delta;
+	cur->n++;
+	return true;
+}
+
+/* move on to the first posting at or after id */
+static bool
+cursor_seek(struct text_cursor *cur, uint64_t id)
+{
+	struct text_term *term = cur->term;
+	unsigned int lo, hi;
+
+	if(cur->n > 0 && cur->id >= id)
+		return true;
+
+	/* the last skip before id, if it is ahead of us */
+	lo = 0;
+	hi = term->nskips;
+	while(lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if(term->skips[mid].prev_id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if(lo > 0 && (lo - 1) * TEXT_SKIP > cur->n)
+	{
+		cur->n = (lo - 1) * TEXT_SKIP;
+		cur->off = term->skips[lo - 1].off;
+		cur->id = term->skips[lo - 1].prev_id;
+	}
+
+	while(cursor_next(cur))
+		if(cur->id >= id)
+			return true;
+
+	return false;
+}
+
+static void
+reverse_ids(uint64_t *ids, unsigned int n)
+{
+	unsigned int i;
+
+	for(i = 0; i < n / 2; i++)
+	{
+		uint64_t tmp = ids[i];
+
+		ids[i] = ids[n - i - 1];
+		ids[n - i - 1] = tmp;
+	}
+}
+
+unsigned int
+text_index_search(struct text_index *idx, const char *query,
+		uint64_t min_id, uint64_t max_id, uint64_t *ids, unsigned int max)
+{
+	struct text_cursor cur[TEXT_QUERY_MAX], tmp;
+	char word[TEXT_WORD_MAX + 1];
+	unsigned int n = 0, found = 0, i, j;
+	bool more;
+
+	if(max == 0)
+		return 0;
+
+	while(n < TEXT_QUERY_MAX && (query = next_word(query, word)) != NULL)
+	{
+		memset(&cur[n], 0, sizeof cur[n]);
+		if((cur[n].term = find_term(idx, word, false)) == NULL)
+			return 0;
+
+		/* rarest first, so it drives the walk */
+		for(i = n++; i > 0 && cur[i].term->count < cur[i - 1].term->count; i--)
+		{
+			tmp = cur[i];
+			cur[i] = cur[i - 1];
+			cur[i - 1] = tmp;
+		}
+	}
+
+	if(n == 0)
+		return 0;
+
+	more = cursor_seek(&cur[0], min_id);
+
+	while(more && cur[0].id <= max_id)
+	{
+		for(j = 1; j < n; j++)
+		{
+			if(!cursor_seek(&cur[j], cur[0].id))
+				more = false;
+			if(!more || cur[j].id != cur[0].id)
+				break;
+		}
+
+		if(!more)
+			break;
+
+		if(j < n)
+		{
+			more = cursor_seek(&cur[0], cur[j].id);
+			continue;
+		}
+
+		/* keep the newest max in a ring */
+		ids[found++ % max] = cur[0].id;
+		more = cursor_next(&cur[0]);
+	}
+
+	/* newest first: each side of the ring's start, reversed */
+	if(found > max)
+	{
+		reverse_ids(ids, found % max);
+		reverse_ids(ids + found % max, max - found % max);
+		return max;
+	}
+
+	reverse_ids(ids, found);
+	return found;
+}
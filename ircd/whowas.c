@@ -198,7 +198,7 @@ whowas_trim(void *unused)
 void
 whowas_init(void)
 {
-	whowas_tree = rb_radixtree_create("whowas", irccasecanon);
+	whowas_tree = rb_radixtree_create_casemap("whowas", irctoupper_tab);
 	if(whowas_list_length == 0)
 	{
 		whowas_list_length = NICKNAMEHISTORYLENGTH;
@@ -0,0 +1,3 @@
+#include <stdio.h>
+char *yytext; int yywrap(void){return 1;} int yylex(void){return 0;}
+int main(void){return yylex();}
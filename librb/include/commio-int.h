@@ -149,6 +149,25 @@ rb_find_fd(int fd)
 int rb_setup_fd(rb_fde_t *F);
 void rb_connect_callback(rb_fde_t *F, int status);
 
+/*
+ * The backends call rb_loop_woke() as their wait returns, and
+ * rb_loop_charge() after each handler they run, which charges the
+ * time since the wait, or the handler before, to the histogram.
+ */
+extern struct rb_loop_stats rb_loop_data;
+extern uint64_t rb_loop_mark;
+
+void rb_loop_woke(int ready);
+
+static inline void
+rb_loop_charge(struct rb_histogram *hist)
+{
+	uint64_t now = rb_monotonic_ns();
+
+	rb_histogram_add(hist, now - rb_loop_mark);
+	rb_loop_mark = now;
+}
+
 
 int rb_io_sched_event(struct ev_entry *ev, int when);
 void rb_io_unsched_event(struct ev_entry *ev);
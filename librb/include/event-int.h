@@ -34,5 +34,7 @@ struct ev_entry
 	void *data;
 	void *comm_ptr;
 	int dead;
+	int heap_index;		/* position in the event heap, -1 if not queued */
+	struct rb_histogram *times;	/* how long it runs, shared by name */
 };
 void rb_event_io_register_all(void);
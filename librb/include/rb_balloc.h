@@ -31,6 +31,9 @@
 #define INCLUDED_balloc_h
 
 
+/* for heaps whose elements should each start a cache line */
+#define RB_CACHE_LINE_SIZE 64
+
 struct rb_bh;
 typedef struct rb_bh rb_bh;
 typedef void rb_bh_usage_cb (size_t bused, size_t bfree, size_t bmemusage, size_t heapalloc,
@@ -41,6 +44,7 @@ int rb_bh_free(rb_bh *, void *);
 void *rb_bh_alloc(rb_bh *);
 
 rb_bh *rb_bh_create(size_t elemsize, int elemsperblock, const char *desc);
+rb_bh *rb_bh_create_aligned(size_t elemsize, size_t align, int elemsperblock, const char *desc);
 int rb_bh_destroy(rb_bh *bh);
 void rb_init_bh(void);
 void rb_bh_usage(rb_bh *bh, size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc);
@@ -118,6 +118,7 @@ int rb_set_nb(rb_fde_t *);
 int rb_set_cloexec(rb_fde_t *);
 int rb_clear_cloexec(rb_fde_t *);
 int rb_set_buffers(rb_fde_t *, int);
+int rb_set_cork(rb_fde_t *, int);
 
 int rb_get_sockerr(rb_fde_t *);
 
@@ -33,6 +33,16 @@
 struct ev_entry;
 typedef void EVH(void *);
 
+/* where the event loop's time goes */
+struct rb_loop_stats
+{
+	struct rb_histogram busy;	/* from each wakeup to the next wait */
+	struct rb_histogram ready;	/* fds ready at each wakeup, a count */
+	struct rb_histogram read;	/* read handlers */
+	struct rb_histogram write;	/* write handlers */
+	struct rb_histogram events;	/* timed events */
+};
+
 struct ev_entry *rb_event_add(const char *name, EVH * func, void *arg, time_t when);
 struct ev_entry *rb_event_addonce(const char *name, EVH * func, void *arg, time_t when);
 struct ev_entry *rb_event_addish(const char *name, EVH * func, void *arg, time_t delta_ish);
@@ -43,6 +53,8 @@ void rb_event_find_delete(EVH * func, void *);
 void rb_event_update(struct ev_entry *, time_t freq);
 void rb_set_back_events(time_t);
 void rb_dump_events(void (*func) (char *, void *), void *ptr);
+const struct rb_loop_stats *rb_get_loop_stats(void);
+void rb_dump_event_times(void (*func) (const char *, const struct rb_histogram *, void *), void *ptr);
 void rb_run_one_event(struct ev_entry *);
 time_t rb_event_next(void);
 
@@ -0,0 +1,125 @@
+/*
+ *  librb: a library used by ircd-ratbox and other things
+ *  rb_hashmap.h: Hash table storage.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+
+#ifndef __RB_HASHMAP_H__
+#define __RB_HASHMAP_H__
+
+#include "librb-config.h"
+
+/*
+ * Unlike rb_dictionary, looking something up changes nothing, and the
+ * entries are kept in one array rather than a node each.  There is no
+ * order: use rb_dictionary where the entries must be walked sorted.
+ */
+typedef struct rb_hashmap rb_hashmap;
+typedef struct rb_hashmap_iter rb_hashmap_iter;
+
+typedef enum
+{
+	RB_HASHMAP_STRING,		/* NUL terminated, compared exactly */
+	RB_HASHMAP_STRING_NOCASE,	/* NUL terminated, ASCII case ignored */
+	RB_HASHMAP_STRING_CASEMAP,	/* NUL terminated, read through a case map */
+	RB_HASHMAP_INTEGER,		/* RB_UINT_TO_POINTER() and the like */
+} rb_hashmap_keytype;
+
+struct rb_hashmap_iter
+{
+	unsigned int index, left;
+	const void *key;
+	void *data;
+};
+
+/*
+ * this is a convenience macro for inlining iteration of hash maps.
+ */
+#define RB_HASHMAP_FOREACH(element, state, map) for (rb_hashmap_foreach_start((map), (state)); (element = rb_hashmap_foreach_cur((map), (state))); rb_hashmap_foreach_next((map), (state)))
+
+/*
+ * rb_hashmap_create() creates a new hash map which has a name.  String
+ * keys are not copied, so must live as long as their entry.
+ */
+extern rb_hashmap *rb_hashmap_create(const char *name, rb_hashmap_keytype keytype);
+
+/*
+ * rb_hashmap_create_casemap() creates a new hash map with string keys
+ * compared after replacing each byte c with casemap[c].
+ */
+extern rb_hashmap *rb_hashmap_create_casemap(const char *name, const unsigned char *casemap);
+
+/*
+ * rb_hashmap_destroy() destroys all entries in a hash map, and also optionally
+ * calls a defined callback function to destroy any data attached to it.
+ */
+extern void rb_hashmap_destroy(rb_hashmap *map,
+	void (*destroy_cb)(const void *key, void *data, void *privdata),
+	void *privdata);
+
+/*
+ * rb_hashmap_foreach_start() begins an iteration over all items keeping
+ * state in the given struct.  It is permitted to remove the current
+ * element of the iteration (but not any other element), and nothing may
+ * be added until the iteration is over.
+ */
+extern void rb_hashmap_foreach_start(rb_hashmap *map, rb_hashmap_iter *state);
+
+/*
+ * rb_hashmap_foreach_cur() returns the current element of the iteration,
+ * or NULL if there are no more elements.
+ */
+extern void *rb_hashmap_foreach_cur(rb_hashmap *map, rb_hashmap_iter *state);
+
+/*
+ * rb_hashmap_foreach_next() moves to the next element.
+ */
+extern void rb_hashmap_foreach_next(rb_hashmap *map, rb_hashmap_iter *state);
+
+/*
+ * rb_hashmap_add() adds a key->value entry to the hash map; it returns
+ * 0 and changes nothing if the key is already there.
+ */
+extern int rb_hashmap_add(rb_hashmap *map, const void *key, void *data);
+
+/*
+ * rb_hashmap_retrieve() returns data from a hash map for key 'key'.
+ */
+extern void *rb_hashmap_retrieve(rb_hashmap *map, const void *key);
+
+/*
+ * rb_hashmap_delete() deletes a key->value entry from the hash map,
+ * returning its data.
+ */
+extern void *rb_hashmap_delete(rb_hashmap *map, const void *key);
+
+/*
+ * rb_hashmap_size() returns the number of elements in a hash map.
+ */
+extern unsigned int rb_hashmap_size(rb_hashmap *map);
+
+/*
+ * rb_hashmap_memory() returns the bytes a hash map uses, not counting
+ * the keys and data it points to.
+ */
+extern size_t rb_hashmap_memory(rb_hashmap *map);
+
+void rb_hashmap_stats(rb_hashmap *map, void (*cb)(const char *line, void *privdata), void *privdata);
+void rb_hashmap_stats_walk(void (*cb)(const char *line, void *privdata), void *privdata);
+
+#endif
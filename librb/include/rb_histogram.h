@@ -0,0 +1,57 @@
+/*
+ *  librb: a library used by ircd-ratbox and other things
+ *  rb_histogram.h: Log bucketed latency histograms.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+
+#ifndef RB_LIB_H
+# error "Do not use rb_histogram.h directly"
+#endif
+
+#ifndef INCLUDED_RB_HISTOGRAM_H__
+#define INCLUDED_RB_HISTOGRAM_H__
+
+/*
+ * Bucket i counts the samples under 2^i microseconds that did not fit
+ * an earlier bucket; the last counts everything longer.
+ */
+#define RB_HISTOGRAM_BUCKETS	24
+
+struct rb_histogram
+{
+	uint64_t count;
+	uint64_t sum;		/* nanoseconds */
+	uint64_t max;
+	uint64_t buckets[RB_HISTOGRAM_BUCKETS];
+};
+
+/* nanoseconds on a clock that never goes backwards */
+uint64_t rb_monotonic_ns(void);
+
+void rb_histogram_add(struct rb_histogram *, uint64_t ns);
+
+/* for counts rather than times: bucket i is under 2^i, and the sum and
+ * max are counts too */
+void rb_histogram_add_count(struct rb_histogram *, uint64_t n);
+
+/* the bucket bound, in microseconds, under which fraction q of the samples fall */
+uint64_t rb_histogram_quantile(const struct rb_histogram *, double q);
+
+#define rb_histogram_bound(i)	(UINT64_C(1) << (i))
+
+#endif
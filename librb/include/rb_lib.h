@@ -184,6 +184,8 @@ pid_t rb_getpid(void);
 
 #include <rb_tools.h>
 #include <rb_memory.h>
+#include <rb_histogram.h>
+#include <rb_scan.h>
 #include <rb_commio.h>
 #include <rb_balloc.h>
 #include <rb_linebuf.h>
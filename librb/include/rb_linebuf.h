@@ -44,18 +44,34 @@ struct _buf_head;
 #define LINEBUF_SIZE            (512 + 510)
 #define CRLF_LEN                2
 
+/* lines are allocated from one of a few size classes so that short lines
+ * don't each pin a full LINEBUF_SIZE buffer; the largest class always holds
+ * LINEBUF_SIZE + CRLF_LEN + 1 bytes.
+ */
+#define LINEBUF_CLASSES         3
+
+/* largest chunk rb_linebuf_put_block makes, so it still fits in size */
+#define LINEBUF_BLOCK_SIZE      (60 * 1024)
+
 typedef struct _buf_line
 {
-	char buf[LINEBUF_SIZE + CRLF_LEN + 1];
 	uint8_t terminated;	/* Whether we've terminated the buffer */
 	uint8_t raw;		/* Whether this linebuf may hold 8-bit data */
+	uint8_t sclass;		/* size class this line was allocated from, or LINEBUF_CLASSES */
+	uint16_t size;		/* usable size of buf */
 	int len;		/* How much data we've got */
 	int refcount;		/* how many linked lists are we in? */
+	char buf[];
 } buf_line_t;
 
+/* the lines of a buf_head_t are kept in a ring of pointers rather than a
+ * dlink list, so attaching a shared line to a sendq doesn't allocate.
+ */
 typedef struct _buf_head
 {
-	rb_dlink_list list;	/* the actual dlink list */
+	buf_line_t **lines;	/* ring of lines, size is a power of two */
+	int first;		/* slot of the first line */
+	int size;		/* number of slots in the ring */
 	int len;		/* length of all the data */
 	int alloclen;		/* Actual allocated data length */
 	int writeofs;		/* offset in the first line for the write */
@@ -73,9 +89,13 @@ void rb_linebuf_donebuf(buf_head_t *);
 int rb_linebuf_parse(buf_head_t *, char *, int, int);
 int rb_linebuf_get(buf_head_t *, char *, int, int, int);
 void rb_linebuf_put(buf_head_t *, const rb_strf_t *);
+void rb_linebuf_put_block(buf_head_t *, const char *, size_t);
 void rb_linebuf_attach(buf_head_t *, buf_head_t *);
 void rb_count_rb_linebuf_memory(size_t *, size_t *);
 int rb_linebuf_flush(rb_fde_t *F, buf_head_t *);
 
+/* the offset of the first CR or LF in data, or len if there is none */
+size_t rb_linebuf_scan(const char *data, size_t len);
+
 
 #endif
@@ -69,6 +69,13 @@ struct rb_radixtree_iteration_state
 
 extern rb_radixtree *rb_radixtree_create(const char *name, void (*canonize_cb)(char *key));
 
+/*
+ * rb_radixtree_create_casemap() creates a new patricia tree whose keys are
+ * canonized by replacing each byte c with casemap[c].  Unlike a canonizing
+ * function, this needs no copy of the key to look it up.
+ */
+extern rb_radixtree *rb_radixtree_create_casemap(const char *name, const unsigned char *casemap);
+
 /*
  * rb_radixtree_shutdown() deallocates all heaps used in patricia trees. This is
  * useful on embedded devices with little memory, and/or when you know you won't need
@@ -0,0 +1,38 @@
+/*
+ *  librb: a library used by ircd-ratbox and other things
+ *  rb_scan.h: Finding delimiters many bytes at a time.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+
+#ifndef RB_LIB_H
+# error "Do not use rb_scan.h directly"
+#endif
+
+#ifndef INCLUDED_RB_SCAN_H__
+#define INCLUDED_RB_SCAN_H__
+
+/* the offset of the first byte of data that is one of the four in set,
+ * or len if there is none; repeat a byte to look for fewer */
+size_t rb_scan_any(const char *data, size_t len, const char set[4]);
+
+/* the scanner in use, and choosing one ("avx2", "sse2" or "scalar");
+ * returns 0 if this CPU can't run it.  The fastest is chosen at first use. */
+const char *rb_scanner(void);
+int rb_set_scanner(const char *name);
+
+#endif
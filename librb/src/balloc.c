@@ -51,24 +51,72 @@
  * the block and return it back to the OS, thus causing our memory consumption to go
  * down after we no longer need it.
  *
+ * Each heap hands out fixed size elements carved from blocks of
+ * elemsPerBlock elements.  Every element is preceded by a pointer back to
+ * the block that owns it, so rb_bh_free() can find the block in O(1).  Free
+ * elements are kept on an intrusive singly linked list inside the block
+ * itself, and blocks that still have room are kept on the heap's avail_list.
+ * Elements are carved lazily from a block, so pages of a fresh block are not
+ * touched until they are needed.  A heap made with rb_bh_create_aligned()
+ * pads its slots so that every element starts on the boundary asked for.
  *
+ * When a block becomes entirely free it is handed back to the OS, except
+ * for one spare empty block per heap which is kept around so that a heap
+ * hovering around a block boundary doesn't mmap()/munmap() constantly.
  *
+ * Blocks of RB_BH_HUGEPAGE_SIZE or more are sized to a multiple of the
+ * hugepage size and marked with MADV_HUGEPAGE where that is available.
+ *
+ * Building with -DNOBALLOC turns all of this into plain rb_malloc()/rb_free()
+ * calls, which is useful when running under valgrind or ASan.
  */
 #include <librb_config.h>
 #include <rb_lib.h>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#define RB_BH_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
 static void _rb_bh_fail(const char *reason, const char *file, int line) __attribute__((noreturn));
 
 static uintptr_t offset_pad;
+static size_t page_size;
+
+typedef struct rb_heap_block rb_heap_block;
+
+/* a block of elements */
+struct rb_heap_block
+{
+	rb_dlink_node node;		/* node in bh->block_list */
+	rb_dlink_node avail_node;	/* node in bh->avail_list while free_count > 0 */
+	rb_bh *bh;			/* heap that owns this block */
+	char *elems;			/* start of the element storage */
+	void *free_head;		/* freed elements, linked through their first word */
+	size_t alloc_size;		/* bytes obtained for this block */
+	unsigned long carved;		/* elements handed out at least once */
+	unsigned long free_count;	/* elements available in this block */
+	int mmapped;
+};
 
 /* information for the root node of the heap */
 struct rb_bh
 {
 	rb_dlink_node hlist;
 	size_t elemSize;	/* Size of each element to be stored */
+	size_t slotSize;	/* elemSize plus the back pointer, padded */
+	size_t align;		/* elements start on a multiple of this */
+	size_t blockSize;	/* Size of each block including its header */
 	unsigned long elemsPerBlock;	/* Number of elements per block */
+	unsigned long free_elems;	/* free elements across all blocks */
+	unsigned long empty_blocks;	/* blocks with no elements in use */
+	unsigned long used_elems;	/* only maintained with NOBALLOC */
 	rb_dlink_list block_list;
-	rb_dlink_list free_list;
+	rb_dlink_list avail_list;
 	char *desc;
 };
 
@@ -76,6 +124,9 @@ static rb_dlink_list *heap_lists;
 
 #define rb_bh_fail(x) _rb_bh_fail(x, __FILE__, __LINE__)
 
+#define BH_ALIGN(x, a) (((x) + ((a) - 1)) & ~((size_t)(a) - 1))
+#define BH_HDR_SIZE BH_ALIGN(sizeof(rb_heap_block), offset_pad)
+
 static void
 _rb_bh_fail(const char *reason, const char *file, int line)
 {
@@ -106,17 +157,108 @@ rb_init_bh(void)
 		offset_pad &= ~(__alignof__(long long) - 1);
 	}
 #endif
+
+#ifdef _SC_PAGESIZE
+	page_size = sysconf(_SC_PAGESIZE);
+#endif
+	if(page_size == 0 || page_size == (size_t)-1)
+		page_size = 4096;
+}
+
+#ifndef NOBALLOC
+/*
+ * static void *get_block(size_t size, int *mmapped)
+ *
+ * Inputs: size of the block wanted
+ * Outputs: pointer to zeroed memory, or NULL
+ * Side Effects: memory is obtained from the OS, via mmap() if we can
+ */
+static void *
+get_block(size_t size, int *mmapped)
+{
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ptr != MAP_FAILED)
+	{
+#ifdef MADV_HUGEPAGE
+		if(size >= RB_BH_HUGEPAGE_SIZE)
+			madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+		*mmapped = 1;
+		return ptr;
+	}
+#endif
+	*mmapped = 0;
+	return calloc(1, size);
 }
 
+static void
+free_block(rb_heap_block *b)
+{
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+	if(b->mmapped)
+	{
+		munmap((void *)b, b->alloc_size);
+		return;
+	}
+#endif
+	free(b);
+}
+
+/*
+ * static rb_heap_block *newblock(rb_bh *bh)
+ *
+ * Inputs: the heap to add a block to
+ * Outputs: the new block
+ * Side Effects: the block is put on the heap's block and avail lists
+ */
+static rb_heap_block *
+newblock(rb_bh *bh)
+{
+	rb_heap_block *b;
+	int mmapped;
+
+	b = get_block(bh->blockSize, &mmapped);
+	if(rb_unlikely(b == NULL))
+		rb_bh_fail("newblock() failed to get memory");
+
+	b->bh = bh;
+	b->alloc_size = bh->blockSize;
+	/* elems is where the back pointer of the first slot goes */
+	b->elems = (char *)BH_ALIGN((uintptr_t)b + BH_HDR_SIZE + offset_pad, bh->align) - offset_pad;
+	b->free_count = bh->elemsPerBlock;
+	b->mmapped = mmapped;
+
+	rb_dlinkAdd(b, &b->node, &bh->block_list);
+	rb_dlinkAdd(b, &b->avail_node, &bh->avail_list);
+	bh->free_elems += bh->elemsPerBlock;
+	bh->empty_blocks++;
+	return b;
+}
+
+static void
+releaseblock(rb_bh *bh, rb_heap_block *b)
+{
+	rb_dlinkDelete(&b->node, &bh->block_list);
+	rb_dlinkDelete(&b->avail_node, &bh->avail_list);
+	bh->free_elems -= bh->elemsPerBlock;
+	bh->empty_blocks--;
+	free_block(b);
+}
+#endif
+
 /* ************************************************************************ */
 /* FUNCTION DOCUMENTATION:                                                  */
-/*    rb_bh_create                                                       */
+/*    rb_bh_create_aligned                                                  */
 /* Description:                                                             */
 /*   Creates a new blockheap from which smaller blocks can be allocated.    */
 /*   Intended to be used instead of multiple calls to malloc() when         */
 /*   performance is an issue.                                               */
 /* Parameters:                                                              */
 /*   elemsize (IN):  Size of the basic element to be stored                 */
+/*   align (IN):  Power of two every element starts on a multiple of, or   */
+/*         0 for no more than pointer alignment.  Not honoured when built   */
+/*         with NOBALLOC.                                                   */
 /*   elemsperblock (IN):  Number of elements to be stored in a single block */
 /*         of memory.  When the blockheap runs out of free memory, it will  */
 /*         allocate elemsize * elemsperblock more.                          */
@@ -124,11 +266,13 @@ rb_init_bh(void)
 /*   Pointer to new rb_bh, or NULL if unsuccessful                      */
 /* ************************************************************************ */
 rb_bh *
-rb_bh_create(size_t elemsize, int elemsperblock, const char *desc)
+rb_bh_create_aligned(size_t elemsize, size_t align, int elemsperblock, const char *desc)
 {
 	rb_bh *bh;
+	size_t blocksize, slack;
 	lrb_assert(elemsize > 0 && elemsperblock > 0);
 	lrb_assert(elemsize >= sizeof(rb_dlink_node));
+	lrb_assert((align & (align - 1)) == 0);
 
 	/* Catch idiotic requests up front */
 	if((elemsize == 0) || (elemsperblock <= 0))
@@ -142,18 +286,36 @@ rb_bh_create(size_t elemsize, int elemsperblock, const char *desc)
 	/* Allocate our new rb_bh */
 	bh = rb_malloc(sizeof(rb_bh));
 	bh->elemSize = elemsize;
-	bh->elemsPerBlock = elemsperblock;
+	bh->align = align > offset_pad ? align : offset_pad;
+	bh->slotSize = BH_ALIGN(BH_ALIGN(elemsize, offset_pad) + offset_pad, bh->align);
+
+	/* room to move the first element up to the boundary */
+	slack = bh->align - offset_pad;
+
+	/* round the block up to whole pages (or hugepages) and use the slack
+	 * for extra elements rather than wasting it
+	 */
+	blocksize = BH_HDR_SIZE + slack + bh->slotSize * (size_t)elemsperblock;
+	if(blocksize >= RB_BH_HUGEPAGE_SIZE)
+		blocksize = BH_ALIGN(blocksize, RB_BH_HUGEPAGE_SIZE);
+	else
+		blocksize = BH_ALIGN(blocksize, page_size);
+	bh->blockSize = blocksize;
+	bh->elemsPerBlock = (blocksize - BH_HDR_SIZE - slack) / bh->slotSize;
+
 	if(desc != NULL)
 		bh->desc = rb_strdup(desc);
 
-	if(bh == NULL)
-	{
-		rb_bh_fail("bh == NULL when it shouldn't be");
-	}
 	rb_dlinkAdd(bh, &bh->hlist, heap_lists);
 	return (bh);
 }
 
+rb_bh *
+rb_bh_create(size_t elemsize, int elemsperblock, const char *desc)
+{
+	return rb_bh_create_aligned(elemsize, 0, elemsperblock, desc);
+}
+
 /* ************************************************************************ */
 /* FUNCTION DOCUMENTATION:                                                  */
 /*    rb_bh_alloc                                                        */
@@ -163,19 +325,58 @@ rb_bh_create(size_t elemsize, int elemsperblock, const char *desc)
 /* Parameters:                                                              */
 /*    bh (IN):  Pointer to the Blockheap.                                   */
 /* Returns:                                                                 */
-/*    Pointer to a structure (void *), or NULL if unsuccessful.             */
+/*    Pointer to a zeroed structure (void *), or NULL if unsuccessful.      */
 /* ************************************************************************ */
 
 void *
 rb_bh_alloc(rb_bh *bh)
 {
+#ifndef NOBALLOC
+	rb_heap_block *b;
+	char *slot;
+	void *data;
+#endif
+
 	lrb_assert(bh != NULL);
 	if(rb_unlikely(bh == NULL))
 	{
 		rb_bh_fail("Cannot allocate if bh == NULL");
 	}
 
+#ifdef NOBALLOC
+	bh->used_elems++;
 	return (rb_malloc(bh->elemSize));
+#else
+	if(bh->avail_list.head == NULL)
+		b = newblock(bh);
+	else
+		b = bh->avail_list.head->data;
+
+	if(b->free_count == bh->elemsPerBlock)
+		bh->empty_blocks--;
+
+	if(b->free_head != NULL)
+	{
+		data = b->free_head;
+		b->free_head = *(void **)data;
+		memset(data, 0, bh->elemSize);
+	}
+	else
+	{
+		/* fresh memory from the OS is already zeroed */
+		slot = b->elems + b->carved * bh->slotSize;
+		*(rb_heap_block **)slot = b;
+		data = slot + offset_pad;
+		b->carved++;
+	}
+
+	b->free_count--;
+	bh->free_elems--;
+	if(b->free_count == 0)
+		rb_dlinkDelete(&b->avail_node, &bh->avail_list);
+
+	return (data);
+#endif
 }
 
 
@@ -193,6 +394,10 @@ rb_bh_alloc(rb_bh *bh)
 int
 rb_bh_free(rb_bh *bh, void *ptr)
 {
+#ifndef NOBALLOC
+	rb_heap_block *b;
+#endif
+
 	lrb_assert(bh != NULL);
 	lrb_assert(ptr != NULL);
 
@@ -208,7 +413,32 @@ rb_bh_free(rb_bh *bh, void *ptr)
 		return (1);
 	}
 
+#ifdef NOBALLOC
+	bh->used_elems--;
 	rb_free(ptr);
+#else
+	b = *(rb_heap_block **)((uintptr_t)ptr - offset_pad);
+	if(rb_unlikely(b->bh != bh || (char *)ptr < b->elems ||
+		       (char *)ptr >= b->elems + b->carved * bh->slotSize))
+	{
+		rb_bh_fail("rb_bh_free() bogus pointer");
+	}
+
+	*(void **)ptr = b->free_head;
+	b->free_head = ptr;
+	b->free_count++;
+	bh->free_elems++;
+
+	if(b->free_count == 1)
+		rb_dlinkAddTail(b, &b->avail_node, &bh->avail_list);
+
+	if(b->free_count == bh->elemsPerBlock)
+	{
+		bh->empty_blocks++;
+		if(bh->empty_blocks > 1)
+			releaseblock(bh, b);
+	}
+#endif
 	return (0);
 }
 
@@ -226,9 +456,20 @@ rb_bh_free(rb_bh *bh, void *ptr)
 int
 rb_bh_destroy(rb_bh *bh)
 {
+#ifndef NOBALLOC
+	rb_dlink_node *ptr, *next;
+#endif
+
 	if(bh == NULL)
 		return (1);
 
+#ifndef NOBALLOC
+	RB_DLINK_FOREACH_SAFE(ptr, next, bh->block_list.head)
+	{
+		free_block(ptr->data);
+	}
+#endif
+
 	rb_dlinkDelete(&bh->hlist, heap_lists);
 	rb_free(bh->desc);
 	rb_free(bh);
@@ -236,17 +477,35 @@ rb_bh_destroy(rb_bh *bh)
 	return (0);
 }
 
+static void
+bh_count(rb_bh *bh, size_t *used, size_t *freem, size_t *heapalloc)
+{
+#ifdef NOBALLOC
+	*used = bh->used_elems;
+	*freem = 0;
+	*heapalloc = bh->used_elems * bh->elemSize;
+#else
+	*freem = bh->free_elems;
+	*used = rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock - bh->free_elems;
+	*heapalloc = rb_dlink_list_length(&bh->block_list) * bh->blockSize;
+#endif
+}
+
 void
-rb_bh_usage(rb_bh *bh __attribute__((unused)), size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc)
+rb_bh_usage(rb_bh *bh, size_t *bused, size_t *bfree, size_t *bmemusage, const char **desc)
 {
+	size_t used, freem, heapalloc;
+
+	bh_count(bh, &used, &freem, &heapalloc);
+
 	if(bused != NULL)
-		*bused = 0;
+		*bused = used;
 	if(bfree != NULL)
-		*bfree = 0;
+		*bfree = freem;
 	if(bmemusage != NULL)
-		*bmemusage = 0;
+		*bmemusage = used * bh->elemSize;
 	if(desc != NULL)
-		*desc = "no blockheap";
+		*desc = bh->desc;
 }
 
 void
@@ -256,7 +515,7 @@ rb_bh_usage_all(rb_bh_usage_cb *cb, void *data)
 	rb_bh *bh;
 	size_t used, freem, memusage, heapalloc;
 	static const char *unnamed = "(unnamed_heap)";
-	const char *desc = unnamed;
+	const char *desc;
 
 	if(cb == NULL)
 		return;
@@ -264,12 +523,9 @@ rb_bh_usage_all(rb_bh_usage_cb *cb, void *data)
 	RB_DLINK_FOREACH(ptr, heap_lists->head)
 	{
 		bh = (rb_bh *)ptr->data;
-		freem = rb_dlink_list_length(&bh->free_list);
-		used = (rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock) - freem;
+		bh_count(bh, &used, &freem, &heapalloc);
 		memusage = used * bh->elemSize;
-		heapalloc = (freem + used) * bh->elemSize;
-		if(bh->desc != NULL)
-			desc = bh->desc;
+		desc = bh->desc != NULL ? bh->desc : unnamed;
 		cb(used, freem, memusage, heapalloc, desc, data);
 	}
 	return;
@@ -279,16 +535,15 @@ void
 rb_bh_total_usage(size_t *total_alloc, size_t *total_used)
 {
 	rb_dlink_node *ptr;
-	size_t total_memory = 0, used_memory = 0, used, freem;
+	size_t total_memory = 0, used_memory = 0, used, freem, heapalloc;
 	rb_bh *bh;
 
 	RB_DLINK_FOREACH(ptr, heap_lists->head)
 	{
 		bh = (rb_bh *)ptr->data;
-		freem = rb_dlink_list_length(&bh->free_list);
-		used = (rb_dlink_list_length(&bh->block_list) * bh->elemsPerBlock) - freem;
+		bh_count(bh, &used, &freem, &heapalloc);
 		used_memory += used * bh->elemSize;
-		total_memory += (freem + used) * bh->elemSize;
+		total_memory += heapalloc;
 	}
 
 	if(total_alloc != NULL)
@@ -40,6 +40,7 @@ struct timeout_data
 {
 	rb_fde_t *F;
 	rb_dlink_node node;
+	rb_dlink_list *list;	/* wheel slot (or run list) we are on */
 	time_t timeout;
 	PF *timeout_handler;
 	void *timeout_data;
@@ -48,7 +49,18 @@ struct timeout_data
 rb_dlink_list *rb_fd_table;
 static rb_bh *fd_heap;
 
-static rb_dlink_list timeout_list;
+/*
+ * Socket timeouts live on a timing wheel of one second slots, indexed by
+ * the second they expire in.  Setting and clearing a timeout is O(1), and
+ * rb_checktimeouts() runs every second and only looks at the slots that
+ * have come due since it last ran.  Timeouts further away than the wheel
+ * is long stay in their slot until the wheel comes round to them.
+ */
+#define RB_TIMEOUT_WHEEL_SIZE 256	/* must be a power of two */
+static rb_dlink_list timeout_wheel[RB_TIMEOUT_WHEEL_SIZE];
+static time_t timeout_wheel_time;	/* last second the wheel was run for */
+static unsigned long timeout_count;
+
 static rb_dlink_list closed_list;
 
 struct defer
@@ -191,6 +203,36 @@ rb_set_buffers(rb_fde_t *F, int size)
 	return 1;
 }
 
+/*
+ * rb_set_cork - hold back partial segments on a TCP socket
+ *
+ * inputs	- fd, and whether to cork (1) or uncork (0) it
+ * output	- 1 if successful 0 if not (or not supported)
+ * side effects - while corked the kernel only sends full segments, so
+ *                a burst of writes goes out packed; uncorking sends
+ *                whatever is left straight away.
+ */
+int
+rb_set_cork(rb_fde_t *F, int on)
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+	if(F == NULL || (F->type & (RB_FD_SOCKET | RB_FD_SCTP)) != RB_FD_SOCKET)
+		return 0;
+#ifdef TCP_CORK
+	if(setsockopt(F->fd, IPPROTO_TCP, TCP_CORK, (char *)&on, sizeof(on)))
+		return 0;
+#else
+	if(setsockopt(F->fd, IPPROTO_TCP, TCP_NOPUSH, (char *)&on, sizeof(on)))
+		return 0;
+#endif
+	return 1;
+#else
+	(void)F;
+	(void)on;
+	return 0;
+#endif
+}
+
 /*
  * set_non_blocking - Set the client connection into non-blocking mode.
  *
@@ -281,28 +323,39 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 	{
 		if(td == NULL)
 			return;
-		rb_dlinkDelete(&td->node, &timeout_list);
+		rb_dlinkDelete(&td->node, td->list);
 		rb_free(td);
 		F->timeout = NULL;
-		if(rb_dlink_list_length(&timeout_list) == 0)
-		{
-			rb_event_delete(rb_timeout_ev);
-			rb_timeout_ev = NULL;
-		}
+		timeout_count--;
 		return;
 	}
 
-	if(F->timeout == NULL)
+	if(td == NULL)
+	{
 		td = F->timeout = rb_malloc(sizeof(struct timeout_data));
+		if(timeout_count++ == 0)
+			timeout_wheel_time = rb_current_time();
+	}
+	else
+		rb_dlinkDelete(&td->node, td->list);
 
 	td->F = F;
 	td->timeout = rb_current_time() + timeout;
 	td->timeout_handler = callback;
 	td->timeout_data = cbdata;
-	rb_dlinkAdd(td, &td->node, &timeout_list);
+
+	/* the slot for this second (or earlier) has already been run */
+	if(td->timeout <= timeout_wheel_time)
+		td->timeout = timeout_wheel_time + 1;
+
+	td->list = &timeout_wheel[td->timeout & (RB_TIMEOUT_WHEEL_SIZE - 1)];
+	rb_dlinkAdd(td, &td->node, td->list);
+
+	/* the event stays once created, it is cheap and saves churning
+	 * timers whenever the last timeout goes away */
 	if(rb_timeout_ev == NULL)
 	{
-		rb_timeout_ev = rb_event_add("rb_checktimeouts", rb_checktimeouts, NULL, 5);
+		rb_timeout_ev = rb_event_add("rb_checktimeouts", rb_checktimeouts, NULL, 1);
 	}
 }
 
@@ -316,29 +369,58 @@ rb_settimeout(rb_fde_t *F, time_t timeout, PF * callback, void *cbdata)
 void
 rb_checktimeouts(void *notused __attribute__((unused)))
 {
+	rb_dlink_list expired = { NULL, NULL, 0 };
 	rb_dlink_node *ptr, *next;
 	struct timeout_data *td;
 	rb_fde_t *F;
 	PF *hdl;
 	void *data;
+	time_t now = rb_current_time();
+	time_t t, end;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, timeout_list.head)
+	if(timeout_count == 0)
 	{
-		td = ptr->data;
-		F = td->F;
-		if(F == NULL || !IsFDOpen(F))
-			continue;
+		timeout_wheel_time = now;
+		return;
+	}
+
+	/* if we fell a long way behind, one lap of the wheel covers it */
+	end = now;
+	if(end - timeout_wheel_time > RB_TIMEOUT_WHEEL_SIZE)
+		timeout_wheel_time = end - RB_TIMEOUT_WHEEL_SIZE;
+
+	for(t = timeout_wheel_time + 1; t <= end; t++)
+	{
+		rb_dlink_list *slot = &timeout_wheel[t & (RB_TIMEOUT_WHEEL_SIZE - 1)];
 
-		if(td->timeout < rb_current_time())
+		RB_DLINK_FOREACH_SAFE(ptr, next, slot->head)
 		{
-			hdl = td->timeout_handler;
-			data = td->timeout_data;
-			rb_dlinkDelete(&td->node, &timeout_list);
-			F->timeout = NULL;
-			rb_free(td);
-			hdl(F, data);
+			td = ptr->data;
+			if(td->timeout > now)
+				continue;
+
+			rb_dlinkMoveNode(&td->node, slot, &expired);
+			td->list = &expired;
 		}
 	}
+	timeout_wheel_time = end;
+
+	/* handlers may set or clear other timeouts, including ones on the
+	 * expired list, so take them off one at a time */
+	while(expired.head != NULL)
+	{
+		td = expired.head->data;
+		F = td->F;
+		hdl = td->timeout_handler;
+		data = td->timeout_data;
+		rb_dlinkDelete(&td->node, &expired);
+		F->timeout = NULL;
+		rb_free(td);
+		timeout_count--;
+
+		if(IsFDOpen(F))
+			hdl(F, data);
+	}
 }
 
 static int
@@ -2032,11 +2114,28 @@ rb_defer(void (*fn)(void *), void *data)
 	rb_dlinkAdd(defer, &defer->node, &defer_list);
 }
 
-int
-rb_select(unsigned long timeout)
+struct rb_loop_stats rb_loop_data;
+uint64_t rb_loop_mark;
+static uint64_t rb_loop_wake;
+
+void
+rb_loop_woke(int ready)
+{
+	rb_loop_mark = rb_loop_wake = rb_monotonic_ns();
+	rb_histogram_add_count(&rb_loop_data.ready, ready > 0 ? ready : 0);
+}
+
+const struct rb_loop_stats *
+rb_get_loop_stats(void)
+{
+	return &rb_loop_data;
+}
+
+static void
+rb_run_deferred(void)
 {
-	int ret = select_handler(timeout);
 	rb_dlink_node *ptr, *next;
+
 	RB_DLINK_FOREACH_SAFE(ptr, next, defer_list.head)
 	{
 		struct defer *defer = ptr->data;
@@ -2044,6 +2143,24 @@ rb_select(unsigned long timeout)
 		rb_dlinkDelete(ptr, &defer_list);
 		rb_free(defer);
 	}
+}
+
+int
+rb_select(unsigned long timeout)
+{
+	int ret;
+
+	/* whatever the events run since the last wait deferred, so it
+	 * is not kept waiting on this one */
+	rb_run_deferred();
+
+	/* all since the last wakeup: handlers, events and the rest */
+	if(rb_loop_wake != 0)
+		rb_histogram_add(&rb_loop_data.busy, rb_monotonic_ns() - rb_loop_wake);
+	rb_loop_wake = 0;
+
+	ret = select_handler(timeout);
+	rb_run_deferred();
 	rb_close_pending_fds();
 	return ret;
 }
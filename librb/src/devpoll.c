@@ -219,6 +219,7 @@ rb_select_devpoll(long delay)
 		}
 
 		rb_set_time();
+		rb_loop_woke(num);
 		if(num == 0)
 			continue;
 
@@ -235,6 +236,7 @@ rb_select_devpoll(long delay)
 				{
 					F->read_handler = NULL;
 					hdl(F, F->read_data);
+					rb_loop_charge(&rb_loop_data.read);
 					/*
 					 * this call used to be with a NULL pointer, BUT
 					 * in the devpoll case we only want to update the
@@ -255,6 +257,7 @@ rb_select_devpoll(long delay)
 				{
 					F->write_handler = NULL;
 					hdl(F, F->write_data);
+					rb_loop_charge(&rb_loop_data.write);
 					/* See above similar code in the read case */
 					devpoll_update_events(F,
 							      RB_SELECT_WRITE, F->write_handler);
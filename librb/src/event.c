@@ -50,7 +50,138 @@
 static char last_event_ran[EV_NAME_LEN];
 static rb_dlink_list event_list;
 
-static time_t event_time_min = -1;
+/*
+ * Pending events are kept in a binary min-heap ordered on ev->when, so
+ * rb_event_run() only touches events that are due and rb_event_next() is
+ * O(1).  event_list is still kept for lookups and rb_dump_events().
+ */
+static struct ev_entry **event_heap;
+static int event_heap_len;
+static int event_heap_size;
+
+/* the event whose handler is currently running, it is freed by
+ * rb_run_one_event() rather than rb_event_delete() */
+static struct ev_entry *event_running;
+
+/* run times by event name, kept for as long as we are */
+struct ev_times
+{
+	char name[EV_NAME_LEN];
+	struct rb_histogram hist;
+	rb_dlink_node node;
+};
+static rb_dlink_list event_times;
+
+static struct rb_histogram *
+rb_event_times(const char *name)
+{
+	rb_dlink_node *ptr;
+	struct ev_times *times;
+
+	RB_DLINK_FOREACH(ptr, event_times.head)
+	{
+		times = ptr->data;
+		if(!strcmp(times->name, name))
+			return &times->hist;
+	}
+
+	times = rb_malloc(sizeof(struct ev_times));
+	rb_strlcpy(times->name, name, sizeof(times->name));
+	rb_dlinkAddTail(times, &times->node, &event_times);
+	return &times->hist;
+}
+
+static void
+rb_event_heap_set(int i, struct ev_entry *ev)
+{
+	event_heap[i] = ev;
+	ev->heap_index = i;
+}
+
+static void
+rb_event_heap_up(int i)
+{
+	struct ev_entry *ev = event_heap[i];
+
+	while(i > 0)
+	{
+		int parent = (i - 1) / 2;
+		if(event_heap[parent]->when <= ev->when)
+			break;
+		rb_event_heap_set(i, event_heap[parent]);
+		i = parent;
+	}
+	rb_event_heap_set(i, ev);
+}
+
+static void
+rb_event_heap_down(int i)
+{
+	struct ev_entry *ev = event_heap[i];
+
+	while(1)
+	{
+		int child = 2 * i + 1;
+		if(child >= event_heap_len)
+			break;
+		if(child + 1 < event_heap_len && event_heap[child + 1]->when < event_heap[child]->when)
+			child++;
+		if(ev->when <= event_heap[child]->when)
+			break;
+		rb_event_heap_set(i, event_heap[child]);
+		i = child;
+	}
+	rb_event_heap_set(i, ev);
+}
+
+static void
+rb_event_heap_insert(struct ev_entry *ev)
+{
+	if(event_heap_len == event_heap_size)
+	{
+		event_heap_size = event_heap_size ? event_heap_size * 2 : 32;
+		event_heap = rb_realloc(event_heap, sizeof(struct ev_entry *) * event_heap_size);
+	}
+
+	rb_event_heap_set(event_heap_len++, ev);
+	rb_event_heap_up(ev->heap_index);
+}
+
+static void
+rb_event_heap_remove(struct ev_entry *ev)
+{
+	int i = ev->heap_index;
+
+	if(i < 0)
+		return;
+
+	ev->heap_index = -1;
+	if(--event_heap_len == i)
+		return;
+
+	rb_event_heap_set(i, event_heap[event_heap_len]);
+	rb_event_heap_up(i);
+	rb_event_heap_down(event_heap[i]->heap_index);
+}
+
+/* ev->when changed, restore heap order */
+static void
+rb_event_heap_update(struct ev_entry *ev)
+{
+	if(ev->heap_index < 0)
+		return;
+
+	rb_event_heap_up(ev->heap_index);
+	rb_event_heap_down(ev->heap_index);
+}
+
+static void
+rb_event_free(struct ev_entry *ev)
+{
+	rb_dlinkDelete(&ev->node, &event_list);
+	rb_free(ev->name);
+	rb_free(ev);
+}
 
 /*
  * struct ev_entry *
@@ -68,7 +199,7 @@ rb_event_find(EVH * func, void *arg)
 	RB_DLINK_FOREACH(ptr, event_list.head)
 	{
 		ev = ptr->data;
-		if((ev->func == func) && (ev->arg == arg))
+		if((ev->func == func) && (ev->arg == arg) && !ev->dead)
 			return ev;
 	}
 
@@ -88,11 +219,11 @@ rb_event_add_common(const char *name, EVH * func, void *arg, time_t when, time_t
 	ev->next = when;
 	ev->frequency = frequency;
 	ev->dead = 0;
-
-	if((ev->when < event_time_min) || (event_time_min == -1))
-		event_time_min = ev->when;
+	ev->heap_index = -1;
+	ev->times = rb_event_times(ev->name);
 
 	rb_dlinkAdd(ev, &ev->node, &event_list);
+	rb_event_heap_insert(ev);
 	rb_io_sched_event(ev, when);
 	return ev;
 }
@@ -140,12 +271,18 @@ rb_event_addonce(const char *name, EVH * func, void *arg, time_t when)
 void
 rb_event_delete(struct ev_entry *ev)
 {
-	if(ev == NULL)
+	if(ev == NULL || ev->dead)
 		return;
 
 	ev->dead = 1;
 
+	rb_event_heap_remove(ev);
 	rb_io_unsched_event(ev);
+
+	/* kernel timers may still have an expiry queued for this event, so
+	 * only free it here when we are doing the scheduling ourselves */
+	if(ev != event_running && !rb_io_supports_event())
+		rb_event_free(ev);
 }
 
 /*
@@ -196,16 +333,35 @@ rb_event_addish(const char *name, EVH * func, void *arg, time_t delta_ish)
 void
 rb_run_one_event(struct ev_entry *ev)
 {
+	uint64_t start, end;
+
+	if(ev->dead)
+		return;
+
 	rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
+	event_running = ev;
+	start = rb_monotonic_ns();
 	ev->func(ev->arg);
+	end = rb_monotonic_ns();
+
+	rb_histogram_add(ev->times, end - start);
+	rb_histogram_add(&rb_loop_data.events, end - start);
+	rb_loop_mark = end;
+
 	if(!ev->frequency)
-	{
 		rb_event_delete(ev);
+	event_running = NULL;
+
+	if(ev->dead)
+	{
+		/* deleted by us or by its own handler */
+		if(!rb_io_supports_event())
+			rb_event_free(ev);
 		return;
 	}
+
 	ev->when = rb_current_time() + rb_event_frequency(ev->frequency);
-	if((ev->when < event_time_min) || (event_time_min == -1))
-		event_time_min = ev->when;
+	rb_event_heap_update(ev);
 }
 
 /*
@@ -213,53 +369,18 @@ rb_run_one_event(struct ev_entry *ev)
  *
  * Input: None
  * Output: None
- * Side Effects: Runs pending events in the event list
+ * Side Effects: Runs pending events from the event heap
  */
 void
 rb_event_run(void)
 {
-	rb_dlink_node *ptr, *next;
-	struct ev_entry *ev;
+	time_t now = rb_current_time();
 
 	if(rb_io_supports_event())
 		return;
 
-	event_time_min = -1;
-	RB_DLINK_FOREACH_SAFE(ptr, next, event_list.head)
-	{
-		ev = ptr->data;
-		if (ev->dead)
-		{
-			rb_dlinkDelete(&ev->node, &event_list);
-			rb_free(ev->name);
-			rb_free(ev);
-			continue;
-		}
-		if(ev->when <= rb_current_time())
-		{
-			rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
-			ev->func(ev->arg);
-
-			/* event is scheduled more than once */
-			if(ev->frequency)
-			{
-				ev->when = rb_current_time() + rb_event_frequency(ev->frequency);
-				if((ev->when < event_time_min) || (event_time_min == -1))
-					event_time_min = ev->when;
-			}
-			else
-			{
-				rb_dlinkDelete(&ev->node, &event_list);
-				rb_free(ev->name);
-				rb_free(ev);
-			}
-		}
-		else
-		{
-			if((ev->when < event_time_min) || (event_time_min == -1))
-				event_time_min = ev->when;
-		}
-	}
+	while(event_heap_len > 0 && event_heap[0]->when <= now)
+		rb_run_one_event(event_heap[0]);
 }
 
 void
@@ -307,12 +428,28 @@ rb_dump_events(void (*func) (char *, void *), void *ptr)
 	RB_DLINK_FOREACH(dptr, event_list.head)
 	{
 		ev = dptr->data;
+		if(ev->dead)
+			continue;
 		snprintf(buf, sizeof buf, "%-28s %-4lld seconds (frequency=%d)", ev->name,
 			    (long long)(ev->when - rb_current_time()), (int)ev->frequency);
 		func(buf, ptr);
 	}
 }
 
+void
+rb_dump_event_times(void (*func) (const char *, const struct rb_histogram *, void *), void *ptr)
+{
+	rb_dlink_node *dptr;
+	struct ev_times *times;
+
+	RB_DLINK_FOREACH(dptr, event_times.head)
+	{
+		times = dptr->data;
+		if(times->hist.count != 0)
+			func(times->name, &times->hist, ptr);
+	}
+}
+
 /*
  * void rb_set_back_events(time_t by)
  * Input: Time to set back events by.
@@ -347,12 +484,17 @@ rb_event_update(struct ev_entry *ev, time_t freq)
 	 */
 	time_t next = rb_event_frequency(freq);
 	if((rb_current_time() + next) < ev->when)
+	{
 		ev->when = rb_current_time() + next;
+		rb_event_heap_update(ev);
+	}
 	return;
 }
 
 time_t
 rb_event_next(void)
 {
-	return event_time_min;
+	if(event_heap_len == 0)
+		return -1;
+	return event_heap[0]->when;
 }
@@ -0,0 +1,608 @@
+/*
+ *  librb: a library used by ircd-ratbox and other things
+ *  hashmap.c: Hash table storage.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+
+#include <librb_config.h>
+#include <rb_lib.h>
+#include <rb_hashmap.h>
+
+/*
+ * Open addressing with linear probing, in Robin Hood order: an entry
+ * further from where its hash would put it takes the place of one
+ * nearer, so every entry is within a few slots of its home, and a
+ * lookup can give up as soon as it passes where the key would be.
+ * Deleting shifts the entries after it back, so there are no
+ * tombstones.  The table doubles when it is three quarters full and
+ * never shrinks.
+ */
+#define RB_HASHMAP_MIN_SIZE	16
+
+struct rb_hashmap_slot
+{
+	uint32_t hash;		/* 0 when empty */
+	const void *key;
+	void *data;
+};
+
+struct rb_hashmap
+{
+	rb_hashmap_keytype keytype;
+	const unsigned char *casemap;
+	struct rb_hashmap_slot *slots;
+	unsigned int mask;
+	unsigned int count;
+	char *id;
+
+	rb_dlink_node node;
+};
+
+static rb_dlink_list hashmap_list = {NULL, NULL, 0};
+
+static inline unsigned char
+rb_hashmap_fold(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static uint32_t
+rb_hashmap_hash(rb_hashmap *map, const void *key)
+{
+	const unsigned char *s = key;
+	uint32_t h = 2166136261U;
+
+	switch(map->keytype)
+	{
+	case RB_HASHMAP_INTEGER:
+		h = ((uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ULL) >> 32;
+		break;
+	case RB_HASHMAP_STRING:
+		for(; *s != '\0'; s++)
+			h = (h ^ *s) * 16777619U;
+		break;
+	case RB_HASHMAP_STRING_NOCASE:
+		for(; *s != '\0'; s++)
+			h = (h ^ rb_hashmap_fold(*s)) * 16777619U;
+		break;
+	case RB_HASHMAP_STRING_CASEMAP:
+		for(; *s != '\0'; s++)
+			h = (h ^ map->casemap[*s]) * 16777619U;
+		break;
+	}
+
+	/* the top bit is never part of the index, and marks the slot used */
+	return h | 0x80000000U;
+}
+
+static int
+rb_hashmap_equal(rb_hashmap *map, const void *a, const void *b)
+{
+	const unsigned char *x = a, *y = b;
+
+	switch(map->keytype)
+	{
+	case RB_HASHMAP_INTEGER:
+		return a == b;
+	case RB_HASHMAP_STRING:
+		return !strcmp(a, b);
+	case RB_HASHMAP_STRING_NOCASE:
+		for(; rb_hashmap_fold(*x) == rb_hashmap_fold(*y); x++, y++)
+			if(*x == '\0')
+				return 1;
+		return 0;
+	case RB_HASHMAP_STRING_CASEMAP:
+		for(; map->casemap[*x] == map->casemap[*y]; x++, y++)
+			if(*x == '\0')
+				return 1;
+		return 0;
+	}
+	return 0;
+}
+
+/* how many slots past its home the entry in slot i is */
+static inline unsigned int
+rb_hashmap_distance(rb_hashmap *map, unsigned int i)
+{
+	return (i - (map->slots[i].hash & map->mask)) & map->mask;
+}
+
+static void
+rb_hashmap_insert(rb_hashmap *map, uint32_t hash, const void *key, void *data)
+{
+	struct rb_hashmap_slot cur, tmp;
+	unsigned int i, dist, d;
+
+	cur.hash = hash;
+	cur.key = key;
+	cur.data = data;
+
+	for(i = hash & map->mask, dist = 0;; i = (i + 1) & map->mask, dist++)
+	{
+		if(map->slots[i].hash == 0)
+		{
+			map->slots[i] = cur;
+			return;
+		}
+
+		d = rb_hashmap_distance(map, i);
+		if(d < dist)
+		{
+			tmp = map->slots[i];
+			map->slots[i] = cur;
+			cur = tmp;
+			dist = d;
+		}
+	}
+}
+
+static void
+rb_hashmap_resize(rb_hashmap *map, unsigned int size)
+{
+	struct rb_hashmap_slot *old = map->slots;
+	unsigned int i, oldsize = old != NULL ? map->mask + 1 : 0;
+
+	map->slots = rb_malloc(sizeof(struct rb_hashmap_slot) * size);
+	map->mask = size - 1;
+
+	for(i = 0; i < oldsize; i++)
+		if(old[i].hash != 0)
+			rb_hashmap_insert(map, old[i].hash, old[i].key, old[i].data);
+
+	rb_free(old);
+}
+
+/* the slot holding key, or -1 */
+static int
+rb_hashmap_find(rb_hashmap *map, const void *key)
+{
+	uint32_t hash = rb_hashmap_hash(map, key);
+	unsigned int i, dist;
+
+	for(i = hash & map->mask, dist = 0;; i = (i + 1) & map->mask, dist++)
+	{
+		if(map->slots[i].hash == 0 || rb_hashmap_distance(map, i) < dist)
+			return -1;
+
+		if(map->slots[i].hash == hash && rb_hashmap_equal(map, map->slots[i].key, key))
+			return i;
+	}
+}
+
+/*
+ * rb_hashmap_create(const char *name, rb_hashmap_keytype keytype)
+ *
+ * Hash map object factory.
+ *
+ * Inputs:
+ *     - hash map name
+ *     - what sort of keys it has
+ *
+ * Outputs:
+ *     - on success, a new hash map object.
+ *
+ * Side Effects:
+ *     - if services runs out of memory and cannot allocate the object,
+ *       the program will abort.
+ */
+rb_hashmap *
+rb_hashmap_create(const char *name, rb_hashmap_keytype keytype)
+{
+	rb_hashmap *map = rb_malloc(sizeof(rb_hashmap));
+
+	map->keytype = keytype;
+	map->id = rb_strdup(name);
+	rb_hashmap_resize(map, RB_HASHMAP_MIN_SIZE);
+
+	rb_dlinkAdd(map, &map->node, &hashmap_list);
+
+	return map;
+}
+
+/*
+ * rb_hashmap_create_casemap(const char *name, const unsigned char *casemap)
+ *
+ * Hash map object factory, for maps whose string keys are compared one
+ * mapped byte at a time.
+ *
+ * Inputs:
+ *     - hash map name
+ *     - table of 256 bytes each byte of a key is replaced with, which
+ *       must outlive the map
+ *
+ * Outputs:
+ *     - on success, a new hash map object.
+ *
+ * Side Effects:
+ *     - if services runs out of memory and cannot allocate the object,
+ *       the program will abort.
+ */
+rb_hashmap *
+rb_hashmap_create_casemap(const char *name, const unsigned char *casemap)
+{
+	rb_hashmap *map = rb_hashmap_create(name, RB_HASHMAP_STRING_CASEMAP);
+
+	map->casemap = casemap;
+
+	return map;
+}
+
+/*
+ * rb_hashmap_destroy(rb_hashmap *map,
+ *     void (*destroy_cb)(const void *key, void *data, void *privdata),
+ *     void *privdata);
+ *
+ * Recursively destroys all entries in a hash map, then the map itself.
+ *
+ * Inputs:
+ *     - hash map object
+ *     - optional iteration callback
+ *     - optional opaque/private data to pass to callback
+ *
+ * Outputs:
+ *     - nothing
+ *
+ * Side Effects:
+ *     - on success, a hash map and optionally its data are destroyed.
+ */
+void
+rb_hashmap_destroy(rb_hashmap *map,
+	void (*destroy_cb)(const void *key, void *data, void *privdata),
+	void *privdata)
+{
+	unsigned int i;
+
+	lrb_assert(map != NULL);
+
+	if(destroy_cb != NULL)
+	{
+		for(i = 0; i <= map->mask; i++)
+			if(map->slots[i].hash != 0)
+				destroy_cb(map->slots[i].key, map->slots[i].data, privdata);
+	}
+
+	rb_dlinkDelete(&map->node, &hashmap_list);
+
+	rb_free(map->slots);
+	rb_free(map->id);
+	rb_free(map);
+}
+
+/*
+ * Deleting the current entry shifts the ones after it back, perhaps
+ * into its slot, so the iteration stays in a slot whose entry has
+ * changed.  It starts just after an empty slot, which deleting never
+ * fills, so nothing is moved from its end to its start.
+ */
+static void
+rb_hashmap_iter_seek(rb_hashmap *map, rb_hashmap_iter *state)
+{
+	while(state->left > 0 && map->slots[state->index].hash == 0)
+	{
+		state->index = (state->index + 1) & map->mask;
+		state->left--;
+	}
+
+	if(state->left == 0)
+	{
+		state->key = NULL;
+		state->data = NULL;
+		return;
+	}
+
+	state->key = map->slots[state->index].key;
+	state->data = map->slots[state->index].data;
+}
+
+/*
+ * rb_hashmap_foreach_start(rb_hashmap *map, rb_hashmap_iter *state);
+ *
+ * Initializes a static iterator over a hash map.
+ *
+ * Inputs:
+ *     - hash map object
+ *     - static state object
+ *
+ * Outputs:
+ *     - nothing
+ *
+ * Side Effects:
+ *     - the static state object is initialized.
+ */
+void
+rb_hashmap_foreach_start(rb_hashmap *map, rb_hashmap_iter *state)
+{
+	unsigned int i;
+
+	lrb_assert(map != NULL);
+	lrb_assert(state != NULL);
+
+	for(i = 0; map->slots[i].hash != 0; i++)
+		;
+
+	state->index = (i + 1) & map->mask;
+	state->left = map->mask;
+	rb_hashmap_iter_seek(map, state);
+}
+
+/*
+ * rb_hashmap_foreach_cur(rb_hashmap *map, rb_hashmap_iter *state);
+ *
+ * Returns the data from the current node being iterated by the
+ * static iterator.
+ *
+ * Inputs:
+ *     - hash map object
+ *     - static state object
+ *
+ * Outputs:
+ *     - reference to data in the current node being iterated
+ *
+ * Side Effects:
+ *     - none
+ */
+void *
+rb_hashmap_foreach_cur(rb_hashmap *map, rb_hashmap_iter *state)
+{
+	lrb_assert(map != NULL);
+	lrb_assert(state != NULL);
+
+	return state->left > 0 ? state->data : NULL;
+}
+
+/*
+ * rb_hashmap_foreach_next(rb_hashmap *map, rb_hashmap_iter *state);
+ *
+ * Advances a static iterator over a hash map.
+ *
+ * Inputs:
+ *     - hash map object
+ *     - static state object
+ *
+ * Outputs:
+ *     - nothing
+ *
+ * Side Effects:
+ *     - the static iterator, &state, is advanced to a new node.
+ */
+void
+rb_hashmap_foreach_next(rb_hashmap *map, rb_hashmap_iter *state)
+{
+	struct rb_hashmap_slot *slot;
+
+	lrb_assert(map != NULL);
+	lrb_assert(state != NULL);
+
+	if(state->left == 0)
+		return;
+
+	slot = &map->slots[state->index];
+	if(slot->hash != 0 && slot->key == state->key && slot->data == state->data)
+	{
+		state->index = (state->index + 1) & map->mask;
+		state->left--;
+	}
+
+	rb_hashmap_iter_seek(map, state);
+}
+
+/*
+ * rb_hashmap_add(rb_hashmap *map, const void *key, void *data)
+ *
+ * Adds an entry to a hash map.
+ *
+ * Inputs:
+ *     - hash map object
+ *     - key for the new entry
+ *     - data to bind to the new entry
+ *
+ * Outputs:
+ *     - 1 on success, 0 if the key was already there
+ *
+ * Side Effects:
+ *     - the table may be grown, so no iteration may be in progress.
+ */
+int
+rb_hashmap_add(rb_hashmap *map, const void *key, void *data)
+{
+	lrb_assert(map != NULL);
+
+	if(rb_hashmap_find(map, key) >= 0)
+		return 0;
+
+	if((map->count + 1) * 4 > (map->mask + 1) * 3)
+		rb_hashmap_resize(map, (map->mask + 1) * 2);
+
+	rb_hashmap_insert(map, rb_hashmap_hash(map, key), key, data);
+	map->count++;
+	return 1;
+}
+
+/*
+ * rb_hashmap_retrieve(rb_hashmap *map, const void *key)
+ *
+ * Looks up an entry by key.
+ *
+ * Inputs:
+ *     - hash map object
+ *     - key of the entry to look up
+ *
+ * Outputs:
+ *     - on success, the data bound to the entry
+ *     - on failure, NULL
+ *
+ * Side Effects:
+ *     - none
+ */
+void *
+rb_hashmap_retrieve(rb_hashmap *map, const void *key)
+{
+	int i;
+
+	lrb_assert(map != NULL);
+
+	i = rb_hashmap_find(map, key);
+	return i >= 0 ? map->slots[i].data : NULL;
+}
+
+/*
+ * rb_hashmap_delete(rb_hashmap *map, const void *key)
+ *
+ * Deletes an entry by key.
+ *
+ * Inputs:
+ *     - hash map object
+ *     - key of the entry to delete
+ *
+ * Outputs:
+ *     - on success, the data that was bound to the entry
+ *     - on failure, NULL
+ *
+ * Side Effects:
+ *     - the entries after it may move back a slot.
+ */
+void *
+rb_hashmap_delete(rb_hashmap *map, const void *key)
+{
+	unsigned int i, next;
+	void *data;
+	int found;
+
+	lrb_assert(map != NULL);
+
+	if((found = rb_hashmap_find(map, key)) < 0)
+		return NULL;
+
+	i = found;
+	data = map->slots[i].data;
+
+	for(next = (i + 1) & map->mask;
+			map->slots[next].hash != 0 && rb_hashmap_distance(map, next) > 0;
+			i = next, next = (next + 1) & map->mask)
+		map->slots[i] = map->slots[next];
+
+	map->slots[i].hash = 0;
+	map->slots[i].key = NULL;
+	map->slots[i].data = NULL;
+	map->count--;
+
+	return data;
+}
+
+/*
+ * rb_hashmap_size(rb_hashmap *map)
+ *
+ * Returns the size of a hash map.
+ *
+ * Inputs:
+ *     - hash map object
+ *
+ * Outputs:
+ *     - size of hash map
+ *
+ * Side Effects:
+ *     - none
+ */
+unsigned int
+rb_hashmap_size(rb_hashmap *map)
+{
+	lrb_assert(map != NULL);
+
+	return map->count;
+}
+
+/*
+ * rb_hashmap_memory(rb_hashmap *map)
+ *
+ * Returns the memory a hash map uses.
+ *
+ * Inputs:
+ *     - hash map object
+ *
+ * Outputs:
+ *     - bytes allocated for the map and its table
+ *
+ * Side Effects:
+ *     - none
+ */
+size_t
+rb_hashmap_memory(rb_hashmap *map)
+{
+	lrb_assert(map != NULL);
+
+	return sizeof(rb_hashmap) + strlen(map->id) + 1 +
+		sizeof(struct rb_hashmap_slot) * (map->mask + 1);
+}
+
+/*
+ * rb_hashmap_stats(rb_hashmap *map, void (*cb)(const char *line, void *privdata), void *privdata)
+ *
+ * Reports how far entries are from their home slots; the depth of an
+ * entry is the slots a lookup of it reads.
+ *
+ * Inputs:
+ *     - hash map object
+ *     - callback
+ *     - data for callback
+ *
+ * Outputs:
+ *     - none
+ *
+ * Side Effects:
+ *     - callback called with stats text
+ */
+void
+rb_hashmap_stats(rb_hashmap *map, void (*cb)(const char *line, void *privdata), void *privdata)
+{
+	char str[256];
+	unsigned int i, depth, sum = 0, maxdepth = 0;
+
+	lrb_assert(map != NULL);
+
+	if(map->count)
+	{
+		for(i = 0; i <= map->mask; i++)
+		{
+			if(map->slots[i].hash == 0)
+				continue;
+
+			depth = rb_hashmap_distance(map, i) + 1;
+			sum += depth;
+			if(depth > maxdepth)
+				maxdepth = depth;
+		}
+		snprintf(str, sizeof str, "%-30s %-15s %-10u %-10u %-10u %-10u", map->id, "HASH", map->count, sum, sum / map->count, maxdepth);
+	}
+	else
+	{
+		snprintf(str, sizeof str, "%-30s %-15s %-10s %-10s %-10s %-10s", map->id, "HASH", "0", "0", "0", "0");
+	}
+
+	cb(str, privdata);
+}
+
+void
+rb_hashmap_stats_walk(void (*cb)(const char *line, void *privdata), void *privdata)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, hashmap_list.head)
+	{
+		rb_hashmap_stats(ptr->data, cb, privdata);
+	}
+}
@@ -277,6 +277,8 @@ rb_helper_close(rb_helper *helper)
 	rb_kill(helper->pid, SIGKILL);
 	rb_close(helper->ifd);
 	rb_close(helper->ofd);
+	rb_linebuf_donebuf(&helper->sendq);
+	rb_linebuf_donebuf(&helper->recvq);
 	rb_free(helper);
 }
 
@@ -0,0 +1,88 @@
+/*
+ *  librb: a library used by ircd-ratbox and other things
+ *  histogram.c: Log bucketed latency histograms.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+#include <librb_config.h>
+#include <rb_lib.h>
+
+uint64_t
+rb_monotonic_ns(void)
+{
+	struct timespec ts;
+
+	if(rb_unlikely(clock_gettime(CLOCK_MONOTONIC, &ts) == -1))
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the bucket is the bit length of the value */
+static void
+histogram_add(struct rb_histogram *hist, uint64_t value, uint64_t sample)
+{
+	unsigned int i = 0;
+
+	if(value != 0)
+		i = 64 - __builtin_clzll(value);
+	if(i >= RB_HISTOGRAM_BUCKETS)
+		i = RB_HISTOGRAM_BUCKETS - 1;
+
+	hist->buckets[i]++;
+	hist->count++;
+	hist->sum += sample;
+	if(sample > hist->max)
+		hist->max = sample;
+}
+
+void
+rb_histogram_add(struct rb_histogram *hist, uint64_t ns)
+{
+	histogram_add(hist, ns / 1000, ns);
+}
+
+void
+rb_histogram_add_count(struct rb_histogram *hist, uint64_t n)
+{
+	histogram_add(hist, n, n);
+}
+
+uint64_t
+rb_histogram_quantile(const struct rb_histogram *hist, double q)
+{
+	uint64_t want, seen = 0;
+	unsigned int i;
+
+	if(hist->count == 0)
+		return 0;
+
+	want = q * hist->count;
+	if(want == 0)
+		want = 1;
+
+	for(i = 0; i < RB_HISTOGRAM_BUCKETS - 1; i++)
+	{
+		seen += hist->buckets[i];
+		if(seen >= want)
+			return rb_histogram_bound(i);
+	}
+
+	/* past the last bound: the longest seen is as good as it gets,
+	 * which a histogram of counts never gets to */
+	return (hist->max + 999) / 1000;
+}
@@ -239,6 +239,7 @@ rb_select_kqueue(long delay)
 	}
 
 	rb_set_time();
+	rb_loop_woke(num);
 
 	if(num == 0)
 		return RB_OK;	/* No error.. */
@@ -263,6 +264,7 @@ rb_select_kqueue(long delay)
 			{
 				F->read_handler = NULL;
 				hdl(F, F->read_data);
+				rb_loop_charge(&rb_loop_data.read);
 			}
 
 			break;
@@ -273,6 +275,7 @@ rb_select_kqueue(long delay)
 			{
 				F->write_handler = NULL;
 				hdl(F, F->write_data);
+				rb_loop_charge(&rb_loop_data.write);
 			}
 			break;
 #if defined(EVFILT_TIMER)
@@ -27,10 +27,68 @@
 #include <rb_lib.h>
 #include <commio-int.h>
 
-static rb_bh *rb_linebuf_heap;
+static rb_bh *rb_linebuf_heap[LINEBUF_CLASSES];
+
+static const size_t rb_linebuf_class_size[LINEBUF_CLASSES] = {
+	64, 256, LINEBUF_SIZE + CRLF_LEN + 1
+};
+
+static const char *rb_linebuf_class_desc[LINEBUF_CLASSES] = {
+	"librb_linebuf_heap_64", "librb_linebuf_heap_256", "librb_linebuf_heap"
+};
 
 static int bufline_count = 0;
 
+/* chunks from rb_linebuf_put_block don't come from a heap */
+static size_t block_count, block_used;
+
+/* rings shrink back to this when they drain */
+#define LINEBUF_RING_MIN 8
+
+#define rb_linebuf_slot(bufhead, n) (&(bufhead)->lines[((bufhead)->first + (n)) & ((bufhead)->size - 1)])
+#define rb_linebuf_head(bufhead) ((bufhead)->numlines ? *rb_linebuf_slot(bufhead, 0) : NULL)
+#define rb_linebuf_tail(bufhead) ((bufhead)->numlines ? rb_linebuf_slot(bufhead, (bufhead)->numlines - 1) : NULL)
+
+/*
+ * rb_linebuf_push
+ *
+ * Append a line to the ring, growing it if it is full.
+ */
+static void
+rb_linebuf_push(buf_head_t * bufhead, buf_line_t * bufline)
+{
+	if(bufhead->numlines == bufhead->size)
+	{
+		int newsize = bufhead->size ? bufhead->size * 2 : LINEBUF_RING_MIN;
+		buf_line_t **lines = rb_malloc(sizeof(buf_line_t *) * newsize);
+		int i;
+
+		for(i = 0; i < bufhead->numlines; i++)
+			lines[i] = *rb_linebuf_slot(bufhead, i);
+
+		rb_free(bufhead->lines);
+		bufhead->lines = lines;
+		bufhead->size = newsize;
+		bufhead->first = 0;
+	}
+
+	*rb_linebuf_slot(bufhead, bufhead->numlines) = bufline;
+	bufhead->numlines++;
+	bufhead->alloclen++;
+}
+
+/*
+ * Finding the end of each line is most of the work of parsing what we
+ * read, a burst from a server being megabytes of it, so it is done
+ * many bytes at a time.  The scan for each line starts where the last
+ * one ended, so a read is scanned once however many lines it holds.
+ */
+size_t
+rb_linebuf_scan(const char *data, size_t len)
+{
+	return rb_scan_any(data, len, "\r\n\r\n");
+}
+
 /*
  * rb_linebuf_init
  *
@@ -40,14 +98,37 @@ static int bufline_count = 0;
 void
 rb_linebuf_init(size_t heap_size)
 {
-	rb_linebuf_heap = rb_bh_create(sizeof(buf_line_t), heap_size, "librb_linebuf_heap");
+	int i;
+
+	for(i = 0; i < LINEBUF_CLASSES; i++)
+		rb_linebuf_heap[i] = rb_bh_create(sizeof(buf_line_t) + rb_linebuf_class_size[i],
+						  heap_size, rb_linebuf_class_desc[i]);
+
 }
 
+/*
+ * rb_linebuf_allocate
+ *
+ * Allocate a line from the smallest size class that can hold size bytes
+ * (including the terminating \0).
+ */
 static buf_line_t *
-rb_linebuf_allocate(void)
+rb_linebuf_allocate(size_t size)
 {
 	buf_line_t *t;
-	t = rb_bh_alloc(rb_linebuf_heap);
+	int i;
+
+	lrb_assert(size <= rb_linebuf_class_size[LINEBUF_CLASSES - 1]);
+
+	for(i = 0; i < LINEBUF_CLASSES - 1; i++)
+	{
+		if(size <= rb_linebuf_class_size[i])
+			break;
+	}
+
+	t = rb_bh_alloc(rb_linebuf_heap[i]);
+	t->sclass = i;
+	t->size = rb_linebuf_class_size[i];
 	return (t);
 
 }
@@ -55,33 +136,63 @@ rb_linebuf_allocate(void)
 static void
 rb_linebuf_free(buf_line_t * p)
 {
-	rb_bh_free(rb_linebuf_heap, p);
+	if(p->sclass == LINEBUF_CLASSES)
+	{
+		block_count--;
+		block_used -= sizeof(buf_line_t) + p->size;
+		rb_free(p);
+		return;
+	}
+	rb_bh_free(rb_linebuf_heap[p->sclass], p);
 }
 
 /*
  * rb_linebuf_new_line
  *
- * Create a new line, and link it to the given linebuf.
- * It will be initially empty.
+ * Create a new line able to hold size bytes, and link it to the given
+ * linebuf.  It will be initially empty.
  */
 static buf_line_t *
-rb_linebuf_new_line(buf_head_t * bufhead)
+rb_linebuf_new_line(buf_head_t * bufhead, size_t size)
 {
 	buf_line_t *bufline;
 
-	bufline = rb_linebuf_allocate();
-	if(bufline == NULL)
-		return NULL;
+	bufline = rb_linebuf_allocate(size);
 	++bufline_count;
 
 	/* Stick it at the end of the buf list */
-	rb_dlinkAddTailAlloc(bufline, &bufhead->list);
+	rb_linebuf_push(bufhead, bufline);
 	bufline->refcount++;
 
-	/* And finally, update the allocated size */
-	bufhead->alloclen++;
-	bufhead->numlines++;
+	return bufline;
+}
+
+/*
+ * rb_linebuf_grow_line
+ *
+ * Move a partial line into a size class able to hold size bytes.
+ * Only lines private to this buf_head_t (not attached anywhere) may grow.
+ */
+static buf_line_t *
+rb_linebuf_grow_line(buf_line_t **slot, size_t size)
+{
+	buf_line_t *old = *slot;
+	buf_line_t *bufline;
 
+	if(size <= old->size)
+		return old;
+
+	lrb_assert(old->refcount == 1);
+
+	bufline = rb_linebuf_allocate(size);
+	memcpy(bufline->buf, old->buf, old->len);
+	bufline->terminated = old->terminated;
+	bufline->raw = old->raw;
+	bufline->len = old->len;
+	bufline->refcount = old->refcount;
+
+	*slot = bufline;
+	rb_linebuf_free(old);
 	return bufline;
 }
 
@@ -89,13 +200,15 @@ rb_linebuf_new_line(buf_head_t * bufhead)
 /*
  * rb_linebuf_done_line
  *
- * We've finished with the given line, so deallocate it
+ * We've finished with the first line, so deallocate it
  */
 static void
-rb_linebuf_done_line(buf_head_t * bufhead, buf_line_t * bufline, rb_dlink_node *node)
+rb_linebuf_done_line(buf_head_t * bufhead)
 {
-	/* Remove it from the linked list */
-	rb_dlinkDestroy(node, &bufhead->list);
+	buf_line_t *bufline = *rb_linebuf_slot(bufhead, 0);
+
+	/* Remove it from the ring */
+	bufhead->first = (bufhead->first + 1) & (bufhead->size - 1);
 
 	/* Update the allocated size */
 	bufhead->alloclen--;
@@ -103,6 +216,15 @@ rb_linebuf_done_line(buf_head_t * bufhead, buf_line_t * bufline, rb_dlink_node *
 	lrb_assert(bufhead->len >= 0);
 	bufhead->numlines--;
 
+	/* don't hang on to a ring that grew for a burst */
+	if(bufhead->numlines == 0 && bufhead->size > LINEBUF_RING_MIN)
+	{
+		rb_free(bufhead->lines);
+		bufhead->lines = NULL;
+		bufhead->size = 0;
+		bufhead->first = 0;
+	}
+
 	bufline->refcount--;
 	lrb_assert(bufline->refcount >= 0);
 
@@ -123,15 +245,12 @@ static inline int
 rb_linebuf_skip_crlf(char *ch, int len)
 {
 	int orig_len = len;
+	size_t skip;
 
-	/* First, skip until the first non-CRLF */
-	for(; len; len--, ch++)
-	{
-		if(*ch == '\r')
-			break;
-		else if(*ch == '\n')
-			break;
-	}
+	/* First, skip until the first CRLF */
+	skip = rb_linebuf_scan(ch, len);
+	ch += skip;
+	len -= skip;
 
 	/* Then, skip until the last CRLF */
 	for(; len; len--, ch++)
@@ -165,11 +284,37 @@ rb_linebuf_newbuf(buf_head_t * bufhead)
 void
 rb_linebuf_donebuf(buf_head_t * bufhead)
 {
-	while(bufhead->list.head != NULL)
+	while(bufhead->numlines > 0)
+		rb_linebuf_done_line(bufhead);
+
+	rb_free(bufhead->lines);
+	bufhead->lines = NULL;
+	bufhead->size = 0;
+	bufhead->first = 0;
+}
+
+/*
+ * rb_linebuf_fit_line
+ *
+ * Return a line with room to append cpylen more bytes (capped at
+ * LINEBUF_SIZE), creating a new one if slot is NULL or growing the
+ * existing partial line otherwise.
+ */
+static buf_line_t *
+rb_linebuf_fit_line(buf_head_t * bufhead, buf_line_t **slot, int cpylen)
+{
+	size_t want;
+
+	if(slot == NULL)
 	{
-		rb_linebuf_done_line(bufhead, (buf_line_t *) bufhead->list.head->data,
-				     bufhead->list.head);
+		want = (cpylen > LINEBUF_SIZE ? LINEBUF_SIZE : cpylen) + 1;
+		return rb_linebuf_new_line(bufhead, want);
 	}
+
+	want = (*slot)->len + cpylen;
+	if(want > LINEBUF_SIZE)
+		want = LINEBUF_SIZE;
+	return rb_linebuf_grow_line(slot, want + 1);
 }
 
 /*
@@ -193,25 +338,28 @@ rb_linebuf_donebuf(buf_head_t * bufhead)
  * -Aaron
  */
 static int
-rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int len)
+rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t **slot, char *data, int len)
 {
+	buf_line_t *bufline;
 	int cpylen = 0;		/* how many bytes we've copied */
 	char *ch = data;	/* Pointer to where we are in the read data */
-	char *bufch = bufline->buf + bufline->len;
+	char *bufch;
 	int clen = 0;		/* how many bytes we've processed,
 				   and don't ever want to see again.. */
 
 	/* If its full or terminated, ignore it */
-
-	bufline->raw = 0;
-	lrb_assert(bufline->len <= LINEBUF_SIZE);
-	if(bufline->terminated == 1)
+	if(slot != NULL && (*slot)->terminated == 1)
 		return 0;
 
 	clen = cpylen = rb_linebuf_skip_crlf(ch, len);
 	if(clen == -1)
 		return -1;
 
+	bufline = rb_linebuf_fit_line(bufhead, slot, cpylen);
+	bufch = bufline->buf + bufline->len;
+	bufline->raw = 0;
+	lrb_assert(bufline->len <= LINEBUF_SIZE);
+
 	/* This is the ~overflow case..This doesn't happen often.. */
 	if(cpylen > (LINEBUF_SIZE - bufline->len))
 	{
@@ -267,25 +415,28 @@ rb_linebuf_copy_line(buf_head_t * bufhead, buf_line_t * bufline, char *data, int
  *
  */
 static int
-rb_linebuf_copy_raw(buf_head_t * bufhead, buf_line_t * bufline, char *data, int len)
+rb_linebuf_copy_raw(buf_head_t * bufhead, buf_line_t **slot, char *data, int len)
 {
+	buf_line_t *bufline;
 	int cpylen = 0;		/* how many bytes we've copied */
 	char *ch = data;	/* Pointer to where we are in the read data */
-	char *bufch = bufline->buf + bufline->len;
+	char *bufch;
 	int clen = 0;		/* how many bytes we've processed,
 				   and don't ever want to see again.. */
 
 	/* If its full or terminated, ignore it */
-
-	bufline->raw = 1;
-	lrb_assert(bufline->len <= LINEBUF_SIZE);
-	if(bufline->terminated == 1)
+	if(slot != NULL && (*slot)->terminated == 1)
 		return 0;
 
 	clen = cpylen = rb_linebuf_skip_crlf(ch, len);
 	if(clen == -1)
 		return -1;
 
+	bufline = rb_linebuf_fit_line(bufhead, slot, cpylen);
+	bufch = bufline->buf + bufline->len;
+	bufline->raw = 1;
+	lrb_assert(bufline->len <= LINEBUF_SIZE);
+
 	/* This is the overflow case..This doesn't happen often.. */
 	if(cpylen > (LINEBUF_SIZE - bufline->len))
 	{
@@ -339,20 +490,34 @@ rb_linebuf_copy_raw(buf_head_t * bufhead, buf_line_t * bufline, char *data, int
 int
 rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 {
-	buf_line_t *bufline;
 	int cpylen;
 	int linecnt = 0;
 
+	/* Unless a partial line is waiting for them, any CRs and LFs up
+	 * front end a line we already have (its CRLF was split between
+	 * reads) or are blank lines.  Either way a parsed buffer would
+	 * get an empty line, which rb_linebuf_get() can't tell from
+	 * having none, leaving those after it until the next read.
+	 */
+	if(!raw && (bufhead->numlines == 0 || (*rb_linebuf_tail(bufhead))->terminated))
+	{
+		while(len > 0 && (*data == '\r' || *data == '\n'))
+		{
+			data++;
+			len--;
+		}
+		if(len == 0)
+			return 0;
+	}
+
 	/* First, if we have a partial buffer, try to squeze data into it */
-	if(bufhead->list.tail != NULL)
+	if(bufhead->numlines > 0)
 	{
-		/* Check we're doing the partial buffer thing */
-		bufline = bufhead->list.tail->data;
 		/* just try, the worst it could do is *reject* us .. */
 		if(!raw)
-			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_line(bufhead, rb_linebuf_tail(bufhead), data, len);
 		else
-			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_raw(bufhead, rb_linebuf_tail(bufhead), data, len);
 
 		if(cpylen == -1)
 			return -1;
@@ -371,14 +536,12 @@ rb_linebuf_parse(buf_head_t * bufhead, char *data, int len, int raw)
 	/* Next, the loop */
 	while(len > 0)
 	{
-		/* We obviously need a new buffer, so .. */
-		bufline = rb_linebuf_new_line(bufhead);
-
-		/* And parse */
+		/* We obviously need a new buffer, which the copy creates, sized
+		 * for the line it finds */
 		if(!raw)
-			cpylen = rb_linebuf_copy_line(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_line(bufhead, NULL, data, len);
 		else
-			cpylen = rb_linebuf_copy_raw(bufhead, bufline, data, len);
+			cpylen = rb_linebuf_copy_raw(bufhead, NULL, data, len);
 
 		if(cpylen == -1)
 			return -1;
@@ -406,10 +569,10 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
 	char *start, *ch;
 
 	/* make sure we have a line */
-	if(bufhead->list.head == NULL)
+	if(bufhead->numlines == 0)
 		return 0;	/* Obviously not.. hrm. */
 
-	bufline = bufhead->list.head->data;
+	bufline = rb_linebuf_head(bufhead);
 
 	/* make sure that the buffer was actually *terminated */
 	if(!(partial || bufline->terminated))
@@ -452,7 +615,7 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
 	lrb_assert(cpylen >= 0);
 
 	/* Deallocate the line */
-	rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
+	rb_linebuf_done_line(bufhead);
 
 	/* return how much we copied */
 	return cpylen;
@@ -467,18 +630,16 @@ rb_linebuf_get(buf_head_t * bufhead, char *buf, int buflen, int partial, int raw
 void
 rb_linebuf_attach(buf_head_t * bufhead, buf_head_t * new)
 {
-	rb_dlink_node *ptr;
 	buf_line_t *line;
+	int i;
 
-	RB_DLINK_FOREACH(ptr, new->list.head)
+	for(i = 0; i < new->numlines; i++)
 	{
-		line = ptr->data;
-		rb_dlinkAddTailAlloc(line, &bufhead->list);
+		line = *rb_linebuf_slot(new, i);
+		rb_linebuf_push(bufhead, line);
 
 		/* Update the allocated size */
-		bufhead->alloclen++;
 		bufhead->len += line->len;
-		bufhead->numlines++;
 
 		line->refcount++;
 	}
@@ -492,20 +653,19 @@ rb_linebuf_attach(buf_head_t * bufhead, buf_head_t * new)
 void
 rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 {
+	static char buf[LINEBUF_SIZE + CRLF_LEN + 1];
 	buf_line_t *bufline;
 	size_t len = 0;
 	int ret;
 
 	/* make sure the previous line is terminated */
-	if (bufhead->list.tail) {
-		bufline = bufhead->list.tail->data;
+	if (bufhead->numlines > 0) {
+		bufline = *rb_linebuf_tail(bufhead);
 		lrb_assert(bufline->terminated);
 	}
 
-	/* create a new line */
-	bufline = rb_linebuf_new_line(bufhead);
-
-	ret = rb_fsnprint(bufline->buf, LINEBUF_SIZE + 1, strings);
+	/* format it first so the line can be allocated at the right size */
+	ret = rb_fsnprint(buf, LINEBUF_SIZE + 1, strings);
 	if (ret > 0)
 		len += ret;
 
@@ -513,9 +673,13 @@ rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 		len = LINEBUF_SIZE;
 
 	/* add trailing CRLF */
-	bufline->buf[len++] = '\r';
-	bufline->buf[len++] = '\n';
-	bufline->buf[len] = '\0';
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+	buf[len] = '\0';
+
+	/* create a new line */
+	bufline = rb_linebuf_new_line(bufhead, len + 1);
+	memcpy(bufline->buf, buf, len + 1);
 
 	bufline->terminated = 1;
 
@@ -523,6 +687,50 @@ rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 	bufhead->len += len;
 }
 
+/*
+ * rb_linebuf_put_block
+ *
+ * Append len bytes of lines that are already CRLF terminated, as a few
+ * chunks of up to LINEBUF_BLOCK_SIZE bytes rather than a line each.
+ * This is for sendqs: rb_linebuf_flush writes a chunk out like any
+ * other line, but rb_linebuf_get would return a whole chunk at once.
+ */
+void
+rb_linebuf_put_block(buf_head_t *bufhead, const char *data, size_t len)
+{
+	buf_line_t *bufline;
+	size_t chunk;
+
+	/* make sure the previous line is terminated */
+	if (bufhead->numlines > 0) {
+		bufline = *rb_linebuf_tail(bufhead);
+		lrb_assert(bufline->terminated);
+	}
+
+	while (len > 0) {
+		chunk = len < LINEBUF_BLOCK_SIZE ? len : LINEBUF_BLOCK_SIZE;
+
+		bufline = rb_malloc(sizeof(buf_line_t) + chunk + 1);
+		bufline->sclass = LINEBUF_CLASSES;
+		bufline->size = chunk + 1;
+		memcpy(bufline->buf, data, chunk);
+		bufline->buf[chunk] = '\0';
+		bufline->terminated = 1;
+		bufline->len = chunk;
+
+		++bufline_count;
+		block_count++;
+		block_used += sizeof(buf_line_t) + bufline->size;
+
+		rb_linebuf_push(bufhead, bufline);
+		bufline->refcount++;
+		bufhead->len += chunk;
+
+		data += chunk;
+		len -= chunk;
+	}
+}
+
 /*
  * rb_linebuf_flush
  *
@@ -547,23 +755,20 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
  */
 	if(!rb_fd_ssl(F))
 	{
-		rb_dlink_node *ptr;
 		int x = 0, y;
 		int xret;
 		static struct rb_iovec vec[RB_UIO_MAXIOV];
 
 		memset(vec, 0, sizeof(vec));
 		/* Check we actually have a first buffer */
-		if(bufhead->list.head == NULL)
+		if(bufhead->numlines == 0)
 		{
 			/* nope, so we return none .. */
 			errno = EWOULDBLOCK;
 			return -1;
 		}
 
-		ptr = bufhead->list.head;
-
-		bufline = ptr->data;
+		bufline = rb_linebuf_head(bufhead);
 		if(!bufline->terminated)
 		{
 			errno = EWOULDBLOCK;
@@ -573,23 +778,17 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 
 		vec[x].iov_base = bufline->buf + bufhead->writeofs;
 		vec[x++].iov_len = bufline->len - bufhead->writeofs;
-		ptr = ptr->next;
 
-		do
+		while(x < RB_UIO_MAXIOV && x < bufhead->numlines)
 		{
-			if(ptr == NULL)
-				break;
-
-			bufline = ptr->data;
+			bufline = *rb_linebuf_slot(bufhead, x);
 			if(!bufline->terminated)
 				break;
 
 			vec[x].iov_base = bufline->buf;
 			vec[x].iov_len = bufline->len;
-			ptr = ptr->next;
-
+			x++;
 		}
-		while(++x < RB_UIO_MAXIOV);
 
 		if(x == 0)
 		{
@@ -601,17 +800,14 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 		if(retval <= 0)
 			return retval;
 
-		ptr = bufhead->list.head;
-
 		for(y = 0; y < x; y++)
 		{
-			bufline = ptr->data;
+			bufline = rb_linebuf_head(bufhead);
 
 			if(xret >= bufline->len - bufhead->writeofs)
 			{
 				xret -= bufline->len - bufhead->writeofs;
-				ptr = ptr->next;
-				rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
+				rb_linebuf_done_line(bufhead);
 				bufhead->writeofs = 0;
 			}
 			else
@@ -627,14 +823,14 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 	/* this is the non-writev case */
 
 	/* Check we actually have a first buffer */
-	if(bufhead->list.head == NULL)
+	if(bufhead->numlines == 0)
 	{
 		/* nope, so we return none .. */
 		errno = EWOULDBLOCK;
 		return -1;
 	}
 
-	bufline = bufhead->list.head->data;
+	bufline = rb_linebuf_head(bufhead);
 
 	/* And that its actually full .. */
 	if(!bufline->terminated)
@@ -658,7 +854,7 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 	{
 		bufhead->writeofs = 0;
 		lrb_assert(bufhead->len >= 0);
-		rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
+		rb_linebuf_done_line(bufhead);
 	}
 
 	/* Return line length */
@@ -674,5 +870,21 @@ rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 void
 rb_count_rb_linebuf_memory(size_t *count, size_t *rb_linebuf_memory_used)
 {
-	rb_bh_usage(rb_linebuf_heap, count, NULL, rb_linebuf_memory_used, NULL);
+	size_t lcount, lused, tcount = 0, tused = 0;
+	int i;
+
+	for(i = 0; i < LINEBUF_CLASSES; i++)
+	{
+		rb_bh_usage(rb_linebuf_heap[i], &lcount, NULL, &lused, NULL);
+		tcount += lcount;
+		tused += lused;
+	}
+
+	tcount += block_count;
+	tused += block_used;
+
+	if(count != NULL)
+		*count = tcount;
+	if(rb_linebuf_memory_used != NULL)
+		*rb_linebuf_memory_used = tused;
 }
@@ -1038,6 +1038,58 @@ rb_match_ip_exact(rb_patricia_tree_t *tree, struct sockaddr *ip, unsigned int le
 
 
 
+/*
+ * rb_match_ip_subtree - find the part of the tree covered by ip/len.
+ * Every node whose prefix lies inside ip/len is in the subtree rooted
+ * at the returned node (inclusive), and nothing else is; NULL means no
+ * such node exists.  Walk the result with RB_PATRICIA_WALK.
+ */
+rb_patricia_node_t *
+rb_match_ip_subtree(rb_patricia_tree_t *tree, struct sockaddr *ip, unsigned int len)
+{
+	rb_patricia_node_t *node, *test;
+	uint8_t *addr;
+
+	if(ip->sa_family == AF_INET6)
+	{
+		if(len > 128)
+			len = 128;
+		addr = (uint8_t *)&((struct sockaddr_in6 *)ip)->sin6_addr;
+	}
+	else
+	{
+		if(len > 32)
+			len = 32;
+		addr = (uint8_t *)&((struct sockaddr_in *)ip)->sin_addr;
+	}
+
+	if(len > tree->maxbits)
+		return NULL;
+
+	node = tree->head;
+	while(node != NULL && node->bit < len)
+	{
+		if(BIT_TEST(addr[node->bit >> 3], 0x80 >> (node->bit & 0x07)))
+			node = node->r;
+		else
+			node = node->l;
+	}
+
+	if(node == NULL)
+		return NULL;
+
+	/* only the branching bits were tested on the way down, so compare
+	 * the full mask against any prefix in the subtree (glue nodes
+	 * always have children) */
+	for(test = node; test->prefix == NULL; test = test->l != NULL ? test->l : test->r)
+		;
+
+	if(!comp_with_mask(prefix_tochar(test->prefix), addr, len))
+		return NULL;
+
+	return node;
+}
+
 rb_patricia_node_t *
 rb_match_string(rb_patricia_tree_t *tree, const char *string)
 {
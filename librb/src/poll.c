@@ -177,6 +177,7 @@ rb_select_poll(long delay)
 
 	num = poll(pollfd_list.pollfds, pollfd_list.maxindex + 1, delay);
 	rb_set_time();
+	rb_loop_woke(num);
 	if(num < 0)
 	{
 		if(!rb_ignore_errno(errno))
@@ -209,7 +210,10 @@ rb_select_poll(long delay)
 			F->read_handler = NULL;
 			F->read_data = NULL;
 			if(hdl)
+			{
 				hdl(F, data);
+				rb_loop_charge(&rb_loop_data.read);
+			}
 		}
 
 		if(IsFDOpen(F) && (revents & (POLLWRNORM | POLLOUT | POLLHUP | POLLERR)))
@@ -219,7 +223,10 @@ rb_select_poll(long delay)
 			F->write_handler = NULL;
 			F->write_data = NULL;
 			if(hdl)
+			{
 				hdl(F, data);
+				rb_loop_charge(&rb_loop_data.write);
+			}
 		}
 
 		if(F->read_handler == NULL)
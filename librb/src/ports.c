@@ -138,6 +138,7 @@ rb_select_ports(long delay)
 
 	i = port_getn(pe, pelst, pemax, &nget, p);
 	rb_set_time();
+	rb_loop_woke(i == -1 ? 0 : nget);
 
 	if(i == -1)
 		return RB_OK;
@@ -153,11 +154,13 @@ rb_select_ports(long delay)
 			{
 				F->read_handler = NULL;
 				hdl(F, F->read_data);
+				rb_loop_charge(&rb_loop_data.read);
 			}
 			if((pelst[i].portev_events & (POLLOUT | POLLHUP | POLLERR)) && (hdl = F->write_handler))
 			{
 				F->write_handler = NULL;
 				hdl(F, F->write_data);
+				rb_loop_charge(&rb_loop_data.write);
 			}
 		} else if(pelst[i].portev_source == PORT_SOURCE_TIMER)
 		{
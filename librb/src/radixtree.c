@@ -36,32 +36,89 @@
 #include <rb_lib.h>
 #include <rb_radixtree.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 rb_dlink_list radixtree_list = {NULL, NULL, 0};
 
 /*
- * Patricia tree.
- *
- * A radix trie that avoids one-way branching and redundant nodes.
- *
- * To find a node, the tree is traversed starting from the root. The
- * nibnum in each node indicates which nibble of the key needs to be
- * tested, and the appropriate branch is taken.
- *
- * The nibnum values are strictly increasing while going down the tree.
- *
- * -- jilles
+ * Adaptive radix tree (Leis, Kemper and Neumann, "The Adaptive Radix
+ * Tree", ICDE 2013).
+ *
+ * Each node branches on one byte of the key.  Nodes come in four sizes,
+ * for up to 4, 16, 48 or 256 children, and are swapped for the next
+ * size up or down as children come and go, so a node is never much
+ * bigger than what it holds.  The bytes all keys below a node share are
+ * kept in the node instead of a chain of nodes with one child each;
+ * only the first RB_RADIXTREE_PREFIX of them are stored, the rest are
+ * skipped over and checked against the key in the leaf found at the end.
+ *
+ * Keys are stored canonized, and end with their NUL, so none is a
+ * prefix of another.  Iteration is in strcmp() order of the canonized
+ * keys, as it was with the patricia tree this replaced.
+ *
+ * A tree made with rb_radixtree_create_casemap() is searched by mapping
+ * each byte of the key as it is read; one made with a canonizing
+ * function has to copy and canonize the key first.
  */
+#define RB_RADIXTREE_PREFIX	8
 
-union rb_radixtree_elem;
-typedef union rb_radixtree_elem rb_radixtree_elem;
+#define NODE4		0
+#define NODE16		1
+#define NODE48		2
+#define NODE256		3
 
-/* Other typedefs are in rb_radixtree.h */
 typedef struct rb_radixtree_node rb_radixtree_node;
 
+struct rb_radixtree_node
+{
+	uint8_t type;
+	uint16_t count;
+	uint32_t prefix_len;
+	unsigned char prefix[RB_RADIXTREE_PREFIX];
+};
+
+/* keys[] sorted */
+struct rb_radixtree_node4
+{
+	rb_radixtree_node n;
+	unsigned char keys[4];
+	void *child[4];
+};
+
+struct rb_radixtree_node16
+{
+	rb_radixtree_node n;
+	unsigned char keys[16];
+	void *child[16];
+};
+
+/* index[] is one more than where the byte's child is, or 0 */
+struct rb_radixtree_node48
+{
+	rb_radixtree_node n;
+	unsigned char index[256];
+	void *child[48];
+};
+
+struct rb_radixtree_node256
+{
+	rb_radixtree_node n;
+	void *child[256];
+};
+
+struct rb_radixtree_leaf
+{
+	void *data;
+	char key[];		/* canonized */
+};
+
 struct rb_radixtree
 {
 	void (*canonize_cb)(char *key);
-	rb_radixtree_elem *root;
+	const unsigned char *casemap;
+	void *root;
 
 	unsigned int count;
 	char *id;
@@ -69,80 +126,845 @@ struct rb_radixtree
 	rb_dlink_node node;
 };
 
-#define POINTERS_PER_NODE 16
-#define NIBBLE_VAL(key, nibnum) (((key)[(nibnum) / 2] >> (((nibnum) & 1) ? 0 : 4)) & 0xF)
+/* children are nodes, or leaves with the low bit of the pointer set */
+#define IS_LEAF(p)	((uintptr_t)(p) & 1)
+#define LEAF(p)		((rb_radixtree_leaf *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define TAG_LEAF(l)	((void *)((uintptr_t)(l) | 1))
 
-struct rb_radixtree_node
-{
-	/* nibble to test (nibble NUM%2 of byte NUM/2) */
-	int nibnum;
+#define STORED(len)	((len) < RB_RADIXTREE_PREFIX ? (len) : RB_RADIXTREE_PREFIX)
+
+/* Preserve compatibility with the old mowgli_patricia.h */
+#define STATE_CUR(state) ((state)->pspare[0])
+#define STATE_NEXT(state) ((state)->pspare[1])
 
-	/* branches of the tree */
-	rb_radixtree_elem *down[POINTERS_PER_NODE];
-	rb_radixtree_elem *parent;
+/* a key being looked for, read through a case map */
+struct rb_radixtree_key
+{
+	const unsigned char *s;
+	size_t len;
+	const unsigned char *map;
+};
 
-	char parent_val;
+static const unsigned char identity_map[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+	0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+	0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
 };
 
-struct rb_radixtree_leaf
+/* the byte at depth, which is 0 from the end of the key on */
+static inline unsigned char
+key_byte(const struct rb_radixtree_key *k, size_t depth)
+{
+	return depth < k->len ? k->map[k->s[depth]] : 0;
+}
+
+/* compares a leaf's key with k, as strcmp() would */
+static int
+leaf_cmp(const rb_radixtree_leaf *leaf, const struct rb_radixtree_key *k)
+{
+	const unsigned char *a = (const unsigned char *)leaf->key;
+	unsigned char b;
+	size_t i;
+
+	for (i = 0;; i++)
+	{
+		b = key_byte(k, i);
+		if (a[i] != b)
+			return a[i] - b;
+		if (a[i] == '\0')
+			return 0;
+	}
+}
+
+static rb_radixtree_node *
+new_node(int type)
+{
+	static const size_t sizes[] = {
+		sizeof(struct rb_radixtree_node4),
+		sizeof(struct rb_radixtree_node16),
+		sizeof(struct rb_radixtree_node48),
+		sizeof(struct rb_radixtree_node256),
+	};
+	rb_radixtree_node *n = rb_malloc(sizes[type]);
+
+	n->type = type;
+	return n;
+}
+
+static void
+copy_header(rb_radixtree_node *dst, const rb_radixtree_node *src)
+{
+	dst->count = src->count;
+	dst->prefix_len = src->prefix_len;
+	memcpy(dst->prefix, src->prefix, STORED(src->prefix_len));
+}
+
+/* where the pointer to the child for byte c is, or NULL */
+static void **
+find_child(rb_radixtree_node *n, unsigned char c)
+{
+	struct rb_radixtree_node4 *n4;
+	struct rb_radixtree_node16 *n16;
+	struct rb_radixtree_node48 *n48;
+	struct rb_radixtree_node256 *n256;
+	int i;
+
+	switch (n->type)
+	{
+	case NODE4:
+		n4 = (struct rb_radixtree_node4 *)n;
+		for (i = 0; i < n->count; i++)
+			if (n4->keys[i] == c)
+				return &n4->child[i];
+		return NULL;
+
+	case NODE16:
+		n16 = (struct rb_radixtree_node16 *)n;
+#ifdef __SSE2__
+		{
+			__m128i hit = _mm_cmpeq_epi8(_mm_set1_epi8((char)c),
+						     _mm_loadu_si128((const __m128i *)n16->keys));
+			int mask = _mm_movemask_epi8(hit) & ((1 << n->count) - 1);
+
+			return mask != 0 ? &n16->child[__builtin_ctz(mask)] : NULL;
+		}
+#else
+		for (i = 0; i < n->count; i++)
+			if (n16->keys[i] == c)
+				return &n16->child[i];
+		return NULL;
+#endif
+
+	case NODE48:
+		n48 = (struct rb_radixtree_node48 *)n;
+		return n48->index[c] != 0 ? &n48->child[n48->index[c] - 1] : NULL;
+
+	case NODE256:
+		n256 = (struct rb_radixtree_node256 *)n;
+		return n256->child[c] != NULL ? &n256->child[c] : NULL;
+	}
+
+	return NULL;
+}
+
+/* the child for the smallest byte above c, or NULL; c = -1 for the first */
+static void *
+next_child(rb_radixtree_node *n, int c)
+{
+	struct rb_radixtree_node4 *n4;
+	struct rb_radixtree_node16 *n16;
+	struct rb_radixtree_node48 *n48;
+	struct rb_radixtree_node256 *n256;
+	int i;
+
+	switch (n->type)
+	{
+	case NODE4:
+		n4 = (struct rb_radixtree_node4 *)n;
+		for (i = 0; i < n->count; i++)
+			if (n4->keys[i] > c)
+				return n4->child[i];
+		return NULL;
+
+	case NODE16:
+		n16 = (struct rb_radixtree_node16 *)n;
+		for (i = 0; i < n->count; i++)
+			if (n16->keys[i] > c)
+				return n16->child[i];
+		return NULL;
+
+	case NODE48:
+		n48 = (struct rb_radixtree_node48 *)n;
+		for (i = c + 1; i < 256; i++)
+			if (n48->index[i] != 0)
+				return n48->child[n48->index[i] - 1];
+		return NULL;
+
+	case NODE256:
+		n256 = (struct rb_radixtree_node256 *)n;
+		for (i = c + 1; i < 256; i++)
+			if (n256->child[i] != NULL)
+				return n256->child[i];
+		return NULL;
+	}
+
+	return NULL;
+}
+
+/* the byte n's child for p is under */
+static unsigned char
+child_byte(rb_radixtree_node *n, void **slot)
+{
+	struct rb_radixtree_node48 *n48;
+	int i;
+
+	switch (n->type)
+	{
+	case NODE4:
+		return ((struct rb_radixtree_node4 *)n)->keys[slot - ((struct rb_radixtree_node4 *)n)->child];
+	case NODE16:
+		return ((struct rb_radixtree_node16 *)n)->keys[slot - ((struct rb_radixtree_node16 *)n)->child];
+	case NODE48:
+		n48 = (struct rb_radixtree_node48 *)n;
+		for (i = 0; i < 256; i++)
+			if (n48->index[i] == slot - n48->child + 1)
+				return i;
+		break;
+	case NODE256:
+		return slot - ((struct rb_radixtree_node256 *)n)->child;
+	}
+
+	lrb_assert(0);
+	return 0;
+}
+
+/*
+ * add_child()
+ *
+ * Adds a child under byte c, which must not have one, growing the node
+ * if it is full.
+ *
+ * Inputs:
+ *     - where the pointer to the node is
+ *     - node
+ *     - byte and child
+ *
+ * Outputs:
+ *     - nothing
+ *
+ * Side Effects:
+ *     - *ref may be replaced with a bigger node.
+ */
+static void
+add_child(void **ref, rb_radixtree_node *n, unsigned char c, void *child)
+{
+	struct rb_radixtree_node4 *n4;
+	struct rb_radixtree_node16 *n16;
+	struct rb_radixtree_node48 *n48;
+	struct rb_radixtree_node256 *n256;
+	int i;
+
+	switch (n->type)
+	{
+	case NODE4:
+		n4 = (struct rb_radixtree_node4 *)n;
+		if (n->count < 4)
+		{
+			for (i = 0; i < n->count && n4->keys[i] < c; i++)
+				;
+			memmove(n4->keys + i + 1, n4->keys + i, n->count - i);
+			memmove(n4->child + i + 1, n4->child + i, (n->count - i) * sizeof(void *));
+			n4->keys[i] = c;
+			n4->child[i] = child;
+			n->count++;
+			return;
+		}
+
+		n16 = (struct rb_radixtree_node16 *)new_node(NODE16);
+		copy_header(&n16->n, n);
+		memcpy(n16->keys, n4->keys, 4);
+		memcpy(n16->child, n4->child, 4 * sizeof(void *));
+		*ref = n16;
+		rb_free(n4);
+		add_child(ref, &n16->n, c, child);
+		return;
+
+	case NODE16:
+		n16 = (struct rb_radixtree_node16 *)n;
+		if (n->count < 16)
+		{
+			for (i = 0; i < n->count && n16->keys[i] < c; i++)
+				;
+			memmove(n16->keys + i + 1, n16->keys + i, n->count - i);
+			memmove(n16->child + i + 1, n16->child + i, (n->count - i) * sizeof(void *));
+			n16->keys[i] = c;
+			n16->child[i] = child;
+			n->count++;
+			return;
+		}
+
+		n48 = (struct rb_radixtree_node48 *)new_node(NODE48);
+		copy_header(&n48->n, n);
+		for (i = 0; i < 16; i++)
+		{
+			n48->index[n16->keys[i]] = i + 1;
+			n48->child[i] = n16->child[i];
+		}
+		*ref = n48;
+		rb_free(n16);
+		add_child(ref, &n48->n, c, child);
+		return;
+
+	case NODE48:
+		n48 = (struct rb_radixtree_node48 *)n;
+		if (n->count < 48)
+		{
+			for (i = 0; n48->child[i] != NULL; i++)
+				;
+			n48->child[i] = child;
+			n48->index[c] = i + 1;
+			n->count++;
+			return;
+		}
+
+		n256 = (struct rb_radixtree_node256 *)new_node(NODE256);
+		copy_header(&n256->n, n);
+		for (i = 0; i < 256; i++)
+			if (n48->index[i] != 0)
+				n256->child[i] = n48->child[n48->index[i] - 1];
+		*ref = n256;
+		rb_free(n48);
+		add_child(ref, &n256->n, c, child);
+		return;
+
+	case NODE256:
+		n256 = (struct rb_radixtree_node256 *)n;
+		n256->child[c] = child;
+		n->count++;
+		return;
+	}
+}
+
+/*
+ * remove_child()
+ *
+ * Removes the child in slot, shrinking the node when it gets small
+ * enough, and replacing it with its last child when it has one left.
+ *
+ * Inputs:
+ *     - where the pointer to the node is
+ *     - node
+ *     - where its pointer to the child is
+ *
+ * Outputs:
+ *     - nothing
+ *
+ * Side Effects:
+ *     - *ref may be replaced with a smaller node, or the last child.
+ */
+static void
+remove_child(void **ref, rb_radixtree_node *n, void **slot)
+{
+	struct rb_radixtree_node4 *n4;
+	struct rb_radixtree_node16 *n16;
+	struct rb_radixtree_node48 *n48;
+	struct rb_radixtree_node256 *n256;
+	rb_radixtree_node *child;
+	unsigned char c;
+	int i, pos, len;
+
+	switch (n->type)
+	{
+	case NODE4:
+		n4 = (struct rb_radixtree_node4 *)n;
+		i = slot - n4->child;
+		memmove(n4->keys + i, n4->keys + i + 1, n->count - i - 1);
+		memmove(n4->child + i, n4->child + i + 1, (n->count - i - 1) * sizeof(void *));
+		n->count--;
+
+		if (n->count > 1)
+			return;
+
+		/* a node with one child becomes part of the child's prefix */
+		if (!IS_LEAF(n4->child[0]))
+		{
+			child = n4->child[0];
+			len = STORED(n->prefix_len);
+			if (len < RB_RADIXTREE_PREFIX)
+				n->prefix[len++] = n4->keys[0];
+			if (len < RB_RADIXTREE_PREFIX)
+			{
+				memcpy(n->prefix + len, child->prefix,
+				       STORED(child->prefix_len) < RB_RADIXTREE_PREFIX - len ?
+						STORED(child->prefix_len) : RB_RADIXTREE_PREFIX - len);
+			}
+			child->prefix_len += n->prefix_len + 1;
+			memcpy(child->prefix, n->prefix, STORED(child->prefix_len));
+		}
+		*ref = n4->child[0];
+		rb_free(n4);
+		return;
+
+	case NODE16:
+		n16 = (struct rb_radixtree_node16 *)n;
+		i = slot - n16->child;
+		memmove(n16->keys + i, n16->keys + i + 1, n->count - i - 1);
+		memmove(n16->child + i, n16->child + i + 1, (n->count - i - 1) * sizeof(void *));
+		n->count--;
+
+		if (n->count > 3)
+			return;
+
+		n4 = (struct rb_radixtree_node4 *)new_node(NODE4);
+		copy_header(&n4->n, n);
+		memcpy(n4->keys, n16->keys, 3);
+		memcpy(n4->child, n16->child, 3 * sizeof(void *));
+		*ref = n4;
+		rb_free(n16);
+		return;
+
+	case NODE48:
+		n48 = (struct rb_radixtree_node48 *)n;
+		c = child_byte(n, slot);
+		n48->index[c] = 0;
+		*slot = NULL;
+		n->count--;
+
+		if (n->count > 12)
+			return;
+
+		n16 = (struct rb_radixtree_node16 *)new_node(NODE16);
+		copy_header(&n16->n, n);
+		for (i = 0, pos = 0; i < 256; i++)
+		{
+			if (n48->index[i] == 0)
+				continue;
+			n16->keys[pos] = i;
+			n16->child[pos++] = n48->child[n48->index[i] - 1];
+		}
+		*ref = n16;
+		rb_free(n48);
+		return;
+
+	case NODE256:
+		n256 = (struct rb_radixtree_node256 *)n;
+		*slot = NULL;
+		n->count--;
+
+		if (n->count > 37)
+			return;
+
+		n48 = (struct rb_radixtree_node48 *)new_node(NODE48);
+		copy_header(&n48->n, n);
+		for (i = 0, pos = 0; i < 256; i++)
+		{
+			if (n256->child[i] == NULL)
+				continue;
+			n48->child[pos] = n256->child[i];
+			n48->index[i] = ++pos;
+		}
+		*ref = n48;
+		rb_free(n256);
+		return;
+	}
+}
+
+/*
+ * first_leaf()
+ *
+ * Find the smallest leaf hanging off a subtree.
+ *
+ * Inputs:
+ *     - element (may be leaf or node) heading subtree
+ *
+ * Outputs:
+ *     - lowest leaf in subtree
+ *
+ * Side Effects:
+ *     - none
+ */
+static rb_radixtree_leaf *
+first_leaf(void *p)
+{
+	while (p != NULL && !IS_LEAF(p))
+		p = next_child(p, -1);
+
+	return p != NULL ? LEAF(p) : NULL;
+}
+
+/* how many of n's prefix bytes k matches from depth */
+static unsigned int
+prefix_match(rb_radixtree_node *n, const struct rb_radixtree_key *k, size_t depth)
+{
+	rb_radixtree_leaf *leaf;
+	unsigned int i;
+
+	for (i = 0; i < STORED(n->prefix_len); i++)
+		if (n->prefix[i] != key_byte(k, depth + i))
+			return i;
+
+	if (n->prefix_len > RB_RADIXTREE_PREFIX)
+	{
+		/* the rest of the prefix is in every key below */
+		leaf = first_leaf(n);
+		for (; i < n->prefix_len; i++)
+			if ((unsigned char)leaf->key[depth + i] != key_byte(k, depth + i))
+				return i;
+	}
+
+	return i;
+}
+
+static rb_radixtree_leaf *
+radix_find(rb_radixtree *dict, const struct rb_radixtree_key *k)
+{
+	rb_radixtree_node *n;
+	rb_radixtree_leaf *leaf;
+	void *p = dict->root, **child;
+	size_t depth = 0;
+	unsigned int i;
+
+	while (p != NULL)
+	{
+		if (IS_LEAF(p))
+		{
+			leaf = LEAF(p);
+			return leaf_cmp(leaf, k) == 0 ? leaf : NULL;
+		}
+
+		n = p;
+		if (n->prefix_len != 0)
+		{
+			/* the bytes not stored are checked in the leaf */
+			for (i = 0; i < STORED(n->prefix_len); i++)
+				if (n->prefix[i] != key_byte(k, depth + i))
+					return NULL;
+			depth += n->prefix_len;
+		}
+
+		child = find_child(n, key_byte(k, depth));
+		if (child == NULL)
+			return NULL;
+
+		p = *child;
+		depth++;
+	}
+
+	return NULL;
+}
+
+/* the leaf with the smallest key above (or, unless strict, equal to) k */
+static rb_radixtree_leaf *
+radix_lower_bound(void *p, const struct rb_radixtree_key *k, size_t depth, int strict)
+{
+	rb_radixtree_node *n;
+	rb_radixtree_leaf *leaf = NULL;
+	unsigned char b, kb;
+	void **child;
+	unsigned int i;
+	int cmp;
+
+	if (p == NULL)
+		return NULL;
+
+	if (IS_LEAF(p))
+	{
+		cmp = leaf_cmp(LEAF(p), k);
+		return cmp > 0 || (cmp == 0 && !strict) ? LEAF(p) : NULL;
+	}
+
+	n = p;
+	for (i = 0; i < n->prefix_len; i++)
+	{
+		if (i < RB_RADIXTREE_PREFIX)
+			b = n->prefix[i];
+		else
+		{
+			if (leaf == NULL)
+				leaf = first_leaf(n);
+			b = leaf->key[depth + i];
+		}
+
+		kb = key_byte(k, depth + i);
+		if (b < kb)
+			return NULL;
+		if (b > kb)
+			return first_leaf(n);
+	}
+	depth += n->prefix_len;
+
+	kb = key_byte(k, depth);
+	child = find_child(n, kb);
+	if (child != NULL && (leaf = radix_lower_bound(*child, k, depth + 1, strict)) != NULL)
+		return leaf;
+
+	return first_leaf(next_child(n, kb));
+}
+
+/* adds leaf, unless its key is there already */
+static int
+radix_insert(rb_radixtree *dict, rb_radixtree_leaf *leaf)
+{
+	struct rb_radixtree_key k = { (const unsigned char *)leaf->key, strlen(leaf->key), identity_map };
+	rb_radixtree_node *n, *split;
+	rb_radixtree_leaf *other;
+	void **ref = &dict->root, **child;
+	size_t depth = 0, i;
+	unsigned int diff;
+	unsigned char c;
+
+	for (;;)
+	{
+		if (*ref == NULL)
+		{
+			*ref = TAG_LEAF(leaf);
+			return 1;
+		}
+
+		if (IS_LEAF(*ref))
+		{
+			other = LEAF(*ref);
+			if (!strcmp(other->key, leaf->key))
+				return 0;
+
+			for (i = depth; other->key[i] == leaf->key[i]; i++)
+				;
+
+			split = new_node(NODE4);
+			split->prefix_len = i - depth;
+			memcpy(split->prefix, leaf->key + depth, STORED(split->prefix_len));
+			add_child(ref, split, other->key[i], *ref);
+			add_child(ref, split, leaf->key[i], TAG_LEAF(leaf));
+			*ref = split;
+			return 1;
+		}
+
+		n = *ref;
+		if (n->prefix_len != 0)
+		{
+			diff = prefix_match(n, &k, depth);
+			if (diff < n->prefix_len)
+			{
+				/* the keys part within the prefix: split it there */
+				split = new_node(NODE4);
+				split->prefix_len = diff;
+				memcpy(split->prefix, n->prefix, STORED(diff));
+
+				if (n->prefix_len <= RB_RADIXTREE_PREFIX)
+				{
+					c = n->prefix[diff];
+					n->prefix_len -= diff + 1;
+					memmove(n->prefix, n->prefix + diff + 1, STORED(n->prefix_len));
+				}
+				else
+				{
+					other = first_leaf(n);
+					c = other->key[depth + diff];
+					n->prefix_len -= diff + 1;
+					memcpy(n->prefix, other->key + depth + diff + 1, STORED(n->prefix_len));
+				}
+
+				add_child(ref, split, c, n);
+				add_child(ref, split, leaf->key[depth + diff], TAG_LEAF(leaf));
+				*ref = split;
+				return 1;
+			}
+			depth += n->prefix_len;
+		}
+
+		child = find_child(n, leaf->key[depth]);
+		if (child == NULL)
+		{
+			add_child(ref, n, leaf->key[depth], TAG_LEAF(leaf));
+			return 1;
+		}
+
+		ref = child;
+		depth++;
+	}
+}
+
+/* takes the leaf for k out of the tree, and returns it */
+static rb_radixtree_leaf *
+radix_remove(rb_radixtree *dict, const struct rb_radixtree_key *k)
+{
+	rb_radixtree_node *n;
+	rb_radixtree_leaf *leaf;
+	void **ref = &dict->root, **child;
+	size_t depth = 0;
+	unsigned int i;
+
+	if (*ref == NULL)
+		return NULL;
+
+	if (IS_LEAF(*ref))
+	{
+		leaf = LEAF(*ref);
+		if (leaf_cmp(leaf, k) != 0)
+			return NULL;
+		*ref = NULL;
+		return leaf;
+	}
+
+	for (;;)
+	{
+		n = *ref;
+		if (n->prefix_len != 0)
+		{
+			for (i = 0; i < STORED(n->prefix_len); i++)
+				if (n->prefix[i] != key_byte(k, depth + i))
+					return NULL;
+			depth += n->prefix_len;
+		}
+
+		child = find_child(n, key_byte(k, depth));
+		if (child == NULL)
+			return NULL;
+
+		if (IS_LEAF(*child))
+		{
+			leaf = LEAF(*child);
+			if (leaf_cmp(leaf, k) != 0)
+				return NULL;
+			remove_child(ref, n, child);
+			return leaf;
+		}
+
+		ref = child;
+		depth++;
+	}
+}
+
+/* the array n keeps its children in, which may have holes */
+static void **
+node_children(rb_radixtree_node *n, int *len)
+{
+	switch (n->type)
+	{
+	case NODE4:
+		*len = n->count;
+		return ((struct rb_radixtree_node4 *)n)->child;
+	case NODE16:
+		*len = n->count;
+		return ((struct rb_radixtree_node16 *)n)->child;
+	case NODE48:
+		*len = 48;
+		return ((struct rb_radixtree_node48 *)n)->child;
+	case NODE256:
+		*len = 256;
+		return ((struct rb_radixtree_node256 *)n)->child;
+	}
+
+	*len = 0;
+	return NULL;
+}
+
+/* calls cb for each leaf in order, until it returns non-zero */
+static int
+radix_walk(void *p, int (*cb)(rb_radixtree_leaf *leaf, void *privdata), void *privdata)
 {
-	/* -1 to indicate this is a leaf, not a node */
-	int nibnum;
+	rb_radixtree_node *n;
+	struct rb_radixtree_node48 *n48;
+	int i, ret;
 
-	/* data associated with the key */
-	void *data;
+	if (p == NULL)
+		return 0;
 
-	/* key (canonized copy) */
-	char *key;
-	rb_radixtree_elem *parent;
+	if (IS_LEAF(p))
+		return cb(LEAF(p), privdata);
 
-	char parent_val;
-};
+	n = p;
+	switch (n->type)
+	{
+	case NODE4:
+		for (i = 0; i < n->count; i++)
+			if ((ret = radix_walk(((struct rb_radixtree_node4 *)n)->child[i], cb, privdata)) != 0)
+				return ret;
+		break;
+	case NODE16:
+		for (i = 0; i < n->count; i++)
+			if ((ret = radix_walk(((struct rb_radixtree_node16 *)n)->child[i], cb, privdata)) != 0)
+				return ret;
+		break;
+	case NODE48:
+		n48 = (struct rb_radixtree_node48 *)n;
+		for (i = 0; i < 256; i++)
+			if (n48->index[i] != 0 &&
+					(ret = radix_walk(n48->child[n48->index[i] - 1], cb, privdata)) != 0)
+				return ret;
+		break;
+	case NODE256:
+		for (i = 0; i < 256; i++)
+			if ((ret = radix_walk(((struct rb_radixtree_node256 *)n)->child[i], cb, privdata)) != 0)
+				return ret;
+		break;
+	}
+
+	return 0;
+}
 
-union rb_radixtree_elem
+/* frees every node and leaf below p, passing each leaf to destroy_cb */
+static void
+radix_free(void *p, void (*destroy_cb)(const char *key, void *data, void *privdata), void *privdata)
 {
-	int nibnum;
-	rb_radixtree_node node;
+	void **child;
+	int i, len;
 
-	rb_radixtree_leaf leaf;
-};
+	if (p == NULL)
+		return;
 
-#define IS_LEAF(elem) ((elem)->nibnum == -1)
+	if (IS_LEAF(p))
+	{
+		if (destroy_cb != NULL)
+			destroy_cb(LEAF(p)->key, LEAF(p)->data, privdata);
+		rb_free(LEAF(p));
+		return;
+	}
 
-/* Preserve compatibility with the old mowgli_patricia.h */
-#define STATE_CUR(state) ((state)->pspare[0])
-#define STATE_NEXT(state) ((state)->pspare[1])
+	child = node_children(p, &len);
+	for (i = 0; i < len; i++)
+		radix_free(child[i], destroy_cb, privdata);
+
+	rb_free(p);
+}
 
 /*
- * first_leaf()
+ * make_key()
  *
- * Find the smallest leaf hanging off a subtree.
+ * Sets up k for looking key up in dict, canonizing a copy of it if the
+ * tree has a canonizing function rather than a case map.
  *
  * Inputs:
- *     - element (may be leaf or node) heading subtree
+ *     - patricia tree object
+ *     - key
+ *     - key to set up, and a buffer for the copy
  *
  * Outputs:
- *     - lowest leaf in subtree
+ *     - the copy, if it had to be allocated, to be freed afterwards
  *
  * Side Effects:
  *     - none
  */
-static rb_radixtree_elem *
-first_leaf(rb_radixtree_elem *delem)
+static char *
+make_key(rb_radixtree *dict, const char *key, struct rb_radixtree_key *k, char *store, size_t storelen)
 {
-	int val;
+	char *ckey_buf = NULL;
+
+	k->len = strlen(key);
+	k->s = (const unsigned char *)key;
+	k->map = dict->casemap != NULL ? dict->casemap : identity_map;
 
-	while (!IS_LEAF(delem))
+	if (dict->canonize_cb != NULL)
 	{
-		for (val = 0; val < POINTERS_PER_NODE; val++)
-			if (delem->node.down[val] != NULL)
-			{
-				delem = delem->node.down[val];
-				break;
-			}
+		if (k->len >= storelen)
+		{
+			ckey_buf = rb_strdup(key);
+			dict->canonize_cb(ckey_buf);
+			k->s = (const unsigned char *)ckey_buf;
+		}
+		else
+		{
+			memcpy(store, key, k->len + 1);
+			dict->canonize_cb(store);
+			k->s = (const unsigned char *)store;
+		}
+		k->len = strlen((const char *)k->s);
 	}
 
-	return delem;
+	return ckey_buf;
 }
 
 /*
@@ -178,6 +1000,35 @@ rb_radixtree_create(const char *name, void (*canonize_cb)(char *key))
 	return dtree;
 }
 
+/*
+ * rb_radixtree_create_casemap(const char *name,
+ *     const unsigned char *casemap)
+ *
+ * Dictionary object factory, for trees whose keys are canonized one
+ * byte at a time.
+ *
+ * Inputs:
+ *     - patricia name
+ *     - table of 256 bytes each byte of a key is replaced with, which
+ *       must outlive the tree
+ *
+ * Outputs:
+ *     - on success, a new patricia object.
+ *
+ * Side Effects:
+ *     - if services runs out of memory and cannot allocate the object,
+ *       the program will abort.
+ */
+rb_radixtree *
+rb_radixtree_create_casemap(const char *name, const unsigned char *casemap)
+{
+	rb_radixtree *dtree = rb_radixtree_create(name, NULL);
+
+	dtree->casemap = casemap;
+
+	return dtree;
+}
+
 /*
  * rb_radixtree_destroy(rb_radixtree *dtree,
  *     void (*destroy_cb)(const char *key, void *data, void *privdata),
@@ -203,29 +1054,35 @@ rb_radixtree_create(const char *name, void (*canonize_cb)(char *key))
 void
 rb_radixtree_destroy(rb_radixtree *dtree, void (*destroy_cb)(const char *key, void *data, void *privdata), void *privdata)
 {
-	rb_radixtree_iteration_state state;
-	rb_radixtree_elem *delem;
-
-	void *entry;
-
 	lrb_assert(dtree != NULL);
 
-	RB_RADIXTREE_FOREACH(entry, &state, dtree)
-	{
-		delem = STATE_CUR(&state);
-
-		if (destroy_cb != NULL)
-			(*destroy_cb)(delem->leaf.key, delem->leaf.data,
-				      privdata);
-
-		rb_radixtree_delete(dtree, delem->leaf.key);
-	}
+	radix_free(dtree->root, destroy_cb, privdata);
 
 	rb_dlinkDelete(&dtree->node, &radixtree_list);
 	rb_free(dtree->id);
 	rb_free(dtree);
 }
 
+struct radix_foreach
+{
+	int (*foreach_cb)(const char *key, void *data, void *privdata);
+	void *(*search_cb)(const char *key, void *data, void *privdata);
+	void *privdata;
+	void *ret;
+};
+
+static int
+foreach_leaf(rb_radixtree_leaf *leaf, void *privdata)
+{
+	struct radix_foreach *f = privdata;
+
+	if (f->foreach_cb != NULL)
+		return f->foreach_cb(leaf->key, leaf->data, f->privdata);
+
+	f->ret = f->search_cb(leaf->key, leaf->data, f->privdata);
+	return f->ret != NULL;
+}
+
 /*
  * rb_radixtree_foreach(rb_radixtree *dtree,
  *     int (*foreach_cb)(const char *key, void *data, void *privdata),
@@ -247,59 +1104,12 @@ rb_radixtree_destroy(rb_radixtree *dtree, void (*destroy_cb)(const char *key, vo
 void
 rb_radixtree_foreach(rb_radixtree *dtree, int (*foreach_cb)(const char *key, void *data, void *privdata), void *privdata)
 {
-	rb_radixtree_elem *delem, *next;
-
-	int val;
+	struct radix_foreach f = { foreach_cb, NULL, privdata, NULL };
 
 	lrb_assert(dtree != NULL);
 
-	delem = dtree->root;
-
-	if (delem == NULL)
-		return;
-
-	/* Only one element in the tree */
-	if (IS_LEAF(delem))
-	{
-		if (foreach_cb != NULL)
-			(*foreach_cb)(delem->leaf.key, delem->leaf.data, privdata);
-
-		return;
-	}
-
-	val = 0;
-
-	do
-	{
-		do
-			next = delem->node.down[val++];
-		while (next == NULL && val < POINTERS_PER_NODE);
-
-		if (next != NULL)
-		{
-			if (IS_LEAF(next))
-			{
-				if (foreach_cb != NULL)
-					(*foreach_cb)(next->leaf.key, next->leaf.data, privdata);
-			}
-			else
-			{
-				delem = next;
-				val = 0;
-			}
-		}
-
-		while (val >= POINTERS_PER_NODE)
-		{
-			val = delem->node.parent_val;
-			delem = delem->node.parent;
-
-			if (delem == NULL)
-				break;
-
-			val++;
-		}
-	} while (delem != NULL);
+	if (foreach_cb != NULL)
+		radix_walk(dtree->root, foreach_leaf, &f);
 }
 
 /*
@@ -324,65 +1134,14 @@ rb_radixtree_foreach(rb_radixtree *dtree, int (*foreach_cb)(const char *key, voi
 void *
 rb_radixtree_search(rb_radixtree *dtree, void *(*foreach_cb)(const char *key, void *data, void *privdata), void *privdata)
 {
-	rb_radixtree_elem *delem, *next;
-
-	int val;
-	void *ret = NULL;
+	struct radix_foreach f = { NULL, foreach_cb, privdata, NULL };
 
 	lrb_assert(dtree != NULL);
 
-	delem = dtree->root;
+	if (foreach_cb != NULL)
+		radix_walk(dtree->root, foreach_leaf, &f);
 
-	if (delem == NULL)
-		return NULL;
-
-	/* Only one element in the tree */
-	if (IS_LEAF(delem))
-	{
-		if (foreach_cb != NULL)
-			return (*foreach_cb)(delem->leaf.key, delem->leaf.data, privdata);
-
-		return NULL;
-	}
-
-	val = 0;
-
-	for (;;)
-	{
-		do
-			next = delem->node.down[val++];
-		while (next == NULL && val < POINTERS_PER_NODE);
-
-		if (next != NULL)
-		{
-			if (IS_LEAF(next))
-			{
-				if (foreach_cb != NULL)
-					ret = (*foreach_cb)(next->leaf.key, next->leaf.data, privdata);
-
-				if (ret != NULL)
-					break;
-			}
-			else
-			{
-				delem = next;
-				val = 0;
-			}
-		}
-
-		while (val >= POINTERS_PER_NODE)
-		{
-			val = delem->node.parent_val;
-			delem = delem->node.parent;
-
-			if (delem == NULL)
-				break;
-
-			val++;
-		}
-	}
-
-	return ret;
+	return f.ret;
 }
 
 /*
@@ -409,11 +1168,7 @@ rb_radixtree_foreach_start(rb_radixtree *dtree, rb_radixtree_iteration_state *st
 
 	lrb_assert(state != NULL);
 
-	if (dtree->root != NULL)
-		STATE_NEXT(state) = first_leaf(dtree->root);
-	else
-		STATE_NEXT(state) = NULL;
-
+	STATE_NEXT(state) = first_leaf(dtree->root);
 	STATE_CUR(state) = STATE_NEXT(state);
 
 	if (STATE_NEXT(state) == NULL)
@@ -457,7 +1212,8 @@ rb_radixtree_foreach_cur(rb_radixtree *dtree, rb_radixtree_iteration_state *stat
  * rb_radixtree_foreach_next(rb_radixtree *dtree,
  *     rb_radixtree_iteration_state *state);
  *
- * Advances a static DTree iterator.
+ * Advances a static DTree iterator.  The next leaf is found before the
+ * current one is handed out, so the current one may be deleted.
  *
  * Inputs:
  *     - patricia tree object
@@ -473,10 +1229,7 @@ void
 rb_radixtree_foreach_next(rb_radixtree *dtree, rb_radixtree_iteration_state *state)
 {
 	rb_radixtree_leaf *leaf;
-
-	rb_radixtree_elem *delem, *next;
-
-	int val;
+	struct rb_radixtree_key k;
 
 	if (dtree == NULL)
 		return;
@@ -492,52 +1245,11 @@ rb_radixtree_foreach_next(rb_radixtree *dtree, rb_radixtree_iteration_state *sta
 		return;
 
 	leaf = STATE_NEXT(state);
-	delem = leaf->parent;
-	val = leaf->parent_val;
-
-	while (delem != NULL)
-	{
-		do
-			next = delem->node.down[val++];
-		while (next == NULL && val < POINTERS_PER_NODE);
-
-		if (next != NULL)
-		{
-			if (IS_LEAF(next))
-			{
-				/* We will find the original leaf first. */
-				if (&next->leaf != leaf)
-				{
-					if (strcmp(next->leaf.key, leaf->key) < 0)
-					{
-						STATE_NEXT(state) = NULL;
-						return;
-					}
-
-					STATE_NEXT(state) = next;
-					return;
-				}
-			}
-			else
-			{
-				delem = next;
-				val = 0;
-			}
-		}
+	k.s = (const unsigned char *)leaf->key;
+	k.len = strlen(leaf->key);
+	k.map = identity_map;
 
-		while (val >= POINTERS_PER_NODE)
-		{
-			val = delem->node.parent_val;
-			delem = delem->node.parent;
-
-			if (delem == NULL)
-				break;
-
-			val++;
-		}
-	}
-
-	STATE_NEXT(state) = NULL;
+	STATE_NEXT(state) = radix_lower_bound(dtree->root, &k, 0, 1);
 }
 
 /*
@@ -548,7 +1260,8 @@ rb_radixtree_foreach_next(rb_radixtree *dtree, rb_radixtree_iteration_state *sta
  * Inputs:
  *     - patricia tree object
  *     - name of node to lookup
- *     - whether to do a direct or fuzzy match
+ *     - whether to do a direct or fuzzy match; a fuzzy match finds
+ *       the first key that is not less than the one given
  *
  * Outputs:
  *     - on success, the dtree node requested
@@ -561,58 +1274,24 @@ rb_radixtree_leaf *
 rb_radixtree_elem_find(rb_radixtree *dict, const char *key, int fuzzy)
 {
 	char ckey_store[256];
-
-	char *ckey_buf = NULL;
-	const char *ckey;
-	rb_radixtree_elem *delem;
-
-	int val, keylen;
+	char *ckey_buf;
+	struct rb_radixtree_key k;
+	rb_radixtree_leaf *leaf;
 
 	lrb_assert(dict != NULL);
 	lrb_assert(key != NULL);
 
-	keylen = strlen(key);
+	ckey_buf = make_key(dict, key, &k, ckey_store, sizeof(ckey_store));
 
-	if (dict->canonize_cb == NULL)
-	{
-		ckey = key;
-	}
+	if (fuzzy)
+		leaf = radix_lower_bound(dict->root, &k, 0, 0);
 	else
-	{
-		if (keylen >= (int) sizeof(ckey_store))
-		{
-			ckey_buf = rb_strdup(key);
-			dict->canonize_cb(ckey_buf);
-			ckey = ckey_buf;
-		}
-		else
-		{
-			rb_strlcpy(ckey_store, key, sizeof ckey_store);
-			dict->canonize_cb(ckey_store);
-			ckey = ckey_store;
-		}
-	}
-
-	delem = dict->root;
-
-	while (delem != NULL && !IS_LEAF(delem))
-	{
-		if (delem->nibnum / 2 < keylen)
-			val = NIBBLE_VAL(ckey, delem->nibnum);
-		else
-			val = 0;
-
-		delem = delem->node.down[val];
-	}
-
-	/* Now, if the key is in the tree, delem contains it. */
-	if ((delem != NULL) && !fuzzy && strcmp(delem->leaf.key, ckey))
-		delem = NULL;
+		leaf = radix_find(dict, &k);
 
 	if (ckey_buf != NULL)
 		rb_free(ckey_buf);
 
-	return &delem->leaf;
+	return leaf;
 }
 
 /*
@@ -670,146 +1349,32 @@ rb_radixtree_foreach_start_from(rb_radixtree *dtree, rb_radixtree_iteration_stat
 rb_radixtree_leaf *
 rb_radixtree_elem_add(rb_radixtree *dict, const char *key, void *data)
 {
-	char *ckey;
-
-	rb_radixtree_elem *delem, *prev, *newnode;
 	rb_radixtree_leaf *leaf;
-
-	int val, keylen;
-	int i, j;
+	size_t keylen, i;
 
 	lrb_assert(dict != NULL);
 	lrb_assert(key != NULL);
 	lrb_assert(data != NULL);
 
 	keylen = strlen(key);
-	ckey = rb_strdup(key);
-
-	if (ckey == NULL)
-		return NULL;
-
-	if (dict->canonize_cb != NULL)
-		dict->canonize_cb(ckey);
-
-	prev = NULL;
-	val = POINTERS_PER_NODE + 2;	/* trap value */
-	delem = dict->root;
+	leaf = rb_malloc(sizeof(rb_radixtree_leaf) + keylen + 1);
+	leaf->data = data;
+	memcpy(leaf->key, key, keylen + 1);
 
-	while (delem != NULL && !IS_LEAF(delem))
+	if (dict->casemap != NULL)
 	{
-		prev = delem;
-
-		if (delem->nibnum / 2 < keylen)
-			val = NIBBLE_VAL(ckey, delem->nibnum);
-		else
-			val = 0;
-
-		delem = delem->node.down[val];
+		for (i = 0; i < keylen; i++)
+			leaf->key[i] = dict->casemap[(unsigned char)leaf->key[i]];
 	}
+	else if (dict->canonize_cb != NULL)
+		dict->canonize_cb(leaf->key);
 
-	/* Now, if the key is in the tree, delem contains it. */
-	if ((delem != NULL) && !strcmp(delem->leaf.key, ckey))
+	if (!radix_insert(dict, leaf))
 	{
-		rb_free(ckey);
+		rb_free(leaf);
 		return NULL;
 	}
 
-	if ((delem == NULL) && (prev != NULL))
-		/* Get a leaf to compare with. */
-		delem = first_leaf(prev);
-
-	if (delem == NULL)
-	{
-		lrb_assert(prev == NULL);
-		lrb_assert(dict->count == 0);
-		leaf = rb_malloc(sizeof(rb_radixtree_leaf));
-		lrb_assert(leaf != NULL);
-		leaf->nibnum = -1;
-		leaf->data = data;
-		leaf->key = ckey;
-		leaf->parent = prev;
-		leaf->parent_val = val;
-		dict->root = (rb_radixtree_elem *) leaf;
-		dict->count++;
-		return leaf;
-	}
-
-	/* Find the first nibble where they differ. */
-	for (i = 0; NIBBLE_VAL(ckey, i) == NIBBLE_VAL(delem->leaf.key, i); i++)
-		;
-
-	/* Find where to insert the new node. */
-	while (prev != NULL && prev->nibnum > i)
-	{
-		val = prev->node.parent_val;
-		prev = prev->node.parent;
-	}
-
-	if ((prev == NULL) || (prev->nibnum < i))
-	{
-		/* Insert new node below prev */
-		newnode = rb_malloc(sizeof(rb_radixtree_node));
-		lrb_assert(newnode != NULL);
-		newnode->nibnum = i;
-		newnode->node.parent = prev;
-		newnode->node.parent_val = val;
-
-		for (j = 0; j < POINTERS_PER_NODE; j++)
-			newnode->node.down[j] = NULL;
-
-		if (prev == NULL)
-		{
-			newnode->node.down[NIBBLE_VAL(delem->leaf.key, i)] = dict->root;
-
-			if (IS_LEAF(dict->root))
-			{
-				dict->root->leaf.parent = newnode;
-				dict->root->leaf.parent_val = NIBBLE_VAL(delem->leaf.key, i);
-			}
-			else
-			{
-				lrb_assert(dict->root->nibnum > i);
-				dict->root->node.parent = newnode;
-				dict->root->node.parent_val = NIBBLE_VAL(delem->leaf.key, i);
-			}
-
-			dict->root = newnode;
-		}
-		else
-		{
-			newnode->node.down[NIBBLE_VAL(delem->leaf.key, i)] = prev->node.down[val];
-
-			if (IS_LEAF(prev->node.down[val]))
-			{
-				prev->node.down[val]->leaf.parent = newnode;
-				prev->node.down[val]->leaf.parent_val = NIBBLE_VAL(delem->leaf.key, i);
-			}
-			else
-			{
-				prev->node.down[val]->node.parent = newnode;
-				prev->node.down[val]->node.parent_val = NIBBLE_VAL(delem->leaf.key, i);
-			}
-
-			prev->node.down[val] = newnode;
-		}
-	}
-	else
-	{
-		/* This nibble is already checked. */
-		lrb_assert(prev->nibnum == i);
-		newnode = prev;
-	}
-
-	val = NIBBLE_VAL(ckey, i);
-	lrb_assert(newnode->node.down[val] == NULL);
-	leaf = rb_malloc(sizeof(rb_radixtree_leaf));
-	lrb_assert(leaf != NULL);
-	leaf->nibnum = -1;
-	leaf->data = data;
-	leaf->key = ckey;
-	leaf->parent = newnode;
-	leaf->parent_val = val;
-	newnode->node.down[val] = (rb_radixtree_elem *) leaf;
 	dict->count++;
 	return leaf;
 }
@@ -842,88 +1407,47 @@ rb_radixtree_add(rb_radixtree *dict, const char *key, void *data)
 void *
 rb_radixtree_delete(rb_radixtree *dict, const char *key)
 {
-	void *data;
+	char ckey_store[256];
+	char *ckey_buf;
+	struct rb_radixtree_key k;
 	rb_radixtree_leaf *leaf;
+	void *data = NULL;
+
+	lrb_assert(dict != NULL);
+	lrb_assert(key != NULL);
 
-	leaf = rb_radixtree_elem_find(dict, key, 0);
+	ckey_buf = make_key(dict, key, &k, ckey_store, sizeof(ckey_store));
 
-	if (leaf == NULL)
-		return NULL;
+	leaf = radix_remove(dict, &k);
+	if (leaf != NULL)
+	{
+		data = leaf->data;
+		rb_free(leaf);
+		dict->count--;
+	}
+
+	if (ckey_buf != NULL)
+		rb_free(ckey_buf);
 
-	data = leaf->data;
-	rb_radixtree_elem_delete(dict, leaf);
 	return data;
 }
 
 void
 rb_radixtree_elem_delete(rb_radixtree *dict, rb_radixtree_leaf *leaf)
 {
-	rb_radixtree_elem *delem, *prev, *next;
-
-	int val, i, used;
+	struct rb_radixtree_key k;
 
 	lrb_assert(dict != NULL);
 	lrb_assert(leaf != NULL);
 
-	delem = (rb_radixtree_elem *) leaf;
-
-	val = delem->leaf.parent_val;
-	prev = delem->leaf.parent;
-
-	rb_free(delem->leaf.key);
-	rb_free(delem);
-
-	if (prev != NULL)
-	{
-		prev->node.down[val] = NULL;
-
-		/* Leaf is gone, now consider the node it was in. */
-		delem = prev;
-
-		used = -1;
-
-		for (i = 0; i < POINTERS_PER_NODE; i++)
-			if (delem->node.down[i] != NULL)
-				used = used == -1 ? i : -2;
+	k.s = (const unsigned char *)leaf->key;
+	k.len = strlen(leaf->key);
+	k.map = identity_map;
 
-		lrb_assert(used == -2 || used >= 0);
-
-		if (used >= 0)
-		{
-			/* Only one pointer in this node, remove it.
-			 * Replace the pointer that pointed to it by
-			 * the sole pointer in it.
-			 */
-			next = delem->node.down[used];
-			val = delem->node.parent_val;
-			prev = delem->node.parent;
-
-			if (prev != NULL)
-				prev->node.down[val] = next;
-			else
-				dict->root = next;
-
-			if (IS_LEAF(next))
-				next->leaf.parent = prev, next->leaf.parent_val = val;
-			else
-				next->node.parent = prev, next->node.parent_val = val;
-
-			rb_free(delem);
-		}
-	}
-	else
-	{
-		/* This was the last leaf. */
-		dict->root = NULL;
-	}
+	radix_remove(dict, &k);
 
+	rb_free(leaf);
 	dict->count--;
-
-	if (dict->count == 0)
-	{
-		lrb_assert(dict->root == NULL);
-		dict->root = NULL;
-	}
 }
 
 /*
@@ -999,51 +1523,28 @@ rb_radixtree_size(rb_radixtree *dict)
 	return dict->count;
 }
 
-/* returns the sum of the depths of the subtree rooted in delem at depth depth */
+/* returns the sum of the depths of the subtree rooted in p at depth depth */
 /* there is no need for this to be recursive, but it is easier... */
 static int
-stats_recurse(rb_radixtree_elem *delem, int depth, int *pmaxdepth)
+stats_recurse(void *p, int depth, int *pmaxdepth)
 {
-	int result = 0;
-	int val;
-	rb_radixtree_elem *next;
+	rb_radixtree_node *n;
+	void **child;
+	int result = 0, i, len;
 
 	if (depth > *pmaxdepth)
 		*pmaxdepth = depth;
 
-	if (depth == 0)
-	{
-		if (IS_LEAF(delem))
-			lrb_assert(delem->leaf.parent == NULL);
-
-		else
-			lrb_assert(delem->node.parent == NULL);
-	}
-
-	if (IS_LEAF(delem))
+	if (IS_LEAF(p))
 		return depth;
 
-	for (val = 0; val < POINTERS_PER_NODE; val++)
-	{
-		next = delem->node.down[val];
-
-		if (next == NULL)
-			continue;
-
-		result += stats_recurse(next, depth + 1, pmaxdepth);
+	n = p;
+	lrb_assert(n->count >= 2);
 
-		if (IS_LEAF(next))
-		{
-			lrb_assert(next->leaf.parent == delem);
-			lrb_assert(next->leaf.parent_val == val);
-		}
-		else
-		{
-			lrb_assert(next->node.parent == delem);
-			lrb_assert(next->node.parent_val == val);
-			lrb_assert(next->node.nibnum > delem->node.nibnum);
-		}
-	}
+	child = node_children(n, &len);
+	for (i = 0; i < len; i++)
+		if (child[i] != NULL)
+			result += stats_recurse(child[i], depth + 1, pmaxdepth);
 
 	return result;
 }
@@ -226,11 +226,13 @@ rb_lib_loop(long delay)
 		{
 			if((next = rb_event_next()) > 0)
 			{
-				next -= rb_current_time();
+				/* wake up when the next event is due rather than
+				 * rounding to whole seconds */
+				const struct timeval *tv = rb_current_time_tv();
+
+				next = next * 1000 - ((time_t)tv->tv_sec * 1000 + tv->tv_usec / 1000);
 				if(next <= 0)
-					next = 1000;
-				else
-					next *= 1000;
+					next = 0;
 			}
 			else
 				next = -1;
@@ -0,0 +1,200 @@
+/*
+ *  librb: a library used by ircd-ratbox and other things
+ *  scan.c: Finding delimiters many bytes at a time.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+#include <librb_config.h>
+#include <rb_lib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RB_X86_SCAN
+#include <immintrin.h>
+#endif
+
+/*
+ * Splitting what we read into lines, and lines into tags, is mostly
+ * looking for the next of a few delimiters.  On x86 we compare 16 or
+ * 32 bytes at a time against each, whichever turns out faster, and use
+ * a plain loop elsewhere.
+ */
+static size_t
+rb_scan_scalar(const char *data, size_t len, const char set[4])
+{
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		if(data[i] == set[0] || data[i] == set[1] || data[i] == set[2] || data[i] == set[3])
+			break;
+	return i;
+}
+
+#ifdef RB_X86_SCAN
+__attribute__((target("sse2")))
+static size_t
+rb_scan_sse2(const char *data, size_t len, const char set[4])
+{
+	const __m128i a = _mm_set1_epi8(set[0]);
+	const __m128i b = _mm_set1_epi8(set[1]);
+	const __m128i c = _mm_set1_epi8(set[2]);
+	const __m128i d = _mm_set1_epi8(set[3]);
+	size_t i;
+
+	for(i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, a), _mm_cmpeq_epi8(v, b)),
+					   _mm_or_si128(_mm_cmpeq_epi8(v, c), _mm_cmpeq_epi8(v, d)));
+		int mask = _mm_movemask_epi8(hit);
+
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + rb_scan_scalar(data + i, len - i, set);
+}
+
+__attribute__((target("avx2")))
+static size_t
+rb_scan_avx2(const char *data, size_t len, const char set[4])
+{
+	const __m256i a = _mm256_set1_epi8(set[0]);
+	const __m256i b = _mm256_set1_epi8(set[1]);
+	const __m256i c = _mm256_set1_epi8(set[2]);
+	const __m256i d = _mm256_set1_epi8(set[3]);
+	size_t i;
+
+	for(i = 0; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, a), _mm256_cmpeq_epi8(v, b)),
+					      _mm256_or_si256(_mm256_cmpeq_epi8(v, c), _mm256_cmpeq_epi8(v, d)));
+		unsigned int mask = _mm256_movemask_epi8(hit);
+
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + rb_scan_sse2(data + i, len - i, set);
+}
+#endif
+
+typedef size_t rb_scan_fn(const char *, size_t, const char *);
+
+static const struct
+{
+	const char *name;
+	rb_scan_fn *scan;
+} rb_scanners[] = {
+#ifdef RB_X86_SCAN
+	{ "avx2", rb_scan_avx2 },
+	{ "sse2", rb_scan_sse2 },
+#endif
+	{ "scalar", rb_scan_scalar },
+};
+
+#define RB_SCANNERS (sizeof(rb_scanners) / sizeof(rb_scanners[0]))
+
+static unsigned int rb_scanner_index;
+static int rb_scanner_chosen;
+
+static int
+rb_scanner_usable(const char *name)
+{
+#ifdef RB_X86_SCAN
+	__builtin_cpu_init();
+	if(!strcmp(name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if(!strcmp(name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+#endif
+	return !strcmp(name, "scalar");
+}
+
+/*
+ * The fastest the CPU can run, timed on spans the length of the usual
+ * tag or line.  Wider is not always faster: on some CPUs and virtual
+ * machines each use of the AVX registers costs more than it saves.
+ */
+static void
+rb_scanner_choose(void)
+{
+	char sample[256];
+	volatile size_t sink = 0;
+	uint64_t start, took = 0, best = UINT64_MAX;
+	unsigned int i, j, round, pick = RB_SCANNERS - 1;
+
+	memset(sample, 'x', sizeof(sample));
+
+	for(i = 0; i < RB_SCANNERS; i++)
+	{
+		if(!rb_scanner_usable(rb_scanners[i].name))
+			continue;
+
+		/* the first round warms up */
+		for(round = 0; round < 2; round++)
+		{
+			start = rb_monotonic_ns();
+			for(j = 0; j < 1000; j++)
+				sink += rb_scanners[i].scan(sample + (j & 15), 16 + (j & 127), " ;= ");
+			took = rb_monotonic_ns() - start;
+		}
+
+		if(took < best)
+		{
+			best = took;
+			pick = i;
+		}
+	}
+
+	rb_scanner_index = pick;
+	rb_scanner_chosen = 1;
+}
+
+size_t
+rb_scan_any(const char *data, size_t len, const char set[4])
+{
+	if(rb_unlikely(!rb_scanner_chosen))
+		rb_scanner_choose();
+
+	return rb_scanners[rb_scanner_index].scan(data, len, set);
+}
+
+const char *
+rb_scanner(void)
+{
+	if(!rb_scanner_chosen)
+		rb_scanner_choose();
+
+	return rb_scanners[rb_scanner_index].name;
+}
+
+int
+rb_set_scanner(const char *name)
+{
+	unsigned int i;
+
+	for(i = 0; i < RB_SCANNERS; i++)
+	{
+		if(strcmp(rb_scanners[i].name, name))
+			continue;
+		if(!rb_scanner_usable(name))
+			return 0;
+		rb_scanner_index = i;
+		rb_scanner_chosen = 1;
+		return 1;
+	}
+	return 0;
+}
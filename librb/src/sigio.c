@@ -255,6 +255,9 @@ rb_select_sigio(long delay)
 
 			if(sig > 0)
 			{
+				/* each signal is a wakeup of its own; only
+				 * the handler times are kept for them */
+				rb_loop_mark = rb_monotonic_ns();
 
 				if(sig == SIGIO)
 				{
@@ -288,7 +291,10 @@ rb_select_sigio(long delay)
 					F->read_handler = NULL;
 					F->read_data = NULL;
 					if(hdl)
+					{
 						hdl(F, data);
+						rb_loop_charge(&rb_loop_data.read);
+					}
 				}
 
 				if(revents & (POLLWRNORM | POLLOUT | POLLHUP | POLLERR))
@@ -298,7 +304,10 @@ rb_select_sigio(long delay)
 					F->write_handler = NULL;
 					F->write_data = NULL;
 					if(hdl)
+					{
 						hdl(F, data);
+						rb_loop_charge(&rb_loop_data.write);
+					}
 				}
 			}
 			else
@@ -322,6 +331,7 @@ rb_select_sigio(long delay)
 
 	num = poll(pollfd_list.pollfds, pollfd_list.maxindex + 1, delay);
 	rb_set_time();
+	rb_loop_woke(num);
 	if(num < 0)
 	{
 		if(!rb_ignore_errno(errno))
@@ -349,7 +359,10 @@ rb_select_sigio(long delay)
 			F->read_handler = NULL;
 			F->read_data = NULL;
 			if(hdl)
+			{
 				hdl(F, data);
+				rb_loop_charge(&rb_loop_data.read);
+			}
 		}
 
 		if(IsFDOpen(F) && (revents & (POLLWRNORM | POLLOUT | POLLHUP | POLLERR)))
@@ -359,7 +372,10 @@ rb_select_sigio(long delay)
 			F->write_handler = NULL;
 			F->write_data = NULL;
 			if(hdl)
+			{
 				hdl(F, data);
+				rb_loop_charge(&rb_loop_data.write);
+			}
 		}
 		if(F->read_handler == NULL)
 			rb_setselect_sigio(F, RB_SELECT_READ, NULL, NULL);
@@ -296,6 +296,7 @@ ms_ban(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p
 			else
 			{
 				rb_dlinkAddAlloc(aconf, &xline_conf_list);
+				xline_list_changed();
 				check_xlines();
 			}
 			break;
@@ -308,7 +309,10 @@ ms_ban(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p
 			break;
 		case CONF_RESV_NICK:
 			if (!(aconf->status & CONF_ILLEGAL))
+			{
 				rb_dlinkAddAlloc(aconf, &resv_conf_list);
+				resv_list_changed();
+			}
 			break;
 	}
 	sendto_server(client_p, NULL, CAP_BAN|CAP_TS6, NOCAPS,
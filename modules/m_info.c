@@ -655,6 +655,16 @@ static struct InfoStruct info_table[] = {
 		"Don't send RPL_WHOISOPERATOR to non-opers",
 		INFO_INTBOOL_YN(&ConfigFileEntry.hide_opers_in_whois),
 	},
+	{
+		"command_timing",
+		"Time each command's handler, for STATS h",
+		INFO_INTBOOL_YN(&ConfigFileEntry.command_timing),
+	},
+	{
+		"deferred_flush",
+		"Write each client's messages once per loop iteration",
+		INFO_INTBOOL_YN(&ConfigFileEntry.deferred_flush),
+	},
 	{
 		"disable_hidden",
 		"Prevent servers from hiding themselves from a flattened /links",
@@ -197,6 +197,8 @@ rehash_txlines(struct Client *source_p)
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &xline_conf_list);
 	}
+
+	xline_list_changed();
 }
 
 static void
@@ -231,6 +233,8 @@ rehash_tresvs(struct Client *source_p)
 		free_conf(aconf);
 		rb_dlinkDestroy(ptr, &resv_conf_list);
 	}
+
+	resv_list_changed();
 }
 
 static void
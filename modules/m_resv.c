@@ -356,6 +356,7 @@ parse_resv(struct Client *source_p, const char *name, const char *reason, int te
 		}
 
 		rb_dlinkAddAlloc(aconf, &resv_conf_list);
+		resv_list_changed();
 		resv_nick_fnc(aconf->host, aconf->passwd, temp_time);
 	}
 	else
@@ -629,6 +630,7 @@ remove_resv(struct Client *source_p, const char *name, int propagated)
 		}
 		/* already have ptr from the loop above.. */
 		rb_dlinkDestroy(ptr, &resv_conf_list);
+		resv_list_changed();
 	}
 	free_conf(aconf);
 
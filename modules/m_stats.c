@@ -44,8 +44,10 @@
 #include "hash.h"
 #include "reject.h"
 #include "whowas.h"
+#include "rb_hashmap.h"
 #include "rb_radixtree.h"
 #include "sslproc.h"
+#include "httpqueue.h"
 #include "s_assert.h"
 
 static const char stats_desc[] =
@@ -100,11 +102,13 @@ static void stats_tdeny(struct Client *);
 static void stats_deny(struct Client *);
 static void stats_exempt(struct Client *);
 static void stats_events(struct Client *);
+static void stats_http_queues(struct Client *);
 static void stats_prop_klines(struct Client *);
 static void stats_auth(struct Client *);
 static void stats_tklines(struct Client *);
 static void stats_klines(struct Client *);
 static void stats_messages(struct Client *);
+static void stats_latency(struct Client *);
 static void stats_dnsbl(struct Client *);
 static void stats_oper(struct Client *);
 static void stats_privset(struct Client *);
@@ -154,6 +158,7 @@ static struct stats_cmd stats_cmd_table[256] = {
 	['f'] = HANDLER_NORM(stats_comm,	true,	NULL),
 	['F'] = HANDLER_NORM(stats_comm,	true,	NULL),
 	['g'] = HANDLER_NORM(stats_prop_klines,	false,	"oper:general"),
+	['h'] = HANDLER_NORM(stats_latency,	false,	"oper:general"),
 	['i'] = HANDLER_NORM(stats_auth,	false,	NULL),
 	['I'] = HANDLER_NORM(stats_auth,	false,	NULL),
 	['k'] = HANDLER_NORM(stats_tklines,	false,	NULL),
@@ -178,6 +183,7 @@ static struct stats_cmd stats_cmd_table[256] = {
 	['u'] = HANDLER_NORM(stats_uptime,	false,	NULL),
 	['v'] = HANDLER_NORM(stats_servers,	false,	NULL),
 	['V'] = HANDLER_NORM(stats_servers,	false,	NULL),
+	['W'] = HANDLER_NORM(stats_http_queues,	true,	NULL),
 	['x'] = HANDLER_NORM(stats_tgecos,	false,	"oper:general"),
 	['X'] = HANDLER_NORM(stats_gecos,	false,	"oper:general"),
 	['y'] = HANDLER_NORM(stats_class,	false,	NULL),
@@ -312,6 +318,7 @@ stats_hash(struct Client *source_p)
 		"NAME", "TYPE", "OBJECTS", "DEPTH SUM", "AVG DEPTH", "MAX DEPTH");
 
 	rb_dictionary_stats_walk(stats_hash_cb, source_p);
+	rb_hashmap_stats_walk(stats_hash_cb, source_p);
 	rb_radixtree_stats_walk(stats_hash_cb, source_p);
 }
 
@@ -489,10 +496,70 @@ stats_events_cb(char *str, void *ptr)
 	sendto_one_numeric(ptr, RPL_STATSDEBUG, "E :%s", str);
 }
 
+/* one row of a time histogram, for STATS E and STATS h alike */
+static void
+stats_histogram_line(struct Client *source_p, char statchar, const char *name,
+		const struct rb_histogram *hist)
+{
+	if(hist->count == 0)
+		return;
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "%c :%s count %llu total %llums avg %lluus p50 %lluus p99 %lluus max %lluus",
+			   statchar, name, (unsigned long long)hist->count,
+			   (unsigned long long)(hist->sum / 1000000),
+			   (unsigned long long)(hist->sum / hist->count / 1000),
+			   (unsigned long long)rb_histogram_quantile(hist, 0.5),
+			   (unsigned long long)rb_histogram_quantile(hist, 0.99),
+			   (unsigned long long)(hist->max / 1000));
+}
+
+static void
+stats_event_times_cb(const char *name, const struct rb_histogram *hist, void *ptr)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "event %s", name);
+	stats_histogram_line(ptr, 'E', buf, hist);
+}
+
+/* the events, then where the loop's time goes */
 static void
 stats_events (struct Client *source_p)
 {
+	const struct rb_loop_stats *loop = rb_get_loop_stats();
+
 	rb_dump_events(stats_events_cb, source_p);
+
+	stats_histogram_line(source_p, 'E', "loop busy", &loop->busy);
+	if(loop->ready.count != 0)
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "E :loop ready count %llu avg %llu p50 %llu p99 %llu max %llu",
+				   (unsigned long long)loop->ready.count,
+				   (unsigned long long)(loop->ready.sum / loop->ready.count),
+				   (unsigned long long)rb_histogram_quantile(&loop->ready, 0.5),
+				   (unsigned long long)rb_histogram_quantile(&loop->ready, 0.99),
+				   (unsigned long long)loop->ready.max);
+	stats_histogram_line(source_p, 'E', "loop read", &loop->read);
+	stats_histogram_line(source_p, 'E', "loop write", &loop->write);
+	stats_histogram_line(source_p, 'E', "loop events", &loop->events);
+	rb_dump_event_times(stats_event_times_cb, source_p);
+}
+
+static void
+stats_http_queues_cb(const char *name, const char *origin,
+		unsigned int queued, unsigned int inflight,
+		unsigned long sent, unsigned long dropped, unsigned long failed, void *ptr)
+{
+	sendto_one_numeric(ptr, RPL_STATSDEBUG,
+			   "W :%s %s queued %u sending %u sent %lu dropped %lu failed %lu",
+			   name, origin, queued, inflight, sent, dropped, failed);
+}
+
+static void
+stats_http_queues(struct Client *source_p)
+{
+	http_queue_stats(stats_http_queues_cb, source_p);
 }
 
 static void
@@ -721,6 +788,60 @@ stats_messages(struct Client *source_p)
 	}
 }
 
+struct stats_latency
+{
+	struct Message *msg;
+	CommandSource source;
+};
+
+static int
+stats_latency_cmp(const void *a, const void *b)
+{
+	const struct stats_latency *la = a, *lb = b;
+	uint64_t sa = la->msg->latency[la->source].sum;
+	uint64_t sb = lb->msg->latency[lb->source].sum;
+
+	return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+/* the commands' handler times, those taking the most in all first */
+static void
+stats_latency(struct Client *source_p)
+{
+	static const char *source_names[] = { "local", "remote", "server" };
+	struct stats_latency *list;
+	rb_dictionary_iter iter;
+	struct Message *msg;
+	char name[64];
+	size_t n = 0, i;
+	int source;
+
+	list = rb_malloc(sizeof(struct stats_latency) *
+			rb_dictionary_size(cmd_dict) * LAST_COMMAND_SOURCE);
+
+	RB_DICTIONARY_FOREACH(msg, &iter, cmd_dict)
+	{
+		for(source = 0; source < LAST_COMMAND_SOURCE; source++)
+		{
+			if(msg->latency[source].count == 0)
+				continue;
+			list[n].msg = msg;
+			list[n].source = source;
+			n++;
+		}
+	}
+
+	qsort(list, n, sizeof(struct stats_latency), stats_latency_cmp);
+
+	for(i = 0; i < n; i++)
+	{
+		snprintf(name, sizeof(name), "%s %s", list[i].msg->cmd, source_names[list[i].source]);
+		stats_histogram_line(source_p, 'h', name, &list[i].msg->latency[list[i].source]);
+	}
+
+	rb_free(list);
+}
+
 static void
 stats_dnsbl(struct Client *source_p)
 {
@@ -1110,12 +1231,14 @@ stats_servers (struct Client *source_p)
 		seconds %= 60;
 
 		sendto_one_numeric(source_p, RPL_STATSDEBUG,
-				   "V :%s (%s!*@*) Idle: %d SendQ: %d "
+				   "V :%s (%s!*@*) Idle: %d SendQ: %d NextPing: %d "
 				   "Connected: %d day%s, %d:%02d:%02d",
 				   target_p->name,
 				   (target_p->serv->by[0] ? target_p->serv->by : "Remote."),
 				   (int) (rb_current_time() - target_p->localClient->lasttime),
 				   (int) rb_linebuf_len (&target_p->localClient->buf_sendq),
+				   (int) (target_p->localClient->ping_deadline > rb_current_time() ?
+					  target_p->localClient->ping_deadline - rb_current_time() : 0),
 				   days, (days == 1) ? "" : "s", hours, minutes,
 				   (int) seconds);
 	}
@@ -1170,6 +1293,17 @@ stats_class(struct Client *source_p)
 		report_classes(source_p);
 }
 
+static void
+stats_memory_bh_cb(size_t bused, size_t bfree, size_t bmemusage, size_t heapalloc,
+		   const char *desc, void *data)
+{
+	struct Client *source_p = data;
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "z :blockheap %s elements used %zu free %zu memory in use %zu total %zu",
+			   desc, bused, bfree, bmemusage, heapalloc);
+}
+
 static void
 stats_memory (struct Client *source_p)
 {
@@ -1221,6 +1355,9 @@ stats_memory (struct Client *source_p)
 
 	size_t total_memory = 0;
 
+	size_t bh_total = 0;
+	size_t bh_used = 0;
+
 	whowas_memory_usage(&ww, &wwm);
 
 	RB_DLINK_FOREACH(ptr, global_client_list.head)
@@ -1387,6 +1524,13 @@ stats_memory (struct Client *source_p)
 			   remote_client_count,
 			   remote_client_memory_used);
 
+	rb_bh_usage_all(stats_memory_bh_cb, source_p);
+	rb_bh_total_usage(&bh_total, &bh_used);
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "z :blockheaps in use %zu total %zu",
+			   bh_used, bh_total);
+
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "z :TOTAL: %zu",
 			   total_memory);
@@ -328,6 +328,7 @@ apply_xline(struct Client *source_p, const char *name, const char *reason, int t
 	}
 
 	rb_dlinkAddAlloc(aconf, &xline_conf_list);
+	xline_list_changed();
 	check_xlines();
 }
 
@@ -525,6 +526,7 @@ remove_xline(struct Client *source_p, const char *name, bool propagated)
 			remove_reject_mask(aconf->host, NULL);
 			free_conf(aconf);
 			rb_dlinkDestroy(ptr, &xline_conf_list);
+			xline_list_changed();
 			return;
 		}
 	}
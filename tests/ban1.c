@@ -0,0 +1,214 @@
+/*
+ *  ban1.c: Test the compiled channel ban sets
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "s_conf.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static struct Client *setter;
+
+/* enough bans that nobody matches for the lists to be compiled */
+static void
+add_filler(struct Channel *chptr, rb_dlink_list *list, long mode_type)
+{
+	char mask[BANLEN];
+
+	for(int i = 0; i < 8; i++)
+	{
+		snprintf(mask, sizeof mask, "filler%d!*@*", i);
+		add_id(setter, chptr, mask, NULL, list, mode_type);
+		snprintf(mask, sizeof mask, "*!*@host%d.filler.test", i);
+		add_id(setter, chptr, mask, NULL, list, mode_type);
+		snprintf(mask, sizeof mask, "*!*@10.%d.0.0/16", i);
+		add_id(setter, chptr, mask, NULL, list, mode_type);
+	}
+}
+
+static void
+ban(struct Channel *chptr, const char *mask, const char *forward)
+{
+	add_id(setter, chptr, mask, forward, &chptr->banlist, CHFL_BAN);
+}
+
+static void
+unban(struct Channel *chptr, const char *mask)
+{
+	free_ban(del_id(chptr, mask, &chptr->banlist, CHFL_BAN));
+}
+
+static const char *
+banned_to(struct Channel *chptr, struct Client *client)
+{
+	const char *forward = NULL;
+
+	if(is_banned(chptr, client, NULL, NULL, &forward) != CHFL_BAN)
+		return NULL;
+
+	return forward != NULL ? forward : "";
+}
+
+static void
+ban_masks(void)
+{
+	struct Channel *chptr = make_channel();
+	struct Client *v4 = make_local_person_full("v4user", "ident", "host.example.test", "192.0.2.77", "v4");
+	struct Client *v6 = make_local_person();
+
+	add_filler(chptr, &chptr->banlist, CHFL_BAN);
+	is_string(NULL, banned_to(chptr, v4), MSG);
+	is_string(NULL, banned_to(chptr, v6), MSG);
+
+	ban(chptr, "V4USER!IDENT@HOST.EXAMPLE.TEST", "#exact");
+	is_string("#exact", banned_to(chptr, v4), MSG);
+	is_string(NULL, banned_to(chptr, v6), MSG);
+	unban(chptr, "v4user!ident@host.example.test");
+	is_string(NULL, banned_to(chptr, v4), MSG);
+
+	ban(chptr, "*!*@*.example.test", "#suffix");
+	is_string("#suffix", banned_to(chptr, v4), MSG);
+	unban(chptr, "*!*@*.example.test");
+
+	ban(chptr, "v4u*!*@*", "#prefix");
+	is_string("#prefix", banned_to(chptr, v4), MSG);
+	unban(chptr, "v4u*!*@*");
+
+	ban(chptr, "*!*@192.0.2.0/24", "#cidr4");
+	is_string("#cidr4", banned_to(chptr, v4), MSG);
+	is_string(NULL, banned_to(chptr, v6), MSG);
+	unban(chptr, "*!*@192.0.2.0/24");
+
+	ban(chptr, "*!*@2001:db8::/32", "#cidr6");
+	is_string("#cidr6", banned_to(chptr, v6), MSG);
+	is_string(NULL, banned_to(chptr, v4), MSG);
+	unban(chptr, "*!*@2001:db8::/32");
+
+	ban(chptr, "v4user!*@192.0.2.64/26", "#usercidr");
+	is_string("#usercidr", banned_to(chptr, v4), MSG);
+	unban(chptr, "v4user!*@192.0.2.64/26");
+
+	ban(chptr, "*!*ide?t@*", "#middle");
+	is_string("#middle", banned_to(chptr, v4), MSG);
+	unban(chptr, "*!*ide?t@*");
+
+	is_string(NULL, banned_to(chptr, v4), MSG);
+	is_string(NULL, banned_to(chptr, v6), MSG);
+
+	remove_local_person(v4);
+	remove_local_person(v6);
+}
+
+static void
+ban_order(void)
+{
+	struct Channel *chptr = make_channel();
+	struct Client *v4 = make_local_person_full("v4user", "ident", "host.example.test", "192.0.2.77", "v4");
+
+	add_filler(chptr, &chptr->banlist, CHFL_BAN);
+
+	/* bans are added at the head, so the last one added is first */
+	ban(chptr, "*!*@192.0.0.0/8", "#wide");
+	ban(chptr, "*!*@*.test", "#host");
+	ban(chptr, "*!*@192.0.2.0/24", "#narrow");
+	is_string("#narrow", banned_to(chptr, v4), MSG);
+
+	unban(chptr, "*!*@192.0.2.0/24");
+	is_string("#host", banned_to(chptr, v4), MSG);
+
+	unban(chptr, "*!*@*.test");
+	is_string("#wide", banned_to(chptr, v4), MSG);
+
+	remove_local_person(v4);
+}
+
+static void
+ban_except(void)
+{
+	struct Channel *chptr = make_channel();
+	struct Client *v4 = make_local_person_full("v4user", "ident", "host.example.test", "192.0.2.77", "v4");
+	struct Client *other = make_local_person_full("other", "ident", "other.example.test", "192.0.2.78", "other");
+	struct membership msptr = { .chptr = chptr, .client_p = v4 };
+
+	add_filler(chptr, &chptr->banlist, CHFL_BAN);
+	add_filler(chptr, &chptr->exceptlist, CHFL_EXCEPTION);
+
+	ban(chptr, "*!*@192.0.2.0/24", NULL);
+	add_id(setter, chptr, "v4user!*@*", NULL, &chptr->exceptlist, CHFL_EXCEPTION);
+
+	is_int(CHFL_EXCEPTION, is_banned(chptr, v4, NULL, NULL, NULL), MSG);
+	is_int(CHFL_BAN, is_banned(chptr, other, NULL, NULL, NULL), MSG);
+
+	/* the membership cache follows the list changes */
+	is_int(CHFL_EXCEPTION, is_banned(chptr, v4, &msptr, NULL, NULL), MSG);
+	is_int(chptr->bants, msptr.bants, MSG);
+	free_ban(del_id(chptr, "v4user!*@*", &chptr->exceptlist, CHFL_EXCEPTION));
+	ok(msptr.bants != chptr->bants, MSG);
+	is_int(CHFL_BAN, is_banned(chptr, v4, &msptr, NULL, NULL), MSG);
+	ok(msptr.flags & CHFL_BANNED, MSG);
+
+	remove_local_person(v4);
+	remove_local_person(other);
+}
+
+static void
+ban_quiet(void)
+{
+	struct Channel *chptr = make_channel();
+	struct Client *v4 = make_local_person_full("v4user", "ident", "host.example.test", "192.0.2.77", "v4");
+
+	add_filler(chptr, &chptr->quietlist, CHFL_QUIET);
+	is_int(0, is_quieted(chptr, v4, NULL, NULL), MSG);
+
+	add_id(setter, chptr, "*!ident@host.example.test", NULL, &chptr->quietlist, CHFL_QUIET);
+	is_int(CHFL_BAN, is_quieted(chptr, v4, NULL, NULL), MSG);
+	is_int(0, is_banned(chptr, v4, NULL, NULL, NULL), MSG);
+
+	remove_local_person(v4);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	ConfigChannel.use_except = 1;
+	ConfigChannel.max_bans = 100;
+	setter = make_local_person_nick("setter");
+
+	ban_masks();
+	ban_order();
+	ban_except();
+	ban_quiet();
+
+	remove_local_person(setter);
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ *  channel1.c: Test channel membership
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "s_conf.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define MEMBERS 3000
+
+static struct Client *server;
+static struct Client *users[MEMBERS];
+
+/* each user is on the channel exactly when present[] says so */
+static unsigned int
+check_members(struct Channel *chptr, const unsigned char *present)
+{
+	struct membership *msptr;
+	unsigned int i, bad = 0;
+
+	for (i = 0; i < MEMBERS; i++)
+	{
+		msptr = find_channel_membership(chptr, users[i]);
+		if (present[i] ? msptr == NULL || msptr->client_p != users[i] || msptr->chptr != chptr : msptr != NULL)
+			bad++;
+	}
+	return bad;
+}
+
+/* through the sizes where the index is built, grown, shrunk and dropped */
+static void
+membership1(void)
+{
+	struct Channel *chptr = allocate_channel("#membership1");
+	struct Channel *other = allocate_channel("#other");
+	static unsigned char present[MEMBERS];
+	unsigned int i, n;
+
+	chptr->mode.mode |= MODE_PERMANENT;
+	memset(present, 0, sizeof(present));
+
+	add_user_to_channel(other, users[0], CHFL_PEON);
+
+	for (n = 1; n <= MEMBERS; n = n < 8 ? n + 1 : n * 3)
+	{
+		for (i = 0; i < n && i < MEMBERS; i++)
+		{
+			if (!present[i])
+			{
+				add_user_to_channel(chptr, users[i], i % 2 ? CHFL_PEON : CHFL_CHANOP);
+				present[i] = 1;
+			}
+		}
+		is_int(0, check_members(chptr, present), "Joining; " MSG);
+	}
+
+	ok(find_channel_membership(other, users[1]) == NULL, MSG);
+	ok(find_channel_membership(other, users[0]) != NULL, MSG);
+	is_int(CHFL_CHANOP, find_channel_membership(chptr, users[0])->flags, MSG);
+	is_int(CHFL_PEON, find_channel_membership(chptr, users[1])->flags, MSG);
+
+	/* out of the middle of the probe runs, then down to nothing */
+	for (n = 2; n <= MEMBERS; n *= 2)
+	{
+		for (i = 0; i < MEMBERS; i++)
+		{
+			if (present[i] && i % n != 0)
+			{
+				remove_user_from_channel(find_channel_membership(chptr, users[i]));
+				present[i] = 0;
+			}
+		}
+		is_int(0, check_members(chptr, present), "Parting; " MSG);
+	}
+
+	remove_user_from_channel(find_channel_membership(chptr, users[0]));
+	present[0] = 0;
+	is_int(0, rb_dlink_list_length(&chptr->members), MSG);
+	is_int(0, check_members(chptr, present), MSG);
+
+	/* and leaving every channel at once */
+	for (i = 0; i < 100; i++)
+	{
+		add_user_to_channel(chptr, users[i], CHFL_PEON);
+		present[i] = 1;
+	}
+	remove_user_from_channels(users[50]);
+	present[50] = 0;
+	is_int(0, check_members(chptr, present), MSG);
+
+	for (i = 0; i < 100; i++)
+		if (present[i])
+			remove_user_from_channel(find_channel_membership(chptr, users[i]));
+	remove_user_from_channel(find_channel_membership(other, users[0]));
+	destroy_channel(chptr);
+}
+
+/* what find_channel_membership() did before there was an index */
+static struct membership *
+walk_shorter_list(struct Channel *chptr, struct Client *client_p)
+{
+	rb_dlink_list *list = &chptr->members;
+	rb_dlink_node *ptr;
+	struct membership *msptr;
+
+	if (rb_dlink_list_length(&client_p->user->channel) <= rb_dlink_list_length(list))
+		list = &client_p->user->channel;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		msptr = ptr->data;
+		if (msptr->client_p == client_p && msptr->chptr == chptr)
+			return msptr;
+	}
+	return NULL;
+}
+
+/* a services bot in many channels, looking itself up in a big one */
+static void
+bench1(void)
+{
+	struct Client *bot = make_remote_person_nick(server, "BenchServ");
+	struct Channel *channels[1000];
+	struct Channel *big = allocate_channel("#big");
+	struct membership *volatile sink;
+	char name[CHANNELLEN];
+	uint64_t start, hashed, walked;
+	unsigned int i;
+
+	for (i = 0; i < 1000; i++)
+	{
+		snprintf(name, sizeof(name), "#bench%u", i);
+		channels[i] = allocate_channel(name);
+		add_user_to_channel(channels[i], bot, CHFL_CHANOP);
+	}
+	for (i = 0; i < MEMBERS; i++)
+		add_user_to_channel(big, users[i], CHFL_PEON);
+	add_user_to_channel(big, bot, CHFL_CHANOP);
+
+	start = rb_monotonic_ns();
+	for (i = 0; i < 100000; i++)
+		sink = find_channel_membership(big, i % 2 ? bot : users[i % MEMBERS]);
+	hashed = rb_monotonic_ns() - start;
+
+	start = rb_monotonic_ns();
+	for (i = 0; i < 100000; i++)
+		sink = walk_shorter_list(big, i % 2 ? bot : users[i % MEMBERS]);
+	walked = rb_monotonic_ns() - start;
+
+	is_int(CHFL_CHANOP, find_channel_membership(big, bot)->flags, MSG);
+	diag("100000 lookups in a channel of %u, half by a client in 1001 channels: %.1fms hashed, %.1fms walking the shorter list",
+		MEMBERS + 1, hashed / 1e6, walked / 1e6);
+
+	remove_user_from_channels(bot);
+	for (i = 0; i < MEMBERS; i++)
+		remove_user_from_channel(find_channel_membership(big, users[i]));
+	remove_remote_person(bot);
+}
+
+int main(int argc, char *argv[])
+{
+	char nick[NICKLEN];
+	unsigned int i;
+
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	server = make_remote_server(&me);
+	for (i = 0; i < MEMBERS; i++)
+	{
+		snprintf(nick, sizeof(nick), "member%u", i);
+		users[i] = make_remote_person_nick(server, nick);
+	}
+
+	membership1();
+	bench1();
+
+	for (i = 0; i < MEMBERS; i++)
+		remove_remote_person(users[i]);
+	remove_remote_server(server);
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
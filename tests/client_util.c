@@ -84,10 +84,12 @@ struct Client *make_local_person_full(const char *nick, const char *username, co
 	rb_strlcpy(client->name, nick, sizeof(client->name));
 	rb_strlcpy(client->username, username, sizeof(client->username));
 	rb_strlcpy(client->host, hostname, sizeof(client->host));
+	rb_strlcpy(client->orighost, hostname, sizeof(client->orighost));
 	rb_inet_ntop_sock((struct sockaddr *)&client->localClient->ip, client->sockhost, sizeof(client->sockhost));
 	rb_strlcpy(client->info, realname, sizeof(client->info));
 
 	add_to_client_hash(client->name, client);
+	add_to_lclient_index(client);
 
 	return client;
 }
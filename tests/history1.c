@@ -0,0 +1,367 @@
+/*
+ *  history1.c: Test the message history store
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+
+#include "history.h"
+#include "s_conf.h"
+#include "ircd.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static void
+history_lines(void)
+{
+	struct history_buf *buf;
+	struct history_line line;
+	char text[32];
+	uint64_t first = 0, id = 0;
+
+	ConfigChannel.history_lines = 50;
+
+	ok(history_find("#lines") == NULL, MSG);
+	is_int(0, history_count(NULL), MSG);
+
+	for(int i = 0; i < 120; i++)
+	{
+		snprintf(text, sizeof text, "line %d", i);
+		id = history_add("#lines", MESSAGE_TYPE_PRIVMSG, "nick!user@host", text);
+		if(i == 0)
+			first = id;
+		ok(id == first + i, MSG);
+	}
+
+	/* found case insensitively, with only the newest lines kept */
+	buf = history_find("#LINES");
+	ok(buf != NULL, MSG);
+	is_int(50, history_count(buf), MSG);
+
+	history_get(buf, 0, &line);
+	ok(line.id == first + 70, MSG);
+	is_string("line 70", line.text, MSG);
+	is_string("nick!user@host", line.source, MSG);
+	is_int(MESSAGE_TYPE_PRIVMSG, line.type, MSG);
+
+	history_get(buf, 49, &line);
+	ok(line.id == id, MSG);
+	is_string("line 119", line.text, MSG);
+
+	/* a lower limit trims the ring on the next line */
+	ConfigChannel.history_lines = 10;
+	history_add("#lines", MESSAGE_TYPE_NOTICE, "nick!user@host", "last");
+	is_int(10, history_count(buf), MSG);
+	history_get(buf, 9, &line);
+	is_string("last", line.text, MSG);
+	is_int(MESSAGE_TYPE_NOTICE, line.type, MSG);
+	history_get(buf, 0, &line);
+	is_string("line 111", line.text, MSG);
+
+	history_drop("#lines");
+	ok(history_find("#lines") == NULL, MSG);
+}
+
+static void
+history_bytes(void)
+{
+	struct history_buf *buf;
+	struct history_line line;
+	char text[400];
+	size_t used;
+	unsigned int i;
+
+	ConfigChannel.history_lines = 1000;
+	ConfigChannel.history_size = 8192;
+
+	for(i = 0; i < 200; i++)
+	{
+		memset(text, 'a' + i % 26, sizeof text - 1);
+		text[sizeof text - 1] = '\0';
+		snprintf(text, 8, "%05u", i);
+		text[5] = ' ';
+		history_add("#bytes", MESSAGE_TYPE_PRIVMSG, "n!u@h", text);
+	}
+
+	/* the arena wraps, but every line kept is whole and in order */
+	buf = history_find("#bytes");
+	ok(history_count(buf) < 200, MSG);
+	ok(history_count(buf) >= 8192 / (400 + 8) - 1, MSG);
+
+	used = 0;
+	for(i = 0; i < history_count(buf); i++)
+	{
+		char want[8];
+
+		history_get(buf, i, &line);
+		snprintf(want, sizeof want, "%05u", 200 - history_count(buf) + i);
+		ok(strncmp(want, line.text, 5) == 0, MSG);
+		is_int(399, strlen(line.text), MSG);
+		is_string("n!u@h", line.source, MSG);
+		used += strlen(line.source) + strlen(line.text) + 2;
+	}
+	ok(used <= 8192, MSG);
+
+	/* a line larger than the whole store is refused */
+	{
+		char *big = malloc(10000);
+
+		memset(big, 'x', 9999);
+		big[9999] = '\0';
+		ok(history_add("#bytes", MESSAGE_TYPE_PRIVMSG, "n!u@h", big) == 0, MSG);
+		free(big);
+	}
+
+	history_drop("#bytes");
+}
+
+static void
+history_index(void)
+{
+	struct history_buf *buf;
+	struct history_line line;
+	uint64_t ids[20];
+	int64_t msec;
+
+	ConfigChannel.history_lines = 1000;
+	ConfigChannel.history_size = 256 * 1024;
+
+	for(int i = 0; i < 20; i++)
+	{
+		ids[i] = history_add("#index", MESSAGE_TYPE_PRIVMSG, "n!u@h", "text");
+		/* lines for another target take ids in between */
+		history_add("#other", MESSAGE_TYPE_PRIVMSG, "n!u@h", "text");
+	}
+
+	buf = history_find("#index");
+	is_int(20, history_count(buf), MSG);
+
+	is_int(0, history_index_id(buf, 0), MSG);
+	is_int(0, history_index_id(buf, ids[0]), MSG);
+	is_int(1, history_index_id(buf, ids[0] + 1), MSG);
+	is_int(7, history_index_id(buf, ids[7]), MSG);
+	is_int(8, history_index_id(buf, ids[7] + 1), MSG);
+	is_int(19, history_index_id(buf, ids[19]), MSG);
+	is_int(20, history_index_id(buf, ids[19] + 1), MSG);
+
+	history_get(buf, 0, &line);
+	msec = line.msec;
+	is_int(0, history_index_msec(buf, msec), MSG);
+	is_int(0, history_index_msec(buf, msec - 1), MSG);
+	history_get(buf, 19, &line);
+	is_int(20, history_index_msec(buf, line.msec + 1), MSG);
+	is_int(0, history_index_msec(NULL, msec), MSG);
+
+	/* expiring drops old lines and then the emptied targets */
+	history_expire(msec);
+	is_int(20, history_count(history_find("#index")), MSG);
+	history_expire(INT64_MAX);
+	ok(history_find("#index") == NULL, MSG);
+	ok(history_find("#other") == NULL, MSG);
+}
+
+static void
+history_msgid(void)
+{
+	char msgid[HISTORY_MSGID_LEN];
+	uint64_t id;
+
+	history_format_msgid(0x1234abcdULL, msgid, sizeof msgid);
+	is_string("0AA000000001234abcd", msgid, MSG);
+
+	ok(history_parse_msgid(msgid, &id), MSG);
+	ok(id == 0x1234abcdULL, MSG);
+
+	ok(!history_parse_msgid("0AB000000001234abcd", &id), MSG);
+	ok(!history_parse_msgid("0AA1234abcd", &id), MSG);
+	ok(!history_parse_msgid("0AA00000000xyz4abcd", &id), MSG);
+}
+
+static void
+history_time(void)
+{
+	int64_t msec;
+
+	ok(history_parse_time("2024-03-01T12:34:56Z", &msec), MSG);
+	ok(msec == INT64_C(1709296496000), MSG);
+	ok(history_parse_time("2024-03-01T12:34:56.5Z", &msec), MSG);
+	ok(msec == INT64_C(1709296496500), MSG);
+	ok(history_parse_time("2024-03-01T12:34:56.05Z", &msec), MSG);
+	ok(msec == INT64_C(1709296496050), MSG);
+	ok(history_parse_time("2024-03-01T12:34:56.123Z", &msec), MSG);
+	ok(msec == INT64_C(1709296496123), MSG);
+	ok(history_parse_time("2024-02-29T00:00:00", &msec), MSG);
+
+	ok(!history_parse_time("2024-13-01T00:00:00Z", &msec), MSG);
+	ok(!history_parse_time("2024-03-01T25:00:00Z", &msec), MSG);
+	ok(!history_parse_time("2024-03-01T00:60:00Z", &msec), MSG);
+	ok(!history_parse_time("2023-02-29T00:00:00Z", &msec), MSG);
+	ok(!history_parse_time("2024-03-01T00:00:00.Z", &msec), MSG);
+	ok(!history_parse_time("2024-03-01T00:00:00Zx", &msec), MSG);
+	ok(!history_parse_time("2024-03-01", &msec), MSG);
+}
+
+static void
+history_log_reopen(void)
+{
+	ConfigChannel.history_log = 0;
+	init_history_log();
+	ConfigChannel.history_log = 1;
+	init_history_log();
+}
+
+static void
+history_log(void)
+{
+	struct history_buf *buf;
+	struct history_line line;
+	char cmd[BUFSIZE], text[400];
+	uint64_t first = 0, last = 0;
+	unsigned int i, n = 3000;
+
+	snprintf(cmd, sizeof cmd, "rm -rf %s", ircd_paths[IRCD_PATH_HISTORY]);
+	ok(system(cmd) == 0, MSG);
+
+	ConfigChannel.history_log = 1;
+	ConfigChannel.history_log_time = 86400;
+	init_history_log();
+
+	/* enough to fill more than one segment */
+	memset(text, 'x', sizeof text - 1);
+	text[sizeof text - 1] = '\0';
+	for(i = 0; i < n; i++)
+	{
+		snprintf(text, 8, "%05u", i);
+		text[5] = ' ';
+		last = history_add("#Log", i % 2 ? MESSAGE_TYPE_NOTICE : MESSAGE_TYPE_PRIVMSG, "n!u@h", text);
+		if(i == 0)
+			first = last;
+	}
+
+	/* the line limits only apply to memory */
+	buf = history_find("#log");
+	is_int(n, history_count(buf), MSG);
+
+	history_log_reopen();
+
+	buf = history_find("#LOG");
+	ok(buf != NULL, MSG);
+	is_int(n, history_count(buf), MSG);
+
+	for(i = 0; i < n; i += 97)
+	{
+		char want[8];
+
+		history_get(buf, i, &line);
+		snprintf(want, sizeof want, "%05u", i);
+		ok(strncmp(want, line.text, 5) == 0, MSG);
+		is_int(399, strlen(line.text), MSG);
+		is_string("n!u@h", line.source, MSG);
+		ok(line.id == first + i, MSG);
+		is_int(i % 2 ? MESSAGE_TYPE_NOTICE : MESSAGE_TYPE_PRIVMSG, line.type, MSG);
+	}
+
+	is_int(0, history_index_id(buf, first), MSG);
+	is_int(1234, history_index_id(buf, first + 1234), MSG);
+	is_int(n - 1, history_index_id(buf, last), MSG);
+	is_int(n, history_index_id(buf, last + 1), MSG);
+	history_get(buf, 0, &line);
+	is_int(0, history_index_msec(buf, line.msec), MSG);
+
+	/* ids carry on from the log, and new lines go to a new segment */
+	ok(history_add("#log", MESSAGE_TYPE_PRIVMSG, "n!u@h", "after") == last + 1, MSG);
+	history_log_reopen();
+	buf = history_find("#log");
+	is_int(n + 1, history_count(buf), MSG);
+	history_get(buf, n, &line);
+	is_string("after", line.text, MSG);
+
+	/* whole segments are expired, and the target with them */
+	ConfigChannel.history_log_time = -3600;
+	history_log_reopen();
+	ok(history_find("#log") == NULL, MSG);
+
+	ConfigChannel.history_log_time = 86400;
+	ConfigChannel.history_log = 0;
+	init_history_log();
+}
+
+static void
+history_log_writers(void)
+{
+	struct history_buf *buf;
+	struct history_line line;
+	char target[16], text[32];
+	unsigned int i, j, n = 200;
+
+	ConfigChannel.history_log = 1;
+	init_history_log();
+
+	/* more targets than may be written at once, each written in turns
+	 * so that its segment has been sealed before its next line */
+	for(j = 0; j < 3; j++)
+	{
+		for(i = 0; i < n; i++)
+		{
+			snprintf(target, sizeof target, "#w%u", i);
+			snprintf(text, sizeof text, "%u %u", i, j);
+			ok(history_add(target, MESSAGE_TYPE_PRIVMSG, "n!u@h", text) != 0, MSG);
+		}
+	}
+
+	history_log_reopen();
+
+	for(i = 0; i < n; i++)
+	{
+		snprintf(target, sizeof target, "#w%u", i);
+		buf = history_find(target);
+		is_int(3, history_count(buf), MSG);
+
+		for(j = 0; j < 3; j++)
+		{
+			snprintf(text, sizeof text, "%u %u", i, j);
+			history_get(buf, j, &line);
+			is_string(text, line.text, MSG);
+		}
+	}
+
+	ConfigChannel.history_log = 0;
+	init_history_log();
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+
+	history_lines();
+	history_bytes();
+	history_index();
+	history_msgid();
+	history_time();
+	history_log();
+	history_log_writers();
+
+	ircd_util_free();
+	return 0;
+}
@@ -1,5 +1,5 @@
 /*
- *  hostmask1.c: Test parse_netmask
+ *  hostmask1.c: Test parse_netmask and address conf lookups
  *  Copyright 2020 Ed Kellett
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include "ircd_defs.h"
 #include "client.h"
 #include "hostmask.h"
+#include "s_conf.h"
 
 #define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
 
@@ -192,6 +193,105 @@ static void invalid_ipv6_cidr(void)
 	is_int(HM_ERROR, ty, MSG);
 }
 
+static struct ConfItem *add_kline(const char *user, const char *host)
+{
+	struct ConfItem *aconf = make_conf();
+
+	aconf->status = CONF_KILL;
+	/* keep delete_one_address_conf() from freeing it under us */
+	aconf->clients = 1;
+	aconf->user = rb_strdup(user);
+	aconf->host = rb_strdup(host);
+	add_conf_by_address(aconf->host, CONF_KILL, aconf->user, NULL, aconf);
+	return aconf;
+}
+
+static struct ConfItem *find_kill(const char *host, const char *ip, const char *user)
+{
+	struct rb_sockaddr_storage addr;
+
+	if (ip == NULL)
+		return find_conf_by_address(host, NULL, NULL, NULL, CONF_KILL, AF_INET, user, NULL);
+
+	if (!rb_inet_pton_sock(ip, &addr))
+		return NULL;
+
+	return find_conf_by_address(host, ip, NULL, (struct sockaddr *)&addr, CONF_KILL,
+			GET_SS_FAMILY(&addr), user, NULL);
+}
+
+static void ip_lookup(void)
+{
+	struct ConfItem *net8, *net16, *single, *net6;
+
+	/* earlier entries take precedence over later ones */
+	single = add_kline("baduser", "10.1.2.3");
+	net16 = add_kline("*", "10.1.0.0/16");
+	net8 = add_kline("*", "10.0.0.0/8");
+	net6 = add_kline("*", "2001:db8::/32");
+
+	ok(find_kill("host.test", "10.1.2.3", "baduser") == single, MSG);
+	ok(find_kill("host.test", "10.1.2.3", "gooduser") == net16, MSG);
+	ok(find_kill("host.test", "10.1.9.9", "baduser") == net16, MSG);
+	ok(find_kill("host.test", "10.200.0.1", "gooduser") == net8, MSG);
+	ok(find_kill("host.test", "11.0.0.1", "gooduser") == NULL, MSG);
+
+	ok(find_kill("host.test", "2001:db8:1::1", "gooduser") == net6, MSG);
+	ok(find_kill("host.test", "2001:db9::1", "gooduser") == NULL, MSG);
+	/* 6to4 addresses are checked against IPv4 K-lines too */
+	ok(find_kill("host.test", "2002:a01:203::1", "baduser") == single, MSG);
+
+	delete_one_address_conf(single->host, single);
+	ok(find_kill("host.test", "10.1.2.3", "baduser") == net16, MSG);
+	delete_one_address_conf(net16->host, net16);
+	ok(find_kill("host.test", "10.1.2.3", "baduser") == net8, MSG);
+	delete_one_address_conf(net8->host, net8);
+	ok(find_kill("host.test", "10.1.2.3", "baduser") == NULL, MSG);
+	delete_one_address_conf(net6->host, net6);
+	ok(find_kill("host.test", "2001:db8:1::1", "gooduser") == NULL, MSG);
+
+	net8 = add_kline("*", "0.0.0.0/0");
+	ok(find_kill("host.test", "11.0.0.1", "gooduser") == net8, MSG);
+	delete_one_address_conf(net8->host, net8);
+	ok(find_kill("host.test", "11.0.0.1", "gooduser") == NULL, MSG);
+}
+
+static void host_lookup(void)
+{
+	struct ConfItem *exact, *domain, *partial, *wild, *textip;
+
+	exact = add_kline("*", "foo.example.com");
+	domain = add_kline("bad*", "*.example.com");
+	partial = add_kline("*", "*oo.example.org");
+	wild = add_kline("*", "host.example.ne?");
+	textip = add_kline("*", "192.0.2.*");
+
+	ok(find_kill("foo.example.com", NULL, "user") == exact, MSG);
+	ok(find_kill("FOO.Example.COM", NULL, "user") == exact, MSG);
+	ok(find_kill("a.b.example.com", NULL, "baduser") == domain, MSG);
+	ok(find_kill("a.b.example.com", NULL, "user") == NULL, MSG);
+	ok(find_kill("example.com", NULL, "baduser") == NULL, MSG);
+	ok(find_kill("x.foo.example.org", NULL, "user") == partial, MSG);
+	ok(find_kill("boo.example.org", NULL, "user") == partial, MSG);
+	ok(find_kill("bar.example.org", NULL, "user") == NULL, MSG);
+	ok(find_kill("host.example.net", NULL, "user") == wild, MSG);
+	ok(find_kill("host.example.nl", NULL, "user") == NULL, MSG);
+
+	/* textual IP masks match the socket host */
+	ok(find_kill("rdns.test", "192.0.2.1", "user") == textip, MSG);
+
+	delete_one_address_conf(exact->host, exact);
+	ok(find_kill("foo.example.com", NULL, "baduser") == domain, MSG);
+	delete_one_address_conf(domain->host, domain);
+	ok(find_kill("foo.example.com", NULL, "baduser") == NULL, MSG);
+	delete_one_address_conf(wild->host, wild);
+	ok(find_kill("host.example.net", NULL, "user") == NULL, MSG);
+	delete_one_address_conf(textip->host, textip);
+	ok(find_kill("rdns.test", "192.0.2.1", "user") == NULL, MSG);
+	delete_one_address_conf(partial->host, partial);
+	ok(find_kill("boo.example.org", NULL, "user") == NULL, MSG);
+}
+
 int main(int argc, char *argv[])
 {
 	memset(&me, 0, sizeof(me));
@@ -199,6 +299,8 @@ int main(int argc, char *argv[])
 
 	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
 	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+	init_s_conf();
+	init_host_hash();
 
 	plan_lazy();
 
@@ -214,5 +316,8 @@ int main(int argc, char *argv[])
 	valid_ipv6_cidr();
 	invalid_ipv6_cidr();
 
+	ip_lookup();
+	host_lookup();
+
 	return 0;
 }
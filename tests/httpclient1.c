@@ -0,0 +1,447 @@
+/*
+ *  httpclient1.c: Test the HTTP client
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+
+#include "httpclient.h"
+#include "httpqueue.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static int listener;
+static char base[64];
+
+struct result
+{
+	int done;
+	int status;
+	char body[1024];
+	char streamed[1024];
+};
+
+static void
+done_cb(const struct http_response *resp, void *arg)
+{
+	struct result *res = arg;
+
+	res->done++;
+	res->status = resp->status;
+	rb_strlcpy(res->body, resp->body != NULL ? resp->body : "", sizeof(res->body));
+}
+
+static bool
+stream_cb(const char *data, size_t len, void *arg)
+{
+	struct result *res = arg;
+
+	strncat(res->streamed, data, len);
+	return false;
+}
+
+static bool
+readable(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) > 0;
+}
+
+/* run the event loop until fd can be read */
+static bool
+wait_fd(int fd)
+{
+	for(int i = 0; i < 300; i++)
+	{
+		if(readable(fd))
+			return true;
+		rb_select(10);
+	}
+	return false;
+}
+
+static void
+wait_done(struct result *res, int n)
+{
+	for(int i = 0; i < 300 && res->done < n; i++)
+		rb_select(10);
+}
+
+static int
+accept_conn(void)
+{
+	if(!wait_fd(listener))
+		return -1;
+	return accept(listener, NULL, NULL);
+}
+
+/* read until count requests have come */
+static int
+read_requests(int fd, char *buf, size_t size, int count)
+{
+	size_t len = 0;
+	ssize_t n;
+	int seen = 0;
+	const char *p;
+
+	buf[0] = '\0';
+	while(seen < count && wait_fd(fd))
+	{
+		if((n = read(fd, buf + len, size - len - 1)) <= 0)
+			break;
+		len += n;
+		buf[len] = '\0';
+
+		seen = 0;
+		for(p = buf; (p = strstr(p, "\r\n\r\n")) != NULL; p += 4)
+			seen++;
+	}
+	return seen;
+}
+
+static void
+reply(int fd, const char *text)
+{
+	ok(write(fd, text, strlen(text)) == (ssize_t)strlen(text), MSG);
+}
+
+static void
+parse_url(void)
+{
+	struct http_url url;
+
+	ok(http_parse_url("http://example.com", &url), MSG);
+	ok(!url.https, MSG);
+	is_string("example.com", url.host, MSG);
+	is_int(80, url.port, MSG);
+	is_string("/", url.path, MSG);
+
+	ok(http_parse_url("HTTPS://Example.com:8443/a/b?c=d#frag", &url), MSG);
+	ok(url.https, MSG);
+	is_int(8443, url.port, MSG);
+	is_string("/a/b?c=d", url.path, MSG);
+
+	ok(http_parse_url("http://[::1]:81?q", &url), MSG);
+	is_string("::1", url.host, MSG);
+	is_int(81, url.port, MSG);
+	is_string("/?q", url.path, MSG);
+
+	ok(!http_parse_url("ftp://example.com/", &url), MSG);
+	ok(!http_parse_url("http://", &url), MSG);
+	ok(!http_parse_url("http://host:0/", &url), MSG);
+	ok(!http_parse_url("http://host:80x/", &url), MSG);
+	ok(!http_parse_url("http://user@host/", &url), MSG);
+	ok(!http_parse_url("http://host/a b", &url), MSG);
+	ok(!http_parse_url("http://host/a\r\nX: y", &url), MSG);
+}
+
+static void
+keepalive(void)
+{
+	struct result res = { 0 };
+	char buf[4096], url[128];
+	int fd;
+
+	snprintf(url, sizeof(url), "%s/first", base);
+	ok(http_request("GET", url, NULL, NULL, 0, NULL, done_cb, &res), MSG);
+
+	fd = accept_conn();
+	ok(fd >= 0, MSG);
+	is_int(1, read_requests(fd, buf, sizeof(buf), 1), MSG);
+	ok(!strncmp(buf, "GET /first HTTP/1.1\r\n", 21), MSG);
+	ok(strstr(buf, "\r\nHost: 127.0.0.1:") != NULL, MSG);
+
+	reply(fd, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello");
+	wait_done(&res, 1);
+	is_int(1, res.done, MSG);
+	is_int(200, res.status, MSG);
+	is_string("hello", res.body, MSG);
+
+	/* the connection is used again, with requests pipelined on it */
+	memset(&res, 0, sizeof(res));
+	ok(http_request("POST", url, "application/json", "{}", 2, NULL, done_cb, &res), MSG);
+	ok(http_request("GET", url, NULL, NULL, 0, NULL, done_cb, &res), MSG);
+	ok(http_request("GET", url, NULL, NULL, 0, NULL, done_cb, &res), MSG);
+
+	is_int(3, read_requests(fd, buf, sizeof(buf), 3), MSG);
+	ok(strstr(buf, "Content-Type: application/json\r\nContent-Length: 2\r\n\r\n{}GET") != NULL, MSG);
+	ok(!readable(listener), MSG);
+
+	reply(fd, "HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n"
+		"HTTP/1.1 100 Continue\r\n\r\n"
+		"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"3\r\nabc\r\n4;x=y\r\ndefg\r\n0\r\nX-Trailer: 1\r\n\r\n"
+		"HTTP/1.1 404 Not Found\r\nContent-Length: 4\r\n\r\n");
+	wait_done(&res, 2);
+	is_int(2, res.done, MSG);
+	is_string("abcdefg", res.body, MSG);
+
+	/* the last body arrives later */
+	reply(fd, "gone");
+	wait_done(&res, 3);
+	is_int(3, res.done, MSG);
+	is_int(404, res.status, MSG);
+	is_string("gone", res.body, MSG);
+
+	/* a kept-alive connection closed before an answer: sent again */
+	memset(&res, 0, sizeof(res));
+	ok(http_request("GET", url, NULL, NULL, 0, NULL, done_cb, &res), MSG);
+	is_int(1, read_requests(fd, buf, sizeof(buf), 1), MSG);
+	close(fd);
+
+	fd = accept_conn();
+	ok(fd >= 0, MSG);
+	is_int(1, read_requests(fd, buf, sizeof(buf), 1), MSG);
+	reply(fd, "HTTP/1.0 200 OK\r\n\r\nuntil close");
+	close(fd);
+	wait_done(&res, 1);
+	is_int(200, res.status, MSG);
+	is_string("until close", res.body, MSG);
+}
+
+static void
+streaming(void)
+{
+	struct result res = { 0 };
+	char buf[4096], url[128];
+	int fd;
+
+	snprintf(url, sizeof(url), "%s/stream", base);
+	ok(http_request("GET", url, NULL, NULL, 0, stream_cb, done_cb, &res), MSG);
+
+	fd = accept_conn();
+	is_int(1, read_requests(fd, buf, sizeof(buf), 1), MSG);
+	reply(fd, "HTTP/1.1 200 OK\r\nContent-Length: 100000\r\n\r\npart");
+	wait_done(&res, 1);
+	is_int(200, res.status, MSG);
+	is_string("part", res.streamed, MSG);
+
+	/* reading stopped, so the connection was dropped */
+	ok(wait_fd(fd), MSG);
+	is_int(0, read(fd, buf, sizeof(buf)), MSG);
+	close(fd);
+}
+
+static void
+cancel(void)
+{
+	struct result res = { 0 };
+	char buf[4096], url[128];
+	int fd;
+
+	snprintf(url, sizeof(url), "%s/cancel", base);
+	ok(http_request("GET", url, NULL, NULL, 0, NULL, done_cb, &res), MSG);
+	fd = accept_conn();
+	is_int(1, read_requests(fd, buf, sizeof(buf), 1), MSG);
+
+	http_cancel_callback(done_cb);
+	reply(fd, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nno");
+	for(int i = 0; i < 20; i++)
+		rb_select(10);
+	is_int(0, res.done, MSG);
+	close(fd);
+
+	/* refused connections fail what was waiting */
+	ok(http_request("GET", "http://127.0.0.1:1/", NULL, NULL, 0, NULL, done_cb, &res), MSG);
+	wait_done(&res, 1);
+	is_int(1, res.done, MSG);
+	is_int(0, res.status, MSG);
+
+	ok(!http_request("GET", "gopher://127.0.0.1/", NULL, NULL, 0, NULL, done_cb, &res), MSG);
+}
+
+static const struct http_batch_format test_format = {
+	.content_type = "application/json",
+	.prefix = "[",
+	.separator = ",",
+	.suffix = "]",
+	.dropped = "d%u",
+	.max_bytes = 64,
+	.max_items = 3,
+	.window = 0,
+};
+
+static const struct http_batch_format big_format = {
+	.content_type = "application/json",
+	.prefix = "[",
+	.separator = ",",
+	.suffix = "]",
+	.dropped = "d%u",
+	.max_bytes = 64 * 1024,
+	.max_items = 2 * HTTP_QUEUE_MAX_ITEMS,
+	.window = 0,
+};
+
+struct queue_stats
+{
+	const char *name;
+	unsigned int queued;
+	unsigned int inflight;
+	unsigned long sent;
+	unsigned long dropped;
+	unsigned long failed;
+};
+
+static void
+stats_cb(const char *name, const char *origin, unsigned int queued, unsigned int inflight,
+		unsigned long sent, unsigned long dropped, unsigned long failed, void *arg)
+{
+	struct queue_stats *st = arg;
+
+	if(strcmp(name, st->name))
+		return;
+	st->queued = queued;
+	st->inflight = inflight;
+	st->sent = sent;
+	st->dropped = dropped;
+	st->failed = failed;
+}
+
+/* the body of the one request read into buf */
+static const char *
+request_body(int fd, char *buf, size_t size)
+{
+	const char *p;
+
+	if(read_requests(fd, buf, size, 1) != 1 || (p = strstr(buf, "\r\n\r\n")) == NULL)
+		return "";
+	return p + 4;
+}
+
+static void
+queue(void)
+{
+	struct queue_stats st = { .name = "test" };
+	struct http_queue *q;
+	char buf[16384], url[128];
+	int fd, i;
+
+	snprintf(url, sizeof(url), "%s/queue", base);
+	ok(http_queue_create("test", "gopher://x/", &test_format) == NULL, MSG);
+	q = http_queue_create("test", url, &test_format);
+	ok(q != NULL, MSG);
+
+	/* nothing else is waiting, so the first goes alone */
+	ok(http_queue_add(q, "\"a\""), MSG);
+	fd = accept_conn();
+	ok(fd >= 0, MSG);
+	is_string("[\"a\"]", request_body(fd, buf, sizeof(buf)), MSG);
+
+	/* the rest wait for it, then go in batches */
+	ok(http_queue_add(q, "b"), MSG);
+	ok(http_queue_add(q, "c"), MSG);
+	ok(http_queue_add(q, "d"), MSG);
+	ok(http_queue_add(q, "e"), MSG);
+	http_queue_stats(stats_cb, &st);
+	is_int(4, st.queued, MSG);
+	is_int(1, st.inflight, MSG);
+
+	reply(fd, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+	is_string("[b,c,d]", request_body(fd, buf, sizeof(buf)), MSG);
+	ok(!readable(fd), MSG);
+
+	/* a server error is tried again after a while */
+	reply(fd, "HTTP/1.1 503 Busy\r\nContent-Length: 0\r\n\r\n");
+	for(i = 0; i < 300 && !readable(fd); i++)
+	{
+		rb_select(10);
+		rb_event_run();
+	}
+	is_string("[b,c,d]", request_body(fd, buf, sizeof(buf)), MSG);
+	reply(fd, "HTTP/1.1 204 No Content\r\n\r\n");
+	is_string("[e]", request_body(fd, buf, sizeof(buf)), MSG);
+
+	/* anything else is given up on, and counted */
+	reply(fd, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+	for(i = 0; i < 20; i++)
+		rb_select(10);
+	http_queue_stats(stats_cb, &st);
+	is_int(0, st.queued, MSG);
+	is_int(0, st.inflight, MSG);
+	is_int(4, st.sent, MSG);
+	is_int(1, st.failed, MSG);
+
+	/* it goes away while a request is out */
+	ok(http_queue_add(q, "f"), MSG);
+	is_string("[f]", request_body(fd, buf, sizeof(buf)), MSG);
+	http_queue_destroy(q);
+	reply(fd, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+	for(i = 0; i < 20; i++)
+		rb_select(10);
+
+	/* a full queue drops what comes, and the next batch says how much */
+	st.name = "big";
+	q = http_queue_create("big", url, &big_format);
+	ok(http_queue_add(q, "x"), MSG);
+	for(i = 0; i < HTTP_QUEUE_MAX_ITEMS; i++)
+		http_queue_add(q, "y");
+	ok(!http_queue_add(q, "z"), MSG);
+	http_queue_stats(stats_cb, &st);
+	is_int(HTTP_QUEUE_MAX_ITEMS, st.queued, MSG);
+	is_int(1, st.dropped, MSG);
+
+	is_string("[x]", request_body(fd, buf, sizeof(buf)), MSG);
+	reply(fd, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+	ok(!strncmp(request_body(fd, buf, sizeof(buf)), "[d1,y,y,", 8), MSG);
+	reply(fd, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+	for(i = 0; i < 20; i++)
+		rb_select(10);
+	http_queue_stats(stats_cb, &st);
+	is_int(0, st.queued, MSG);
+	is_int(1 + HTTP_QUEUE_MAX_ITEMS, st.sent, MSG);
+	http_queue_destroy(q);
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(listener, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(listener, 8) < 0 ||
+			getsockname(listener, (struct sockaddr *)&sin, &len) < 0)
+		bail("cannot listen: %s", strerror(errno));
+	snprintf(base, sizeof(base), "http://127.0.0.1:%d", ntohs(sin.sin_port));
+
+	parse_url();
+	keepalive();
+	streaming();
+	queue();
+	cancel();
+
+	close(listener);
+	ircd_util_free();
+	return 0;
+}
@@ -84,6 +84,8 @@ void ircd_util_init(const char *name)
 
 	snprintf(buf, sizeof(buf), "%s.ban.db", name);
 	ircd_paths[IRCD_PATH_BANDB] = rb_strdup(buf);
+	snprintf(buf, sizeof(buf), "%s.history", name);
+	ircd_paths[IRCD_PATH_HISTORY] = rb_strdup(buf);
 	snprintf(buf, sizeof(buf), "%s.ban.db-journal", name);
 	unlink(buf);
 
@@ -0,0 +1,166 @@
+/*
+ *  kline1.c: Test applying K-lines to local users
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "s_conf.h"
+#include "class.h"
+#include "hostmask.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static struct Client *v4a, *v4b, *v6, *sixtofour, *named, *other;
+
+/* the auth block everyone is attached to */
+static struct ConfItem iline = { .status = CONF_CLIENT };
+
+static struct Client *make_kline_user(const char *nick, const char *username, const char *hostname, const char *ip)
+{
+	struct Client *client = make_local_person_full(nick, username, hostname, ip, nick);
+
+	iline.c_class = default_class;
+	client->localClient->att_conf = &iline;
+	iline.clients++;
+	return client;
+}
+
+static void make_users(void)
+{
+	v4a = make_kline_user("v4a", "user", "198.51.100.1", "198.51.100.1");
+	v4b = make_kline_user("v4b", "user", "198.51.100.200", "198.51.100.200");
+	v6 = make_kline_user("v6", "user", "2001:db8::1", "2001:db8::1");
+	sixtofour = make_kline_user("sixtofour", "user", "sixtofour.test", "2002:c633:6405::1");
+	named = make_kline_user("named", "baduser", "a.b.example.net", "192.0.2.1");
+	other = make_kline_user("other", "user", "other.example.org", "192.0.2.2");
+}
+
+static void remove_users(void)
+{
+	struct Client **clientp;
+	struct Client *clients[] = { v4a, v4b, v6, sixtofour, named, other, NULL };
+
+	for (clientp = clients; *clientp != NULL; clientp++)
+		if (!IsAnyDead(*clientp))
+			remove_local_person(*clientp);
+}
+
+static struct ConfItem *make_kline(const char *user, const char *host)
+{
+	struct ConfItem *aconf = make_conf();
+
+	aconf->status = CONF_KILL;
+	aconf->user = rb_strdup(user);
+	aconf->host = rb_strdup(host);
+	aconf->passwd = rb_strdup("test");
+	add_conf_by_address(aconf->host, CONF_KILL, aconf->user, NULL, aconf);
+	return aconf;
+}
+
+static void kline_ipv4(void)
+{
+	make_users();
+
+	/* covers v4a and the 6to4 address, but not v4b */
+	check_one_kline(make_kline("*", "198.51.100.0/25"));
+	ok(IsAnyDead(v4a), MSG);
+	ok(!IsAnyDead(v4b), MSG);
+	ok(IsAnyDead(sixtofour), MSG);
+	ok(!IsAnyDead(v6), MSG);
+	ok(!IsAnyDead(named), MSG);
+
+	remove_users();
+}
+
+static void kline_ipv6(void)
+{
+	make_users();
+
+	check_one_kline(make_kline("*", "2001:db8::/32"));
+	ok(IsAnyDead(v6), MSG);
+	ok(!IsAnyDead(sixtofour), MSG);
+	ok(!IsAnyDead(v4a), MSG);
+
+	remove_users();
+}
+
+static void kline_host(void)
+{
+	make_users();
+
+	/* username must match too */
+	check_one_kline(make_kline("user", "*.example.net"));
+	ok(!IsAnyDead(named), MSG);
+
+	check_one_kline(make_kline("bad*", "*.example.net"));
+	ok(IsAnyDead(named), MSG);
+	ok(!IsAnyDead(other), MSG);
+
+	/* socket hosts count as well */
+	check_one_kline(make_kline("*", "*.0.2.2"));
+	ok(IsAnyDead(other), MSG);
+
+	/* no usable suffix, so every user is looked at */
+	check_one_kline(make_kline("*", "198.51.100.2*"));
+	ok(IsAnyDead(v4b), MSG);
+	ok(!IsAnyDead(v4a), MSG);
+
+	remove_users();
+}
+
+static void kline_batch(void)
+{
+	rb_dlink_list klines = { NULL, NULL, 0 };
+
+	make_users();
+
+	rb_dlinkAddAlloc(make_kline("*", "198.51.100.1"), &klines);
+	rb_dlinkAddAlloc(make_kline("*", "other.example.org"), &klines);
+	check_new_klines(&klines);
+
+	is_int(0, rb_dlink_list_length(&klines), MSG);
+	ok(IsAnyDead(v4a), MSG);
+	ok(IsAnyDead(other), MSG);
+	ok(!IsAnyDead(v4b), MSG);
+	ok(!IsAnyDead(named), MSG);
+
+	remove_users();
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	kline_ipv4();
+	kline_ipv6();
+	kline_host();
+	kline_batch();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -3340,16 +3340,41 @@ static void reconstruct_tail(void)
 	is_string(" :", mb->para[2], MSG);
 }
 
-int main(int argc, char *argv[])
+/* how many lines like a client's a second each scanner parses */
+static void bench_tags(void)
 {
-	memset(&me, 0, sizeof(me));
-	strcpy(me.name, "me.name.");
+	static const char *lines[] = {
+		"@+typing=active;label=a1b2c3 TAGMSG #channel",
+		"@msgid=Yxbd8Ug2CPhWKiKQ5ZgbVz;time=2017-07-14T02:40:00.000Z;label=123 PRIVMSG #channel :hello there, how are things?",
+		"@+draft/reply=Yxbd8Ug2CPhWKiKQ5ZgbVz;+draft/react=\\:smile\\:;label=456 TAGMSG #channel",
+		":nick!user@host PRIVMSG #channel :no tags on this one at all",
+	};
+	static const char *scanners[] = { "avx2", "sse2", "scalar" };
+	const char *best = rb_scanner();
+	struct MsgBuf msgbuf;
+	unsigned int s, i, n = 200000;
+	uint64_t start, ns;
 
-	plan_lazy();
+	for (s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++) {
+		if (!rb_set_scanner(scanners[s]))
+			continue;
 
-	is_int(512, TAGSLEN, MSG);
-	is_int(510, DATALEN, MSG);
+		start = rb_monotonic_ns();
+		for (i = 0; i < n; i++) {
+			strcpy(tmp, lines[i % 4]);
+			msgbuf_parse(&msgbuf, tmp);
+		}
+		ns = rb_monotonic_ns() - start;
 
+		is_int(3, msgbuf.n_para, MSG);
+		diag("%s: %u lines in %.2fms, %.0fns a line", scanners[s], n, ns / 1e6, (double)ns / n);
+	}
+
+	rb_set_scanner(best);
+}
+
+static void all_tests(void)
+{
 	basic_tags1();
 	basic_tags2();
 	basic_tags3();
@@ -3455,6 +3480,33 @@ int main(int argc, char *argv[])
 	unescape_8bit();
 
 	reconstruct_tail();
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *scanners[] = { "avx2", "sse2", "scalar" };
+	const char *best;
+	unsigned int s;
+
+	memset(&me, 0, sizeof(me));
+	strcpy(me.name, "me.name.");
+
+	plan_lazy();
+
+	is_int(512, TAGSLEN, MSG);
+	is_int(510, DATALEN, MSG);
+
+	/* every case with each scanner this CPU has */
+	best = rb_scanner();
+	for (s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++) {
+		if (rb_set_scanner(scanners[s])) {
+			diag("%s scanner", scanners[s]);
+			all_tests();
+		}
+	}
+	rb_set_scanner(best);
+
+	bench_tags();
 
 	return 0;
 }
@@ -0,0 +1,154 @@
+/*
+ *  parse1.c: Test command dispatch
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "msg.h"
+#include "parse.h"
+#include "s_conf.h"
+#include "s_stats.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static void
+timing1(void)
+{
+	struct Client *user = make_local_person();
+	struct Client *server = make_remote_server(&me);
+	struct Client *remote = make_remote_person(server);
+	struct Message *msg = find_command("PRIVMSG");
+	unsigned int count;
+
+	ok(msg != NULL, MSG);
+	if(msg == NULL)
+		return;
+
+	count = msg->count;
+
+	client_util_parse(user, "PRIVMSG " TEST_NICK " :hi" CRLF);
+	client_util_parse(user, "PRIVMSG " TEST_NICK " :again" CRLF);
+	client_util_parse(server, ":" TEST_REMOTE_NICK " PRIVMSG nobody :hi" CRLF);
+	client_util_parse(server, ":" TEST_SERVER_NAME " PRIVMSG " TEST_NICK " :hi" CRLF);
+
+	is_int(count + 4, msg->count, MSG);
+	is_int(2, msg->latency[COMMAND_LOCAL].count, MSG);
+	is_int(1, msg->latency[COMMAND_REMOTE].count, MSG);
+	is_int(1, msg->latency[COMMAND_SERVER].count, MSG);
+	ok(msg->latency[COMMAND_LOCAL].sum >= msg->latency[COMMAND_LOCAL].max, MSG);
+
+	/* turned off, they are only counted */
+	ConfigFileEntry.command_timing = 0;
+	client_util_parse(user, "PRIVMSG " TEST_NICK " :off" CRLF);
+	is_int(count + 5, msg->count, MSG);
+	is_int(2, msg->latency[COMMAND_LOCAL].count, MSG);
+	ConfigFileEntry.command_timing = 1;
+
+	remove_local_person(user);
+	remove_remote_person(remote);
+	remove_remote_server(server);
+}
+
+static struct Message test_msgtab = {
+	"TESTCMD", 0, 0, 0, 0,
+	{mg_ignore, mg_ignore, mg_ignore, mg_ignore, mg_ignore, mg_ignore}
+};
+
+static void
+lookup1(void)
+{
+	struct Client *server = make_remote_server(&me);
+	struct Message *msg = find_command("PRIVMSG");
+	unsigned int num;
+
+	ok(msg != NULL, MSG);
+	ok(msg == rb_dictionary_retrieve(cmd_dict, "PRIVMSG"), MSG);
+	ok(msg == find_command("privmsg"), MSG);
+	ok(msg == find_command("PrivMsg"), MSG);
+	ok(find_command("PRIVMSGX") == NULL, MSG);
+	ok(find_command("PRIVMS") == NULL, MSG);
+	ok(find_command("") == NULL, MSG);
+
+	ok(find_command("TESTCMD") == NULL, MSG);
+	mod_add_cmd(&test_msgtab);
+	ok(find_command("testcmd") == &test_msgtab, MSG);
+	ok(find_command("PRIVMSG") == msg, MSG);
+	mod_del_cmd(&test_msgtab);
+	ok(find_command("TESTCMD") == NULL, MSG);
+	ok(find_command("PRIVMSG") == msg, MSG);
+
+	/* numerics never reach the table */
+	num = ServerStats.is_num;
+	client_util_parse(server, ":" TEST_SERVER_NAME " 401 nobody nobody :No such nick" CRLF);
+	client_util_parse(server, ":" TEST_SERVER_NAME " 4010 nobody nobody :No such nick" CRLF);
+	is_int(num + 2, ServerStats.is_num, MSG);
+
+	remove_remote_server(server);
+}
+
+/* how long looking up the commands a burst is made of takes */
+static void
+bench1(void)
+{
+	static const char *names[] = { "PRIVMSG", "UID", "SJOIN", "NOTICE", "PING", "ENCAP", "TMODE", "NOSUCH" };
+	volatile uintptr_t sink = 0;
+	uint64_t start, took, hash_ns = 0, dict_ns = 0;
+	int i, run;
+
+	for(run = 0; run < 3; run++)
+	{
+		start = rb_monotonic_ns();
+		for(i = 0; i < 1000000; i++)
+			sink += (uintptr_t)find_command(names[i & 7]);
+		took = rb_monotonic_ns() - start;
+		if(run == 0 || took < hash_ns)
+			hash_ns = took;
+
+		start = rb_monotonic_ns();
+		for(i = 0; i < 1000000; i++)
+			sink += (uintptr_t)rb_dictionary_retrieve(cmd_dict, names[i & 7]);
+		took = rb_monotonic_ns() - start;
+		if(run == 0 || took < dict_ns)
+			dict_ns = took;
+	}
+
+	diag("1000000 lookups of %u commands: %.1fms hashed, %.1fms in the dictionary",
+		rb_dictionary_size(cmd_dict), hash_ns / 1e6, dict_ns / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	timing1();
+	lookup1();
+	bench1();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ *  ping1.c: Test ping and registration timeouts on the ping wheel
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "class.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define PING_MSG "PING :" TEST_ME_NAME CRLF
+
+/* exited local clients, until free_exited_clients() frees them */
+extern rb_dlink_list dead_list;
+
+/* the clock the ircd sees, moved on by hand */
+static struct timeval test_time;
+
+int
+rb_gettimeofday(struct timeval *tv, void *tz)
+{
+	*tv = test_time;
+	return 0;
+}
+
+/* move the clock on a second at a time, running check_pings() and
+ * whatever else comes due */
+static void
+advance(time_t secs)
+{
+	while(secs-- > 0)
+	{
+		test_time.tv_sec++;
+		rb_set_time();
+		rb_event_run();
+	}
+}
+
+/* only compares pointers, the client may have been freed */
+static bool
+listed(struct Client *client, rb_dlink_list *list)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		if(ptr->data == client)
+			return true;
+	}
+	return false;
+}
+
+/* make_local_unknown() files its client as a local user, this one stays
+ * on unknown_list as a connection that has not registered would */
+static struct Client *
+make_unregistered(void)
+{
+	struct Client *client = make_client(NULL);
+
+	client->preClient->auth.accepted = true;
+	client->localClient->localflags |= LFLAGS_FAKE;
+	return client;
+}
+
+static void
+unknown_timeout(void)
+{
+	struct Client *client = make_unregistered();
+
+	/* 30 seconds to register */
+	advance(30);
+	ok(listed(client, &unknown_list), MSG);
+	advance(1);
+	ok(!listed(client, &unknown_list), MSG);
+	advance(10);
+}
+
+static void
+client_ping_timeout(void)
+{
+	struct Client *idle = make_local_person_nick("idle");
+	struct Client *active = make_local_person_nick("active");
+	struct Client *freed = make_local_person_nick("freed");
+	int ping = get_client_ping(idle);
+
+	/* on the same slots as the others, and gone from them before they
+	 * come round */
+	remove_local_person(freed);
+	ok(listed(freed, &dead_list), MSG);
+	advance(10);
+	ok(!listed(freed, &lclient_list), MSG);
+	ok(!listed(freed, &dead_list), MSG);
+
+	/* pinged once ping seconds have passed without a word */
+	advance(40);
+	active->localClient->lasttime = rb_current_time();
+
+	advance(ping - 50);
+	is_client_sendq_empty(idle, MSG);
+	advance(1);
+	is_client_sendq(PING_MSG, idle, MSG);
+	is_client_sendq_empty(active, MSG);
+
+	/* the active one is looked at again later, not dropped */
+	advance(49);
+	is_client_sendq_empty(active, MSG);
+	advance(1);
+	is_client_sendq(PING_MSG, active, MSG);
+
+	/* and dropped ping seconds after being pinged, if it did not reply */
+	advance(ping - 51);
+	ok(listed(idle, &lclient_list), MSG);
+	advance(1);
+	ok(!listed(idle, &lclient_list), MSG);
+
+	/* a reply puts off the timeout */
+	active->localClient->lasttime = rb_current_time();
+	active->flags &= ~FLAGS_PINGSENT;
+	advance(ping + 50);
+	ok(listed(active, &lclient_list), MSG);
+	is_client_sendq(PING_MSG, active, MSG);
+	advance(ping);
+	ok(!listed(active, &lclient_list), MSG);
+
+	advance(10);
+}
+
+static void
+server_ping_timeout(void)
+{
+	struct Client *server = make_remote_server(&me);
+	int ping = get_client_ping(server);
+
+	is_int(90, ping, MSG);
+
+	advance(ping);
+	is_client_sendq_empty(server, MSG);
+	advance(1);
+	ok(strstr(get_client_sendq(server), PING_MSG) != NULL, MSG);
+
+	advance(ping - 1);
+	ok(listed(server, &serv_list), MSG);
+	advance(1);
+	ok(!listed(server, &serv_list), MSG);
+
+	advance(10);
+}
+
+int
+main(int argc, char *argv[])
+{
+	/* have librb run the events itself rather than through kernel timers */
+	setenv("LIBRB_USE_IOTYPE", "poll", 1);
+
+	gettimeofday(&test_time, NULL);
+
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	unknown_timeout();
+	client_ping_timeout();
+	server_ping_timeout();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
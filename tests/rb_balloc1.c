@@ -0,0 +1,128 @@
+/*
+ *  rb_balloc1.c: Test the block allocator
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define ELEMS 2000
+
+struct elem
+{
+	char data[72];
+};
+
+static void alloc_free1(void)
+{
+	static struct elem *elems[ELEMS];
+	rb_bh *bh = rb_bh_create(sizeof(struct elem), 64, "alloc_free1");
+	size_t used, freem, memusage;
+	const char *desc;
+	bool zeroed = true;
+	int i, j;
+
+	for (i = 0; i < ELEMS; i++)
+	{
+		elems[i] = rb_bh_alloc(bh);
+		for (j = 0; j < (int)sizeof(elems[i]->data); j++)
+			if (elems[i]->data[j] != 0)
+				zeroed = false;
+		memset(elems[i]->data, 'x', sizeof(elems[i]->data));
+	}
+	ok(zeroed, MSG);
+
+	rb_bh_usage(bh, &used, &freem, &memusage, &desc);
+	is_int(ELEMS, used, MSG);
+	is_int(ELEMS * sizeof(struct elem), memusage, MSG);
+	is_string("alloc_free1", desc, MSG);
+
+	/* freed elements come back zeroed */
+	for (i = 0; i < ELEMS; i += 2)
+		rb_bh_free(bh, elems[i]);
+	rb_bh_usage(bh, &used, NULL, NULL, NULL);
+	is_int(ELEMS / 2, used, MSG);
+
+	zeroed = true;
+	for (i = 0; i < ELEMS; i += 2)
+	{
+		elems[i] = rb_bh_alloc(bh);
+		for (j = 0; j < (int)sizeof(elems[i]->data); j++)
+			if (elems[i]->data[j] != 0)
+				zeroed = false;
+	}
+	ok(zeroed, MSG);
+
+	/* the odd elements were never touched */
+	for (i = 1; i < ELEMS; i += 2)
+		if (elems[i]->data[0] != 'x' || elems[i]->data[sizeof(elems[i]->data) - 1] != 'x')
+			break;
+	is_int(ELEMS + 1, i, MSG);
+
+	for (i = 0; i < ELEMS; i++)
+		rb_bh_free(bh, elems[i]);
+	rb_bh_usage(bh, &used, &freem, NULL, NULL);
+	is_int(0, used, MSG);
+
+	rb_bh_destroy(bh);
+}
+
+static void release1(void)
+{
+	static struct elem *elems[ELEMS];
+	rb_bh *bh = rb_bh_create(sizeof(struct elem), 16, "release1");
+	size_t total_before, total_after, freem;
+	int i;
+
+	rb_bh_total_usage(&total_before, NULL);
+
+	for (i = 0; i < ELEMS; i++)
+		elems[i] = rb_bh_alloc(bh);
+	for (i = 0; i < ELEMS; i++)
+		rb_bh_free(bh, elems[i]);
+
+	/* everything but one spare block is handed back */
+	rb_bh_total_usage(&total_after, NULL);
+	rb_bh_usage(bh, NULL, &freem, NULL, NULL);
+	ok(total_after > total_before, MSG);
+	ok(freem > 0 && freem < ELEMS, MSG);
+
+	rb_bh_destroy(bh);
+	rb_bh_total_usage(&total_after, NULL);
+	is_int(total_before, total_after, MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	alloc_free1();
+	release1();
+
+	return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ *  rb_event1.c: Test the event heap and the socket timeout wheel
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+/* the clock librb sees, moved on by hand */
+static struct timeval test_time;
+
+int
+rb_gettimeofday(struct timeval *tv, void *tz)
+{
+	*tv = test_time;
+	return 0;
+}
+
+/* move the clock on a second at a time, running what comes due */
+static void
+advance(time_t secs)
+{
+	while(secs-- > 0)
+	{
+		test_time.tv_sec++;
+		rb_set_time();
+		rb_event_run();
+	}
+}
+
+static char fired[16];
+static size_t nfired;
+
+static void
+record(void *arg)
+{
+	if(nfired < sizeof(fired) - 1)
+		fired[nfired++] = *(const char *)arg;
+	fired[nfired] = '\0';
+}
+
+static void
+reset_fired(void)
+{
+	nfired = 0;
+	fired[0] = '\0';
+}
+
+static void
+event_order(void)
+{
+	reset_fired();
+
+	rb_event_addonce("e", record, "e", 5);
+	rb_event_addonce("a", record, "a", 1);
+	rb_event_addonce("d", record, "d", 4);
+	rb_event_addonce("b", record, "b", 2);
+	rb_event_addonce("c", record, "c", 3);
+
+	ok(rb_event_next() == rb_current_time() + 1, MSG);
+
+	/* all due at once, still run earliest first */
+	test_time.tv_sec += 10;
+	rb_set_time();
+	rb_event_run();
+	is_string("abcde", fired, MSG);
+	is_int(-1, rb_event_next(), MSG);
+
+	/* and one at a time as they come due */
+	reset_fired();
+	rb_event_addonce("c", record, "c", 30);
+	rb_event_addonce("a", record, "a", 10);
+	rb_event_addonce("b", record, "b", 20);
+	advance(10);
+	is_string("a", fired, MSG);
+	advance(9);
+	is_string("a", fired, MSG);
+	advance(1);
+	is_string("ab", fired, MSG);
+	advance(10);
+	is_string("abc", fired, MSG);
+	is_int(-1, rb_event_next(), MSG);
+}
+
+static void
+event_update(void)
+{
+	struct ev_entry *a, *b;
+
+	reset_fired();
+
+	a = rb_event_add("a", record, "a", 100);
+	b = rb_event_add("b", record, "b", 55);
+	ok(rb_event_next() == rb_current_time() + 55, MSG);
+
+	/* brought forward past b, it must now be at the top */
+	rb_event_update(a, 10);
+	ok(rb_event_next() == rb_current_time() + 10, MSG);
+
+	advance(10);
+	is_string("a", fired, MSG);
+	advance(30);
+	is_string("aaaa", fired, MSG);
+	advance(10);
+	is_string("aaaaa", fired, MSG);
+	advance(5);
+	is_string("aaaaab", fired, MSG);
+
+	rb_event_delete(a);
+	rb_event_delete(b);
+	is_int(-1, rb_event_next(), MSG);
+}
+
+static struct ev_entry *self_ev;
+static int self_runs;
+
+static void
+delete_self(void *unused)
+{
+	self_runs++;
+	rb_event_delete(self_ev);
+}
+
+static void
+event_delete_self(void)
+{
+	reset_fired();
+
+	self_runs = 0;
+	self_ev = rb_event_add("self", delete_self, NULL, 1);
+	rb_event_addonce("a", record, "a", 3);
+
+	advance(5);
+	is_int(1, self_runs, MSG);
+	is_string("a", fired, MSG);
+	is_int(-1, rb_event_next(), MSG);
+
+	/* the same handler again, to catch a stale heap slot */
+	self_ev = rb_event_add("self", delete_self, NULL, 2);
+	advance(5);
+	is_int(2, self_runs, MSG);
+	is_int(-1, rb_event_next(), MSG);
+}
+
+static int timeouts;
+
+static void
+count_timeout(rb_fde_t *F, void *data)
+{
+	timeouts++;
+}
+
+static void
+timeout_rearm(void)
+{
+	rb_fde_t *F1, *F2;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "rb_event1") < 0)
+	{
+		ok(false, MSG);
+		return;
+	}
+
+	timeouts = 0;
+	rb_settimeout(F1, 5, count_timeout, NULL);
+	advance(3);
+	rb_settimeout(F1, 5, count_timeout, NULL);
+
+	/* not at the first deadline, once at the second */
+	advance(4);
+	is_int(0, timeouts, MSG);
+	advance(1);
+	is_int(1, timeouts, MSG);
+	advance(300);
+	is_int(1, timeouts, MSG);
+
+	/* cleared before it comes due */
+	rb_settimeout(F1, 5, count_timeout, NULL);
+	rb_settimeout(F1, 0, NULL, NULL);
+	advance(10);
+	is_int(1, timeouts, MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+timeout_laps(void)
+{
+	rb_fde_t *F1, *F2;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "rb_event1") < 0)
+	{
+		ok(false, MSG);
+		return;
+	}
+
+	/* more than one lap of the wheel out: its slot comes round first */
+	timeouts = 0;
+	rb_settimeout(F1, 300, count_timeout, NULL);
+	advance(299);
+	is_int(0, timeouts, MSG);
+	advance(1);
+	is_int(1, timeouts, MSG);
+
+	/* several laps out, with the clock jumping rather than ticking */
+	rb_settimeout(F1, 1000, count_timeout, NULL);
+	advance(1);
+	test_time.tv_sec += 600;
+	rb_set_time();
+	rb_event_run();
+	is_int(1, timeouts, MSG);
+	test_time.tv_sec += 398;
+	rb_set_time();
+	rb_event_run();
+	is_int(1, timeouts, MSG);
+	advance(1);
+	is_int(2, timeouts, MSG);
+
+	/* and one the loop fell more than a lap behind on */
+	rb_settimeout(F1, 10, count_timeout, NULL);
+	test_time.tv_sec += 1000;
+	rb_set_time();
+	rb_event_run();
+	is_int(3, timeouts, MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	/* have librb run the events itself rather than through kernel timers */
+	setenv("LIBRB_USE_IOTYPE", "poll", 1);
+
+	gettimeofday(&test_time, NULL);
+
+	plan_lazy();
+
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+
+	event_order();
+	event_update();
+	event_delete_self();
+	timeout_rearm();
+	timeout_laps();
+
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ *  rb_hashmap1.c: Test rb_hashmap
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "match.h"
+#include "rb_dictionary.h"
+#include "rb_hashmap.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static void
+string1(void)
+{
+	rb_hashmap *map = rb_hashmap_create("string1", RB_HASHMAP_STRING);
+	rb_hashmap *nocase = rb_hashmap_create("string1 nocase", RB_HASHMAP_STRING_NOCASE);
+
+	ok(rb_hashmap_add(map, "test", "data1"), MSG);
+	ok(!rb_hashmap_add(map, "test", "data2"), MSG);
+	ok(rb_hashmap_add(map, "TEST", "data3"), MSG);
+	is_int(2, rb_hashmap_size(map), MSG);
+	is_string("data1", rb_hashmap_retrieve(map, "test"), MSG);
+	is_string("data3", rb_hashmap_retrieve(map, "TEST"), MSG);
+	ok(rb_hashmap_retrieve(map, "Test") == NULL, MSG);
+	ok(rb_hashmap_retrieve(map, "") == NULL, MSG);
+
+	ok(rb_hashmap_add(nocase, "test", "data1"), MSG);
+	ok(!rb_hashmap_add(nocase, "TEST", "data2"), MSG);
+	is_string("data1", rb_hashmap_retrieve(nocase, "tEsT"), MSG);
+	ok(rb_hashmap_retrieve(nocase, "test2") == NULL, MSG);
+	is_string("data1", rb_hashmap_delete(nocase, "TEST"), MSG);
+	ok(rb_hashmap_delete(nocase, "test") == NULL, MSG);
+	is_int(0, rb_hashmap_size(nocase), MSG);
+
+	rb_hashmap_destroy(map, NULL, NULL);
+	rb_hashmap_destroy(nocase, NULL, NULL);
+}
+
+/* the IRC casemap also folds []\^ into {}|~ */
+static void
+casemap1(void)
+{
+	rb_hashmap *map = rb_hashmap_create_casemap("casemap1", irctoupper_tab);
+
+	ok(rb_hashmap_add(map, "Nick[away]", "data1"), MSG);
+	ok(!rb_hashmap_add(map, "NICK{AWAY}", "data2"), MSG);
+	is_string("data1", rb_hashmap_retrieve(map, "nick{away}"), MSG);
+	is_string("data1", rb_hashmap_retrieve(map, "nICK[AWAY]"), MSG);
+	ok(rb_hashmap_retrieve(map, "nick") == NULL, MSG);
+
+	ok(rb_hashmap_add(map, "a\\b^", "data3"), MSG);
+	is_string("data3", rb_hashmap_retrieve(map, "A|B~"), MSG);
+	is_int(2, rb_hashmap_size(map), MSG);
+
+	is_string("data1", rb_hashmap_delete(map, "NICK{away]"), MSG);
+	is_string("data3", rb_hashmap_delete(map, "a|b~"), MSG);
+	is_int(0, rb_hashmap_size(map), MSG);
+
+	rb_hashmap_destroy(map, NULL, NULL);
+}
+
+static void
+count_cb(const void *key, void *data, void *privdata)
+{
+	(*(unsigned int *)privdata)++;
+}
+
+/* enough to grow it several times, then emptied again */
+static void
+integer1(void)
+{
+	rb_hashmap *map = rb_hashmap_create("integer1", RB_HASHMAP_INTEGER);
+	size_t empty = rb_hashmap_memory(map);
+	unsigned int i, bad = 0, destroyed = 0;
+
+	ok(rb_hashmap_add(map, RB_UINT_TO_POINTER(0), "zero"), MSG);
+	is_string("zero", rb_hashmap_retrieve(map, RB_UINT_TO_POINTER(0)), MSG);
+
+	for(i = 1; i <= 10000; i++)
+		if(!rb_hashmap_add(map, RB_UINT_TO_POINTER(i * 16), RB_UINT_TO_POINTER(i)))
+			bad++;
+	is_int(0, bad, MSG);
+	is_int(10001, rb_hashmap_size(map), MSG);
+	ok(rb_hashmap_memory(map) > empty, MSG);
+
+	for(i = 1; i <= 10000; i++)
+	{
+		if(rb_hashmap_retrieve(map, RB_UINT_TO_POINTER(i * 16)) != RB_UINT_TO_POINTER(i))
+			bad++;
+		if(rb_hashmap_retrieve(map, RB_UINT_TO_POINTER(i * 16 + 1)) != NULL)
+			bad++;
+	}
+	is_int(0, bad, MSG);
+
+	/* every other one, so the rest have to be moved back */
+	for(i = 1; i <= 10000; i += 2)
+		if(rb_hashmap_delete(map, RB_UINT_TO_POINTER(i * 16)) != RB_UINT_TO_POINTER(i))
+			bad++;
+	is_int(0, bad, MSG);
+	is_int(5001, rb_hashmap_size(map), MSG);
+
+	for(i = 1; i <= 10000; i++)
+		if(rb_hashmap_retrieve(map, RB_UINT_TO_POINTER(i * 16)) != (i % 2 ? NULL : RB_UINT_TO_POINTER(i)))
+			bad++;
+	is_int(0, bad, MSG);
+
+	rb_hashmap_destroy(map, count_cb, &destroyed);
+	is_int(5001, destroyed, MSG);
+}
+
+/* each entry is seen once, even when the one before it was deleted */
+static void
+iter1(void)
+{
+	rb_hashmap *map = rb_hashmap_create("iter1", RB_HASHMAP_INTEGER);
+	rb_hashmap_iter iter;
+	unsigned char seen[3001];
+	void *data;
+	unsigned int i, n, bad = 0;
+
+	for(n = 0; n < 3; n++)
+	{
+		for(i = 1; i <= 3000; i++)
+			rb_hashmap_add(map, RB_UINT_TO_POINTER(i), RB_UINT_TO_POINTER(i));
+
+		memset(seen, 0, sizeof(seen));
+		RB_HASHMAP_FOREACH(data, &iter, map)
+		{
+			i = RB_POINTER_TO_UINT(data);
+			if(seen[i]++)
+				bad++;
+
+			/* none, some, then all of them */
+			if(n == 2 || (n == 1 && i % 3 == 0))
+				rb_hashmap_delete(map, data);
+		}
+
+		for(i = 1; i <= 3000; i++)
+			if(seen[i] != 1)
+				bad++;
+		is_int(0, bad, MSG);
+	}
+
+	is_int(0, rb_hashmap_size(map), MSG);
+
+	n = 0;
+	RB_HASHMAP_FOREACH(data, &iter, map)
+		n++;
+	is_int(0, n, MSG);
+
+	rb_hashmap_destroy(map, NULL, NULL);
+}
+
+static void
+stats_cb(const char *line, void *privdata)
+{
+	rb_strlcpy(privdata, line, 256);
+}
+
+static void
+stats1(void)
+{
+	rb_hashmap *map = rb_hashmap_create("stats1", RB_HASHMAP_STRING);
+	char line[256];
+
+	rb_hashmap_stats(map, stats_cb, line);
+	ok(!strncmp(line, "stats1", 6), MSG);
+	ok(strstr(line, "HASH") != NULL, MSG);
+
+	rb_hashmap_add(map, "a", "a");
+	rb_hashmap_stats(map, stats_cb, line);
+	ok(strstr(line, "HASH            1          1          1          1") != NULL, MSG);
+
+	rb_hashmap_destroy(map, NULL, NULL);
+}
+
+/* looking up connection IDs and names, against the splay tree */
+static void
+bench1(void)
+{
+	rb_hashmap *map = rb_hashmap_create("bench1", RB_HASHMAP_INTEGER);
+	rb_hashmap *smap = rb_hashmap_create("bench1 names", RB_HASHMAP_STRING_NOCASE);
+	rb_dictionary *dict = rb_dictionary_create("bench1", rb_uint32cmp);
+	rb_dictionary *sdict = rb_dictionary_create("bench1 names", rb_strcasecmp);
+	static char names[20000][16];
+	volatile uintptr_t sink = 0;
+	uint64_t start, hash_ns, dict_ns, shash_ns, sdict_ns;
+	unsigned int i, key;
+
+	for(i = 0; i < 20000; i++)
+	{
+		snprintf(names[i], sizeof(names[i]), "nick%u", i * 7919);
+		rb_hashmap_add(map, RB_UINT_TO_POINTER(i * 7919), names[i]);
+		rb_dictionary_add(dict, RB_UINT_TO_POINTER(i * 7919), names[i]);
+		rb_hashmap_add(smap, names[i], names[i]);
+		rb_dictionary_add(sdict, names[i], names[i]);
+	}
+
+	/* in a scattered order, as lines from different clients arrive */
+	start = rb_monotonic_ns();
+	for(i = 0, key = 0; i < 1000000; i++, key = (key + 7717) % 20000)
+		sink += (uintptr_t)rb_hashmap_retrieve(map, RB_UINT_TO_POINTER(key * 7919));
+	hash_ns = rb_monotonic_ns() - start;
+
+	start = rb_monotonic_ns();
+	for(i = 0, key = 0; i < 1000000; i++, key = (key + 7717) % 20000)
+		sink += (uintptr_t)rb_dictionary_retrieve(dict, RB_UINT_TO_POINTER(key * 7919));
+	dict_ns = rb_monotonic_ns() - start;
+
+	start = rb_monotonic_ns();
+	for(i = 0, key = 0; i < 1000000; i++, key = (key + 7717) % 20000)
+		sink += (uintptr_t)rb_hashmap_retrieve(smap, names[key]);
+	shash_ns = rb_monotonic_ns() - start;
+
+	start = rb_monotonic_ns();
+	for(i = 0, key = 0; i < 1000000; i++, key = (key + 7717) % 20000)
+		sink += (uintptr_t)rb_dictionary_retrieve(sdict, names[key]);
+	sdict_ns = rb_monotonic_ns() - start;
+
+	diag("1000000 lookups in 20000 integers: %.1fms hashed, %.1fms splay tree",
+		hash_ns / 1e6, dict_ns / 1e6);
+	diag("1000000 lookups in 20000 strings: %.1fms hashed, %.1fms splay tree",
+		shash_ns / 1e6, sdict_ns / 1e6);
+	diag("hash map of 20000 takes %zu bytes", rb_hashmap_memory(map));
+
+	rb_hashmap_destroy(map, NULL, NULL);
+	rb_hashmap_destroy(smap, NULL, NULL);
+	rb_dictionary_destroy(dict, NULL, NULL);
+	rb_dictionary_destroy(sdict, NULL, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+
+	plan_lazy();
+
+	string1();
+	casemap1();
+	integer1();
+	iter1();
+	stats1();
+	bench1();
+
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ *  rb_histogram1.c: Test the latency histograms
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static void
+buckets1(void)
+{
+	struct rb_histogram hist;
+
+	memset(&hist, 0, sizeof(hist));
+
+	rb_histogram_add(&hist, 500);		/* under 1us */
+	rb_histogram_add(&hist, 1000);		/* 1us */
+	rb_histogram_add(&hist, 1999);
+	rb_histogram_add(&hist, 3000);		/* 2-3us */
+	rb_histogram_add(&hist, 1000000);	/* 1ms: 2^9 <= 1000 < 2^10 */
+	rb_histogram_add(&hist, UINT64_C(3600) * 1000000000);
+
+	is_int(1, hist.buckets[0], MSG);
+	is_int(2, hist.buckets[1], MSG);
+	is_int(1, hist.buckets[2], MSG);
+	is_int(1, hist.buckets[10], MSG);
+	is_int(1, hist.buckets[RB_HISTOGRAM_BUCKETS - 1], MSG);
+	is_int(6, hist.count, MSG);
+	ok(hist.max == UINT64_C(3600) * 1000000000, MSG);
+	ok(hist.sum == UINT64_C(3600) * 1000000000 + 1000000 + 3000 + 1999 + 1000 + 500, MSG);
+}
+
+static void
+quantile1(void)
+{
+	struct rb_histogram hist;
+	int i;
+
+	memset(&hist, 0, sizeof(hist));
+	is_int(0, rb_histogram_quantile(&hist, 0.5), MSG);
+
+	for(i = 0; i < 99; i++)
+		rb_histogram_add(&hist, 5000);
+	rb_histogram_add(&hist, 700000);
+
+	is_int(8, rb_histogram_quantile(&hist, 0.5), MSG);
+	is_int(8, rb_histogram_quantile(&hist, 0.99), MSG);
+	is_int(1024, rb_histogram_quantile(&hist, 1.0), MSG);
+
+	/* beyond the last bound, the longest is the answer */
+	rb_histogram_add(&hist, UINT64_C(100) * 1000000000);
+	is_int(100000000, rb_histogram_quantile(&hist, 1.0), MSG);
+}
+
+static void
+count1(void)
+{
+	struct rb_histogram hist;
+
+	memset(&hist, 0, sizeof(hist));
+
+	rb_histogram_add_count(&hist, 0);
+	rb_histogram_add_count(&hist, 1);
+	rb_histogram_add_count(&hist, 3);
+	rb_histogram_add_count(&hist, 100);	/* 2^6 <= 100 < 2^7 */
+
+	is_int(1, hist.buckets[0], MSG);
+	is_int(1, hist.buckets[1], MSG);
+	is_int(1, hist.buckets[2], MSG);
+	is_int(1, hist.buckets[7], MSG);
+	is_int(4, hist.count, MSG);
+	is_int(104, hist.sum, MSG);
+	is_int(100, hist.max, MSG);
+	is_int(4, rb_histogram_quantile(&hist, 0.75), MSG);
+}
+
+static void
+slow_event(void *arg)
+{
+	usleep(1000);
+}
+
+static void
+event_times_cb(const char *name, const struct rb_histogram *hist, void *ptr)
+{
+	if(!strcmp(name, "slow_event"))
+		*(const struct rb_histogram **)ptr = hist;
+}
+
+static void
+pipe_read(rb_fde_t *F, void *data)
+{
+	char buf[16];
+
+	(void)rb_read(F, buf, sizeof(buf));
+	*(int *)data += 1;
+}
+
+static void
+loop1(void)
+{
+	const struct rb_loop_stats *loop = rb_get_loop_stats();
+	const struct rb_histogram *times = NULL;
+	struct ev_entry *ev;
+	rb_fde_t *F1, *F2;
+	uint64_t events = loop->events.count;
+	int reads = 0;
+
+	ev = rb_event_addonce("slow_event", slow_event, NULL, 60);
+	rb_run_one_event(ev);
+	rb_dump_event_times(event_times_cb, &times);
+
+	if(ok(times != NULL, MSG))
+	{
+		is_int(1, times->count, MSG);
+		ok(times->sum >= 1000000, MSG);
+	}
+	is_int(events + 1, loop->events.count, MSG);
+
+	if(!ok(rb_pipe(&F1, &F2, "loop1") == 0, MSG))
+		return;
+
+	rb_setselect(F1, RB_SELECT_READ, pipe_read, &reads);
+	(void)rb_write(F2, "x", 1);
+	rb_select(1000);
+	is_int(1, reads, MSG);
+	ok(loop->ready.count >= 1, MSG);
+	ok(loop->ready.max >= 1, MSG);
+	ok(loop->read.count >= 1, MSG);
+
+	/* the time from that wakeup is charged when we wait again */
+	rb_select(0);
+	ok(loop->busy.count >= 1, MSG);
+
+	rb_close(F1);
+	rb_close(F2);
+}
+
+static void
+clock1(void)
+{
+	uint64_t a, b;
+
+	a = rb_monotonic_ns();
+	usleep(2000);
+	b = rb_monotonic_ns();
+	ok(b - a >= 2000000, MSG);
+	ok(b - a < 2000000000, MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+
+	plan_lazy();
+
+	buckets1();
+	quantile1();
+	count1();
+	loop1();
+	clock1();
+
+	return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ *  rb_linebuf1.c: Test splitting what is read into lines
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+/* the same, naming the scanner being tested */
+#define SMSG "%s:%d (%s) %s", __FILE__, __LINE__, __FUNCTION__
+
+static const char *scanners[] = { "avx2", "sse2", "scalar" };
+
+/* every scanner agrees with a plain loop, wherever the CR or LF is */
+static void
+scan1(void)
+{
+	char data[200];
+	size_t i, len, pos, bad = 0;
+	unsigned int s;
+
+	for(s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++)
+	{
+		if(!rb_set_scanner(scanners[s]))
+		{
+			diag("%s scanner not available", scanners[s]);
+			continue;
+		}
+
+		for(len = 0; len < 100; len++)
+		{
+			for(pos = 0; pos <= len; pos++)
+			{
+				for(i = 0; i < len + 1; i++)
+					data[i] = 'a' + i % 26;
+				/* bytes that only look like CR or LF in a signed compare */
+				data[len / 2] = (char)('\r' | 0x80);
+				if(pos < len)
+					data[pos] = pos % 2 ? '\r' : '\n';
+				/* just past the end, which must not be seen */
+				data[len] = '\n';
+
+				if(rb_linebuf_scan(data, len) != pos)
+					bad++;
+
+				/* and unaligned */
+				if(len > 0 && rb_linebuf_scan(data + 1, len - 1) !=
+						(pos > 0 && pos < len ? pos - 1 : len - 1))
+					bad++;
+			}
+		}
+
+		is_int(0, bad, SMSG, scanners[s]);
+		bad = 0;
+	}
+
+	ok(rb_set_scanner("scalar"), MSG);
+	is_string("scalar", rb_scanner(), MSG);
+	ok(!rb_set_scanner("mmx"), MSG);
+	is_string("scalar", rb_scanner(), MSG);
+}
+
+static void
+parse_lines(buf_head_t *buf, const char *data)
+{
+	char copy[BUFSIZE * 4];
+
+	rb_strlcpy(copy, data, sizeof(copy));
+	rb_linebuf_parse(buf, copy, strlen(copy), 0);
+}
+
+static void
+is_lines(buf_head_t *buf, const char **want, int count, const char *scanner)
+{
+	char line[LINEBUF_SIZE + 1];
+	int i;
+
+	is_int(count, rb_linebuf_numlines(buf), SMSG, scanner);
+	for(i = 0; i < count; i++)
+	{
+		rb_linebuf_get(buf, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_PARSED);
+		is_string(want[i], line, SMSG, scanner);
+	}
+	is_int(0, rb_linebuf_len(buf), SMSG, scanner);
+}
+
+static void
+parse1(void)
+{
+	static const char *lines[] = { "PING :a", "PRIVMSG #a :hello", "PONG", "NICK b" };
+	buf_head_t buf;
+	char line[LINEBUF_SIZE + 1];
+	char big[LINEBUF_SIZE + 100];
+	unsigned int s;
+
+	for(s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++)
+	{
+		if(!rb_set_scanner(scanners[s]))
+			continue;
+
+		rb_linebuf_newbuf(&buf);
+
+		/* a whole read of lines, with every sort of line ending */
+		parse_lines(&buf, "PING :a\r\nPRIVMSG #a :hello\nPONG\r\r\n\nNICK b\r\n");
+		is_lines(&buf, lines, 4, scanners[s]);
+
+		/* lines split across reads */
+		parse_lines(&buf, "PING");
+		is_int(0, rb_linebuf_get(&buf, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_PARSED),
+				SMSG, scanners[s]);
+		parse_lines(&buf, " :a\r");
+		parse_lines(&buf, "\nPRIVMSG #a :hello\r\nPONG\r\nNICK");
+		parse_lines(&buf, " b\n");
+		is_lines(&buf, lines, 4, scanners[s]);
+
+		/* one too long is cut short, and the rest of it dropped */
+		memset(big, 'x', sizeof(big));
+		memcpy(big + sizeof(big) - 8, "\r\nPONG\r\n", 8);
+		rb_linebuf_parse(&buf, big, sizeof(big), 0);
+		is_int(2, rb_linebuf_numlines(&buf), SMSG, scanners[s]);
+		is_int(LINEBUF_SIZE, rb_linebuf_get(&buf, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_PARSED),
+				SMSG, scanners[s]);
+		rb_linebuf_get(&buf, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_PARSED);
+		is_string("PONG", line, SMSG, scanners[s]);
+
+		rb_linebuf_donebuf(&buf);
+	}
+}
+
+static void
+put_block1(void)
+{
+	static char data[LINEBUF_BLOCK_SIZE * 2 + 100], line[LINEBUF_BLOCK_SIZE + 1];
+	buf_head_t buf, sendq;
+	size_t count, used, count_before, used_before;
+	rb_strf_t strings = { .format = "PING :after", .format_args = NULL, .next = NULL };
+
+	memset(data, 'x', sizeof(data));
+	rb_count_rb_linebuf_memory(&count_before, &used_before);
+
+	/* cut into chunks of at most LINEBUF_BLOCK_SIZE */
+	rb_linebuf_newbuf(&buf);
+	rb_linebuf_put_block(&buf, data, sizeof(data));
+	is_int(3, rb_linebuf_numlines(&buf), MSG);
+	is_int(sizeof(data), rb_linebuf_len(&buf), MSG);
+
+	rb_count_rb_linebuf_memory(&count, &used);
+	is_int(count_before + 3, count, MSG);
+	ok(used >= used_before + sizeof(data), MSG);
+
+	/* chunks can be shared with a sendq, and mix with ordinary lines */
+	rb_linebuf_newbuf(&sendq);
+	rb_linebuf_attach(&sendq, &buf);
+	rb_linebuf_donebuf(&buf);
+	rb_linebuf_put(&sendq, &strings);
+	is_int(4, rb_linebuf_numlines(&sendq), MSG);
+
+	is_int(LINEBUF_BLOCK_SIZE, rb_linebuf_get(&sendq, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_RAW), MSG);
+	is_int(LINEBUF_BLOCK_SIZE, rb_linebuf_get(&sendq, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_RAW), MSG);
+	is_int(100, rb_linebuf_get(&sendq, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_RAW), MSG);
+	memset(line, 0, sizeof(line));
+	rb_linebuf_get(&sendq, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_RAW);
+	is_string("PING :after\r\n", line, MSG);
+
+	rb_count_rb_linebuf_memory(&count, &used);
+	is_int(count_before, count, MSG);
+	is_int(used_before, used, MSG);
+
+	rb_linebuf_donebuf(&sendq);
+}
+
+/* how long parsing a burst takes with each scanner */
+static void
+bench1(void)
+{
+	static const char *sample[] = {
+		":00AAAAAAB UID nick%d 1 1500000000 +i ~user host.example.com 192.0.2.1 00AAAA%03d * :A real name",
+		":00A SJOIN 1500000000 #channel%d +nt :@00AAAA%03d 00AAAAAAB 00AAAAAAC 00AAAAAAD",
+		":00AAAAAAB PRIVMSG #channel%d :hello there, this is message %d",
+	};
+	const size_t size = 4 * 1024 * 1024;
+	char *burst = rb_malloc(size), *copy = rb_malloc(size);
+	size_t len = 0, off;
+	uint64_t start, took, ns[3];
+	buf_head_t buf;
+	unsigned int s, i;
+	int run;
+
+	for(i = 0; len + 200 < size; i++)
+	{
+		len += snprintf(burst + len, size - len, sample[i % 3], i, i % 1000);
+		len += snprintf(burst + len, size - len, "\r\n");
+	}
+
+	for(s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++)
+	{
+		ns[s] = 0;
+		if(!rb_set_scanner(scanners[s]))
+			continue;
+
+		for(run = 0; run < 3; run++)
+		{
+			memcpy(copy, burst, len);
+			rb_linebuf_newbuf(&buf);
+
+			/* in reads the size of the ircd's */
+			start = rb_monotonic_ns();
+			for(off = 0; off < len; off += 16384)
+				rb_linebuf_parse(&buf, copy + off, len - off < 16384 ? len - off : 16384, 0);
+			took = rb_monotonic_ns() - start;
+			if(run == 0 || took < ns[s])
+				ns[s] = took;
+
+			is_int(i, rb_linebuf_numlines(&buf), SMSG, scanners[s]);
+			rb_linebuf_donebuf(&buf);
+		}
+
+		diag("%s: %zu lines, %zu bytes in %.2fms, %.0fMB/s", scanners[s], (size_t)i, len,
+			ns[s] / 1e6, len / (ns[s] / 1e3));
+	}
+
+	rb_free(burst);
+	rb_free(copy);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *best;
+
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	best = rb_scanner();
+	diag("scanner chosen: %s", best);
+
+	scan1();
+	parse1();
+	put_block1();
+	bench1();
+
+	ok(rb_set_scanner(best), MSG);
+
+	return 0;
+}
@@ -0,0 +1,339 @@
+/*
+ *  rb_radixtree1.c: Test rb_radixtree
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "match.h"
+#include "rb_dictionary.h"
+#include "rb_radixtree.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static void
+basic1(void)
+{
+	rb_radixtree *tree = rb_radixtree_create("basic1", NULL);
+
+	ok(rb_radixtree_retrieve(tree, "test") == NULL, MSG);
+	ok(rb_radixtree_add(tree, "test", "data1"), MSG);
+	ok(!rb_radixtree_add(tree, "test", "data2"), MSG);
+	ok(rb_radixtree_add(tree, "TEST", "data3"), MSG);
+	ok(rb_radixtree_add(tree, "tes", "data4"), MSG);
+	ok(rb_radixtree_add(tree, "testing", "data5"), MSG);
+	ok(rb_radixtree_add(tree, "", "data6"), MSG);
+	is_int(5, rb_radixtree_size(tree), MSG);
+
+	is_string("data1", rb_radixtree_retrieve(tree, "test"), MSG);
+	is_string("data3", rb_radixtree_retrieve(tree, "TEST"), MSG);
+	is_string("data4", rb_radixtree_retrieve(tree, "tes"), MSG);
+	is_string("data5", rb_radixtree_retrieve(tree, "testing"), MSG);
+	is_string("data6", rb_radixtree_retrieve(tree, ""), MSG);
+	ok(rb_radixtree_retrieve(tree, "Test") == NULL, MSG);
+	ok(rb_radixtree_retrieve(tree, "te") == NULL, MSG);
+	ok(rb_radixtree_retrieve(tree, "testi") == NULL, MSG);
+	ok(rb_radixtree_retrieve(tree, "testings") == NULL, MSG);
+
+	is_string("data1", rb_radixtree_delete(tree, "test"), MSG);
+	ok(rb_radixtree_delete(tree, "test") == NULL, MSG);
+	is_string("data4", rb_radixtree_retrieve(tree, "tes"), MSG);
+	is_string("data5", rb_radixtree_retrieve(tree, "testing"), MSG);
+	is_int(4, rb_radixtree_size(tree), MSG);
+
+	rb_radixtree_destroy(tree, NULL, NULL);
+}
+
+/* a case map and a canonizing function give the same tree */
+static void
+casemap1(void)
+{
+	rb_radixtree *mapped = rb_radixtree_create_casemap("casemap1", irctoupper_tab);
+	rb_radixtree *canon = rb_radixtree_create("casemap1 canon", irccasecanon);
+	rb_radixtree *trees[] = { mapped, canon };
+	rb_radixtree_leaf *leaf;
+	unsigned int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		ok(rb_radixtree_add(trees[i], "Nick[away]", "data1"), MSG);
+		ok(!rb_radixtree_add(trees[i], "NICK{AWAY}", "data2"), MSG);
+		is_string("data1", rb_radixtree_retrieve(trees[i], "nick{away}"), MSG);
+		is_string("data1", rb_radixtree_retrieve(trees[i], "nICK[AWAY]"), MSG);
+		ok(rb_radixtree_retrieve(trees[i], "nick") == NULL, MSG);
+
+		leaf = rb_radixtree_elem_find(trees[i], "nick{AWAY}", 0);
+		ok(leaf != NULL, MSG);
+		is_string("NICK[AWAY]", rb_radixtree_elem_get_key(leaf), MSG);
+		is_string("data1", rb_radixtree_elem_get_data(leaf), MSG);
+		rb_radixtree_elem_set_data(leaf, "data3");
+		is_string("data3", rb_radixtree_retrieve(trees[i], "NICK[AWAY]"), MSG);
+
+		rb_radixtree_elem_delete(trees[i], leaf);
+		ok(rb_radixtree_retrieve(trees[i], "NICK[AWAY]") == NULL, MSG);
+		is_int(0, rb_radixtree_size(trees[i]), MSG);
+	}
+
+	rb_radixtree_destroy(mapped, NULL, NULL);
+	rb_radixtree_destroy(canon, NULL, NULL);
+}
+
+static int
+cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+static void
+count_cb(const char *key, void *data, void *privdata)
+{
+	(*(unsigned int *)privdata)++;
+}
+
+/*
+ * Enough keys, sharing long prefixes, to make nodes of every size, then
+ * all of them taken out again in a scattered order.
+ */
+static void
+many1(void)
+{
+	rb_radixtree *tree = rb_radixtree_create("many1", NULL);
+	rb_radixtree_iteration_state iter;
+	static char keys[20000][40];
+	static const char *sorted[20000];
+	const char *prev = NULL;
+	void *data;
+	unsigned int i, n, bad = 0, destroyed = 0;
+
+	for (i = 0; i < 20000; i++)
+	{
+		if (i % 4 == 0)
+			snprintf(keys[i], sizeof(keys[i]), "#channel-with-a-long-name-%u", i * 7919);
+		else if (i % 4 == 1)
+			snprintf(keys[i], sizeof(keys[i]), "%c%u", 1 + i % 255, i);
+		else
+			snprintf(keys[i], sizeof(keys[i]), "user%u", i * 31);
+		sorted[i] = keys[i];
+		if (!rb_radixtree_add(tree, keys[i], keys[i]))
+			bad++;
+	}
+	is_int(0, bad, MSG);
+	is_int(20000, rb_radixtree_size(tree), MSG);
+	qsort(sorted, 20000, sizeof(sorted[0]), cmp_str);
+
+	for (i = 0; i < 20000; i++)
+	{
+		char miss[48];
+
+		if (rb_radixtree_retrieve(tree, keys[i]) != keys[i])
+			bad++;
+		snprintf(miss, sizeof(miss), "%sx", keys[i]);
+		if (rb_radixtree_retrieve(tree, miss) != NULL)
+			bad++;
+	}
+	is_int(0, bad, MSG);
+
+	/* in strcmp() order */
+	n = 0;
+	RB_RADIXTREE_FOREACH(data, &iter, tree)
+	{
+		if (n >= 20000 || data != sorted[n])
+			bad++;
+		if (prev != NULL && strcmp(prev, data) >= 0)
+			bad++;
+		prev = data;
+		n++;
+	}
+	is_int(20000, n, MSG);
+	is_int(0, bad, MSG);
+
+	/* every third one, from the middle of a walk */
+	n = 0;
+	RB_RADIXTREE_FOREACH(data, &iter, tree)
+	{
+		if (data != sorted[n])
+			bad++;
+		if (n % 3 == 0 && rb_radixtree_delete(tree, data) != data)
+			bad++;
+		n++;
+	}
+	is_int(20000, n, MSG);
+	is_int(0, bad, MSG);
+	is_int(20000 - 6667, rb_radixtree_size(tree), MSG);
+
+	for (i = 0; i < 20000; i++)
+		if (rb_radixtree_retrieve(tree, sorted[i]) != (i % 3 == 0 ? NULL : sorted[i]))
+			bad++;
+	is_int(0, bad, MSG);
+
+	for (i = 0; i < 20000; i += 2)
+		rb_radixtree_delete(tree, keys[i]);
+	for (i = 0; i < 20000; i++)
+		if (rb_radixtree_retrieve(tree, sorted[i]) != NULL)
+			destroyed++;
+	is_int(destroyed, rb_radixtree_size(tree), MSG);
+
+	destroyed = 0;
+	rb_radixtree_destroy(tree, count_cb, &destroyed);
+	ok(destroyed > 0, MSG);
+}
+
+/* starting part way, as LIST does for a channel name */
+static void
+from1(void)
+{
+	rb_radixtree *tree = rb_radixtree_create_casemap("from1", irctoupper_tab);
+	rb_radixtree_iteration_state iter;
+	rb_radixtree_leaf *leaf;
+	const char *names[] = { "#a", "#ab", "#abc", "#b", "#ba", "#c" };
+	char seen[64];
+	void *data;
+	unsigned int i;
+
+	for (i = 0; i < 6; i++)
+		rb_radixtree_add(tree, names[i], (void *)names[i]);
+
+	seen[0] = '\0';
+	RB_RADIXTREE_FOREACH_FROM(data, &iter, tree, "#AB")
+		rb_strlcat(seen, data, sizeof(seen));
+	is_string("#ab#abc#b#ba#c", seen, MSG);
+
+	seen[0] = '\0';
+	RB_RADIXTREE_FOREACH_FROM(data, &iter, tree, "#abd")
+		rb_strlcat(seen, data, sizeof(seen));
+	is_string("#b#ba#c", seen, MSG);
+
+	seen[0] = '\0';
+	RB_RADIXTREE_FOREACH_FROM(data, &iter, tree, "#d")
+		rb_strlcat(seen, data, sizeof(seen));
+	is_string("", seen, MSG);
+
+	seen[0] = '\0';
+	RB_RADIXTREE_FOREACH_FROM(data, &iter, tree, "")
+		rb_strlcat(seen, data, sizeof(seen));
+	is_string("#a#ab#abc#b#ba#c", seen, MSG);
+
+	leaf = rb_radixtree_elem_find(tree, "#B", 1);
+	ok(leaf != NULL, MSG);
+	is_string("#B", rb_radixtree_elem_get_key(leaf), MSG);
+	leaf = rb_radixtree_elem_find(tree, "#bb", 1);
+	ok(leaf != NULL, MSG);
+	is_string("#C", rb_radixtree_elem_get_key(leaf), MSG);
+	ok(rb_radixtree_elem_find(tree, "#bb", 0) == NULL, MSG);
+
+	rb_radixtree_destroy(tree, NULL, NULL);
+}
+
+static void
+stats_cb(const char *line, void *privdata)
+{
+	rb_strlcpy(privdata, line, 256);
+}
+
+static void
+stats1(void)
+{
+	rb_radixtree *tree = rb_radixtree_create("stats1", NULL);
+	char line[256];
+
+	rb_radixtree_stats(tree, stats_cb, line);
+	ok(!strncmp(line, "stats1", 6), MSG);
+	ok(strstr(line, "RADIX           0          0          0          0") != NULL, MSG);
+
+	rb_radixtree_add(tree, "a", "a");
+	rb_radixtree_stats(tree, stats_cb, line);
+	ok(strstr(line, "RADIX           1          0          0          0") != NULL, MSG);
+
+	rb_radixtree_add(tree, "b", "b");
+	rb_radixtree_stats(tree, stats_cb, line);
+	ok(strstr(line, "RADIX           2          2          1          1") != NULL, MSG);
+
+	rb_radixtree_destroy(tree, NULL, NULL);
+}
+
+/* looking up nicknames, against copying to canonize and the splay tree */
+static void
+bench1(void)
+{
+	rb_radixtree *mapped = rb_radixtree_create_casemap("bench1", irctoupper_tab);
+	rb_radixtree *canon = rb_radixtree_create("bench1 canon", irccasecanon);
+	rb_dictionary *dict = rb_dictionary_create("bench1", rb_strcasecmp);
+	static char names[20000][16];
+	volatile uintptr_t sink = 0;
+	uint64_t start, took, best[3] = { UINT64_MAX, UINT64_MAX, UINT64_MAX };
+	unsigned int i, key, round;
+
+	for (i = 0; i < 20000; i++)
+	{
+		snprintf(names[i], sizeof(names[i]), "Nick%u", i * 7919);
+		rb_radixtree_add(mapped, names[i], names[i]);
+		rb_radixtree_add(canon, names[i], names[i]);
+		rb_dictionary_add(dict, names[i], names[i]);
+	}
+
+	/* the first round warms up */
+	for (round = 0; round < 3; round++)
+	{
+		start = rb_monotonic_ns();
+		for (i = 0, key = 0; i < 1000000; i++, key = (key + 7717) % 20000)
+			sink += (uintptr_t)rb_radixtree_retrieve(mapped, names[key]);
+		took = rb_monotonic_ns() - start;
+		if (took < best[0])
+			best[0] = took;
+
+		start = rb_monotonic_ns();
+		for (i = 0, key = 0; i < 1000000; i++, key = (key + 7717) % 20000)
+			sink += (uintptr_t)rb_radixtree_retrieve(canon, names[key]);
+		took = rb_monotonic_ns() - start;
+		if (took < best[1])
+			best[1] = took;
+
+		start = rb_monotonic_ns();
+		for (i = 0, key = 0; i < 1000000; i++, key = (key + 7717) % 20000)
+			sink += (uintptr_t)rb_dictionary_retrieve(dict, names[key]);
+		took = rb_monotonic_ns() - start;
+		if (took < best[2])
+			best[2] = took;
+	}
+
+	diag("1000000 lookups in 20000 nicknames: %.1fms case mapped, %.1fms canonized copy, %.1fms splay tree",
+		best[0] / 1e6, best[1] / 1e6, best[2] / 1e6);
+
+	rb_radixtree_destroy(mapped, NULL, NULL);
+	rb_radixtree_destroy(canon, NULL, NULL);
+	rb_dictionary_destroy(dict, NULL, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+
+	plan_lazy();
+
+	basic1();
+	casemap1();
+	many1();
+	from1();
+	stats1();
+	bench1();
+
+	return 0;
+}
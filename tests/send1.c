@@ -5022,6 +5022,204 @@ static void kill_client_serv_butone1__tags(void)
 	standard_free();
 }
 
+static void deferred_flush1(void)
+{
+	struct Client *client = make_local_person();
+	rb_fde_t *F1, *F2;
+	char buf[32768];
+	int i, len;
+
+	if (!ok(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "deferred_flush1") == 0, MSG))
+		return;
+	client->localClient->F = F1;
+
+	/* nothing is written until the loop iteration ends, then all at once */
+	for (i = 0; i < 30; i++)
+		sendto_one(client, "Hello %d", i);
+	ok(IsFlushDeferred(client), MSG);
+	is_int(-1, rb_read(F2, buf, sizeof(buf)), MSG);
+
+	rb_select(0);
+	ok(!IsFlushDeferred(client), MSG);
+	is_int(0, rb_linebuf_len(&client->localClient->buf_sendq), MSG);
+	len = rb_read(F2, buf, sizeof(buf) - 1);
+	is_int(30 * strlen("Hello 10" CRLF) - 10, len, MSG);
+	buf[len > 0 ? len : 0] = '\0';
+	is_string("Hello 29" CRLF, strstr(buf, "Hello 29"), MSG);
+
+	/* a big enough sendq is written straight away */
+	for (i = 0; i < 16 * 1024 / 64 + 1; i++)
+		sendto_one(client, "%062d", i);
+	ok(rb_read(F2, buf, sizeof(buf)) >= 16 * 1024, MSG);
+	rb_select(0);
+	is_int(64, rb_read(F2, buf, sizeof(buf)), MSG);
+
+	/* without deferred_flush, each message is written as it is sent */
+	ConfigFileEntry.deferred_flush = 0;
+	sendto_one(client, "Hello");
+	ok(!IsFlushDeferred(client), MSG);
+	is_int(strlen("Hello" CRLF), rb_read(F2, buf, sizeof(buf)), MSG);
+	ConfigFileEntry.deferred_flush = 1;
+
+	/* exiting writes out what is deferred without waiting for the loop */
+	sendto_one(client, "Terminating");
+	ok(IsFlushDeferred(client), MSG);
+	send_flush_all();
+	ok(!IsFlushDeferred(client), MSG);
+	is_int(strlen("Terminating" CRLF), rb_read(F2, buf, sizeof(buf)), MSG);
+
+	sendto_one(client, "Goodbye");
+	remove_local_person(client);
+	rb_close(F2);
+}
+
+/*
+ * Sending to a big channel with its members' struct Client mostly out of
+ * cache: each member visited should only cost the line with the fields
+ * sendto_channel_flags() looks at.
+ */
+static void channel_fanout_bench1(void)
+{
+	static struct Client *members[20000];
+	struct Client *bench_server = make_remote_server(&me);
+	struct Client *source = make_local_person_nick("BenchSource");
+	struct Channel *bench_channel = allocate_channel("#bench");
+	static char evict[32 * 1024 * 1024];
+	volatile char sink = 0;
+	uint64_t start, cold = UINT64_MAX, warm = UINT64_MAX, took;
+	char nick[NICKLEN];
+	unsigned int i, misaligned = 0;
+	int round;
+
+	ok(offsetof(struct Client, servptr) + sizeof(struct Client *) <= RB_CACHE_LINE_SIZE, MSG);
+
+	for (i = 0; i < 20000; i++)
+	{
+		snprintf(nick, sizeof(nick), "Bench%u", i);
+		members[i] = make_remote_person_nick(bench_server, nick);
+		if (i % 4 == 0)
+			members[i]->umodes |= UMODE_DEAF;
+		if ((uintptr_t)members[i] % RB_CACHE_LINE_SIZE != 0)
+			misaligned++;
+		add_user_to_channel(bench_channel, members[i], CHFL_PEON);
+	}
+#ifndef NOBALLOC
+	is_int(0, misaligned, MSG);
+#endif
+
+	for (round = 0; round < 5; round++)
+	{
+		/* push the members out of cache */
+		for (i = 0; i < sizeof(evict); i += 64)
+			evict[i] = sink++;
+
+		start = rb_monotonic_ns();
+		sendto_channel_flags(source, ALL_MEMBERS, source, bench_channel, "PRIVMSG #bench :cold %d", round);
+		took = rb_monotonic_ns() - start;
+		if (took < cold)
+			cold = took;
+
+		start = rb_monotonic_ns();
+		sendto_channel_flags(source, ALL_MEMBERS, source, bench_channel, "PRIVMSG #bench :warm %d", round);
+		took = rb_monotonic_ns() - start;
+		if (took < warm)
+			warm = took;
+	}
+
+	is_string(":BenchSource PRIVMSG #bench :cold 0" CRLF, get_client_sendq(bench_server), MSG);
+	rb_linebuf_donebuf(&bench_server->localClient->buf_sendq);
+
+	diag("sending to 20000 remote members: %.1fns a member out of cache, %.1fns in cache",
+		cold / 20000.0, warm / 20000.0);
+
+	for (i = 0; i < 20000; i++)
+		remove_remote_person(members[i]);
+	remove_local_person(source);
+	remove_remote_server(bench_server);
+}
+
+static size_t drain_sendq(struct Client *client, char *out, size_t size)
+{
+	static char line[LINEBUF_BLOCK_SIZE + 1];
+	size_t len = 0;
+	int ret;
+
+	while ((ret = rb_linebuf_get(&client->localClient->buf_sendq, line, sizeof(line), 0, 1)) > 0)
+	{
+		if (len + ret > size)
+			break;
+		memcpy(out + len, line, ret);
+		len += ret;
+	}
+
+	return len;
+}
+
+static void send_burst_lines(struct Client *server, const char *longline)
+{
+	int i;
+
+	for (i = 0; i < 20000; i++)
+	{
+		sendto_one(server, ":%s UID Burst%d 1 %d +i burst burst.test 127.0.0.1 %sA%05d :burst user",
+			me.id, i, 1000000 + i, me.id, i);
+
+		/* sent by other means, so the burst buffer is flushed first */
+		if (i == 10000)
+			sendto_server(NULL, NULL, NOCAPS, NOCAPS, ":%s PING :middle", me.id);
+	}
+
+	sendto_one(server, ":%s ENCAP * LONG :%s", me.id, longline);
+	sendto_one(server, "PING :%s", me.id);
+}
+
+static void send_burst1(void)
+{
+	static char expect[4 * 1024 * 1024], got[4 * 1024 * 1024];
+	struct Client *server = make_remote_server(&me);
+	char longline[DATALEN * 2];
+	char middle[BUFSIZE];
+	size_t expect_len, got_len, bytes;
+	unsigned long lines;
+	uint64_t start, plain_ns, burst_ns;
+
+	memset(longline, 'x', sizeof(longline) - 1);
+	longline[sizeof(longline) - 1] = '\0';
+
+	start = rb_monotonic_ns();
+	send_burst_lines(server, longline);
+	plain_ns = rb_monotonic_ns() - start;
+	expect_len = drain_sendq(server, expect, sizeof(expect));
+
+	start = rb_monotonic_ns();
+	send_burst_start(server);
+	send_burst_lines(server, longline);
+	bytes = send_burst_finish(&lines);
+	burst_ns = rb_monotonic_ns() - start;
+
+	/* 1.5MB goes on the sendq in a few dozen chunks */
+	ok(rb_linebuf_numlines(&server->localClient->buf_sendq) < 50, MSG);
+
+	got_len = drain_sendq(server, got, sizeof(got));
+	is_int(expect_len, got_len, MSG);
+	ok(memcmp(expect, got, expect_len) == 0, MSG);
+
+	/* the line sent with sendto_server() isn't counted as part of it */
+	snprintf(middle, sizeof(middle), ":%s PING :middle" CRLF, me.id);
+	is_int(20002, lines, MSG);
+	is_int(expect_len - strlen(middle), bytes, MSG);
+
+	/* a later sendto_one() is queued as usual */
+	sendto_one(server, "PING :%s", me.id);
+	is_int(1, rb_linebuf_numlines(&server->localClient->buf_sendq), MSG);
+	rb_linebuf_donebuf(&server->localClient->buf_sendq);
+
+	diag("queueing a 20002 line burst: %.1fms a line at a time, %.1fms through the burst buffer",
+		plain_ns / 1000000.0, burst_ns / 1000000.0);
+
+	remove_remote_server(server);
+}
+
 int main(int argc, char *argv[])
 {
 	plan_lazy();
@@ -5112,6 +5310,10 @@ int main(int argc, char *argv[])
 	kill_client_serv_butone1();
 	kill_client_serv_butone1__tags();
 
+	deferred_flush1();
+	channel_fanout_bench1();
+	send_burst1();
+
 	client_util_free();
 	ircd_util_free();
 	return 0;
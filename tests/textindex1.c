@@ -0,0 +1,113 @@
+/*
+ *  textindex1.c: Test the inverted word index
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "textindex.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static void
+test_words(void)
+{
+	struct text_index *idx = text_index_create();
+	uint64_t ids[10];
+
+	text_index_add(idx, 10, "Hello world");
+	text_index_add(idx, 20, "hello, hello there");
+	text_index_add(idx, 30, "The WORLD[] says hi");
+	/* out of order lines are ignored */
+	text_index_add(idx, 25, "hello world");
+
+	is_int(3, text_index_lines(idx), MSG);
+	ok(text_index_last_id(idx) == 30, MSG);
+
+	/* case folded, including the IRC brackets, newest first */
+	is_int(2, text_index_search(idx, "HELLO", 0, UINT64_MAX, ids, 10), MSG);
+	ok(ids[0] == 20 && ids[1] == 10, MSG);
+	is_int(2, text_index_search(idx, "world{}", 0, UINT64_MAX, ids, 10), MSG);
+	ok(ids[0] == 30 && ids[1] == 10, MSG);
+
+	/* every word has to be there */
+	is_int(1, text_index_search(idx, "world hello", 0, UINT64_MAX, ids, 10), MSG);
+	ok(ids[0] == 10, MSG);
+	is_int(0, text_index_search(idx, "hello missing", 0, UINT64_MAX, ids, 10), MSG);
+	is_int(0, text_index_search(idx, "  ,. ", 0, UINT64_MAX, ids, 10), MSG);
+
+	/* ranges are inclusive */
+	is_int(1, text_index_search(idx, "hello", 11, 20, ids, 10), MSG);
+	ok(ids[0] == 20, MSG);
+	is_int(0, text_index_search(idx, "hello", 21, 30, ids, 10), MSG);
+
+	text_index_destroy(idx);
+}
+
+static void
+test_many(void)
+{
+	struct text_index *idx = text_index_create();
+	uint64_t ids[50];
+	char text[64];
+	unsigned int i, n;
+
+	/* long posting lists, big gaps between ids, and many words */
+	for(i = 1; i <= 5000; i++)
+	{
+		snprintf(text, sizeof text, "common w%u %s %s", i, i % 3 ? "" : "three",
+				i % 7 ? "" : "seven");
+		text_index_add(idx, (uint64_t)i * 1000, text);
+	}
+
+	/* the newest of many, in a ring */
+	is_int(50, text_index_search(idx, "common", 0, UINT64_MAX, ids, 50), MSG);
+	for(i = 0; i < 50; i++)
+		ok(ids[i] == (uint64_t)(5000 - i) * 1000, MSG);
+
+	is_int(7, text_index_search(idx, "common", 0, UINT64_MAX, ids, 7), MSG);
+	ok(ids[0] == 5000000 && ids[6] == 4994000, MSG);
+
+	/* the skips find where a range starts */
+	is_int(3, text_index_search(idx, "three seven", 0, 2100 * 1000, ids, 3), MSG);
+	ok(ids[0] == 2100000 && ids[1] == 2079000 && ids[2] == 2058000, MSG);
+
+	n = text_index_search(idx, "seven three common", 4000 * 1000, 4100 * 1000, ids, 50);
+	is_int(5, n, MSG);
+	for(i = 0; i < n; i++)
+		ok(ids[i] % 21000 == 0 && ids[i] >= 4000000 && ids[i] <= 4100000, MSG);
+
+	is_int(1, text_index_search(idx, "w4321", 0, UINT64_MAX, ids, 50), MSG);
+	ok(ids[0] == 4321000, MSG);
+	is_int(0, text_index_search(idx, "w4321 seven", 0, UINT64_MAX, ids, 50), MSG);
+
+	text_index_destroy(idx);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	test_words();
+	test_many();
+
+	return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ *  webhook1.c: Test the webhook extension's event batches
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "hook.h"
+#include "modules.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+/* a nick may hold both, and the text anything */
+#define TEST_WEBHOOK_NICK "a\\b\"c"
+#define TEST_WEBHOOK_TEXT "say \"hi\" \\o/"
+
+static int listener;
+
+static bool
+readable(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) > 0;
+}
+
+/* run the event loop, and the batch window's timer, until fd can be read */
+static bool
+wait_fd(int fd)
+{
+	for(int i = 0; i < 500; i++)
+	{
+		if(readable(fd))
+			return true;
+		rb_select(10);
+		rb_event_run();
+	}
+	return false;
+}
+
+/* the body of the next request on fd */
+static const char *
+request_body(int fd, char *buf, size_t size)
+{
+	size_t len = 0;
+	ssize_t n;
+	const char *p, *cl;
+
+	buf[0] = '\0';
+	while(wait_fd(fd))
+	{
+		if((n = read(fd, buf + len, size - len - 1)) <= 0)
+			break;
+		len += n;
+		buf[len] = '\0';
+
+		if((p = strstr(buf, "\r\n\r\n")) != NULL && (cl = strstr(buf, "Content-Length: ")) != NULL &&
+				strlen(p + 4) >= (size_t)atoi(cl + 16))
+			return p + 4;
+	}
+	return "";
+}
+
+static void
+reply(int fd)
+{
+	static const char text[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+
+	ok(write(fd, text, strlen(text)) == (ssize_t)strlen(text), MSG);
+}
+
+/* just enough of a JSON parser to say whether a body is well formed */
+static const char *json_value(const char *p);
+
+static const char *
+json_space(const char *p)
+{
+	while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		p++;
+	return p;
+}
+
+static const char *
+json_string(const char *p)
+{
+	if(*p++ != '"')
+		return NULL;
+
+	for(; *p != '"'; p++)
+	{
+		if((unsigned char)*p < 0x20)
+			return NULL;
+		if(*p != '\\')
+			continue;
+
+		p++;
+		if(*p == 'u')
+		{
+			for(int i = 1; i <= 4; i++)
+				if(!isxdigit((unsigned char)p[i]))
+					return NULL;
+			p += 4;
+		}
+		else if(strchr("\"\\/bfnrt", *p) == NULL || *p == '\0')
+			return NULL;
+	}
+	return p + 1;
+}
+
+static const char *
+json_list(const char *p, char close, bool object)
+{
+	p = json_space(p + 1);
+	if(*p == close)
+		return p + 1;
+
+	for(;;)
+	{
+		if(object)
+		{
+			if((p = json_string(p)) == NULL)
+				return NULL;
+			p = json_space(p);
+			if(*p++ != ':')
+				return NULL;
+		}
+		if((p = json_value(p)) == NULL)
+			return NULL;
+		if(*p == close)
+			return p + 1;
+		if(*p++ != ',')
+			return NULL;
+	}
+}
+
+static const char *
+json_value(const char *p)
+{
+	p = json_space(p);
+
+	if(*p == '{')
+		p = json_list(p, '}', true);
+	else if(*p == '[')
+		p = json_list(p, ']', false);
+	else if(*p == '"')
+		p = json_string(p);
+	else if(isdigit((unsigned char)*p) || *p == '-')
+		for(p++; isdigit((unsigned char)*p); p++)
+			;
+	else if(!strncmp(p, "true", 4) || !strncmp(p, "null", 4))
+		p += 4;
+	else if(!strncmp(p, "false", 5))
+		p += 5;
+	else
+		return NULL;
+
+	return p != NULL ? json_space(p) : NULL;
+}
+
+static bool
+json_valid(const char *text)
+{
+	const char *end = json_value(text);
+
+	return end != NULL && *end == '\0';
+}
+
+static int
+count(const char *haystack, const char *needle)
+{
+	int n = 0;
+
+	for(; (haystack = strstr(haystack, needle)) != NULL; haystack++)
+		n++;
+	return n;
+}
+
+static void
+json_valid1(void)
+{
+	ok(json_valid("{\"a\":[1,\"b\\\\\\\"\",{}],\"c\":null}"), MSG);
+	ok(!json_valid("{\"nick\":\"a\\b\"c\"}"), MSG);
+	ok(!json_valid("{\"events\":[{},]}"), MSG);
+}
+
+static void
+batch1(void)
+{
+	struct Client *client = make_local_person_nick(TEST_WEBHOOK_NICK);
+	struct Channel *chptr = make_channel();
+	hook_data_channel_activity activity = { .client = client, .chptr = chptr };
+	hook_data_privmsg_channel privmsg = {
+		.msgtype = MESSAGE_TYPE_PRIVMSG,
+		.source_p = client,
+		.chptr = chptr,
+		.text = TEST_WEBHOOK_TEXT,
+	};
+	char buf[16384];
+	const char *body;
+	int fd;
+
+	/* nothing else is waiting, so the join goes alone */
+	call_hook(register_hook("channel_join"), &activity);
+	fd = wait_fd(listener) ? accept(listener, NULL, NULL) : -1;
+	if(!ok(fd >= 0, MSG))
+		return;
+
+	body = request_body(fd, buf, sizeof(buf));
+	ok(json_valid(body), MSG);
+	ok(strstr(body, "\"nick\":\"a\\\\b\\\"c\"") != NULL, MSG);
+
+	/* these wait for it, and then go together */
+	call_hook(h_privmsg_channel, &privmsg);
+	call_hook(register_hook("channel_part"), &activity);
+	reply(fd);
+
+	body = request_body(fd, buf, sizeof(buf));
+	ok(json_valid(body), MSG);
+	is_int(2, count(body, "\"event\":"), MSG);
+	ok(strstr(body, "\"text\":\"say \\\"hi\\\" \\\\o/\"") != NULL, MSG);
+	is_int(2, count(body, "\"nick\":\"a\\\\b\\\"c\""), MSG);
+
+	reply(fd);
+	close(fd);
+	remove_local_person(client);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	char url[64];
+
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(listener, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(listener, 8) < 0 ||
+			getsockname(listener, (struct sockaddr *)&sin, &len) < 0)
+		bail("cannot listen: %s", strerror(errno));
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/hook", ntohs(sin.sin_port));
+
+	/* the extension takes its URL from the environment as it loads */
+	setenv("WEBHOOK_URL", url, 1);
+	if(!ok(load_a_module("../extensions/.libs/webhook.so", false, MAPI_ORIGIN_EXTENSION, false), MSG))
+		return 0;
+
+	json_valid1();
+	batch1();
+
+	close(listener);
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
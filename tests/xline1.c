@@ -0,0 +1,189 @@
+/*
+ *  xline1.c: Test the compiled xline and nick resv matchers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+
+#include "s_conf.h"
+#include "s_newconf.h"
+#include "operhash.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static struct ConfItem *
+add_mask(rb_dlink_list *list, const char *mask)
+{
+	struct ConfItem *aconf = make_conf();
+
+	aconf->status = (list == &xline_conf_list) ? CONF_XLINE : CONF_RESV_NICK;
+	aconf->host = rb_strdup(mask);
+	aconf->info.oper = operhash_add("test");
+	rb_dlinkAddAlloc(aconf, list);
+
+	if(list == &xline_conf_list)
+		xline_list_changed();
+	else
+		resv_list_changed();
+
+	return aconf;
+}
+
+static void
+del_mask(rb_dlink_list *list, struct ConfItem *aconf)
+{
+	rb_dlinkFindDestroy(aconf, list);
+
+	if(list == &xline_conf_list)
+		xline_list_changed();
+	else
+		resv_list_changed();
+
+	free_conf(aconf);
+}
+
+static void
+xline_literal(void)
+{
+	struct ConfItem *a = add_mask(&xline_conf_list, "bad gecos");
+
+	ok(find_xline("bad gecos", 0) == a, MSG);
+	ok(find_xline("BAD Gecos", 0) == a, MSG);
+	ok(find_xline("bad gecos2", 0) == NULL, MSG);
+	ok(find_xline("bad", 0) == NULL, MSG);
+	ok(find_xline("", 0) == NULL, MSG);
+
+	del_mask(&xline_conf_list, a);
+	ok(find_xline("bad gecos", 0) == NULL, MSG);
+}
+
+static void
+xline_wild(void)
+{
+	struct ConfItem *a = add_mask(&xline_conf_list, "*spam*");
+	struct ConfItem *b = add_mask(&xline_conf_list, "foo?bar");
+	struct ConfItem *c = add_mask(&xline_conf_list, "guest#");
+	struct ConfItem *d = add_mask(&xline_conf_list, "x@y");
+
+	ok(find_xline("buy spam now", 0) == a, MSG);
+	ok(find_xline("FOOxBAR", 0) == b, MSG);
+	ok(find_xline("fooxxbar", 0) == NULL, MSG);
+	ok(find_xline("guest5", 0) == c, MSG);
+	ok(find_xline("guestx", 0) == NULL, MSG);
+	ok(find_xline("xqy", 0) == d, MSG);
+	ok(find_xline("x1y", 0) == NULL, MSG);
+
+	del_mask(&xline_conf_list, a);
+	del_mask(&xline_conf_list, b);
+	del_mask(&xline_conf_list, c);
+	del_mask(&xline_conf_list, d);
+}
+
+static void
+xline_escape(void)
+{
+	struct ConfItem *a = add_mask(&xline_conf_list, "\\*lit*");
+	struct ConfItem *b = add_mask(&xline_conf_list, "two\\swords");
+
+	ok(find_xline("*literal", 0) == a, MSG);
+	ok(find_xline("xliteral", 0) == NULL, MSG);
+	ok(find_xline("two words", 0) == b, MSG);
+	ok(find_xline("twoswords", 0) == NULL, MSG);
+
+	del_mask(&xline_conf_list, a);
+	del_mask(&xline_conf_list, b);
+}
+
+static void
+xline_order(void)
+{
+	/* entries are added at the head, so the last one added is first */
+	struct ConfItem *a = add_mask(&xline_conf_list, "foo*");
+	struct ConfItem *b = add_mask(&xline_conf_list, "*");
+	struct ConfItem *c = add_mask(&xline_conf_list, "foobar");
+
+	ok(find_xline("foobar", 0) == c, MSG);
+	ok(find_xline("foobaz", 0) == b, MSG);
+
+	del_mask(&xline_conf_list, b);
+	ok(find_xline("foobaz", 0) == a, MSG);
+	ok(find_xline("barfoo", 0) == NULL, MSG);
+
+	del_mask(&xline_conf_list, a);
+	del_mask(&xline_conf_list, c);
+}
+
+static void
+xline_counter(void)
+{
+	struct ConfItem *a = add_mask(&xline_conf_list, "counted");
+
+	find_xline("counted", 0);
+	is_int(0, a->port, MSG);
+	find_xline("counted", 1);
+	is_int(1, a->port, MSG);
+
+	del_mask(&xline_conf_list, a);
+}
+
+static void
+resv_nick(void)
+{
+	struct ConfItem *a = add_mask(&resv_conf_list, "NickServ");
+	struct ConfItem *b = add_mask(&resv_conf_list, "[bot]*");
+	struct ConfItem *c;
+
+	ok(find_nick_resv("nickserv") == a, MSG);
+	is_int(1, a->port, MSG);
+	ok(find_nick_resv("{BOT}foo") == b, MSG);
+	ok(find_nick_resv("bot") == NULL, MSG);
+
+	/* a list changed without telling us must still be seen */
+	c = make_conf();
+	c->status = CONF_RESV_NICK;
+	c->host = rb_strdup("other");
+	c->info.oper = operhash_add("test");
+	rb_dlinkAddAlloc(c, &resv_conf_list);
+	ok(find_nick_resv("other") == c, MSG);
+
+	del_mask(&resv_conf_list, a);
+	del_mask(&resv_conf_list, b);
+	del_mask(&resv_conf_list, c);
+	ok(find_nick_resv("nickserv") == NULL, MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+
+	xline_literal();
+	xline_wild();
+	xline_escape();
+	xline_order();
+	xline_counter();
+	resv_nick();
+
+	ircd_util_free();
+	return 0;
+}